@@ -0,0 +1,61 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Build the simavr python module.
+
+The library sources are compiled into the module directly: libsimavr.a is
+not built as position independent code and can not be linked into a shared
+object.
+
+  SIMAVR_SRCDIR   : directory with the simulator sources (default ../src)
+  SIMAVR_BUILDDIR : directory with config.h (default SIMAVR_SRCDIR)
+"""
+
+import os, glob
+from distutils.core import setup, Extension
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+srcdir = os.environ.get('SIMAVR_SRCDIR',
+	os.path.normpath(os.path.join(here, '..', 'src')))
+builddir = os.environ.get('SIMAVR_BUILDDIR', srcdir)
+
+sources = [ os.path.join(here, 'simavrmodule.c') ]
+for f in sorted(glob.glob(os.path.join(srcdir, '*.c'))):
+	if os.path.basename(f) not in ('main.c', 'pcprof.c', 'tracedump.c'):
+		sources.append(f)
+
+simavr = Extension('simavr',
+	sources = sources,
+	include_dirs = [ builddir, srcdir ],
+	define_macros = [ ('HAVE_CONFIG_H', '1') ],
+	# the core relies on the GNU89 'extern inline' semantics
+	extra_compile_args = [ '-fgnu89-inline' ],
+	libraries = [ 'pthread' ])
+
+setup(name = 'simavr',
+	version = '0.1.2.2',
+	description = 'In-process AVR simulator (libsimavr)',
+	ext_modules = [ simavr ])
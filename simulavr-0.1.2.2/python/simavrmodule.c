@@ -0,0 +1,869 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file simavrmodule.c
+ * \brief Python binding of libsimavr.
+ *
+ * The module exports a single type, simavr.Sim, which owns one simulated
+ * device. The methods map one to one to the functions in simavr.h, except
+ * that memory is accessed in blocks (bytes objects) to keep the number of
+ * calls from python low. All addresses are byte addresses, flash included,
+ * the same way the gdb remote protocol and the regress suite see them.
+ *
+ * Builds with python 2 and python 3.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdint.h>
+
+#include "simavr.h"
+
+#if PY_MAJOR_VERSION >= 3
+#define BYTES_FMT "y#"
+#else
+#define BYTES_FMT "s#"
+#endif
+
+/* Maximum length of an APDU response (data + SW1 SW2). */
+
+#define APDU_RESP_MAX 65538
+
+typedef struct
+{
+    PyObject_HEAD
+    SimAvr *sim;
+} SimObject;
+
+static PyObject *SimError;
+
+static int
+Sim_init (SimObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "device", NULL };
+    const char *device = "at90s8515";
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "|s", kwlist, &device))
+        return -1;
+
+    if (self->sim)
+        simavr_destroy (self->sim);
+
+    self->sim = simavr_new (device);
+    if (self->sim == NULL)
+    {
+        PyErr_Format (SimError, "unsupported device: %s", device);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+Sim_dealloc (SimObject *self)
+{
+    simavr_destroy (self->sim);
+    Py_TYPE (self)->tp_free ((PyObject *)self);
+}
+
+static PyObject *
+Sim_load_flash (SimObject *self, PyObject *args)
+{
+    const char *file;
+
+    if (!PyArg_ParseTuple (args, "s", &file))
+        return NULL;
+
+    if (simavr_load_flash (self->sim, file) < 0)
+        return PyErr_Format (SimError, "can not load flash image %s", file);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_load_flash_image (SimObject *self, PyObject *args)
+{
+    const char *image;
+    Py_ssize_t len;
+
+    if (!PyArg_ParseTuple (args, BYTES_FMT, &image, &len))
+        return NULL;
+
+    if (simavr_load_flash_image (self->sim, (const uint8_t *)image, len) < 0)
+        return PyErr_Format (SimError, "flash image does not fit");
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_load_eeprom (SimObject *self, PyObject *args)
+{
+    const char *file;
+
+    if (!PyArg_ParseTuple (args, "s", &file))
+        return NULL;
+
+    if (simavr_load_eeprom (self->sim, file) < 0)
+        return PyErr_Format (SimError, "can not load eeprom image %s", file);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_eeprom_file (SimObject *self, PyObject *args)
+{
+    const char *file, *journal = NULL;
+
+    if (!PyArg_ParseTuple (args, "s|z", &file, &journal))
+        return NULL;
+
+    if (simavr_eeprom_file (self->sim, file, journal) < 0)
+        return PyErr_Format (SimError, "can not use eeprom file %s", file);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_eeprom_sync (SimObject *self)
+{
+    if (simavr_eeprom_sync (self->sim) < 0)
+        return PyErr_Format (SimError, "eeprom write back failed");
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_rng_seed (SimObject *self, PyObject *args)
+{
+    unsigned long long seed;
+
+    if (!PyArg_ParseTuple (args, "K", &seed))
+        return NULL;
+
+    simavr_rng_seed (self->sim, seed);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_save_state (SimObject *self, PyObject *args)
+{
+    const char *file;
+
+    if (!PyArg_ParseTuple (args, "s", &file))
+        return NULL;
+
+    if (simavr_save_state (self->sim, file) < 0)
+        return PyErr_Format (SimError, "can not save state to %s", file);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_load_state (SimObject *self, PyObject *args)
+{
+    const char *file;
+
+    if (!PyArg_ParseTuple (args, "s", &file))
+        return NULL;
+
+    if (simavr_load_state (self->sim, file) < 0)
+        return PyErr_Format (SimError, "can not load state from %s", file);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_checkpoint (SimObject *self)
+{
+    int depth = simavr_checkpoint (self->sim);
+
+    if (depth < 0)
+        return PyErr_Format (SimError, "can not take a checkpoint");
+
+    return PyLong_FromLong (depth);
+}
+
+static PyObject *
+Sim_rollback (SimObject *self)
+{
+    if (simavr_rollback (self->sim) < 0)
+        return PyErr_Format (SimError, "no checkpoint to roll back to");
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_checkpoint_drop (SimObject *self)
+{
+    if (simavr_checkpoint_drop (self->sim) < 0)
+        return PyErr_Format (SimError, "no checkpoint to drop");
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_reset (SimObject *self)
+{
+    simavr_reset (self->sim);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_run (SimObject *self, PyObject *args)
+{
+    unsigned long long cycles;
+    int res;
+
+    if (!PyArg_ParseTuple (args, "K", &cycles))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS;
+    res = simavr_run (self->sim, cycles);
+    Py_END_ALLOW_THREADS;
+
+    return PyLong_FromLong (res);
+}
+
+static PyObject *
+Sim_step (SimObject *self, PyObject *args)
+{
+    int count = 1;
+    int res = SIMAVR_RUN_LIMIT;
+
+    if (!PyArg_ParseTuple (args, "|i", &count))
+        return NULL;
+
+    while ((count-- > 0) && (res == SIMAVR_RUN_LIMIT))
+        res = simavr_step (self->sim);
+
+    return PyLong_FromLong (res);
+}
+
+static PyObject *
+Sim_cycles (SimObject *self)
+{
+    return PyLong_FromUnsignedLongLong (simavr_get_cycles (self->sim));
+}
+
+static PyObject *
+Sim_break_insert (SimObject *self, PyObject *args)
+{
+    unsigned long addr;
+
+    if (!PyArg_ParseTuple (args, "k", &addr))
+        return NULL;
+
+    simavr_break_insert (self->sim, addr);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_break_remove (SimObject *self, PyObject *args)
+{
+    unsigned long addr;
+
+    if (!PyArg_ParseTuple (args, "k", &addr))
+        return NULL;
+
+    simavr_break_remove (self->sim, addr);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_pc_get (SimObject *self)
+{
+    return PyLong_FromUnsignedLong (simavr_pc_get (self->sim));
+}
+
+static PyObject *
+Sim_symbol (SimObject *self, PyObject *args)
+{
+    unsigned long addr;
+    uint32_t offset;
+    const char *name;
+
+    if (!PyArg_ParseTuple (args, "k", &addr))
+        return NULL;
+
+    name = simavr_symbol (self->sim, addr, &offset);
+    if (name == NULL)
+        Py_RETURN_NONE;
+
+    return Py_BuildValue ("(sk)", name, (unsigned long)offset);
+}
+
+static PyObject *
+Sim_symbol_addr (SimObject *self, PyObject *args)
+{
+    const char *name;
+    int addr;
+
+    if (!PyArg_ParseTuple (args, "s", &name))
+        return NULL;
+
+    addr = simavr_symbol_addr (self->sim, name);
+    if (addr < 0)
+        Py_RETURN_NONE;
+
+    return PyLong_FromLong (addr);
+}
+
+static PyObject *
+Sim_profile_start (SimObject *self)
+{
+    simavr_profile_start (self->sim);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_profile_stop (SimObject *self)
+{
+    simavr_profile_stop (self->sim);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_profile_write (SimObject *self, PyObject *args)
+{
+    const char *file;
+
+    if (!PyArg_ParseTuple (args, "s", &file))
+        return NULL;
+
+    if (simavr_profile_write (self->sim, file) < 0)
+        return PyErr_Format (SimError, "can not write profile %s", file);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_flame_dir (SimObject *self, PyObject *args)
+{
+    const char *dir;
+
+    if (!PyArg_ParseTuple (args, "z", &dir))
+        return NULL;
+
+    simavr_profile_flame_dir (self->sim, dir);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_sample_start (SimObject *self, PyObject *args)
+{
+    unsigned long period = 0;   /* the default period */
+    int callers = 0;
+
+    if (!PyArg_ParseTuple (args, "|ki", &period, &callers))
+        return NULL;
+
+    simavr_sample_start (self->sim, period, callers);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_sample_stop (SimObject *self)
+{
+    simavr_sample_stop (self->sim);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_sample_write (SimObject *self, PyObject *args)
+{
+    const char *file;
+
+    if (!PyArg_ParseTuple (args, "s", &file))
+        return NULL;
+
+    if (simavr_sample_write (self->sim, file) < 0)
+        return PyErr_Format (SimError, "can not write samples %s", file);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_trace_start (SimObject *self, PyObject *args)
+{
+    const char *file;
+    long trigger = -1;
+    unsigned long size = 0;     /* the default size */
+
+    if (!PyArg_ParseTuple (args, "s|lk", &file, &trigger, &size))
+        return NULL;
+
+    if (simavr_trace_start (self->sim, file, trigger, size) < 0)
+        return PyErr_Format (SimError, "can not write trace %s", file);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_trace_stop (SimObject *self)
+{
+    simavr_trace_stop (self->sim);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_replay_start (SimObject *self, PyObject *args)
+{
+    const char *file;
+    int play = 0;
+
+    if (!PyArg_ParseTuple (args, "s|i", &file, &play))
+        return NULL;
+
+    if (simavr_replay_start (self->sim, file, play) < 0)
+        return PyErr_Format (SimError, "can not %s %s",
+                             play ? "replay" : "record to", file);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_replay_stop (SimObject *self)
+{
+    simavr_replay_stop (self->sim);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_pc_set (SimObject *self, PyObject *args)
+{
+    unsigned long addr;
+
+    if (!PyArg_ParseTuple (args, "k", &addr))
+        return NULL;
+
+    simavr_pc_set (self->sim, addr);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_reg_get (SimObject *self, PyObject *args)
+{
+    int reg;
+
+    if (!PyArg_ParseTuple (args, "i", &reg))
+        return NULL;
+
+    if ((reg < 0) || (reg > 31))
+        return PyErr_Format (PyExc_IndexError, "no register r%d", reg);
+
+    return PyLong_FromLong (simavr_reg_get (self->sim, reg));
+}
+
+static PyObject *
+Sim_reg_set (SimObject *self, PyObject *args)
+{
+    int reg, val;
+
+    if (!PyArg_ParseTuple (args, "ii", &reg, &val))
+        return NULL;
+
+    if ((reg < 0) || (reg > 31))
+        return PyErr_Format (PyExc_IndexError, "no register r%d", reg);
+
+    simavr_reg_set (self->sim, reg, val);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_sreg_get (SimObject *self)
+{
+    return PyLong_FromLong (simavr_sreg_get (self->sim));
+}
+
+static PyObject *
+Sim_sreg_set (SimObject *self, PyObject *args)
+{
+    int val;
+
+    if (!PyArg_ParseTuple (args, "i", &val))
+        return NULL;
+
+    simavr_sreg_set (self->sim, val);
+    Py_RETURN_NONE;
+}
+
+/* Block accessors. The loops are done here instead of in python, this is
+   what makes the in-process backend fast. */
+
+static PyObject *
+Sim_mem_read (SimObject *self, PyObject *args)
+{
+    PyObject *res;
+    char *buf;
+    int addr;
+    Py_ssize_t len, i;
+
+    if (!PyArg_ParseTuple (args, "in", &addr, &len))
+        return NULL;
+
+    res = PyBytes_FromStringAndSize (NULL, len);
+    if (res == NULL)
+        return NULL;
+
+    buf = PyBytes_AS_STRING (res);
+    for (i = 0; i < len; i++)
+        buf[i] = simavr_mem_read (self->sim, addr + i);
+
+    return res;
+}
+
+static PyObject *
+Sim_mem_write (SimObject *self, PyObject *args)
+{
+    const char *data;
+    int addr;
+    Py_ssize_t len, i;
+
+    if (!PyArg_ParseTuple (args, "i" BYTES_FMT, &addr, &data, &len))
+        return NULL;
+
+    for (i = 0; i < len; i++)
+        simavr_mem_write (self->sim, addr + i, data[i]);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_flash_read (SimObject *self, PyObject *args)
+{
+    PyObject *res;
+    char *buf;
+    int addr;
+    Py_ssize_t len, i;
+    uint16_t word;
+
+    if (!PyArg_ParseTuple (args, "in", &addr, &len))
+        return NULL;
+
+    res = PyBytes_FromStringAndSize (NULL, len);
+    if (res == NULL)
+        return NULL;
+
+    buf = PyBytes_AS_STRING (res);
+    for (i = 0; i < len; i++)
+    {
+        word = simavr_flash_read (self->sim, (addr + i) / 2);
+        buf[i] = ((addr + i) & 1) ? (word >> 8) : (word & 0xff);
+    }
+
+    return res;
+}
+
+static PyObject *
+Sim_flash_write (SimObject *self, PyObject *args)
+{
+    const char *data;
+    int addr, waddr;
+    Py_ssize_t len, i;
+    uint16_t word;
+
+    if (!PyArg_ParseTuple (args, "i" BYTES_FMT, &addr, &data, &len))
+        return NULL;
+
+    for (i = 0; i < len; i++)
+    {
+        waddr = (addr + i) / 2;
+        word = simavr_flash_read (self->sim, waddr);
+        if ((addr + i) & 1)
+            word = (word & 0x00ff) | ((uint8_t)data[i] << 8);
+        else
+            word = (word & 0xff00) | (uint8_t)data[i];
+        simavr_flash_write (self->sim, waddr, word);
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_eeprom_read (SimObject *self, PyObject *args)
+{
+    PyObject *res;
+    char *buf;
+    int addr;
+    Py_ssize_t len, i;
+
+    if (!PyArg_ParseTuple (args, "in", &addr, &len))
+        return NULL;
+
+    res = PyBytes_FromStringAndSize (NULL, len);
+    if (res == NULL)
+        return NULL;
+
+    buf = PyBytes_AS_STRING (res);
+    for (i = 0; i < len; i++)
+        buf[i] = simavr_eeprom_read (self->sim, addr + i);
+
+    return res;
+}
+
+static PyObject *
+Sim_eeprom_write (SimObject *self, PyObject *args)
+{
+    const char *data;
+    int addr;
+    Py_ssize_t len, i;
+
+    if (!PyArg_ParseTuple (args, "i" BYTES_FMT, &addr, &data, &len))
+        return NULL;
+
+    for (i = 0; i < len; i++)
+        simavr_eeprom_write (self->sim, addr + i, data[i]);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_host_send (SimObject *self, PyObject *args)
+{
+    const char *line;
+
+    if (!PyArg_ParseTuple (args, "s", &line))
+        return NULL;
+
+    if (simavr_host_send (self->sim, line) < 0)
+        return PyErr_Format (SimError, "host input buffer full");
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Sim_host_recv (SimObject *self)
+{
+    PyObject *res = PyBytes_FromStringAndSize (NULL, 0);
+    PyObject *part;
+    char buf[1024];
+    int len;
+
+    while ((res != NULL)
+           && ((len = simavr_host_recv (self->sim, buf, sizeof (buf))) > 0))
+    {
+        part = PyBytes_FromStringAndSize (buf, len);
+        PyBytes_ConcatAndDel (&res, part);
+    }
+
+    return res;
+}
+
+static PyObject *
+Sim_apdu (SimObject *self, PyObject *args)
+{
+    PyObject *res;
+    const char *cmd;
+    Py_ssize_t cmd_len;
+    unsigned long long max_cycles = 1000000000ULL;
+    uint8_t *resp;
+    int len;
+
+    if (!PyArg_ParseTuple (args, BYTES_FMT "|K", &cmd, &cmd_len,
+                           &max_cycles))
+        return NULL;
+
+    resp = PyMem_Malloc (APDU_RESP_MAX);
+    if (resp == NULL)
+        return PyErr_NoMemory ();
+
+    Py_BEGIN_ALLOW_THREADS;
+    len = simavr_apdu (self->sim, (const uint8_t *)cmd, cmd_len, resp,
+                       APDU_RESP_MAX, max_cycles);
+    Py_END_ALLOW_THREADS;
+
+    if (len < 0)
+        res = PyErr_Format (SimError, "APDU exchange failed");
+    else
+        res = PyBytes_FromStringAndSize ((char *)resp, len);
+
+    PyMem_Free (resp);
+    return res;
+}
+
+static PyMethodDef Sim_methods[] = {
+    {"load_flash", (PyCFunction)Sim_load_flash, METH_VARARGS,
+     "load_flash(file): load a binary or ELF flash image file"},
+    {"load_flash_image", (PyCFunction)Sim_load_flash_image, METH_VARARGS,
+     "load_flash_image(data): load a binary flash image"},
+    {"load_eeprom", (PyCFunction)Sim_load_eeprom, METH_VARARGS,
+     "load_eeprom(file): load a binary eeprom image file"},
+    {"eeprom_file", (PyCFunction)Sim_eeprom_file, METH_VARARGS,
+     "eeprom_file(file[, journal]): keep the eeprom in file"},
+    {"eeprom_sync", (PyCFunction)Sim_eeprom_sync, METH_NOARGS,
+     "eeprom_sync(): write the eeprom back to its file"},
+    {"rng_seed", (PyCFunction)Sim_rng_seed, METH_VARARGS,
+     "rng_seed(seed): make the random number source deterministic"},
+    {"save_state", (PyCFunction)Sim_save_state, METH_VARARGS,
+     "save_state(file): save the device state to a file"},
+    {"load_state", (PyCFunction)Sim_load_state, METH_VARARGS,
+     "load_state(file): restore a state saved by save_state()"},
+    {"checkpoint", (PyCFunction)Sim_checkpoint, METH_NOARGS,
+     "checkpoint(): take an in-memory checkpoint, return the depth"},
+    {"rollback", (PyCFunction)Sim_rollback, METH_NOARGS,
+     "rollback(): return to the innermost checkpoint (it is kept)"},
+    {"checkpoint_drop", (PyCFunction)Sim_checkpoint_drop, METH_NOARGS,
+     "checkpoint_drop(): drop the innermost checkpoint"},
+    {"reset", (PyCFunction)Sim_reset, METH_NOARGS,
+     "reset(): reset the device"},
+    {"run", (PyCFunction)Sim_run, METH_VARARGS,
+     "run(cycles): run for at most cycles clocks, return a RUN_* value"},
+    {"step", (PyCFunction)Sim_step, METH_VARARGS,
+     "step([count]): execute instructions, return a RUN_* value"},
+    {"cycles", (PyCFunction)Sim_cycles, METH_NOARGS,
+     "cycles(): number of clock cycles executed so far"},
+    {"break_insert", (PyCFunction)Sim_break_insert, METH_VARARGS,
+     "break_insert(addr): insert a break point"},
+    {"break_remove", (PyCFunction)Sim_break_remove, METH_VARARGS,
+     "break_remove(addr): remove a break point"},
+    {"pc_get", (PyCFunction)Sim_pc_get, METH_NOARGS,
+     "pc_get(): program counter (byte address)"},
+    {"pc_set", (PyCFunction)Sim_pc_set, METH_VARARGS,
+     "pc_set(addr): set the program counter (byte address)"},
+    {"symbol", (PyCFunction)Sim_symbol, METH_VARARGS,
+     "symbol(addr): (name, offset) of the symbol at addr or None"},
+    {"symbol_addr", (PyCFunction)Sim_symbol_addr, METH_VARARGS,
+     "symbol_addr(name): byte address of a symbol or None"},
+    {"profile_start", (PyCFunction)Sim_profile_start, METH_NOARGS,
+     "profile_start(): start the function profiler"},
+    {"profile_stop", (PyCFunction)Sim_profile_stop, METH_NOARGS,
+     "profile_stop(): stop the function profiler"},
+    {"profile_write", (PyCFunction)Sim_profile_write, METH_VARARGS,
+     "profile_write(file): write the profile in the callgrind format"},
+    {"flame_dir", (PyCFunction)Sim_flame_dir, METH_VARARGS,
+     "flame_dir(dir): write folded stacks of every APDU to dir (None: stop)"},
+    {"sample_start", (PyCFunction)Sim_sample_start, METH_VARARGS,
+     "sample_start([period[, callers]]): sample the PC every period cycles"},
+    {"sample_stop", (PyCFunction)Sim_sample_stop, METH_NOARGS,
+     "sample_stop(): stop the PC sampling"},
+    {"sample_write", (PyCFunction)Sim_sample_write, METH_VARARGS,
+     "sample_write(file): write the PC samples for simulavr-pcprof"},
+    {"trace_start", (PyCFunction)Sim_trace_start, METH_VARARGS,
+     "trace_start(file[, trigger[, size]]): trace the instructions"},
+    {"trace_stop", (PyCFunction)Sim_trace_stop, METH_NOARGS,
+     "trace_stop(): end the trace and write the rest of it"},
+    {"replay_start", (PyCFunction)Sim_replay_start, METH_VARARGS,
+     "replay_start(file[, play]): record the host input, or replay it"},
+    {"replay_stop", (PyCFunction)Sim_replay_stop, METH_NOARGS,
+     "replay_stop(): end recording or replaying, the log is closed"},
+    {"reg_get", (PyCFunction)Sim_reg_get, METH_VARARGS,
+     "reg_get(n): read register rn"},
+    {"reg_set", (PyCFunction)Sim_reg_set, METH_VARARGS,
+     "reg_set(n, val): write register rn"},
+    {"sreg_get", (PyCFunction)Sim_sreg_get, METH_NOARGS,
+     "sreg_get(): read the status register"},
+    {"sreg_set", (PyCFunction)Sim_sreg_set, METH_VARARGS,
+     "sreg_set(val): write the status register"},
+    {"mem_read", (PyCFunction)Sim_mem_read, METH_VARARGS,
+     "mem_read(addr, len): read the data space"},
+    {"mem_write", (PyCFunction)Sim_mem_write, METH_VARARGS,
+     "mem_write(addr, data): write the data space"},
+    {"flash_read", (PyCFunction)Sim_flash_read, METH_VARARGS,
+     "flash_read(addr, len): read flash"},
+    {"flash_write", (PyCFunction)Sim_flash_write, METH_VARARGS,
+     "flash_write(addr, data): write flash"},
+    {"eeprom_read", (PyCFunction)Sim_eeprom_read, METH_VARARGS,
+     "eeprom_read(addr, len): read eeprom"},
+    {"eeprom_write", (PyCFunction)Sim_eeprom_write, METH_VARARGS,
+     "eeprom_write(addr, data): write eeprom"},
+    {"host_send", (PyCFunction)Sim_host_send, METH_VARARGS,
+     "host_send(line): queue a line of host input"},
+    {"host_recv", (PyCFunction)Sim_host_recv, METH_NOARGS,
+     "host_recv(): take the output of the device"},
+    {"apdu", (PyCFunction)Sim_apdu, METH_VARARGS,
+     "apdu(cmd[, max_cycles]): exchange an APDU, return the response"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject SimType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    "simavr.Sim",               /* tp_name */
+    sizeof (SimObject),         /* tp_basicsize */
+    0,                          /* tp_itemsize */
+    (destructor)Sim_dealloc,    /* tp_dealloc */
+};
+
+static PyMethodDef module_methods[] = {
+    {NULL, NULL, 0, NULL}
+};
+
+static PyObject *
+simavr_module_init (PyObject *m)
+{
+    SimType.tp_flags = Py_TPFLAGS_DEFAULT;
+    SimType.tp_doc = "Sim([device]): a simulated AVR device";
+    SimType.tp_methods = Sim_methods;
+    SimType.tp_init = (initproc)Sim_init;
+    SimType.tp_new = PyType_GenericNew;
+
+    if ((m == NULL) || (PyType_Ready (&SimType) < 0))
+        return NULL;
+
+    SimError = PyErr_NewException ("simavr.error", NULL, NULL);
+    Py_INCREF (SimError);
+    PyModule_AddObject (m, "error", SimError);
+
+    Py_INCREF (&SimType);
+    PyModule_AddObject (m, "Sim", (PyObject *)&SimType);
+
+    PyModule_AddIntConstant (m, "API_VERSION", simavr_api_version ());
+    PyModule_AddIntConstant (m, "RUN_LIMIT", SIMAVR_RUN_LIMIT);
+    PyModule_AddIntConstant (m, "RUN_WAIT", SIMAVR_RUN_WAIT);
+    PyModule_AddIntConstant (m, "RUN_BREAK", SIMAVR_RUN_BREAK);
+    PyModule_AddIntConstant (m, "RUN_STOPPED", SIMAVR_RUN_STOPPED);
+    PyModule_AddIntConstant (m, "APDU_MAX", SIMAVR_APDU_MAX);
+
+    return m;
+}
+
+#if PY_MAJOR_VERSION >= 3
+
+static struct PyModuleDef simavr_module = {
+    PyModuleDef_HEAD_INIT,
+    "simavr",
+    "In-process AVR simulator (libsimavr)",
+    -1,
+    module_methods
+};
+
+PyMODINIT_FUNC
+PyInit_simavr (void)
+{
+    return simavr_module_init (PyModule_Create (&simavr_module));
+}
+
+#else
+
+PyMODINIT_FUNC
+initsimavr (void)
+{
+    simavr_module_init (Py_InitModule3 ("simavr", module_methods,
+                                        "In-process AVR simulator "
+                                        "(libsimavr)"));
+}
+
+#endif
@@ -29,6 +29,9 @@ import gdb_rsp
 class AvrTarget(gdb_rsp.GdbRemoteSerialProtocol):
 	offset_flash = 0x0
 	offset_sram  = 0x00800000
+
+	# test directories for the in-process target only
+	skip_dirs = ['test_simavr']
 	
 	def __init__(self, host='localhost', port=1212, ofile=None):
 		gdb_rsp.GdbRemoteSerialProtocol.__init__(self,host,port,ofile)
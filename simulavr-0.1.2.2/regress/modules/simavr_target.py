@@ -0,0 +1,113 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""In-process target for the regression tests.
+
+SimavrTarget has the same interface as avr_target.AvrTarget, but drives the
+simulator through the simavr python module (see python/ in the top level
+directory) instead of the gdb remote protocol. No simulator process is
+started and no packets are exchanged, which makes the tests much faster.
+"""
+
+import array, struct
+import simavr
+from registers import Reg, Addr
+
+class SimavrTarget:
+	# test directories for the gdbserver target only
+	skip_dirs = ['test_gdb']
+
+	def __init__(self, dev='at90s8515'):
+		self.sim = simavr.Sim(dev)
+
+	def close(self):
+		self.sim = None
+
+	def read_regs(self):
+		# same layout as the gdb 'g' packet: r0-r31, SREG, SP, PC
+		regs = list(self.read_sram(0, 32))
+		regs.append(self.sim.sreg_get())
+		regs.append(self.read_reg(Reg.SP))
+		regs.append(self.sim.pc_get())
+		return regs
+
+	def write_regs(self, regs):
+		self.write_sram(0, 32, regs[:32])
+		self.sim.sreg_set(regs[Reg.SREG])
+		self.write_reg(Reg.SP, regs[Reg.SP])
+		self.sim.pc_set(regs[Reg.PC])
+
+	def read_reg(self, reg):
+		if reg < Reg.SREG:
+			return self.sim.reg_get(reg)
+		elif reg < Reg.SP:
+			return self.sim.sreg_get()
+		elif reg < Reg.PC:
+			return struct.unpack('<H', self.sim.mem_read(Addr.SPL, 2))[0]
+		else:
+			return self.sim.pc_get()
+
+	def write_reg(self, reg, val):
+		if reg < Reg.SREG:
+			self.sim.reg_set(reg, val)
+		elif reg < Reg.SP:
+			self.sim.sreg_set(val)
+		elif reg < Reg.PC:
+			self.sim.mem_write(Addr.SPL, struct.pack('<H', val))
+		else:
+			self.sim.pc_set(val)
+
+	def read_flash(self, addr, _len):
+		return array.array('B', self.sim.flash_read(addr, _len))
+
+	def write_flash(self, addr, _len, buf):
+		self.sim.flash_write(addr, array.array('B', buf[:_len]).tostring())
+
+	def read_sram(self, addr, _len):
+		return array.array('B', self.sim.mem_read(addr, _len))
+
+	def write_sram(self, addr, _len, buf):
+		self.sim.mem_write(addr, array.array('B', buf[:_len]).tostring())
+
+	def load_binary(self, file):
+		self.sim.load_flash(file)
+
+	def step(self):
+		return self.sim.step()
+
+	def cont(self):
+		while 1:
+			res = self.sim.run(1000000)
+			if res != simavr.RUN_LIMIT:
+				return res
+
+	def break_insert(self, _type, addr, _len):
+		self.sim.break_insert(addr)
+
+	def break_remove(self, _type, addr, _len):
+		self.sim.break_remove(addr)
+
+	def reset(self):
+		self.sim.reset()
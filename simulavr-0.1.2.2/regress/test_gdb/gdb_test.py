@@ -0,0 +1,101 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Helpers for the tests of the gdbserver packets.
+
+The programs are hand assembled lists of instruction words. They are written
+to the flash at address 0 of the at90s8515 the regression target simulates,
+and the PC is set to 0. Tests that need other simulator options start a
+simulator of their own.
+"""
+
+import array, os, signal, socket, struct, subprocess, time
+import avr_target
+import base_test
+from registers import Reg
+
+class GDB_TestFail(base_test.TestFail): pass
+
+class gdb_test:
+	"""Load the program of the test, then run its checks.
+	"""
+	def __init__(self, target):
+		self.target = target
+
+	def run(self):
+		words = self.program()
+		self.target.write_flash(0, 2 * len(words), array.array('B',
+								struct.pack('<%dH' % len(words), *words)))
+		self.target.write_reg(Reg.PC, 0)
+		self.check()
+
+	def pc(self):
+		return self.target.read_regs()[Reg.PC]
+
+	def reg(self, n):
+		return self.target.read_regs()[n]
+
+	def expect(self, what, got, want):
+		if got != want:
+			raise GDB_TestFail, '%s: expect=%x, got=%x' % (what, want, got)
+
+	def reason(self, reply):
+		"""Return the stop reason of a 'T' reply, e.g. 'watch:800100', or ''.
+		"""
+		for field in reply[3:].split(';'):
+			if field.split(':')[0] in ('watch', 'rwatch', 'awatch', 'replaylog'):
+				return field
+		return ''
+
+class own_simulator:
+	"""Start the simulator with the options self.args() returns, connect to
+	its gdb port self.port as self.gdb and run the checks. The regression
+	target is not used.
+	"""
+	def __init__(self, target):
+		self.target = target
+
+	def run(self):
+		null = open(os.devnull, 'w')
+		sim = subprocess.Popen([ self.target.sim_path ] + self.args(),
+							   stdout = null, stderr = null)
+		try:
+			self.gdb = self.connect()
+			try:
+				self.check()
+			finally:
+				self.gdb.close()
+		finally:
+			os.kill(sim.pid, signal.SIGINT)
+			sim.wait()
+			null.close()
+
+	def connect(self):
+		for i in range(50):
+			try:
+				return avr_target.AvrTarget(port = self.port)
+			except socket.error:
+				time.sleep(0.1)
+		raise GDB_TestFail, 'simulator did not start'
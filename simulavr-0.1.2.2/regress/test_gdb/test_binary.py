@@ -0,0 +1,100 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Test the packets with binary data, X and vFlashWrite.
+"""
+
+import array
+import gdb_test
+
+SRAM = 0x800100					# in the address space of gdb
+FLASH = 0x1000
+ERASE = 0x80					# bytes erased from FLASH
+
+# '#', '$', '}' and '*' are escaped
+DATA = array.array('B', [ 0x23, 0x00, 0x24, 0x7d, 0xff, 0x2a, 0x5d, 0x03 ])
+
+def escape(data):
+	s = ''
+	for b in data:
+		if chr(b) in '#$}*':
+			s += '}' + chr(b ^ 0x20)
+		else:
+			s += chr(b)
+	return s
+
+class base_binary(gdb_test.gdb_test):
+	def program(self):
+		return [ 0xcfff ]
+
+	def packet(self, pkt, want = 'OK'):
+		self.target.send(pkt)
+		reply = self.target.recv()
+		if reply != want:
+			raise gdb_test.GDB_TestFail, '%s reply %s, want %s' % (pkt[:12], reply, want)
+
+	def compare(self, what, got, want):
+		if got != want:
+			raise gdb_test.GDB_TestFail, '%s: expect=%s, got=%s' % (what,
+				self.target.bin2str(want), self.target.bin2str(got))
+
+class test_binary_sram(base_binary):
+	"""Write the escaped bytes with X, read them back with m.
+	"""
+	def check(self):
+		self.packet('X%x,%x:%s' % (SRAM, len(DATA), escape(DATA)))
+		self.compare('sram', self.target.read_mem(SRAM, len(DATA)), DATA)
+
+class test_binary_length(base_binary):
+	"""The length of an X packet must match its data.
+	"""
+	def check(self):
+		self.packet('X%x,%x:%s' % (SRAM, len(DATA) + 1, escape(DATA)), 'E16')
+
+class test_binary_flash(base_binary):
+	"""Erase a block of flash, write the escaped bytes to its start with
+	vFlashWrite and read the block back with m.
+	"""
+	def check(self):
+		self.target.write_flash(FLASH, ERASE, array.array('B', [0] * ERASE))
+
+		self.packet('vFlashErase:%x,%x' % (FLASH, ERASE))
+		self.packet('vFlashWrite:%x:%s' % (FLASH, escape(DATA)))
+		self.packet('vFlashDone')
+
+		got = self.target.read_flash(FLASH, ERASE)
+		self.compare('written', got[:len(DATA)], DATA)
+		self.compare('erased', got[len(DATA):],
+					 array.array('B', [0xff] * (ERASE - len(DATA))))
+
+class test_binary_erase_range(base_binary):
+	"""An erase past the flash space, or of a length that does not fit an
+	int, is refused before anything is allocated for it.
+	"""
+	def check(self):
+		self.packet('vFlashErase:7fff00,200', 'E01')
+		self.packet('vFlashErase:0,ffffffff', 'E01')
+		self.packet('vFlashErase:ffffffff,10', 'E01')
+		self.packet('vFlashDone')
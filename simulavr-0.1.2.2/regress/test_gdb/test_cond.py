@@ -0,0 +1,96 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Test the break point conditions, the agent expressions of a Z0 packet.
+"""
+
+import gdb_test
+from registers import Reg
+
+# ldi r16, 0; inc r16; cpi r16, 5; brne .-6; loop
+PROGRAM = [ 0xe000, 0x9503, 0x3005, 0xf7e9, 0xcfff ]
+BREAK = 4						# the cpi, reached with r16 = 1 .. 5
+END = 8
+
+class base_cond(gdb_test.gdb_test):
+	"""Run to the break point with the condition of the test, or to the end
+	of the program.
+	"""
+	reply = 'OK'
+
+	def program(self):
+		return PROGRAM
+
+	def check(self):
+		self.target.break_insert(0, END, 2)
+		try:
+			self.target.send('Z0,%x,2;%s' % (BREAK, self.cond))
+			reply = self.target.recv()
+			if reply != self.reply:
+				raise gdb_test.GDB_TestFail, 'Z0 reply %s, want %s' % (reply, self.reply)
+			self.target.cont()
+		finally:
+			self.target.send('z0,%x,2' % BREAK)
+			self.target.recv()
+			self.target.break_remove(0, END, 2)
+
+		self.expect('PC', self.pc(), self.pc_at)
+		self.expect('r16', self.reg(Reg.R16), self.r16)
+
+class test_cond_true(base_cond):
+	"""reg r16, const8 3, equal, end: stops when r16 is 3.
+	"""
+	cond = 'X7,26001022031327'
+	pc_at = BREAK
+	r16 = 3
+
+class test_cond_false(base_cond):
+	"""const8 0, end: never stops at the break point.
+	"""
+	cond = 'X3,220027'
+	pc_at = END
+	r16 = 5
+
+class test_cond_no_end(base_cond):
+	"""const8 1 without end can not be evaluated, the target stops.
+	"""
+	cond = 'X2,2201'
+	pc_at = BREAK
+	r16 = 1
+
+class test_cond_bad_opcode(base_cond):
+	"""An unknown bytecode stops the target too.
+	"""
+	cond = 'X2,ff27'
+	pc_at = BREAK
+	r16 = 1
+
+class test_cond_malformed(base_cond):
+	"""A condition shorter than its length is refused with the break point.
+	"""
+	cond = 'X3,2201'
+	reply = 'E01'
+	pc_at = END
+	r16 = 5
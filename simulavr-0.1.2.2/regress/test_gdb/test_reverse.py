@@ -0,0 +1,86 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Test reverse execution, the 'bs' and 'bc' packets.
+"""
+
+import gdb_test
+from registers import Reg
+
+# ldi r16, 0; then inc r16 four times; loop
+COUNT = [ 0xe000, 0x9503, 0x9503, 0x9503, 0x9503, 0xcfff ]
+
+class base_reverse(gdb_test.gdb_test):
+	def program(self):
+		return COUNT
+
+	def reverse(self, how):
+		self.target.send('b' + how)
+		return self.target.handle_reply()
+
+	def expect_at(self, pc, r16):
+		self.expect('PC', self.pc(), pc)
+		self.expect('r16', self.reg(Reg.R16), r16)
+
+class test_reverse_step(base_reverse):
+	"""Each step back undoes one instruction, up to the start of the
+	history.
+	"""
+	def check(self):
+		for i in range(4):
+			self.target.step()
+		self.expect_at(8, 3)
+
+		for pc, r16 in ((6, 2), (4, 1), (2, 0)):
+			reply = self.reverse('s')
+			self.expect('reason', self.reason(reply) == '', 1)
+			self.expect_at(pc, r16)
+
+		self.reverse('s')
+		self.expect('PC', self.pc(), 0)
+		reply = self.reverse('s')
+		self.expect('replaylog:begin', self.reason(reply) == 'replaylog:begin', 1)
+		self.expect('PC', self.pc(), 0)
+
+class test_reverse_continue(base_reverse):
+	"""Running back stops at the last time a break point was reached, then
+	at the start of the history.
+	"""
+	def check(self):
+		for i in range(5):
+			self.target.step()
+		self.expect_at(10, 4)
+
+		self.target.break_insert(0, 4, 2)
+		try:
+			reply = self.reverse('c')
+			self.expect('reason', self.reason(reply) == '', 1)
+			self.expect_at(4, 1)
+
+			reply = self.reverse('c')
+			self.expect('replaylog:begin', self.reason(reply) == 'replaylog:begin', 1)
+			self.expect('PC', self.pc(), 0)
+		finally:
+			self.target.break_remove(0, 4, 2)
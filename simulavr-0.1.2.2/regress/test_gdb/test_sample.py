@@ -0,0 +1,72 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Test the PC sampling under gdb.
+"""
+
+import array, os, struct, tempfile
+import gdb_test
+from registers import Reg
+
+PORT = 1230
+STACK = 0x25f					# top of the sram of the at90s8515
+
+# set SP; loop: rcall f; rjmp loop; f: nop; nop; nop; ret
+PROGRAM = [ 0xe002, 0xbf0e, 0xe50f, 0xbf0d, 0xd001, 0xcffe,
+			0x0000, 0x0000, 0x0000, 0x9508 ]
+AFTER_RET = 10
+
+class test_sample_watch(gdb_test.own_simulator):
+	"""Sampling the return address at SP in every cycle must not set off a
+	read watchpoint on it: only the ret does.
+	"""
+	port = PORT
+
+	def run(self):
+		fd, self.samples = tempfile.mkstemp('.samples')
+		os.close(fd)
+		try:
+			gdb_test.own_simulator.run(self)
+		finally:
+			os.remove(self.samples)
+
+	def args(self):
+		return [ '-g', '-G', '-d', 'at90s8515', '-p', str(PORT),
+				 '-q', self.samples, '-Q', '1', '-K' ]
+
+	def check(self):
+		self.gdb.write_flash(0, 2 * len(PROGRAM), array.array('B',
+							 struct.pack('<%dH' % len(PROGRAM), *PROGRAM)))
+		self.gdb.write_reg(Reg.PC, 0)
+
+		self.gdb.break_insert(3, 0x800000 + STACK, 1)
+		try:
+			for i in range(3):
+				self.gdb.cont()
+				pc = self.gdb.read_regs()[Reg.PC]
+				if pc != AFTER_RET:
+					raise gdb_test.GDB_TestFail, 'read watch stop at 0x%x' % (pc)
+		finally:
+			self.gdb.break_remove(3, 0x800000 + STACK, 1)
@@ -0,0 +1,97 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Test the gdbserver of several cards: every card is a process of gdb.
+"""
+
+import os, struct, tempfile
+import gdb_test
+from registers import Reg
+
+PORT = 1220						# cards on PORT, PORT + 1, gdb on PORT + 2
+CARDS = 2
+
+class test_threads(gdb_test.own_simulator):
+	"""Start a simulator with two cards looping at 0, list the cards and
+	switch between their register files.
+	"""
+	port = PORT + CARDS
+
+	def run(self):
+		fd, self.image = tempfile.mkstemp('.bin')
+		os.write(fd, struct.pack('<H', 0xcfff))
+		os.close(fd)
+		try:
+			gdb_test.own_simulator.run(self)
+		finally:
+			os.remove(self.image)
+
+	def args(self):
+		return [ '-d', 'OsEID128', '-N', str(CARDS), '-g', '-p', str(PORT),
+				 self.image ]
+
+	def packet(self, pkt, want = None):
+		self.gdb.send(pkt)
+		reply = self.gdb.recv()
+		if want is not None and reply != want:
+			raise gdb_test.GDB_TestFail, '%s reply %s, want %s' % (pkt, reply, want)
+		return reply
+
+	def info(self, n):
+		return self.packet('qThreadExtraInfo,p%x.%x' % (n, n)).decode('hex')
+
+	def held(self, n):
+		return 'held by gdb' in self.info(n)
+
+	def check(self):
+		if 'multiprocess+' not in self.packet('qSupported:multiprocess+'):
+			raise gdb_test.GDB_TestFail, 'no multiprocess support'
+
+		# every card is a process with a single thread
+		self.packet('qfThreadInfo', 'mp1.1,p2.2')
+		self.packet('qsThreadInfo', 'l')
+		self.packet('Tp2.2', 'OK')
+		self.packet('Tp3.3', 'E01')
+		self.packet('Hgp3.3', 'E01')
+
+		# a card gdb selects is held, the other one keeps running
+		self.packet('Hgp2.2', 'OK')
+		if not self.held(2) or self.held(1):
+			raise gdb_test.GDB_TestFail, 'Hg p2: %s / %s' % (self.info(1), self.info(2))
+		self.gdb.write_reg(Reg.R16, 0x22)
+
+		self.packet('Hgp1.1', 'OK')
+		self.gdb.write_reg(Reg.R16, 0x11)
+		if self.gdb.read_regs()[Reg.R16] != 0x11:
+			raise gdb_test.GDB_TestFail, 'r16 of card 0'
+
+		self.packet('Hgp2.2', 'OK')
+		if self.gdb.read_regs()[Reg.R16] != 0x22:
+			raise gdb_test.GDB_TestFail, 'r16 of card 1'
+
+		# detaching a card gives it back to the workers
+		self.packet('D;2', 'OK')
+		if self.held(2) or not self.held(1):
+			raise gdb_test.GDB_TestFail, 'D;2: %s / %s' % (self.info(1), self.info(2))
@@ -0,0 +1,111 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Test the watchpoints, the Z2 (write), Z3 (read) and Z4 (access) packets.
+"""
+
+import gdb_test
+
+ADDR = 0x100					# sram address watched
+GDB_ADDR = 0x800000 + ADDR		# the same in the address space of gdb
+
+# ldi r16, 0x55; sts 0x100, r16; lds r17, 0x100; loop
+PROGRAM = [ 0xe505, 0x9300, ADDR, 0x9110, ADDR, 0xcfff ]
+END = 10						# the loop, a break point stops a miss
+
+class base_watch(gdb_test.gdb_test):
+	def program(self):
+		return PROGRAM
+
+	def check(self):
+		self.target.break_insert(0, END, 2)
+		self.target.break_insert(self.type, GDB_ADDR, 1)
+		try:
+			reply = self.target.cont()
+		finally:
+			self.target.break_remove(self.type, GDB_ADDR, 1)
+			self.target.break_remove(0, END, 2)
+
+		want = '%s:%x' % (self.kind, GDB_ADDR)
+		if self.reason(reply) != want:
+			raise gdb_test.GDB_TestFail, 'stop reply %s, want %s' % (reply, want)
+		# stopped after the instruction that made the access
+		self.expect('PC', self.pc(), self.pc_after)
+
+class test_watch_write(base_watch):
+	type = 2
+	kind = 'watch'
+	pc_after = 6
+
+class test_watch_read(base_watch):
+	type = 3
+	kind = 'rwatch'
+	pc_after = 10
+
+class test_watch_access(base_watch):
+	type = 4
+	kind = 'awatch'
+	pc_after = 6
+
+EEPROM = 0x810000				# the eeprom in the address space of gdb
+OSEID_PORT = 1240
+OSEID_EEPROM = 4096				# eeprom bytes of the OsEID128
+
+def eeprom_watch(gdb, addr, len):
+	"""Insert and remove a write watchpoint in the eeprom, return the reply
+	to the insert.
+	"""
+	gdb.send('Z2,%x,%x' % (EEPROM + addr, len))
+	reply = gdb.recv()
+	if reply == 'OK':
+		gdb.break_remove(2, EEPROM + addr, len)
+	return reply
+
+class test_watch_eeprom_none(gdb_test.gdb_test):
+	"""The device of the regression target has no eeprom to watch.
+	"""
+	def run(self):
+		reply = eeprom_watch(self.target, 0, 1)
+		if reply != 'E01':
+			raise gdb_test.GDB_TestFail, 'eeprom watch reply %s' % (reply)
+
+class test_watch_eeprom_size(gdb_test.own_simulator):
+	"""On an OsEID device a watchpoint may cover its eeprom up to the last
+	byte, not past it.
+	"""
+	port = OSEID_PORT
+
+	def args(self):
+		return [ '-g', '-G', '-d', 'OsEID128', '-p', str(OSEID_PORT) ]
+
+	def check(self):
+		for addr, len, want in ((0, 1, 'OK'),
+								(OSEID_EEPROM - 4, 4, 'OK'),
+								(OSEID_EEPROM - 4, 5, 'E01'),
+								(OSEID_EEPROM, 1, 'E01')):
+			reply = eeprom_watch(self.gdb, addr, len)
+			if reply != want:
+				raise gdb_test.GDB_TestFail, 'watch %d bytes at 0x%x: %s, want %s' % (
+					len, addr, reply, want)
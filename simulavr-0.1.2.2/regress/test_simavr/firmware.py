@@ -0,0 +1,95 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Small OsEID firmware images for the in-process tests.
+
+They are hand assembled, so the tests do not need an avr toolchain. The
+OsEID FIFO is at data address 0xfe, its control register at 0xff: writing 2
+waits for a command from the host, reading the control register gives 0 once
+the FIFO is empty, writing 0 empties it and writing 1 sends its contents.
+"""
+
+import struct
+
+# Answer every command APDU with the command itself.
+ECHO = [
+	0xe002,				#     ldi  r16, 2
+	0x9300, 0x00ff,		#     sts  0xff, r16	; wait for a command
+	0xe0a0,				#     ldi  r26, 0x00	; X = 0x100
+	0xe0b1,				#     ldi  r27, 0x01
+	0x9100, 0x00ff,		# rd: lds  r16, 0xff
+	0x2300,				#     tst  r16
+	0xf021,				#     breq out
+	0x9100, 0x00fe,		#     lds  r16, 0xfe
+	0x930d,				#     st   X+, r16
+	0xcff8,				#     rjmp rd
+	0xe000,				# out:ldi  r16, 0
+	0x9300, 0x00ff,		#     sts  0xff, r16	; empty the FIFO
+	0xe0c0,				#     ldi  r28, 0x00	; Y = 0x100
+	0xe0d1,				#     ldi  r29, 0x01
+	0x17ca,				# wr: cp   r28, r26
+	0x07db,				#     cpc  r29, r27
+	0xf021,				#     breq done
+	0x9109,				#     ld   r16, Y+
+	0x9300, 0x00fe,		#     sts  0xfe, r16
+	0xcff9,				#     rjmp wr
+	0xe001,				# done:ldi r16, 1
+	0x9300, 0x00ff,		#     sts  0xff, r16	; send the answer
+	0xcfe3,				#     rjmp 0
+]
+
+# Answer every command APDU with a byte of the random number source.
+RANDOM = [
+	0xe002,				#     ldi  r16, 2
+	0x9300, 0x00ff,		#     sts  0xff, r16	; wait for a command
+	0xe003,				#     ldi  r16, 3
+	0x9300, 0x00ff,		#     sts  0xff, r16	; random byte to the FIFO
+	0x9110, 0x00fe,		#     lds  r17, 0xfe
+	0xe000,				#     ldi  r16, 0
+	0x9300, 0x00ff,		#     sts  0xff, r16	; empty the FIFO
+	0x9310, 0x00fe,		#     sts  0xfe, r17
+	0xe001,				#     ldi  r16, 1
+	0x9300, 0x00ff,		#     sts  0xff, r16	; send the answer
+	0xcfef,				#     rjmp 0
+]
+
+# Reserve a stack frame the way avr-gcc does and call a function, forever.
+FRAME = [
+	0xe100,				#     ldi  r16, 0x10
+	0xbf0e,				#     out  SPH, r16
+	0xef0f,				#     ldi  r16, 0xff
+	0xbf0d,				#     out  SPL, r16
+	0xd000,				# 4:  rcall .+0		; 2 bytes of frame
+	0x900f,				#     pop  r0
+	0x900f,				#     pop  r0
+	0xd001,				#     rcall 0x12
+	0xcffb,				#     rjmp 4
+	0x9508,				# 0x12: ret
+]
+
+def image(words):
+	"""Return the flash image of a list of instruction words.
+	"""
+	return struct.pack('<%dH' % len(words), *words)
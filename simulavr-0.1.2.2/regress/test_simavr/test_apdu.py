@@ -0,0 +1,112 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Test the APDU exchange of the simavr library with the OsEID FIFO.
+"""
+
+import simavr
+import base_test, firmware
+
+class APDU_TestFail(base_test.TestFail): pass
+
+class base_apdu:
+	"""Run the echo firmware on an OsEID device of its own.
+
+	The regression target is not used, the device is created here.
+	"""
+	def __init__(self, target):
+		self.target = target
+
+	def run(self):
+		self.sim = simavr.Sim('OsEID128')
+		self.sim.load_flash_image(firmware.image(firmware.ECHO))
+		self.sim.reset()
+		# protocol T1: the FIFO control register reads 0xf1 while not empty
+		self.sim.host_send('> 1')
+		self.check()
+
+	def command(self, n):
+		return ''.join([chr((i * 7 + 3) & 0xff) for i in range(n)])
+
+	def echo(self, n):
+		cmd = self.command(n)
+		resp = self.sim.apdu(cmd)
+		if resp != cmd:
+			raise APDU_TestFail, '%d byte APDU: got %d bytes back' % (n, len(resp))
+
+class test_apdu_short(base_apdu):
+	def check(self):
+		self.echo(5)
+
+class test_apdu_max(base_apdu):
+	"""The longest APDU the card takes must arrive complete.
+	"""
+	def check(self):
+		self.echo(simavr.APDU_MAX)
+		self.echo(4)
+
+class test_apdu_too_long(base_apdu):
+	"""A longer one is refused by the library, not cut.
+	"""
+	def check(self):
+		try:
+			self.sim.apdu(self.command(simavr.APDU_MAX + 1))
+		except simavr.error:
+			pass
+		else:
+			raise APDU_TestFail, 'APDU of %d bytes accepted' % (simavr.APDU_MAX + 1)
+		self.echo(4)
+
+class test_apdu_line_too_long(base_apdu):
+	"""A host line with too many bytes gets the status 'wrong length', the
+	card does not see it.
+	"""
+	def check(self):
+		line = '>' + ' 5a' * (simavr.APDU_MAX + 40)
+		self.sim.host_send(line)
+		self.sim.host_send('> 01 02')
+		if self.sim.run(1000000) != simavr.RUN_WAIT:
+			raise APDU_TestFail, 'device did not wait for input'
+		out = self.sim.host_recv()
+		if out != '< 1\n< 67 00 \n< 01 02 \n':
+			raise APDU_TestFail, 'unexpected output %r' % (out)
+
+class test_apdu_fifo_overflow(base_apdu):
+	"""Bytes written to a full FIFO are dropped, the answer holds the first
+	APDU_MAX of them.
+	"""
+	def check(self):
+		if self.sim.run(1000000) != simavr.RUN_WAIT:
+			raise APDU_TestFail, 'device did not wait for input'
+		self.sim.host_recv()
+		self.sim.mem_write(0xff, chr(0))
+		for i in range(2 * simavr.APDU_MAX):
+			self.sim.mem_write(0xfe, chr(i & 0xff))
+		self.sim.mem_write(0xff, chr(1))
+		out = self.sim.host_recv()
+		want = '< ' + ''.join(['%02x ' % (i & 0xff)
+							   for i in range(simavr.APDU_MAX)]) + '\n'
+		if out != want:
+			raise APDU_TestFail, 'unexpected output %r' % (out)
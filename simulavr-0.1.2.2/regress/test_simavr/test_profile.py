@@ -0,0 +1,64 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Test the function profiler of the simavr library.
+"""
+
+import os, tempfile
+import simavr
+import base_test, firmware
+
+class Profile_TestFail(base_test.TestFail): pass
+
+class test_profile_frame:
+	"""An "rcall .+0" that reserves stack space is not a call: the profile
+	holds the program and the function it calls, nothing else.
+	"""
+	def __init__(self, target):
+		self.target = target
+
+	def run(self):
+		sim = simavr.Sim('OsEID128')
+		sim.load_flash_image(firmware.image(firmware.FRAME))
+		sim.reset()
+
+		fd, out = tempfile.mkstemp('.callgrind')
+		os.close(fd)
+		try:
+			sim.profile_start()
+			sim.run(1000)
+			sim.profile_write(out)
+			sim.profile_stop()
+			lines = open(out).read().splitlines()
+		finally:
+			os.remove(out)
+
+		funcs = [l.split()[1] for l in lines
+				 if l.startswith('fn=') and len(l.split()) > 1]
+		if funcs != ['0x00000']:
+			raise Profile_TestFail, 'functions %r' % (funcs)
+		callees = [l.split()[1] for l in lines if l.startswith('cfn=')]
+		if callees != ['0x00012']:
+			raise Profile_TestFail, 'callees %r' % (callees)
@@ -0,0 +1,76 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Test recording the host input of a run and replaying it.
+"""
+
+import os, tempfile
+import simavr
+import base_test, firmware
+
+class Replay_TestFail(base_test.TestFail): pass
+
+class test_replay_round_trip:
+	"""Record a run that reads host lines and random bytes, then replay the
+	log on a second device: without any input it must give the same answers
+	at the same clock cycle.
+	"""
+	def __init__(self, target):
+		self.target = target
+
+	def device(self):
+		sim = simavr.Sim('OsEID128')
+		sim.load_flash_image(firmware.image(firmware.RANDOM))
+		sim.reset()
+		return sim
+
+	def play(self, sim):
+		if sim.run(1000000) != simavr.RUN_WAIT:
+			raise Replay_TestFail, 'device did not wait for input'
+		return sim.host_recv(), sim.cycles()
+
+	def run(self):
+		fd, log = tempfile.mkstemp('.replay')
+		os.close(fd)
+		try:
+			sim = self.device()
+			sim.replay_start(log)
+			for i in range(4):
+				sim.host_send('> %02x' % (i))
+			recorded = self.play(sim)
+			sim.replay_stop()
+
+			if len(recorded[0].splitlines()) != 4:
+				raise Replay_TestFail, 'unexpected output %r' % (recorded[0])
+
+			sim = self.device()
+			sim.replay_start(log, 1)
+			replayed = self.play(sim)
+			sim.replay_stop()
+		finally:
+			os.remove(log)
+
+		if replayed != recorded:
+			raise Replay_TestFail, 'recorded %r, replayed %r' % (recorded, replayed)
@@ -0,0 +1,154 @@
+#! /usr/bin/env python
+###############################################################################
+#
+# simulavr - A simulator for the Atmel AVR family of microcontrollers.
+# Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+###############################################################################
+#
+# $Id$
+#
+
+"""Test saving and restoring the device state: state files, checkpoints and
+rollback.
+"""
+
+import os, tempfile
+import simavr
+import base_test, firmware
+
+class State_TestFail(base_test.TestFail): pass
+
+EEPROM_LEN = 64
+SRAM = 0x100
+SRAM_LEN = 0x100
+
+class base_state:
+	"""Run the echo firmware on an OsEID device of its own until it waits
+	for a command, with some marks in the registers, sram and eeprom.
+	"""
+	def __init__(self, target):
+		self.target = target
+
+	def device(self):
+		sim = simavr.Sim('OsEID128')
+		sim.load_flash_image(firmware.image(firmware.ECHO))
+		sim.reset()
+		return sim
+
+	def run(self):
+		fd, self.file = tempfile.mkstemp('.state')
+		os.close(fd)
+		try:
+			self.sim = self.device()
+			self.echo('\x00\xa4\x04\x00')
+			self.sim.reg_set(20, 0x5a)
+			self.sim.mem_write(SRAM + 0x80, '\x11\x22\x33')
+			self.sim.eeprom_write(0, '\xca\xfe')
+			self.check()
+		finally:
+			os.remove(self.file)
+
+	def echo(self, cmd):
+		resp = self.sim.apdu(cmd)
+		if resp != cmd:
+			raise State_TestFail, 'APDU %r: got %r back' % (cmd, resp)
+
+	def mutate(self):
+		"""Change everything state() looks at.
+		"""
+		self.echo('\x80\xca\x01\x02\x03')
+		self.sim.reg_set(20, 0xa5)
+		self.sim.mem_write(SRAM + 0x80, '\x44\x55\x66')
+		self.sim.eeprom_write(0, '\xbe\xef')
+
+	def state(self, sim):
+		return ([sim.reg_get(n) for n in range(32)], sim.sreg_get(),
+				sim.pc_get(), sim.mem_read(SRAM, SRAM_LEN),
+				sim.eeprom_read(0, EEPROM_LEN), sim.cycles())
+
+	def compare(self, what, got, want):
+		names = ('registers', 'sreg', 'pc', 'sram', 'eeprom', 'cycles')
+		for i in range(len(names)):
+			if got[i] != want[i]:
+				raise State_TestFail, '%s: %s differ' % (what, names[i])
+
+class test_state_file(base_state):
+	"""A state file restores the device it was saved from, and a new one.
+	"""
+	def check(self):
+		self.sim.save_state(self.file)
+		saved = self.state(self.sim)
+
+		self.mutate()
+		if self.state(self.sim)[3] == saved[3]:
+			raise State_TestFail, 'sram not changed'
+		self.sim.load_state(self.file)
+		self.compare('same device', self.state(self.sim), saved)
+
+		self.sim = self.device()
+		self.sim.load_state(self.file)
+		self.compare('new device', self.state(self.sim), saved)
+		# the firmware goes on where it was saved
+		self.echo('\x00\xb0\x00\x00\x10')
+
+class test_state_damaged(base_state):
+	"""A file that is not a state file, or is cut short, is refused and the
+	device is left reset.
+	"""
+	def check(self):
+		self.sim.save_state(self.file)
+		data = open(self.file, 'rb').read()
+
+		for what, bad in (('garbage', 'x' * len(data)),
+						  ('short', data[:len(data) / 2])):
+			self.echo('\x00\xb0\x00\x00\x10')
+			if self.sim.pc_get() == 0:
+				raise State_TestFail, 'device at its reset address'
+			open(self.file, 'wb').write(bad)
+			try:
+				self.sim.load_state(self.file)
+			except simavr.error:
+				pass
+			else:
+				raise State_TestFail, '%s state file accepted' % (what)
+			if self.sim.pc_get() != 0:
+				raise State_TestFail, '%s state file: device not reset' % (what)
+			self.sim.reset()
+
+class test_state_rollback(base_state):
+	"""A rollback returns to the checkpoint, which stays in place until it
+	is dropped.
+	"""
+	def check(self):
+		if self.sim.checkpoint() != 1:
+			raise State_TestFail, 'checkpoint depth'
+		saved = self.state(self.sim)
+
+		for i in range(2):
+			self.mutate()
+			self.sim.rollback()
+			self.compare('rollback %d' % (i), self.state(self.sim), saved)
+		self.echo('\x00\xb0\x00\x00\x10')
+
+		self.sim.checkpoint_drop()
+		try:
+			self.sim.rollback()
+		except simavr.error:
+			pass
+		else:
+			raise State_TestFail, 'rollback without a checkpoint'
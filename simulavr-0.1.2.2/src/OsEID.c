@@ -60,13 +60,15 @@
 #include "avrcore.h"
 
 #include "display.h"
+#include "OsEID.h"
 
 // OsEID
 typedef struct _Oseid Oseid;
 
 #define OSEID_ATR "< 3b:f5:18:00:02:80:01:4f:73:45:49:44:1a\n"
-// full APDU (extended) for rsa 2048 sign = 5+2+257+2
-#define FIFO_LEN 266
+// ISO 7816 status "wrong length", answer to a line the card can not take
+#define OSEID_WRONG_LENGTH "< 67 00 \n"
+#define FIFO_LEN OSEID_APDU_MAX
 struct _Oseid
 {
   VDevice parent;
@@ -78,7 +80,8 @@ struct _Oseid
 
 // read stdin:
 // write 0 to FIFOCTRL (reset FIFO)
-// write 2 to FIFOCTRL (this block  until user type input line)
+// write 2 to FIFOCTRL (this block  until user type input line, in server
+//   mode the core is parked instead, see hostio.c)
 // pop FIFO - in rx,FIFO wait until enough data is readed
 
   uint8_t FIFO;
@@ -95,6 +98,8 @@ static void oseid_destroy (void *sp);
 static uint8_t oseid_read (VDevice * dev, int addr);
 static void oseid_write (VDevice * dev, int addr, uint8_t val);
 static void oseid_reset (VDevice * dev);
+static void oseid_save (VDevice * dev, Snapshot * ss);
+static void oseid_load (VDevice * dev, Snapshot * ss);
 static void oseid_add_addr (VDevice * vdev, int addr, char *name,
 			    int rel_addr, void *data);
 
@@ -122,6 +127,7 @@ oseid_construct (Oseid * oseid, int addr, char *name)
 
   vdev_construct ((VDevice *) oseid, oseid_read, oseid_write, oseid_reset,
 		  oseid_add_addr);
+  vdev_set_state_fp ((VDevice *) oseid, oseid_save, oseid_load);
   oseid_add_addr ((VDevice *) oseid, addr, name, 0, NULL);
   oseid_reset ((VDevice *) oseid);
 }
@@ -162,6 +168,113 @@ oseid_read (VDevice * dev, int addr)
   return 0;
 }
 
+static HostIO *
+oseid_host (Oseid * oseid)
+{
+  return avr_core_get_host ((AvrCore *) vdev_get_core ((VDevice *) oseid));
+}
+
+// Read lines from host until a data line is found, answer the special
+// cases (reset, power up/down, protocol) directly. Returns 1 when the FIFO
+// is filled, 0 if the host has not sent a data line yet.
+static int
+oseid_host_input (Oseid * oseid)
+{
+  HostIO *host = oseid_host (oseid);
+  char buffer[HOSTIO_BUF_SIZE + 1];
+  int val, res;
+  char *pos, *end;
+
+  for (;;)
+    {
+      oseid->flen = 0;
+
+      for (;;)
+	{
+	  res = hostio_read_line (host, buffer, sizeof (buffer));
+	  if (res == 0)
+	    return 0;
+	  if ((res < 0) || (buffer[0] == '>'))
+	    break;
+	}
+      // the line was dropped, a cut command must not reach the card
+      if (res < 0)
+	{
+	  hostio_printf (host, OSEID_WRONG_LENGTH);
+	  continue;
+	}
+      // check special cases:
+      if (0 == strncmp ("> R\n", buffer, 4))
+	{
+	  // card reset
+//                fprintf (stderr, "card reset, sending ATR\n");
+	  hostio_printf (host, OSEID_ATR);
+	  oseid->protocol = 0xf0;
+	  continue;
+	}
+      if (0 == strncmp ("> D\n", buffer, 4))
+	{
+//                fprintf (stderr, "power down\n");
+	  continue;
+	}
+      if (0 == strncmp ("> P\n", buffer, 4))
+	{
+	  // power up
+//                fprintf (stderr, "power up, sending ATR\n");
+	  hostio_printf (host, OSEID_ATR);
+	  oseid->protocol = 0xf0;
+	  continue;
+	}
+      if (0 == strncmp ("> 0\n", buffer, 4))
+	{
+	  // protocol 0
+//                fprintf (stderr, "protocol 0\n");
+	  hostio_printf (host, "< 0\n");
+	  oseid->protocol = 0xf0;
+	  continue;
+	}
+      if (0 == strncmp ("> 1\n", buffer, 4))
+	{
+	  // protocol 1
+//                fprintf (stderr, "protocol 1\n");
+	  hostio_printf (host, "< 1\n");
+	  oseid->protocol = 0xf1;
+	  continue;
+	}
+
+      pos = buffer + 2;
+      end = buffer + strlen (buffer);
+      while ((pos < end) && (1 == sscanf (pos, "%2x ", &val)))
+	{
+	  pos += 3;
+	  if (oseid->flen > FIFO_LEN)
+	    break;
+	  if (oseid->flen < FIFO_LEN)
+	    oseid->fifo[oseid->flen] = val;
+	  oseid->flen++;
+	}
+      if (oseid->flen > FIFO_LEN)
+	{
+	  avr_warning ("APDU longer than %d bytes, dropped\n", FIFO_LEN);
+	  hostio_printf (host, OSEID_WRONG_LENGTH);
+	  continue;
+	}
+      break;
+    }
+  avr_core_apdu_begin ((AvrCore *) vdev_get_core ((VDevice *) oseid));
+  return 1;
+}
+
+// called by hostio_resume() when new lines arrived from host
+static void
+oseid_host_resume (void *data)
+{
+  Oseid *oseid = (Oseid *) data;
+
+  if (!oseid_host_input (oseid))
+    hostio_wait (oseid_host (oseid), oseid_host_resume, oseid);
+}
+
 static void
 oseid_write (VDevice * dev, int addr, uint8_t val)
 {
@@ -175,99 +288,43 @@ oseid_write (VDevice * dev, int addr, uint8_t val)
 
       if (val == 1)
 	{
-	  printf ("< ");
-	  for (i = 0; i < oseid->flen; i++)
-	    printf ("%02x ", oseid->fifo[i]);
-	  printf ("\n");
+	  char line[3 * FIFO_LEN + 4];
+	  char *pos = line;
+	  int len = (oseid->flen < FIFO_LEN) ? oseid->flen : FIFO_LEN;
+
+	  pos += snprintf (pos, sizeof (line), "< ");
+	  for (i = 0; i < len; i++)
+	    pos += snprintf (pos, line + sizeof (line) - pos, "%02x ",
+			     oseid->fifo[i]);
+	  snprintf (pos, line + sizeof (line) - pos, "\n");
+	  hostio_printf (oseid_host (oseid), "%s", line);
 	  oseid->flen = 0;
+	  avr_core_apdu_end ((AvrCore *) vdev_get_core (dev));
 	}
 
       if (val == 2)
 	{
-	  char buffer[4096];
-	  int val;
-	  char *pos;
-
-	  for (;;)
-	    {
-	      oseid->flen = 0;
-	      fflush (stdin);
-
-	      for (;;)
-		{
-		  while (buffer != fgets (buffer, 1024, stdin));
-		  fprintf (stderr, "%s", buffer);
-		  if (buffer[0] == '>')
-		    break;
-		}
-	      // check special cases:
-	      if (0 == strncmp ("> R\n", buffer, 4))
-		{
-		  // card reset
-//                fprintf (stderr, "card reset, sending ATR\n");
-		  fprintf (stdout, OSEID_ATR);
-		  oseid->protocol = 0xf0;
-		  continue;
-		}
-	      if (0 == strncmp ("> D\n", buffer, 4))
-		{
-//                fprintf (stderr, "power down\n");
-		  continue;
-		}
-	      if (0 == strncmp ("> P\n", buffer, 4))
-		{
-		  // power up
-//                fprintf (stderr, "power up, sending ATR\n");
-		  fprintf (stdout, OSEID_ATR);
-		  oseid->protocol = 0xf0;
-		  continue;
-		}
-	      if (0 == strncmp ("> 0\n", buffer, 4))
-		{
-		  // protocol 0
-//                fprintf (stderr, "protocol 0\n");
-		  fprintf (stdout, "< 0\n");
-		  oseid->protocol = 0xf0;
-		  continue;
-		}
-	      if (0 == strncmp ("> 1\n", buffer, 4))
-		{
-		  // protocol 1
-//                fprintf (stderr, "protocol 1\n");
-		  fprintf (stdout, "< 1\n");
-		  oseid->protocol = 0xf1;
-		  continue;
-		}
-	      break;
-	    }
-
-	  pos = buffer + 2;
-	  while (1 == sscanf (pos, "%2x ", &val))
-	    {
-	      if (pos > buffer + 4090)
-		break;
-	      pos += 3;
-	      if (oseid->flen >= FIFO_LEN)
-		break;
-	      oseid->fifo[oseid->flen] = val;
-	      oseid->flen++;
-	    }
+	  // in server mode no line may be available yet, the core is
+	  // then parked until the host sends one (see hostio.c); stdin
+	  // blocks, so the display is brought up to date first
+	  oseid->flen = 0;
+	  avr_core_display_flush ((AvrCore *) vdev_get_core (dev));
+	  if (!oseid_host_input (oseid))
+	    hostio_wait (oseid_host (oseid), oseid_host_resume, oseid);
 	  return;
 	}
       if (val == 3)
 	{
-	  FILE *f;
-	  f = fopen ("/dev/urandom", "r");
-	  oseid->fifo[0] = fgetc (f);
-	  avr_message ("RND data %02x\n", oseid->fifo[0]);
-	  fclose (f);
+	  // random byte from the core RNG (see rng.c, --rng-seed)
+	  oseid->fifo[0] =
+	    avr_core_rng_get_byte ((AvrCore *) vdev_get_core (dev));
 	  oseid->flen = 0;
 	}
 
     }
   else if (addr == (oseid->addr) + 0)
     {
-      if (oseid->flen <= FIFO_LEN)
+      if (oseid->flen < FIFO_LEN)
 	oseid->fifo[oseid->flen++] = val;
     }
   else
@@ -279,9 +336,44 @@ oseid_reset (VDevice * dev)
 {
   Oseid *oseid = (Oseid *) dev;
   memset (oseid->fifo, 0, 256);
+  oseid->flen = 0;
   avr_message ("OsEID fifo reset\n");
 }
 
+// snapshot: the FIFO and whether the firmware is parked in FIFOCTRL=2
+// waiting for a host line; the wait is re-armed on load
+static void
+oseid_save (VDevice * dev, Snapshot * ss)
+{
+  Oseid *oseid = (Oseid *) dev;
+  HostIO *host = oseid_host (oseid);
+
+  snapshot_put_u8 (ss, oseid->FIFO);
+  snapshot_put_u8 (ss, oseid->FIFOCTRL);
+  snapshot_put_u8 (ss, oseid->protocol);
+  snapshot_put_u16 (ss, oseid->flen);
+  snapshot_put (ss, oseid->fifo, FIFO_LEN);
+  snapshot_put_u8 (ss, host->resume == oseid_host_resume
+		   && host->resume_data == oseid);
+}
+
+static void
+oseid_load (VDevice * dev, Snapshot * ss)
+{
+  Oseid *oseid = (Oseid *) dev;
+
+  oseid->FIFO = snapshot_get_u8 (ss);
+  oseid->FIFOCTRL = snapshot_get_u8 (ss);
+  oseid->protocol = snapshot_get_u8 (ss);
+  oseid->flen = snapshot_get_u16 (ss);
+  snapshot_get (ss, oseid->fifo, FIFO_LEN);
+  if (snapshot_get_u8 (ss))
+    hostio_wait (oseid_host (oseid), oseid_host_resume, oseid);
+
+  if (oseid->flen > FIFO_LEN)
+    ss->error = 1;
+}
+
 static void
 oseid_add_addr (VDevice * vdev, int addr, char *name, int rel_addr,
 		void *data)
@@ -315,7 +407,7 @@ struct _EEprom
   uint16_t addr;
 
   uint8_t EECR, EEDR, EEARL, EEARH;
-  uint8_t mem[4096];		// atmega128, atmega1284
+  Storage *stor;		// OSEID_EE_SIZE bytes, atmega128, atmega1284
 };
 #endif
 static EEprom *ee_new (int addr, char *name);
@@ -324,31 +416,60 @@ static void ee_destroy (void *sp);
 static uint8_t ee_read (VDevice * dev, int addr);
 static void ee_write (VDevice * dev, int addr, uint8_t val);
 static void ee_reset (VDevice * dev);
+static void ee_save (VDevice * dev, Snapshot * ss);
+static void ee_load (VDevice * dev, Snapshot * ss);
 static void ee_add_addr (VDevice * vdev, int addr, char *name, int rel_addr,
 			 void *data);
 
-// dirty access to eeprom mem  from gdb
-uint8_t *ee_mem;
+// direct access to eeprom mem (gdb, eeprom image loading)
+// the EEprom vdev is found through the core, each core has its own eeprom
+
+static EEprom *
+ee_lookup (AvrCore * core)
+{
+  VDevice *dev = avr_core_get_vdev_by_addr (core, OSEID_EECR_ADDR);
+
+  if (dev == NULL || dev->read != ee_read)
+    return NULL;
+  return (EEprom *) dev;
+}
+
 uint8_t
-gdb_ee_read (int adr)
+oseid_ee_read (AvrCore * core, int adr)
 {
-  if (!ee_mem)
+  EEprom *ee = ee_lookup (core);
+
+  if (!ee)
     return 0;
-  if (adr < 4096)
-    return (ee_mem[adr]);
+  if (adr >= 0 && adr < OSEID_EE_SIZE)
+    return storage_readb (ee->stor, adr);
   return 0;
 }
 
 void
-gdb_ee_write (int adr, uint8_t data)
+oseid_ee_write (AvrCore * core, int adr, uint8_t data)
 {
-  if (!ee_mem)
+  EEprom *ee = ee_lookup (core);
+
+  if (!ee)
     return;
-  if (adr < 4096)
-    ee_mem[adr] = data;
+  if (adr >= 0 && adr < OSEID_EE_SIZE)
+    storage_writeb (ee->stor, adr, data);
   return;
 }
 
+// eeprom contents, for checkpoints (NULL if there is no OsEID eeprom)
+
+Storage *
+oseid_ee_storage (AvrCore * core)
+{
+  EEprom *ee = ee_lookup (core);
+
+  if (!ee)
+    return NULL;
+  return ee->stor;
+}
+
 VDevice *
 ee_create (int addr, char *name, int rel_addr, void *data)
 {
@@ -363,7 +484,6 @@ ee_new (int addr, char *name)
   ee = avr_new (EEprom, 1);
   ee_construct (ee, addr, name);
   class_overload_destroy ((AvrClass *) ee, ee_destroy);
-  ee_mem = ee->mem;
   return ee;
 }
 
@@ -374,6 +494,8 @@ ee_construct (EEprom * ee, int addr, char *name)
     avr_error ("passed null ptr");
 
   vdev_construct ((VDevice *) ee, ee_read, ee_write, ee_reset, ee_add_addr);
+  vdev_set_state_fp ((VDevice *) ee, ee_save, ee_load);
+  ee->stor = storage_new (0, OSEID_EE_SIZE);
   ee_add_addr ((VDevice *) ee, addr, name, 0, NULL);
   ee_reset ((VDevice *) ee);
 }
@@ -383,6 +505,7 @@ ee_destroy (void *ee)
 {
   if (ee == NULL)
     return;
+  class_unref ((AvrClass *) ((EEprom *) ee)->stor);
   vdev_destroy (ee);
 }
 
@@ -414,6 +537,7 @@ static void
 ee_write (VDevice * dev, int addr, uint8_t val)
 {
   EEprom *ee = (EEprom *) dev;
+  AvrCore *core = (AvrCore *) vdev_get_core (dev);
 
   if (addr == (ee->addr) + 2)
     ee->EEARL = val;
@@ -425,7 +549,11 @@ ee_write (VDevice * dev, int addr, uint8_t val)
     {
       if (val == 1)
 	{
-	  ee->EEDR = ee->mem[((ee->EEARH << 8 | ee->EEARL) & 0xfff)];
+	  if (core->watch)
+	    avr_core_watch_eeprom (core, (ee->EEARH << 8 | ee->EEARL) & 0xfff,
+				   MEM_WATCH_READ);
+	  ee->EEDR =
+	    storage_readb (ee->stor, (ee->EEARH << 8 | ee->EEARL) & 0xfff);
 #if 0
 	  avr_message ("triggered read from  0x%04x (%02x)\n",
 		       (ee->EEARH << 8 | ee->EEARL) & 0xfff, ee->EEDR);
@@ -437,7 +565,11 @@ ee_write (VDevice * dev, int addr, uint8_t val)
 
 	  avr_message ("triggered write to  0x%04x (%02x)\n",
 		       (ee->EEARH << 8 | ee->EEARL) & 0xfff, ee->EEDR);
-	  ee->mem[((ee->EEARH << 8 | ee->EEARL) & 0xfff)] = ee->EEDR;
+	  if (core->watch)
+	    avr_core_watch_eeprom (core, (ee->EEARH << 8 | ee->EEARL) & 0xfff,
+				   MEM_WATCH_WRITE);
+	  storage_writeb (ee->stor, (ee->EEARH << 8 | ee->EEARL) & 0xfff,
+			  ee->EEDR);
 	}
     }
   else
@@ -453,6 +585,30 @@ ee_reset (VDevice * dev)
   avr_message ("EEprom reset\n");
 }
 
+static void
+ee_save (VDevice * dev, Snapshot * ss)
+{
+  EEprom *ee = (EEprom *) dev;
+
+  snapshot_put_u8 (ss, ee->EECR);
+  snapshot_put_u8 (ss, ee->EEDR);
+  snapshot_put_u8 (ss, ee->EEARL);
+  snapshot_put_u8 (ss, ee->EEARH);
+  storage_save (ee->stor, ss);
+}
+
+static void
+ee_load (VDevice * dev, Snapshot * ss)
+{
+  EEprom *ee = (EEprom *) dev;
+
+  ee->EECR = snapshot_get_u8 (ss);
+  ee->EEDR = snapshot_get_u8 (ss);
+  ee->EEARL = snapshot_get_u8 (ss);
+  ee->EEARH = snapshot_get_u8 (ss);
+  storage_load (ee->stor, ss);
+}
+
 static void
 ee_add_addr (VDevice * vdev, int addr, char *name, int rel_addr, void *data)
 {
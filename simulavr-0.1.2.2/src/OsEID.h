@@ -4,6 +4,13 @@
 extern VDevice *ee_create (int addr, char *name, int rel_addr, void *data);
 extern VDevice *oseid_create (int addr, char *name, int rel_addr, void *data);
 
-uint8_t gdb_ee_read(int adr);
-void    gdb_ee_write(int adr,uint8_t data);
+#define OSEID_EECR_ADDR 0x3c
+#define OSEID_EE_SIZE 4096
+// longest APDU the card reads, full APDU (extended) for rsa 2048 sign =
+// 5+2+257+2; the host sends it as "> xx xx ..", longer ones are refused
+#define OSEID_APDU_MAX 266
+
+uint8_t oseid_ee_read (AvrCore * core, int adr);
+void oseid_ee_write (AvrCore * core, int adr, uint8_t data);
+Storage *oseid_ee_storage (AvrCore * core);
 #endif
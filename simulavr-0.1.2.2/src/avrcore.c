@@ -33,6 +33,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
 #include <signal.h>
 
 #include "avrerror.h"
@@ -60,9 +63,7 @@
 #include "sig.h"
 #include "devsupp.h"
 #include "spm_helper.h"
-
-/** \brief Flag for enabling output of instruction debug messages. */
-int global_debug_inst_output = 0;
+#include "OsEID.h"
 
 /***************************************************************************\
  *
@@ -345,6 +346,7 @@ irq_get_head_vector (DList *head)
 \***************************************************************************/
 
 static void avr_core_construct (AvrCore *core, DevSuppDefn *dev);
+static void avr_core_sram_bounds (AvrCore *core, int *base, int *end);
 
 /** \name AvrCore handling methods */
 
@@ -394,16 +396,40 @@ avr_core_construct (AvrCore *core, DevSuppDefn *dev)
     core->PC_max = flash_sz / 2; /* flash_sz is in bytes, need number of
                                     words here */
 
+    core->display = display_new ();
+
     core->flash = flash_new (flash_sz);
+    flash_set_display (core->flash, core->display);
+    core->image = NULL;
+
+    core->eeprom = NULL;
 
     core->breakpoints = NULL;
 
+    core->checkpoints = NULL;
+    core->profile = NULL;
+    core->sampler = NULL;
+    core->sample_at = UINT64_MAX;
+    core->trace = NULL;
+    core->replay = NULL;
+    core->history = NULL;
+    core->watch = NULL;
+    core->num_watch = 0;
+    avr_core_opstats_clear (core);
+    core->mon_CK = 0;
+    core->mon_insns = 0;
+
     core->irq_pending = NULL;
     core->irq_vtable = (IntVect *)(global_vtable_list[vtab_idx]);
     core->irq_offset = 0;
 
     core->CK = 0;
     core->inst_CKS = 0;
+    core->nop_CK = 0;
+    core->program_time = 0;
+
+    core->debug_inst_output = 0;
+    core->inst_hook = 0;
 
     core->clk_cb = NULL;
     core->async_cb = NULL;
@@ -448,6 +474,13 @@ avr_core_construct (AvrCore *core, DevSuppDefn *dev)
     /* SPM instruction helper */
     core->spmhelper = (SPMhelper *) spmhelper_new (core->flash);
 
+    /* Random number source, host entropy unless avr_core_rng_seed() is
+       called. */
+    core->rng = rng_new ();
+
+    /* Host channel, stdin/stdout unless the server attaches a socket. */
+    core->host = hostio_new ();
+
     /* Assuming the SREG is always at 0x5f. */
 
     core->sreg = (SREG *)avr_core_get_vdev_by_addr (core, 0x5f);
@@ -478,20 +511,16 @@ avr_core_construct (AvrCore *core, DevSuppDefn *dev)
         avr_message ("attach: Internal SRAM from 0x%04x to 0x%04x\n", base,
                      (base + sram_sz - 1));
 
-        for (addr = base; addr < (base + sram_sz); addr++)
-        {
-            avr_core_attach_vdev (core, addr, "Internal SRAM", sram, 0, 0,
-                                  0xff, 0xff);
-        }
+        avr_core_attach_vdev_range (core, base, sram_sz, "Internal SRAM",
+                                    sram, 0, 0, 0xff, 0xff);
     }
     else
     {
         core->sram = NULL;
     }
 
-    /* Initialize the decoder lookup table */
-
-    decode_init_lookup_table ();
+    /* The decoder lookup table fills itself as opcodes are executed, see
+       decode_opcode(). */
 }
 
 /**
@@ -508,14 +537,29 @@ avr_core_destroy (void *core)
     if (_core == NULL)
         return;
 
+    avr_core_history_stop (_core);
+    while (_core->checkpoints)
+        avr_core_checkpoint_drop (_core);
+
+    avr_core_profile_stop (_core);
+    avr_core_sample_stop (_core);
+    avr_core_trace_stop (_core);
+    avr_core_replay_stop (_core);
+
     class_unref ((AvrClass *)_core->sreg);
     class_unref ((AvrClass *)_core->flash);
+    if (_core->image)
+        class_unref ((AvrClass *)_core->image);
     class_unref ((AvrClass *)_core->gpwr);
     class_unref ((AvrClass *)_core->mem);
     class_unref ((AvrClass *)_core->stack);
     class_unref ((AvrClass *)_core->spmhelper);
+    class_unref ((AvrClass *)_core->rng);
+    class_unref ((AvrClass *)_core->display);
+    class_unref ((AvrClass *)_core->host);
 
     dlist_delete_all (_core->breakpoints);
+    avr_free (_core->watch);
     dlist_delete_all (_core->clk_cb);
     dlist_delete_all (_core->async_cb);
     dlist_delete_all (_core->irq_pending);
@@ -547,12 +591,40 @@ avr_core_get_sizes (AvrCore *core, int *flash, int *sram, int *sram_start,
         *eeprom = 0;
 }
 
+/** \brief Returns the display used by the core. It is closed unless
+    display_open() was called on it. */
+extern inline Display *avr_core_get_display (AvrCore *core);
+
+/** \brief Sends the display updates collected so far, for when the core
+    stops running (gdb) or waits for the host. */
+void
+avr_core_display_flush (AvrCore *core)
+{
+    display_flush (core->display);
+}
+
+/** \brief Returns the channel the core's devices use to talk to the
+    host. */
+extern inline HostIO *avr_core_get_host (AvrCore *core);
+
+/** \brief Enable or disable printing of every executed instruction to
+    stderr. */
+extern inline void avr_core_set_debug_inst_output (AvrCore *core, int on);
+
 /** \brief Attach a virtual device into the Memory. */
 extern inline void avr_core_attach_vdev (AvrCore *core, uint16_t addr,
                                          char *name, VDevice *vdev,
                                          int flags, uint8_t reset_value,
                                          uint8_t rd_mask, uint8_t wr_mask);
 
+/** \brief Attach a virtual device to a contiguous range of the Memory. */
+extern inline void avr_core_attach_vdev_range (AvrCore *core, uint16_t addr,
+                                               int len, char *name,
+                                               VDevice *vdev, int flags,
+                                               uint8_t reset_value,
+                                               uint8_t rd_mask,
+                                               uint8_t wr_mask);
+
 /** \brief Returns the \c VDevice with the name \a name. */
 extern inline VDevice *avr_core_get_vdev_by_name (AvrCore *core, char *name);
 
@@ -695,7 +767,7 @@ avr_core_io_display_names (AvrCore *core)
     for (i = IO_REG_ADDR_BEGIN; i < IO_REG_ADDR_END; i++)
     {
         mem_io_fetch (core->mem, i, &val, name, sizeof (name) - 1);
-        display_io_reg_name (i - IO_REG_ADDR_BEGIN, name);
+        display_io_reg_name (core->display, i - IO_REG_ADDR_BEGIN, name);
     }
 }
 
@@ -736,6 +808,419 @@ extern inline void avr_core_stack_push (AvrCore *core, int bytes,
 
 /*@}*/
 
+/** \name Profiler Methods */
+
+/*@{*/
+
+/** \brief Start the function profiler, see profile.c.
+ *
+ * A profile already running is dropped. The functions are named from the
+ * symbols of the loaded program (ELF), or by their addresses.
+ */
+void
+avr_core_profile_start (AvrCore *core)
+{
+    avr_core_profile_stop (core);
+    core->profile = profile_new (core->image, core->PC, core->CK);
+}
+
+/** \brief Stop the function profiler and drop the profile. */
+
+void
+avr_core_profile_stop (AvrCore *core)
+{
+    if (core->profile)
+        class_unref ((AvrClass *)core->profile);
+    core->profile = NULL;
+}
+
+/** \brief Write the profile in the callgrind format to \a file.
+ *
+ * The profiler keeps running. Returns 0 or -1.
+ */
+int
+avr_core_profile_write (AvrCore *core, char *file)
+{
+    if (core->profile == NULL)
+    {
+        avr_warning ("the profiler is not running\n");
+        return -1;
+    }
+
+    return profile_write_callgrind (core->profile, file, core->CK);
+}
+
+/** \brief Write folded stacks (flame graph input) for every APDU to \a dir.
+ *
+ * Starts the profiler if it is not running. See profile_flame_dir().
+ */
+void
+avr_core_profile_flame_dir (AvrCore *core, char *dir)
+{
+    if (core->profile == NULL)
+        avr_core_profile_start (core);
+
+    profile_flame_dir (core->profile, dir);
+}
+
+/** \brief Called by the card device when an APDU from the host is in the
+    FIFO. */
+
+void
+avr_core_apdu_begin (AvrCore *core)
+{
+    if (core->profile)
+        profile_apdu_begin (core->profile, core->CK);
+}
+
+/** \brief Called by the card device when the firmware sends the
+    response. */
+
+void
+avr_core_apdu_end (AvrCore *core)
+{
+    if (core->profile)
+        profile_apdu_end (core->profile, core->CK);
+}
+
+/*@}*/
+
+/** \name PC Sampling Methods */
+
+/*@{*/
+
+/** \brief Sample the PC every \a period clock cycles, see sample.c.
+ *
+ * With \a callers the return address at the top of the stack is counted
+ * too. Samples already taken are dropped.
+ */
+void
+avr_core_sample_start (AvrCore *core, uint32_t period, int callers)
+{
+    avr_core_sample_stop (core);
+    core->sampler = sampler_new (period, core->PC_max, callers);
+    core->sample_at = core->CK + period;
+}
+
+/** \brief Stop the PC sampling and drop the samples. */
+
+void
+avr_core_sample_stop (AvrCore *core)
+{
+    if (core->sampler)
+        class_unref ((AvrClass *)core->sampler);
+    core->sampler = NULL;
+    core->sample_at = UINT64_MAX;
+}
+
+/** \brief Write the samples taken so far to \a file. Returns 0 or -1. */
+
+int
+avr_core_sample_write (AvrCore *core, char *file)
+{
+    if (core->sampler == NULL)
+    {
+        avr_warning ("PC sampling is not running\n");
+        return -1;
+    }
+
+    return sampler_write (core->sampler, file);
+}
+
+/* Take the samples due at CK for the instruction at pc, a long instruction
+   may cover more than one. The return address is only read from the
+   internal sram, past the memory bus: never from the io registers, and
+   without setting off a watchpoint. */
+
+static void
+avr_core_sample (AvrCore *core, int pc)
+{
+    Sampler *smp = core->sampler;
+    uint32_t n = (core->CK - core->sample_at) / smp->period + 1;
+    uint8_t buf[3];
+    int base, end;
+    int sp, i, ret = -1;
+
+    core->sample_at += (uint64_t) n * smp->period;
+
+    if (smp->caller && ((sp = stack_pointer (core->stack)) >= 0))
+    {
+        avr_core_sram_bounds (core, &base, &end);
+        if ((sp + 1 >= base) && (sp + core->PC_size < end))
+        {
+            sram_read_block (core->sram, sp + 1, buf, core->PC_size);
+            for (ret = 0, i = 0; i < core->PC_size; i++)
+                ret = (ret << 8) | buf[i];
+        }
+    }
+
+    sampler_add (smp, pc, ret, n);
+}
+
+/** \brief Report a call to the profiler. */
+extern inline void avr_core_profile_call (AvrCore *core, int pc, int ret);
+
+/** \brief Report a return to the profiler. */
+extern inline void avr_core_profile_ret (AvrCore *core);
+
+/* The profiler names an interrupt after its handler, not after the jump in
+   the vector table. */
+
+static void
+avr_core_profile_irq (AvrCore *core, int vector)
+{
+    uint16_t op = flash_read (core->flash, vector);
+    int target = vector;
+
+    if ((op & 0xfe0e) == 0x940c)        /* JMP k */
+        target = ((((op >> 3) & 0x3e) | (op & 1)) << 16)
+            + flash_read (core->flash, vector + 1);
+    else if ((op & 0xf000) == 0xc000)   /* RJMP k */
+        target = vector + 1 + ((int16_t)(op << 4) >> 4);
+
+    if (target < 0)
+        target += core->PC_max;
+
+    profile_call (core->profile, target * 2, stack_pointer (core->stack),
+                  core->CK);
+}
+
+/*@}*/
+
+/** \name Trace Methods */
+
+/*@{*/
+
+/** \brief Trace the executed instructions to \a file, see trace.c.
+ *
+ * \a trigger is a flash word address or TRACE_NO_TRIGGER, \a size the
+ * number of records kept in memory. Returns 0, or -1 with a warning.
+ */
+
+int
+avr_core_trace_start (AvrCore *core, char *file, int32_t trigger,
+                      uint32_t size)
+{
+    avr_core_trace_stop (core);
+    core->trace = trace_new (file, trigger, size);
+    core->inst_hook = core->debug_inst_output || core->trace;
+
+    return core->trace ? 0 : -1;
+}
+
+/** \brief End the trace, the records still in memory are written. */
+
+void
+avr_core_trace_stop (AvrCore *core)
+{
+    if (core->trace)
+        class_unref ((AvrClass *)core->trace);
+    core->trace = NULL;
+    core->inst_hook = core->debug_inst_output;
+}
+
+/*@}*/
+
+/** \name Record/Replay Methods */
+
+/*@{*/
+
+/** \brief Record the host input to \a file, or with \a play replay it
+ *  from there (see replay.c).
+ *
+ * Covers the lines read from the host and the random number source.
+ * Returns 0, or -1 with a warning.
+ */
+
+int
+avr_core_replay_start (AvrCore *core, char *file, int play)
+{
+    avr_core_replay_stop (core);
+    core->replay = replay_new (file, play, &core->CK);
+    core->host->replay = core->replay;
+
+    return core->replay ? 0 : -1;
+}
+
+/** \brief End recording or replaying, the log is closed. */
+
+void
+avr_core_replay_stop (AvrCore *core)
+{
+    if (core->replay)
+        class_unref ((AvrClass *)core->replay);
+    core->replay = NULL;
+    core->host->replay = NULL;
+}
+
+/*@}*/
+
+/** \name Opcode Statistics Methods */
+
+/*@{*/
+
+/* Counted opcodes, most executed first. Returns their number. */
+
+static int
+avr_core_opstats_order (AvrCore *core, int *order, uint64_t *total)
+{
+    int i, j, op, n = 0;
+
+    *total = 0;
+    for (op = 0; op < NUM_OPCODE_HANLDERS; op++)
+    {
+        if (core->op_count[op] == 0)
+            continue;
+        *total += core->op_count[op];
+
+        /* insertion sort, there are only about a hundred of them */
+        for (i = n++; i > 0; i--)
+        {
+            j = order[i - 1];
+            if (core->op_count[j] >= core->op_count[op])
+                break;
+            order[i] = j;
+        }
+        order[i] = op;
+    }
+
+    return n;
+}
+
+static void
+avr_core_opstats_line (AvrCore *core, int op, uint64_t total, char *buf,
+                       size_t size)
+{
+    snprintf (buf, size, "%-8s %12llu %6.2f%% %14llu %5.2f\n",
+              global_opcode_name[op], (unsigned long long)core->op_count[op],
+              100.0 * core->op_count[op] / total,
+              (unsigned long long)core->op_cycles[op],
+              (double)core->op_cycles[op] / core->op_count[op]);
+}
+
+#define OPSTATS_HEADER \
+    "opcode          count   insns%         cycles   avg\n"
+
+/** \brief Zero the per opcode counters.
+ *
+ * Every executed instruction is counted under the opcode_* id its handler
+ * returns, with the clock cycles it took. The counters are not part of the
+ * saved state and survive a reset.
+ */
+
+void
+avr_core_opstats_clear (AvrCore *core)
+{
+    memset (core->op_count, 0, sizeof (core->op_count));
+    memset (core->op_cycles, 0, sizeof (core->op_cycles));
+}
+
+/** \brief Print the opcode counters with avr_message(), most executed
+    first. */
+
+void
+avr_core_opstats_print (AvrCore *core)
+{
+    int order[NUM_OPCODE_HANLDERS];
+    uint64_t total;
+    char line[80];
+    int i, n;
+
+    n = avr_core_opstats_order (core, order, &total);
+    if (n == 0)
+        return;
+
+    avr_message ("Opcode mix:\n");
+    avr_message ("   %s", OPSTATS_HEADER);
+    for (i = 0; i < n; i++)
+    {
+        avr_core_opstats_line (core, order[i], total, line, sizeof (line));
+        avr_message ("   %s", line);
+    }
+}
+
+/** \brief Return the opcode counters as text, to be freed with
+    avr_free(). */
+
+char *
+avr_core_opstats_text (AvrCore *core)
+{
+    int order[NUM_OPCODE_HANLDERS];
+    uint64_t total;
+    char *text, *p;
+    size_t size;
+    int i, n;
+
+    n = avr_core_opstats_order (core, order, &total);
+    if (n == 0)
+        return avr_strdup ("No instructions executed.\n");
+
+    size = sizeof (OPSTATS_HEADER) + n * 80;
+    p = text = avr_new (char, size);
+    strcpy (p, OPSTATS_HEADER);
+    p += strlen (p);
+    for (i = 0; i < n; i++)
+    {
+        avr_core_opstats_line (core, order[i], total, p, size - (p - text));
+        p += strlen (p);
+    }
+
+    return text;
+}
+
+/*@}*/
+
+/** \name Random Number Source Methods */
+
+/*@{*/
+
+/** \brief Make the random number source deterministic.
+ *
+ * All bytes returned by avr_core_rng_get_byte() from now on depend only on
+ * \a seed. See rng.c.
+ */
+void
+avr_core_rng_seed (AvrCore *core, uint64_t seed)
+{
+    rng_seed (core->rng, seed);
+}
+
+/** \brief Drop buffered host random bytes (see rng_discard()). */
+
+void
+avr_core_rng_discard (AvrCore *core)
+{
+    rng_discard (core->rng);
+}
+
+/** \brief Returns the next byte from the random number source. */
+extern inline uint8_t avr_core_rng_get_byte (AvrCore *core);
+
+/** \brief avr_core_rng_get_byte() while recording or replaying.
+ *
+ * A replayed run takes the logged byte; past the end of the log, or once
+ * the run no longer follows it, the random number source is used again.
+ */
+uint8_t
+avr_core_replay_rng (AvrCore *core)
+{
+    char buf[2];
+    uint8_t val;
+
+    /* taken in any case, so that a seeded source goes on as recorded at
+       the end of the log */
+    val = rng_get_byte (core->rng);
+
+    if (replay_get (core->replay, REPLAY_RNG, buf, sizeof (buf)) == 1)
+        return buf[0];
+
+    replay_put (core->replay, REPLAY_RNG, &val, 1);
+
+    return val;
+}
+
+/*@}*/
+
 /** \name Program Counter Methods */
 
 /*@{*/
@@ -942,6 +1427,40 @@ avr_core_enable_breakpoints (AvrCore *core)
    
    Returns BREAK_POINT, or >= 0. */
 
+/* Execute the instruction with the debug output and the trace, kept out of
+   exec_next_instruction() so that it costs a single test when off. */
+
+static int
+exec_hooked_instruction (AvrCore *core, struct opcode_info *opi, int pc,
+                         uint16_t opcode)
+{
+    TraceRec *rec = NULL;
+    int result;
+
+    if (core->trace)
+    {
+        rec = trace_begin (core->trace, pc, opcode, core->CK,
+                           core->gpwr->reg);
+        core->mem->trace_rec = rec;
+    }
+
+    result = opi->func (core, opcode, opi->arg1, opi->arg2);
+
+    if (rec)
+    {
+        trace_end (core->trace, rec, result, sreg_get (core->sreg),
+                   core->gpwr->reg);
+        core->mem->trace_rec = NULL;
+    }
+
+    if (core->debug_inst_output)
+        fprintf (stderr, "0x%06x (0x%06x) : 0x%04x : %s\n", pc, pc * 2,
+                 opcode, (result >= 0) ? global_opcode_name[result]
+                 : "BREAK_POINT");
+
+    return result;
+}
+
 static int
 exec_next_instruction (AvrCore *core)
 {
@@ -958,11 +1477,16 @@ exec_next_instruction (AvrCore *core)
 
     opi = decode_opcode (opcode);
 
-    result = opi->func (core, opcode, opi->arg1, opi->arg2);
+    if (core->inst_hook)
+        result = exec_hooked_instruction (core, opi, pc, opcode);
+    else
+        result = opi->func (core, opcode, opi->arg1, opi->arg2);
 
-    if (global_debug_inst_output)
-        fprintf (stderr, "0x%06x (0x%06x) : 0x%04x : %s\n", pc, pc * 2,
-                 opcode, global_opcode_name[result]);
+    if (result >= 0)
+    {
+        core->op_count[result]++;
+        core->op_cycles[result] += core->inst_CKS;
+    }
 
     return result;
 }
@@ -1033,6 +1557,9 @@ avr_core_check_interrupts (AvrCore *core)
 
                 avr_core_PC_set (core, irq->addr + core->irq_offset);
 
+                if (core->profile)
+                    avr_core_profile_irq (core, avr_core_PC_get (core));
+
                 avr_core_irq_clear (core, irq);
             }
         }
@@ -1050,6 +1577,15 @@ avr_core_step (AvrCore *core)
 {
     int res = 0;
     int state;
+    int pc = core->PC;
+
+    /* A device waiting for host input is parked, see hostio_wait(). */
+    if (hostio_waiting (core->host))
+    {
+        if (hostio_has_line (core->host))
+            hostio_resume (core->host);
+        return res;
+    }
 
     /* The MCU is stopped when in one of the many sleep modes */
     state = avr_core_get_state (core);
@@ -1070,6 +1606,9 @@ avr_core_step (AvrCore *core)
         core->inst_CKS--;
     }
 
+    if (core->CK >= core->sample_at)
+        avr_core_sample (core, pc);
+
     /* FIXME: async cb's and interrupt checking might need to be put 
        somewhere else. */
 
@@ -1105,25 +1644,47 @@ avr_core_step (AvrCore *core)
 void
 avr_core_run (AvrCore *core)
 {
-    uint64_t cnt = 0;
-    int res;
-    uint64_t start_time, run_time;
-
     avr_core_reset (core);      /* make sure the device is in a sane state. */
 
     core->state = STATE_RUNNING;
 
-    signal_watch_start (SIGINT);
+    avr_core_continue (core);
+}
 
-    /* FIXME: [TRoth 2002/03/19] This loop isn't going to handle sleep or idle
-       modes properly. */
+/** \brief Run the simulated device from its current state.
+ *
+ * Like avr_core_run(), but without the reset, e.g. for a device restored
+ * with avr_core_load_state(). The run also ends when the device waits for
+ * host input that will not come (end of file on stdin).
+ */
 
-    start_time = get_program_time ();
+void
+avr_core_continue (AvrCore *core)
+{
+    uint64_t cnt = 0;
+    int res;
+    uint64_t start_time, run_time;
+    SigWatch sigint;
+
+    signal_watch_start (&sigint, SIGINT);
+
+    /* FIXME: [TRoth 2002/03/19] This loop isn't going to handle sleep or idle
+       modes properly. */
+
+    start_time = avr_core_get_program_time (core);
     while (core->state == STATE_RUNNING)
     {
-        if (signal_has_occurred (SIGINT))
+        if (signal_has_occurred (&sigint))
             break;
 
+        if (hostio_waiting (core->host))
+        {
+            if (!hostio_has_line (core->host))
+                break;
+            hostio_resume (core->host);
+            continue;
+        }
+
         res = avr_core_step (core);
 
         if (res == BREAK_POINT)
@@ -1131,9 +1692,12 @@ avr_core_run (AvrCore *core)
 
         cnt++;
     }
-    run_time = get_program_time () - start_time;
+    run_time = avr_core_get_program_time (core) - start_time;
+
+    /* the display shows where the run ended */
+    display_flush (core->display);
 
-    signal_watch_stop (SIGINT);
+    signal_watch_stop (&sigint);
     
     /* avoid division by zero below */
     if (run_time == 0) run_time = 1;
@@ -1149,6 +1713,8 @@ avr_core_run (AvrCore *core)
     avr_message ("Executed %lld clock cycles.\n", avr_core_CK_get (core));
     avr_message ("   %lld clks/sec\n",
                  (avr_core_CK_get (core) * 1000) / run_time);
+
+    avr_core_opstats_print (core);
 }
 
 /** \brief Sets the simulated CPU back to its initial state.
@@ -1168,144 +1734,1663 @@ avr_core_reset (AvrCore *core)
        Normaly the clockcycles must not be reset here!
        This leads to an error in the vcd file. */
 
-    display_clock (core->CK);
+    display_clock (core->display, core->CK);
 
     mem_reset (core->mem);
+
+    if (core->profile)
+        profile_restart (core->profile, 0, core->CK);
+}
+
+/** \brief Power the device down and up again.
+ *
+ *  Like avr_core_reset(), but a device waiting for host input is let go
+ *  and the internal sram is cleared, so nothing of the previous session
+ *  survives. The eeprom keeps its contents.
+ */
+
+void
+avr_core_power_cycle (AvrCore *core)
+{
+    uint8_t *zero;
+    int base, end;
+
+    hostio_wait (core->host, NULL, NULL);
+    avr_core_reset (core);
+
+    avr_core_sram_bounds (core, &base, &end);
+    if (end > base)
+    {
+        zero = avr_new0 (uint8_t, end - base);
+        sram_write_block (core->sram, base, zero, end - base);
+        avr_free (zero);
+    }
 }
 
 /*@}*/
 
-/** \name Callback Handling Methods */
+/** \name Snapshot Methods */
 
 /*@{*/
 
+#ifndef DOXYGEN                 /* don't expose to doxygen */
+
+#define SNAPSHOT_MAGIC "SIMAVRSS"
+
+struct irq_save_data
+{
+    AvrCore *core;
+    Snapshot *ss;
+    int count;
+};
+
+struct _Checkpoint
+{
+    Snapshot *ss;               /* registers and devices, without the
+                                   memory contents */
+    Checkpoint *prev;           /* enclosing checkpoint */
+};
+
+#endif /* DOXYGEN */
+
+/* FNV-1a hash of the program, used to check that a state saved without the
+   flash is restored over the same program. Break points must be disabled. */
+
+static uint32_t
+avr_core_flash_hash (AvrCore *core)
+{
+    Storage *stor = (Storage *)core->flash;
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < stor->size; i++)
+        hash = (hash ^ stor->data[i]) * 16777619u;
+
+    return hash;
+}
+
+static int
+iter_save_irq (AvrClass *data, void *user_data)
+{
+    struct irq_save_data *isd = (struct irq_save_data *)user_data;
+    Irq *irq = (Irq *)data;
+
+    snapshot_put_u32 (isd->ss, irq->vector - isd->core->irq_vtable);
+    isd->count++;
+
+    return 0;                   /* Don't delete any item from the list. */
+}
+
 /**
- * \brief For adding external read and write callback functions.
- *
- * rd and wr should come in pairs, but it is safe to add
- * empty function via passing a NULL pointer for either function.
- *
- * \param core A pointer to an AvrCore object.
- *
- * \param port_id The ID for handling the simulavr inheritance model.
- *
- * \param ext_rd Function for the device core to call when it needs to
- * communicate with the external world via I/O Ports.
+ * \brief Append the complete state of the device to a snapshot.
  *
- * \param ext_wr Function for the device core to call when it needs to
- * communicate with the external world via I/O Ports.
+ * The flash is only stored if the program rewrote it with SPM, otherwise
+ * only its hash is kept and the program has to be loaded before the state
+ * is restored. Returns -1 if a device can not be saved.
+ */
+int
+avr_core_snapshot_save (AvrCore *core, Snapshot *ss)
+{
+    struct irq_save_data isd = { core, ss, 0 };
+    int flash_sz, sram_sz, sram_start, eeprom_sz;
+    int count_pos;
+
+    avr_core_get_sizes (core, &flash_sz, &sram_sz, &sram_start, &eeprom_sz);
+
+    snapshot_put (ss, SNAPSHOT_MAGIC, 8);
+    snapshot_put_u32 (ss, SNAPSHOT_VERSION);
+    snapshot_put_u32 (ss, flash_sz);
+    snapshot_put_u32 (ss, sram_sz);
+    snapshot_put_u32 (ss, sram_start);
+
+    snapshot_put_u32 (ss, core->PC);
+    snapshot_put_u32 (ss, core->state);
+    snapshot_put_u32 (ss, core->sleep_mode);
+    snapshot_put_u64 (ss, core->CK);
+    snapshot_put_u32 (ss, core->inst_CKS);
+    snapshot_put_u64 (ss, core->nop_CK);
+    snapshot_put_u64 (ss, core->program_time);
+
+    count_pos = ss->len;
+    snapshot_put_u32 (ss, 0);
+    core->irq_pending =
+        dlist_iterator (core->irq_pending, iter_save_irq, &isd);
+    snapshot_patch_u32 (ss, count_pos, isd.count);
+
+    stack_save (core->stack, ss);
+    rng_save (core->rng, ss);
+
+    /* the program as loaded, without break points */
+    avr_core_disable_breakpoints (core);
+    if (ss->skip_storage)
+        snapshot_put_u32 (ss, 0);
+    else
+        snapshot_put_u32 (ss, avr_core_flash_hash (core));
+    snapshot_put_u8 (ss, core->flash->modified);
+    if (core->flash->modified)
+        storage_save ((Storage *)core->flash, ss);
+    avr_core_enable_breakpoints (core);
+
+    return mem_save (core->mem, ss);
+}
+
+/**
+ * \brief Restore the device from a snapshot made by avr_core_snapshot_save().
  *
+ * The device is reset first. Returns -1 (and leaves the device reset) if
+ * the snapshot does not match this device or program.
  */
-void
-avr_core_add_ext_rd_wr (AvrCore *core, int addr, PortFP_ExtRd ext_rd,
-                        PortFP_ExtWr ext_wr)
+int
+avr_core_snapshot_load (AvrCore *core, Snapshot *ss)
 {
-    Port *p = (Port *)mem_get_vdevice_by_addr (core->mem, addr);
+    int flash_sz, sram_sz, sram_start, eeprom_sz;
+    uint32_t hash, n, irq;
+    char magic[8];
 
-    if (p == NULL)
+    avr_core_get_sizes (core, &flash_sz, &sram_sz, &sram_start, &eeprom_sz);
+
+    snapshot_get (ss, magic, 8);
+    if (memcmp (magic, SNAPSHOT_MAGIC, 8) != 0)
     {
-        avr_warning ("Device does not have vdevice at 0x%04x.\n", addr);
-        return;
+        avr_warning ("not a simulavr state file\n");
+        goto fail;
+    }
+    if (snapshot_get_u32 (ss) != SNAPSHOT_VERSION)
+    {
+        avr_warning ("state file version not supported\n");
+        goto fail;
+    }
+    if ((snapshot_get_u32 (ss) != (uint32_t) flash_sz)
+        || (snapshot_get_u32 (ss) != (uint32_t) sram_sz)
+        || (snapshot_get_u32 (ss) != (uint32_t) sram_start))
+    {
+        avr_warning ("state file was saved from a different device\n");
+        goto fail;
     }
 
-    port_add_ext_rd_wr (p, ext_rd, ext_wr);
+    avr_core_reset (core);
+
+    /* The devices drop their callbacks lazily, their load methods install
+       new ones where needed. */
+    dlist_delete_all (core->clk_cb);
+    core->clk_cb = NULL;
+    dlist_delete_all (core->async_cb);
+    core->async_cb = NULL;
+
+    /* A device waiting for the host re-arms the wait in its load method. */
+    hostio_wait (core->host, NULL, NULL);
+
+    avr_core_PC_set (core, snapshot_get_u32 (ss));
+    core->state = snapshot_get_u32 (ss);
+    core->sleep_mode = snapshot_get_u32 (ss);
+    core->CK = snapshot_get_u64 (ss);
+    core->inst_CKS = snapshot_get_u32 (ss);
+    core->nop_CK = snapshot_get_u64 (ss);
+    core->program_time = snapshot_get_u64 (ss);
+
+    n = snapshot_get_u32 (ss);
+    while (n-- && !ss->error)
+    {
+        irq = snapshot_get_u32 (ss);
+        if (irq >= sizeof (IntVectTable) / sizeof (IntVect))
+            ss->error = 1;
+        else
+            core->irq_pending =
+                irq_list_add (core->irq_pending, &core->irq_vtable[irq]);
+    }
+
+    stack_load (core->stack, ss);
+    rng_load (core->rng, ss);
+
+    avr_core_disable_breakpoints (core);
+    hash = snapshot_get_u32 (ss);
+    core->flash->modified = snapshot_get_u8 (ss);
+    if (core->flash->modified)
+        storage_load ((Storage *)core->flash, ss);
+    else if (!ss->skip_storage && (hash != avr_core_flash_hash (core)))
+    {
+        avr_warning ("state file was saved with a different program\n");
+        ss->error = 1;
+    }
+    avr_core_enable_breakpoints (core);
+
+    if (ss->error || (mem_load (core->mem, ss) < 0))
+    {
+        avr_warning ("state file is damaged\n");
+        goto fail;
+    }
+
+    display_clock (core->display, core->CK);
+
+    if (core->profile)
+        profile_restart (core->profile, core->PC, core->CK);
+    if (core->sampler)
+        core->sample_at = core->CK + core->sampler->period;
+
+    return 0;
+
+  fail:
+    avr_core_reset (core);
+    return -1;
+}
+
+/** \brief Save the state of the device to a file. Returns 0 or -1. */
+
+int
+avr_core_save_state (AvrCore *core, char *file)
+{
+    Snapshot *ss = snapshot_new ();
+    int res;
+
+    res = avr_core_snapshot_save (core, ss);
+    if (res == 0)
+        res = snapshot_write_file (ss, file);
+
+    class_unref ((AvrClass *)ss);
+
+    return res;
 }
 
 /**
- * \brief Add a new clock callback to list.
+ * \brief Restore the state of the device from a file.
+ *
+ * The program has to be loaded before. Returns 0 or -1.
  */
-extern inline void avr_core_clk_cb_add (AvrCore *core, CallBack *cb);
+int
+avr_core_load_state (AvrCore *core, char *file)
+{
+    Snapshot *ss;
+    int res;
+
+    ss = snapshot_read_file (file);
+    if (ss == NULL)
+        return -1;
+
+    res = avr_core_snapshot_load (core, ss);
+    class_unref ((AvrClass *)ss);
+
+    return res;
+}
+
+/* Call fn for every memory whose contents a checkpoint tracks. */
+
+static void
+avr_core_storage_foreach (AvrCore *core, void (*fn) (Storage *stor))
+{
+    Storage *ee = oseid_ee_storage (core);
+
+    fn ((Storage *)core->flash);
+    if (core->sram)
+        fn (core->sram->stor);
+    if (ee)
+        fn (ee);
+}
+
+static void
+avr_core_storage_rollback (Storage *stor)
+{
+    storage_rollback (stor);
+}
+
+static void
+avr_core_storage_release (Storage *stor)
+{
+    storage_release (stor);
+}
 
 /**
- * \brief Add a new asynchronous callback to list.
+ * \brief Take an in-memory checkpoint of the device.
+ *
+ * Registers and io devices are copied (a few hundred bytes). sram, eeprom
+ * and flash are not copied at all: each page is saved on its first write
+ * after the checkpoint (see storage_checkpoint()). Checkpoints nest.
+ * Returns the number of checkpoints or -1 if a device can not be saved.
  */
-extern inline void avr_core_async_cb_add (AvrCore *core, CallBack *cb);
+int
+avr_core_checkpoint (AvrCore *core)
+{
+    Checkpoint *cp;
+    Snapshot *ss;
+    int depth;
 
-/** \brief Run all the callbacks in the list.
- 
-    If a callback returns non-zero (true), then it is done with it's job and
-    wishes to be removed from the list.
- 
-    The time argument has dual meaning. If the callback list is for the clock
-    callbacks, time is the value of the CK clock counter. If the callback list
-    is for the asynchronous callback, time is the number of milliseconds from
-    some unknown, arbitrary time on the host system. */
+    ss = snapshot_new ();
+    ss->skip_storage = 1;
+    if (avr_core_snapshot_save (core, ss) < 0)
+    {
+        class_unref ((AvrClass *)ss);
+        return -1;
+    }
 
-extern inline void avr_core_clk_cb_exec (AvrCore *core);
+    cp = avr_new (Checkpoint, 1);
+    cp->ss = ss;
+    cp->prev = core->checkpoints;
+    core->checkpoints = cp;
+
+    /* The pages are saved without break points, so a rollback does not
+       resurrect a break point removed in the meantime. */
+    avr_core_disable_breakpoints (core);
+    avr_core_storage_foreach (core, storage_checkpoint);
+    avr_core_enable_breakpoints (core);
+
+    for (depth = 0; cp; cp = cp->prev)
+        depth++;
+
+    return depth;
+}
 
 /**
- * \brief Run all the asynchronous callbacks.
+ * \brief Return the device to the innermost checkpoint.
+ *
+ * The checkpoint stays in place, so a test suite can roll back to it after
+ * every test. Returns -1 if there is no checkpoint.
  */
-extern inline void avr_core_async_cb_exec (AvrCore *core);
+int
+avr_core_rollback (AvrCore *core)
+{
+    Checkpoint *cp = core->checkpoints;
+    int res;
 
-/*@}*/
+    if (cp == NULL)
+        return -1;
+
+    avr_core_disable_breakpoints (core);
+    avr_core_storage_foreach (core, avr_core_storage_rollback);
+
+    cp->ss->pos = 0;
+    cp->ss->error = 0;
+    res = avr_core_snapshot_load (core, cp->ss);
+
+    avr_core_enable_breakpoints (core);
+
+    return res;
+}
 
 /**
- * \brief Dump the contents of the entire CPU core.
+ * \brief Drop the innermost checkpoint, the device keeps its state.
  *
- * \param core A pointer to an AvrCore object.
- * \param f_core An open file descriptor.
+ * Returns -1 if there is no checkpoint.
  */
-void
-avr_core_dump_core (AvrCore *core, FILE * f_core)
+int
+avr_core_checkpoint_drop (AvrCore *core)
 {
-    unsigned int pc = avr_core_PC_get (core);
+    Checkpoint *cp = core->checkpoints;
 
-    fprintf (f_core, "PC = 0x%06x (PC*2 = 0x%06x)\n\n", pc, pc * 2);
-    mem_dump_core (core->mem, f_core);
-    flash_dump_core (core->flash, f_core);
+    if (cp == NULL)
+        return -1;
+
+    avr_core_storage_foreach (core, avr_core_storage_release);
+
+    core->checkpoints = cp->prev;
+    class_unref ((AvrClass *)cp->ss);
+    avr_free (cp);
+
+    return 0;
+}
+
+static void
+avr_core_storage_release_outer (Storage *stor)
+{
+    storage_release_outer (stor);
 }
 
 /**
- * \brief Load a program from an input file.
+ * \brief Drop the outermost checkpoint.
+ *
+ * The device can no longer be rolled back that far, the checkpoints inside
+ * it stay valid. Returns -1 if there is no checkpoint.
  */
 int
-avr_core_load_program (AvrCore *core, char *file, int format)
+avr_core_checkpoint_drop_outer (AvrCore *core)
 {
-    return flash_load_from_file (core->flash, file, format);
+    Checkpoint **link = &core->checkpoints;
+    Checkpoint *cp;
+
+    if (*link == NULL)
+        return -1;
+
+    while ((*link)->prev)
+        link = &(*link)->prev;
+    cp = *link;
+
+    avr_core_storage_foreach (core, avr_core_storage_release_outer);
+
+    *link = NULL;
+    class_unref ((AvrClass *)cp->ss);
+    avr_free (cp);
+
+    return 0;
 }
 
-/** \brief Load a program from an input file. */
-#include "OsEID.h"
-#include <unistd.h>
-#include <errno.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <string.h>
-int
-avr_core_load_eeprom (AvrCore *core, char *file, int format)
+/*@}*/
+
+/** \name Reverse Execution Methods */
+
+/*@{*/
+
+#ifndef DOXYGEN                 /* don't expose to doxygen */
+
+/* A checkpoint of the history and where it was taken. */
+
+typedef struct _HistoryMark HistoryMark;
+
+struct _HistoryMark
 {
-// this is not working because src/memory.c: mem_get_vdevice_by_name() is deprecated
-//    EEProm *ee = (EEProm *)mem_get_vdevice_by_name (core->mem, "EEProm");
+    uint64_t steps;             /* History.steps at the checkpoint */
+    uint64_t ck;
+    int input;                  /* position in the input log */
+};
 
-//    return eeprom_load_from_file (ee, file, format);
+struct _History
+{
+    uint64_t interval;          /* clock cycles between the checkpoints */
+    uint64_t next_at;           /* CK of the next checkpoint */
+    uint64_t steps;             /* instructions executed since the start,
+                                   the position in the history */
+    int count;                  /* marks in use, one per checkpoint */
+    int own_log;                /* the input log was started for the
+                                   history */
+    int shortened;              /* the input log filled up, warned */
+    HistoryMark mark[HISTORY_CHECKPOINTS];
+};
 
-// here dirty hack for OsEID
-    int fd, res;
-    int addr;
-    uint8_t inst;
+#endif /* DOXYGEN */
 
-    for (addr = 0; addr < 4096 ; addr++)
-        gdb_ee_write(addr, 0xff);
+/**
+ * \brief Keep a history for reverse execution.
+ *
+ * While the core is stepped with avr_core_history_step() a checkpoint is
+ * taken every \a interval clock cycles (0: HISTORY_INTERVAL) and the host
+ * input is logged in memory (see replay.c). A step back returns to the
+ * checkpoint before the target and executes again from there; with the
+ * logged input the device takes the same path. Only the last
+ * HISTORY_CHECKPOINTS checkpoints are kept, fewer if their input grows past
+ * REPLAY_MEMORY_MAX.
+ *
+ * Returns 0, or -1 with a warning if the history can not be kept: the core
+ * has other checkpoints, or the input is recorded to a file.
+ */
+int
+avr_core_history_start (AvrCore *core, uint64_t interval)
+{
+    History *h;
+    int own_log = 0;
 
-    addr = 0;
+    avr_core_history_stop (core);
 
-    fd = open (file, O_RDONLY);
-    if (fd < 0)
-        avr_error ("Couldn't open binary eeprom image file: %s: %s", file,
-                   strerror (errno));
+    if (core->checkpoints)
+    {
+        avr_warning ("Reverse execution can not be used with checkpoints\n");
+        return -1;
+    }
 
-    while ((res = read (fd, &inst, sizeof (inst))) != 0)
+    if (core->replay == NULL)
+    {
+        core->replay = replay_new (NULL, 0, &core->CK);
+        core->host->replay = core->replay;
+        own_log = 1;
+    }
+    else if (replay_seek (core->replay, replay_tell (core->replay)) < 0)
     {
-        if (res == -1)
-            avr_error ("Error reading binary eeprom image file: %s: %s", file,
-                       strerror (errno));
-        gdb_ee_write(addr, inst);
-        addr++;
+        avr_warning ("Reverse execution can not be used with --record\n");
+        return -1;
     }
-    printf("EEPROM load ok\n");
-    close (fd);
+
+    h = avr_new0 (History, 1);
+    h->interval = interval ? interval : HISTORY_INTERVAL;
+    h->next_at = core->CK;
+    h->own_log = own_log;
+    core->history = h;
 
     return 0;
 }
+
+/** \brief Drop the history and its checkpoints. */
+
+void
+avr_core_history_stop (AvrCore *core)
+{
+    History *h = core->history;
+
+    if (h == NULL)
+        return;
+
+    while (h->count--)
+        avr_core_checkpoint_drop (core);
+    if (h->own_log)
+        avr_core_replay_stop (core);
+
+    avr_free (h);
+    core->history = NULL;
+}
+
+/**
+ * \brief Reset the device for gdb ('signal SIGHUP').
+ *
+ * Rolling back across a reset that the history did not see would execute
+ * the code from before it again, so a running history starts over.
+ */
+void
+avr_core_history_reset (AvrCore *core)
+{
+    avr_core_reset (core);
+
+    if (core->history)
+        avr_core_history_start (core, core->history->interval);
+}
+
+/* Drop the oldest checkpoint of the history and the logged input only it
+   needed. */
+
+static void
+avr_core_history_drop_outer (AvrCore *core)
+{
+    History *h = core->history;
+    int i, cut;
+
+    avr_core_checkpoint_drop_outer (core);
+    memmove (h->mark, h->mark + 1, --h->count * sizeof (HistoryMark));
+
+    cut = replay_trim (core->replay, h->count ? h->mark[0].input
+                       : replay_tell (core->replay));
+    for (i = 0; i < h->count; i++)
+        h->mark[i].input -= cut;
+}
+
+/* Take a checkpoint of the history. With too much input logged since the
+   oldest checkpoints they are given up. */
+
+static void
+avr_core_history_mark (AvrCore *core)
+{
+    History *h = core->history;
+    HistoryMark *m;
+
+    if (h->count == HISTORY_CHECKPOINTS)
+        avr_core_history_drop_outer (core);
+
+    if (h->count && replay_full (core->replay))
+    {
+        if (!h->shortened++)
+            avr_warning ("Input log full, the history is shortened\n");
+        while (h->count && replay_full (core->replay))
+            avr_core_history_drop_outer (core);
+    }
+
+    if (avr_core_checkpoint (core) < 0)
+    {
+        avr_warning ("No checkpoint, the history ends here\n");
+        h->next_at = UINT64_MAX;
+        return;
+    }
+
+    m = &h->mark[h->count++];
+    m->steps = h->steps;
+    m->ck = core->CK;
+    m->input = replay_tell (core->replay);
+    h->next_at = core->CK + h->interval;
+}
+
+/* Go back to the innermost checkpoint, further ones are dropped first. */
+
+static void
+avr_core_history_rollback (AvrCore *core, int idx)
+{
+    History *h = core->history;
+
+    while (h->count > idx + 1)
+    {
+        avr_core_checkpoint_drop (core);
+        h->count--;
+    }
+
+    avr_core_rollback (core);
+    replay_seek (core->replay, h->mark[idx].input);
+    h->steps = h->mark[idx].steps;
+    h->next_at = h->mark[idx].ck + h->interval;
+}
+
+/* Execute again up to the position target of the history, the host does not
+   see the output a second time. The checkpoints passed are taken again.
+   Break points are ignored, a BREAK opcode ends the run early. */
+
+static void
+avr_core_history_redo (AvrCore *core, uint64_t target)
+{
+    History *h = core->history;
+
+    core->host->mute = 1;
+    avr_core_disable_breakpoints (core);
+
+    while (h->steps < target)
+    {
+        if (core->CK >= h->next_at)
+            avr_core_history_mark (core);
+        if (avr_core_step (core) == BREAK_POINT)
+            break;
+        h->steps++;
+    }
+
+    avr_core_enable_breakpoints (core);
+    core->host->mute = 0;
+}
+
+/* Return to the position target, it must not be before the first mark. */
+
+static void
+avr_core_history_goto (AvrCore *core, uint64_t target)
+{
+    History *h = core->history;
+    int idx = h->count - 1;
+
+    while ((idx > 0) && (h->mark[idx].steps > target))
+        idx--;
+
+    avr_core_history_rollback (core, idx);
+    avr_core_history_redo (core, target);
+}
+
+/* avr_core_step() that returns WATCH_POINT after an instruction (or the
+   vectoring to an irq) that hit a watchpoint. Kept out of avr_core_step(),
+   a run without gdb does not look at the watchpoints. */
+
+static int
+avr_core_watch_step (AvrCore *core)
+{
+    int res;
+
+    if (core->watch == NULL)
+        return avr_core_step (core);
+
+    core->mem->watch_hit = 0;   /* reads of gdb are no hits */
+    res = avr_core_step (core);
+    if (core->mem->watch_hit && (res != BREAK_POINT))
+        res = WATCH_POINT;
+
+    return res;
+}
+
+/**
+ * \brief avr_core_step() for the gdbserver.
+ *
+ * With a history takes the checkpoints and counts the position. Returns
+ * WATCH_POINT after an instruction that hit a watchpoint (see
+ * avr_core_watch_insert()).
+ */
+int
+avr_core_history_step (AvrCore *core)
+{
+    History *h = core->history;
+    int res;
+
+    if (h && (core->CK >= h->next_at))
+        avr_core_history_mark (core);
+
+    res = avr_core_watch_step (core);
+
+    /* a break point did not execute anything */
+    if (h && (res != BREAK_POINT))
+        h->steps++;
+
+    return res;
+}
+
+/**
+ * \brief Undo the last instruction.
+ *
+ * Returns 0, or -1 at the start of the history (nothing is done).
+ */
+int
+avr_core_reverse_step (AvrCore *core)
+{
+    History *h = core->history;
+
+    if ((h == NULL) || (h->count == 0) || (h->steps <= h->mark[0].steps))
+        return -1;
+
+    avr_core_history_goto (core, h->steps - 1);
+
+    return 0;
+}
+
+/**
+ * \brief Run backwards to the last break point or watchpoint reached before.
+ *
+ * The intervals between the checkpoints are executed again, latest first,
+ * noting where the PC was at a break point and which instructions hit a
+ * watchpoint. A watchpoint stops before the instruction that made the
+ * access, as if it had been undone. Returns 0 at a break point, 1 at a
+ * watchpoint (see avr_core_watch_hit()), or -1 at the start of the history.
+ *
+ * \a interrupted (if not NULL) is called with \a data every
+ * HISTORY_POLL_STEPS instructions; once it returns true the device goes
+ * back to where the run started and -2 is returned.
+ */
+int
+avr_core_reverse_continue (AvrCore *core, int (*interrupted) (void *data),
+                           void *data)
+{
+    History *h = core->history;
+    uint64_t start, end, hit = 0;
+    int idx, found = 0, stop = 0, polls = 0, res;
+    int watch_hit = 0, watch_addr = 0;
+
+    if ((h == NULL) || (h->count == 0))
+        return -1;
+
+    /* Going back to a checkpoint releases the ones after it, their saved
+       pages no longer apply. They are taken again when the device is
+       brought to where the run stops. */
+    start = end = h->steps;
+    for (idx = h->count - 1; (idx >= 0) && !found && !stop; idx--)
+    {
+        if (h->mark[idx].steps < end)
+        {
+            avr_core_history_rollback (core, idx);
+
+            core->host->mute = 1;
+            avr_core_disable_breakpoints (core);
+            while (h->steps < end)
+            {
+                if (interrupted && (++polls == HISTORY_POLL_STEPS))
+                {
+                    polls = 0;
+                    if ((stop = interrupted (data)))
+                        break;
+                }
+                if (brk_pt_list_lookup (core->breakpoints, core->PC))
+                {
+                    hit = h->steps;
+                    found = 1;
+                    watch_hit = 0;
+                }
+                res = avr_core_watch_step (core);
+                if (res == BREAK_POINT)
+                    break;
+                if (res == WATCH_POINT)
+                {
+                    hit = h->steps;
+                    found = 1;
+                    watch_hit = core->mem->watch_hit;
+                    watch_addr = core->mem->watch_addr;
+                }
+                h->steps++;
+            }
+            avr_core_enable_breakpoints (core);
+            core->host->mute = 0;
+
+            /* unless found, look before the checkpoint */
+            end = h->mark[idx].steps;
+        }
+    }
+
+    if (stop)
+    {
+        avr_core_history_goto (core, start);
+        return -2;
+    }
+
+    avr_core_history_goto (core, found ? hit : h->mark[0].steps);
+
+    if (!found)
+        return -1;
+
+    if (watch_hit == 0)
+        return 0;
+
+    core->mem->watch_hit = watch_hit;
+    core->mem->watch_addr = watch_addr;
+    return 1;
+}
+
+/*@}*/
+
+/** \name Watchpoint Methods */
+
+/*@{*/
+
+#ifndef DOXYGEN                 /* don't expose to doxygen */
+
+struct _WatchPt
+{
+    int eeprom;                 /* eeprom, otherwise data space */
+    int addr;
+    int len;
+    int flag;                   /* MEM_WATCH_WRITE, _READ or _ACCESS */
+};
+
+#endif /* DOXYGEN */
+
+/* Build the watchpoint map of the data space again from the list. */
+
+static void
+avr_core_watch_update (AvrCore *core)
+{
+    WatchPt *w;
+
+    mem_watch_clear (core->mem);
+
+    for (w = core->watch; w < core->watch + core->num_watch; w++)
+        if (!w->eeprom)
+            mem_watch_add (core->mem, w->addr, w->len, w->flag);
+}
+
+/**
+ * \brief Set a watchpoint on \a len bytes from \a addr.
+ *
+ * \a flag is MEM_WATCH_WRITE, MEM_WATCH_READ or MEM_WATCH_ACCESS. The
+ * address is in the data space (registers and io registers are reached by
+ * their memory address only, not as operands of an instruction), or in the
+ * eeprom if \a eeprom is set. avr_core_history_step() returns WATCH_POINT
+ * after an instruction that hit one.
+ *
+ * Returns 0, or -1 for an address outside the data space or the eeprom of
+ * the device.
+ */
+int
+avr_core_watch_insert (AvrCore *core, int eeprom, int addr, int len,
+                       int flag)
+{
+    WatchPt *w;
+    Storage *ee = oseid_ee_storage (core);
+    int size = core->mem->xram_end + 1;
+
+    if (eeprom)
+        size = ee ? storage_get_size (ee) : 0;
+
+    if ((addr < 0) || (len <= 0) || (addr + len > size))
+        return -1;
+
+    core->watch = avr_renew (WatchPt, core->watch, core->num_watch + 1);
+    w = &core->watch[core->num_watch++];
+    w->eeprom = eeprom;
+    w->addr = addr;
+    w->len = len;
+    w->flag = flag;
+
+    avr_core_watch_update (core);
+
+    return 0;
+}
+
+/**
+ * \brief Remove a watchpoint set with avr_core_watch_insert().
+ *
+ * Returns 0, or -1 if there is no such watchpoint.
+ */
+int
+avr_core_watch_remove (AvrCore *core, int eeprom, int addr, int len,
+                       int flag)
+{
+    int i;
+
+    for (i = 0; i < core->num_watch; i++)
+    {
+        WatchPt *w = &core->watch[i];
+
+        if ((w->eeprom == eeprom) && (w->addr == addr) && (w->len == len)
+            && (w->flag == flag))
+            break;
+    }
+
+    if (i == core->num_watch)
+        return -1;
+
+    memmove (core->watch + i, core->watch + i + 1,
+             (--core->num_watch - i) * sizeof (WatchPt));
+    if (core->num_watch == 0)
+    {
+        avr_free (core->watch);
+        core->watch = NULL;
+    }
+
+    avr_core_watch_update (core);
+
+    return 0;
+}
+
+/**
+ * \brief The watchpoint hit by the last instruction.
+ *
+ * Returns the flag of the watchpoint (MEM_WATCH_*), with the address of
+ * the access in \a addr and \a eeprom set for the eeprom, or 0 if the
+ * instruction hit none.
+ */
+int
+avr_core_watch_hit (AvrCore *core, int *eeprom, int *addr)
+{
+    int hit = core->mem->watch_hit;
+
+    *eeprom = (hit & MEM_WATCH_EEPROM) != 0;
+    *addr = core->mem->watch_addr;
+
+    return hit & ~MEM_WATCH_EEPROM;
+}
+
+/**
+ * \brief Check an access of the device to the eeprom for a watchpoint.
+ *
+ * Called by the eeprom device with \a flag MEM_WATCH_READ or
+ * MEM_WATCH_WRITE.
+ */
+void
+avr_core_watch_eeprom (AvrCore *core, int addr, int flag)
+{
+    WatchPt *w;
+
+    if (core->mem->watch_hit)
+        return;
+
+    for (w = core->watch; w < core->watch + core->num_watch; w++)
+    {
+        if (!w->eeprom || (addr < w->addr) || (addr >= w->addr + w->len))
+            continue;
+        if (w->flag & (flag | MEM_WATCH_ACCESS))
+        {
+            core->mem->watch_hit = w->flag | MEM_WATCH_EEPROM;
+            core->mem->watch_addr = addr;
+            return;
+        }
+    }
+}
+
+/*@}*/
+
+/** \name Callback Handling Methods */
+
+/*@{*/
+
+/**
+ * \brief For adding external read and write callback functions.
+ *
+ * rd and wr should come in pairs, but it is safe to add
+ * empty function via passing a NULL pointer for either function.
+ *
+ * \param core A pointer to an AvrCore object.
+ *
+ * \param port_id The ID for handling the simulavr inheritance model.
+ *
+ * \param ext_rd Function for the device core to call when it needs to
+ * communicate with the external world via I/O Ports.
+ *
+ * \param ext_wr Function for the device core to call when it needs to
+ * communicate with the external world via I/O Ports.
+ *
+ */
+void
+avr_core_add_ext_rd_wr (AvrCore *core, int addr, PortFP_ExtRd ext_rd,
+                        PortFP_ExtWr ext_wr)
+{
+    Port *p = (Port *)mem_get_vdevice_by_addr (core->mem, addr);
+
+    if (p == NULL)
+    {
+        avr_warning ("Device does not have vdevice at 0x%04x.\n", addr);
+        return;
+    }
+
+    port_add_ext_rd_wr (p, ext_rd, ext_wr);
+}
+
+/**
+ * \brief Add a new clock callback to list.
+ */
+extern inline void avr_core_clk_cb_add (AvrCore *core, CallBack *cb);
+
+/**
+ * \brief Add a new asynchronous callback to list.
+ */
+extern inline void avr_core_async_cb_add (AvrCore *core, CallBack *cb);
+
+/** \brief Run all the callbacks in the list.
+ 
+    If a callback returns non-zero (true), then it is done with it's job and
+    wishes to be removed from the list.
+ 
+    The time argument has dual meaning. If the callback list is for the clock
+    callbacks, time is the value of the CK clock counter. If the callback list
+    is for the asynchronous callback, time is the number of milliseconds from
+    some unknown, arbitrary time on the host system. */
+
+extern inline void avr_core_clk_cb_exec (AvrCore *core);
+
+/**
+ * \brief Return the number of milliseconds of elapsed program time.
+ *
+ * Time zero is not well defined, so only time differences should be used.
+ * Calling gettimeofday() for every instruction slows down the simulation
+ * (due to meltdown/spectre mitigations in the kernel), so this is just a
+ * counter kept in the core, incremented on every call.
+ */
+extern inline uint64_t avr_core_get_program_time (AvrCore *core);
+
+/**
+ * \brief Run all the asynchronous callbacks.
+ */
+extern inline void avr_core_async_cb_exec (AvrCore *core);
+
+/*@}*/
+
+/**
+ * \brief Dump the contents of the entire CPU core.
+ *
+ * \param core A pointer to an AvrCore object.
+ * \param f_core An open file descriptor.
+ */
+void
+avr_core_dump_core (AvrCore *core, FILE * f_core)
+{
+    unsigned int pc = avr_core_PC_get (core);
+
+    fprintf (f_core, "PC = 0x%06x (PC*2 = 0x%06x)\n\n", pc, pc * 2);
+    mem_dump_core (core->mem, f_core);
+    flash_dump_core (core->flash, f_core);
+}
+
+/**
+ * \brief Load a program from an input file.
+ *
+ * See image_read() for the formats. The symbols of an ELF file are kept, see
+ * avr_core_symbol().
+ */
+int
+avr_core_load_program (AvrCore *core, char *file, int format)
+{
+    Image *img;
+    int res;
+
+    img = image_read (file, format);
+    if (img == NULL)
+        return -1;
+
+    res = avr_core_load_image (core, img);
+    class_unref ((AvrClass *)img);
+
+    return res;
+}
+
+/**
+ * \brief Load the flash part of an image.
+ *
+ * A caller creating many cores reads the file once with image_read() and
+ * loads the image into each of them. The core keeps a reference to an image
+ * with symbols.
+ */
+int
+avr_core_load_image (AvrCore *core, Image *img)
+{
+    if (flash_load_from_bin_image (core->flash, img->flash, img->flash_len)
+        < 0)
+        return -1;
+
+    if (core->image)
+        class_unref ((AvrClass *)core->image);
+    core->image = NULL;
+
+    if (img->num_syms)
+    {
+        class_ref ((AvrClass *)img);
+        core->image = img;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Load a program from a binary image already in memory.
+ *
+ * The symbols of a previously loaded program are dropped.
+ */
+int
+avr_core_load_program_image (AvrCore *core, uint8_t *image, int len)
+{
+    if (core->image)
+        class_unref ((AvrClass *)core->image);
+    core->image = NULL;
+
+    return flash_load_from_bin_image (core->flash, image, len);
+}
+
+/**
+ * \brief Load the eeprom from a file.
+ *
+ * See image_read() for the formats; for ELF the .eeprom section is used.
+ */
+int
+avr_core_load_eeprom (AvrCore *core, char *file, int format)
+{
+// this is not working because src/memory.c: mem_get_vdevice_by_name() is deprecated
+//    EEProm *ee = (EEProm *)mem_get_vdevice_by_name (core->mem, "EEProm");
+
+//    return eeprom_load_from_file (ee, file, format);
+
+    Image *img;
+    int res;
+
+    img = image_read (file, format);
+    if (img == NULL)
+        return -1;
+
+    res = avr_core_load_eeprom_image (core, img);
+    class_unref ((AvrClass *)img);
+    if (res == 0)
+        printf("EEPROM load ok\n");
+
+    return res;
+}
+
+/**
+ * \brief Load the eeprom part of an image.
+ *
+ * An image without eeprom data (a binary file, or Intel HEX made from the
+ * .eeprom section) is taken as eeprom contents as a whole. The rest of the
+ * eeprom is erased.
+ */
+int
+avr_core_load_eeprom_image (AvrCore *core, Image *img)
+{
+// here dirty hack for OsEID
+    uint8_t buf[OSEID_EE_SIZE];
+    Storage *ee = oseid_ee_storage (core);
+    uint8_t *data = img->eeprom;
+    int len = img->eeprom_len;
+
+    if (ee == NULL)
+    {
+        avr_warning ("device has no eeprom\n");
+        return -1;
+    }
+
+    if (data == NULL)
+    {
+        data = img->flash;
+        len = img->flash_len;
+    }
+    if (len > OSEID_EE_SIZE)
+    {
+        avr_warning ("eeprom image too large: %d bytes\n", len);
+        return -1;
+    }
+
+    memset (buf, 0xff, sizeof (buf));
+    memcpy (buf, data, len);
+    storage_write_block (ee, 0, buf, OSEID_EE_SIZE);
+
+    return 0;
+}
+
+/**
+ * \brief Keep the eeprom in a file.
+ *
+ * The file is mapped as the eeprom memory, so the eeprom survives the
+ * simulator: a new file starts erased (0xff), an existing one is used as it
+ * is. \a journal (may be NULL) names a write journal, see
+ * storage_map_file(). Returns 0 or -1 on error.
+ */
+int
+avr_core_eeprom_file (AvrCore *core, char *file, char *journal)
+{
+    Storage *ee = oseid_ee_storage (core);
+
+    if (ee == NULL)
+    {
+        avr_warning ("device has no eeprom\n");
+        return -1;
+    }
+
+    return storage_map_file (ee, file, journal, 0xff);
+}
+
+/** \brief Write the eeprom back to its file now. Returns 0 or -1 on error. */
+
+int
+avr_core_eeprom_sync (AvrCore *core)
+{
+    Storage *ee = oseid_ee_storage (core);
+
+    if (ee == NULL)
+        return 0;
+
+    return storage_sync (ee);
+}
+
+/**
+ * \brief Write the contents of the eeprom to a binary \a file.
+ *
+ * The file can be loaded again with avr_core_load_eeprom(). Returns 0 or -1
+ * on error.
+ */
+int
+avr_core_eeprom_save (AvrCore *core, char *file)
+{
+    Storage *ee = oseid_ee_storage (core);
+    uint8_t buf[OSEID_EE_SIZE];
+    int size;
+    FILE *fp;
+
+    if (ee == NULL)
+    {
+        avr_warning ("device has no eeprom\n");
+        return -1;
+    }
+
+    size = storage_get_size (ee);
+    storage_read_block (ee, 0, buf, size);
+
+    fp = fopen (file, "wb");
+    if (fp == NULL)
+    {
+        avr_warning ("%s: %s\n", file, strerror (errno));
+        return -1;
+    }
+
+    if ((fwrite (buf, 1, size, fp) != (size_t) size) || (fclose (fp) != 0))
+    {
+        avr_warning ("%s: write failed\n", file);
+        return -1;
+    }
+
+    return 0;
+}
+
+/** \name Bulk Memory Access Methods */
+
+/*@{*/
+
+/**
+ * \brief Query the sizes of the memory spaces as a debugger addresses them.
+ *
+ * \a flash and \a eeprom are in bytes, \a data covers the whole data space:
+ * registers, io registers, sram and external ram. The eeprom size is 0 if
+ * the device has none.
+ */
+
+void
+avr_core_space_sizes (AvrCore *core, int *flash, int *data, int *eeprom)
+{
+    Storage *ee = oseid_ee_storage (core);
+
+    *flash = flash_get_size (core->flash);
+    *data = core->mem->xram_end + 1;
+    *eeprom = ee ? storage_get_size (ee) : 0;
+}
+
+/* Check that the len bytes at addr are inside a space of size bytes. */
+
+static int
+avr_core_block_check (int addr, int len, int size)
+{
+    if ((addr < 0) || (len < 0) || (len > size - addr))
+    {
+        avr_warning ("block out of bounds: 0x%x, %d bytes\n", addr, len);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The data space addresses [*base, *end) of the internal sram. */
+
+static void
+avr_core_sram_bounds (AvrCore *core, int *base, int *end)
+{
+    *base = *end = 0;
+
+    if (core->sram)
+    {
+        *base = sram_get_base (core->sram);
+        *end = *base + sram_get_size (core->sram);
+    }
+}
+
+/**
+ * \brief Read \a len bytes of the data space at \a addr.
+ *
+ * The part in the internal sram is copied in one go. Registers, io
+ * registers and external ram are read through the memory bus, as with
+ * avr_core_mem_read(). Returns 0 or -1 if the block is outside the data
+ * space.
+ */
+
+int
+avr_core_mem_read_block (AvrCore *core, int addr, uint8_t *buf, int len)
+{
+    int base, end, n;
+
+    if (avr_core_block_check (addr, len, core->mem->xram_end + 1) < 0)
+        return -1;
+
+    avr_core_sram_bounds (core, &base, &end);
+
+    for (; len > 0; addr += n, buf += n, len -= n)
+    {
+        if ((addr >= base) && (addr < end))
+        {
+            n = (len < end - addr) ? len : end - addr;
+            sram_read_block (core->sram, addr, buf, n);
+        }
+        else
+        {
+            n = 1;
+            *buf = mem_read (core->mem, addr);
+        }
+    }
+
+    return 0;
+}
+
+/** \brief Write \a len bytes of the data space at \a addr, the counterpart
+    of avr_core_mem_read_block(). */
+
+int
+avr_core_mem_write_block (AvrCore *core, int addr, const uint8_t *buf,
+                          int len)
+{
+    int base, end, n;
+
+    if (avr_core_block_check (addr, len, core->mem->xram_end + 1) < 0)
+        return -1;
+
+    avr_core_sram_bounds (core, &base, &end);
+
+    for (; len > 0; addr += n, buf += n, len -= n)
+    {
+        if ((addr >= base) && (addr < end))
+        {
+            n = (len < end - addr) ? len : end - addr;
+            sram_write_block (core->sram, addr, buf, n);
+        }
+        else
+        {
+            n = 1;
+            mem_write (core->mem, addr, *buf);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Read \a len bytes of the flash at byte address \a addr.
+ *
+ * The bytes are in program order, see flash_read_block(). Returns 0 or -1
+ * if the block is outside the flash.
+ */
+
+int
+avr_core_flash_read_block (AvrCore *core, int addr, uint8_t *buf, int len)
+{
+    if (avr_core_block_check (addr, len, flash_get_size (core->flash)) < 0)
+        return -1;
+
+    flash_read_block (core->flash, addr, buf, len);
+
+    return 0;
+}
+
+/** \brief Write \a len bytes of the flash at byte address \a addr, the
+    counterpart of avr_core_flash_read_block(). */
+
+int
+avr_core_flash_write_block (AvrCore *core, int addr, const uint8_t *buf,
+                            int len)
+{
+    if (avr_core_block_check (addr, len, flash_get_size (core->flash)) < 0)
+        return -1;
+
+    flash_write_block (core->flash, addr, buf, len);
+
+    return 0;
+}
+
+/** \brief Read \a len bytes of the eeprom at \a addr. Returns 0 or -1 if
+    the block is outside the eeprom. */
+
+int
+avr_core_eeprom_read_block (AvrCore *core, int addr, uint8_t *buf, int len)
+{
+    Storage *ee = oseid_ee_storage (core);
+
+    if (ee == NULL)
+    {
+        avr_warning ("device has no eeprom\n");
+        return -1;
+    }
+
+    if (avr_core_block_check (addr, len, storage_get_size (ee)) < 0)
+        return -1;
+
+    storage_read_block (ee, addr, buf, len);
+
+    return 0;
+}
+
+/** \brief Write \a len bytes of the eeprom at \a addr, the counterpart of
+    avr_core_eeprom_read_block(). */
+
+int
+avr_core_eeprom_write_block (AvrCore *core, int addr, const uint8_t *buf,
+                             int len)
+{
+    Storage *ee = oseid_ee_storage (core);
+
+    if (ee == NULL)
+    {
+        avr_warning ("device has no eeprom\n");
+        return -1;
+    }
+
+    if (avr_core_block_check (addr, len, storage_get_size (ee)) < 0)
+        return -1;
+
+    storage_write_block (ee, addr, buf, len);
+
+    return 0;
+}
+
+/*@}*/
+
+/** \name Monitor Command Methods */
+
+/*@{*/
+
+#define MONITOR_HELP \
+    "Monitor commands:\n" \
+    "  counters            show the clock cycles and instructions executed\n" \
+    "  opstats             show the executed opcodes\n" \
+    "  opstats reset       zero the opcode counters\n" \
+    "  profile start       start the function profiler\n" \
+    "  profile stop        stop the profiler, the profile is dropped\n" \
+    "  profile write FILE  write the profile (callgrind format)\n" \
+    "  save FILE           save the device state\n" \
+    "  load FILE           restore the device state (then 'flushregs')\n" \
+    "  apdu HEX            queue a command APDU for the card\n" \
+    "  eeprom FILE         write the eeprom contents to a binary file\n"
+
+/* The counters, with the difference to the previous 'counters' command. */
+
+static char *
+avr_core_monitor_counters (AvrCore *core)
+{
+    char buf[256];
+    uint64_t insns = 0;
+    int op;
+
+    for (op = 0; op < NUM_OPCODE_HANLDERS; op++)
+        insns += core->op_count[op];
+
+    /* a reset or the opcode counters may have zeroed them in between */
+    if (core->CK < core->mon_CK)
+        core->mon_CK = 0;
+    if (insns < core->mon_insns)
+        core->mon_insns = 0;
+
+    snprintf (buf, sizeof (buf),
+              "cycles       %14llu  +%llu\n"
+              "instructions %14llu  +%llu\n",
+              (unsigned long long)core->CK,
+              (unsigned long long)(core->CK - core->mon_CK),
+              (unsigned long long)insns,
+              (unsigned long long)(insns - core->mon_insns));
+
+    core->mon_CK = core->CK;
+    core->mon_insns = insns;
+
+    return avr_strdup (buf);
+}
+
+/* Restore the device state from file. A history for reverse execution is
+   started again, its checkpoints are from before the load. */
+
+static int
+avr_core_monitor_load (AvrCore *core, char *file)
+{
+    uint64_t interval = 0;
+    int history = (core->history != NULL);
+    int res;
+
+    if (history)
+    {
+        interval = core->history->interval;
+        avr_core_history_stop (core);
+    }
+
+    res = avr_core_load_state (core, file);
+
+    if (history)
+        avr_core_history_start (core, interval);
+
+    return res;
+}
+
+/* Queue the APDU given in hex (blanks between the bytes are optional) as a
+   line of the host, the card reads it when it waits for the next command.
+   Like the card, it takes no more than OSEID_APDU_MAX bytes. */
+
+static char *
+avr_core_monitor_apdu (AvrCore *core, char *hex)
+{
+    char line[HOSTIO_BUF_SIZE];
+    char buf[80];
+    int pos, n = 0;
+    unsigned int val;
+
+    pos = sprintf (line, ">");
+    while (*hex)
+    {
+        if (isspace ((unsigned char)*hex))
+        {
+            hex++;
+            continue;
+        }
+        if (!isxdigit ((unsigned char)hex[0])
+            || !isxdigit ((unsigned char)hex[1])
+            || (pos + 4 >= HOSTIO_BUF_SIZE))
+            return avr_strdup ("apdu: expected hex bytes\n");
+        if (n == OSEID_APDU_MAX)
+        {
+            snprintf (buf, sizeof (buf), "apdu: more than %d bytes\n",
+                      OSEID_APDU_MAX);
+            return avr_strdup (buf);
+        }
+        sscanf (hex, "%2x", &val);
+        pos += sprintf (line + pos, " %02x", val);
+        hex += 2;
+        n++;
+    }
+    line[pos++] = '\n';
+
+    if ((n == 0) || (hostio_put_input (core->host, line, pos) < 0))
+        return avr_strdup ("apdu: not queued\n");
+
+    snprintf (buf, sizeof (buf), "APDU of %d bytes queued, 'continue' to"
+              " run the card\n", n);
+
+    return avr_strdup (buf);
+}
+
+/* The output of a command that succeeded or failed, the reason of a
+   failure was printed by the simulator. */
+
+static char *
+avr_core_monitor_result (int res)
+{
+    return avr_strdup ((res < 0) ? "failed, see the simulator's output\n"
+                       : "");
+}
+
+/**
+ * \brief Run the gdb monitor command \a cmd.
+ *
+ * The commands read and steer the simulator from a gdb session: counters,
+ * opcode statistics, the profiler, the device state, host input and the
+ * eeprom. Returns the output for gdb, to be freed with avr_free().
+ */
+
+char *
+avr_core_monitor (AvrCore *core, char *cmd)
+{
+    if (strcmp (cmd, "counters") == 0)
+        return avr_core_monitor_counters (core);
+
+    if (strcmp (cmd, "opstats") == 0)
+        return avr_core_opstats_text (core);
+
+    if (strcmp (cmd, "opstats reset") == 0)
+    {
+        avr_core_opstats_clear (core);
+        return avr_strdup ("");
+    }
+
+    if (strcmp (cmd, "profile start") == 0)
+    {
+        avr_core_profile_start (core);
+        return avr_strdup ("");
+    }
+
+    if (strcmp (cmd, "profile stop") == 0)
+    {
+        avr_core_profile_stop (core);
+        return avr_strdup ("");
+    }
+
+    if (strncmp (cmd, "profile write ", 14) == 0)
+        return avr_core_monitor_result (avr_core_profile_write (core,
+                                                                cmd + 14));
+
+    if (strncmp (cmd, "save ", 5) == 0)
+        return avr_core_monitor_result (avr_core_save_state (core, cmd + 5));
+
+    if (strncmp (cmd, "load ", 5) == 0)
+        return avr_core_monitor_result (avr_core_monitor_load (core,
+                                                               cmd + 5));
+
+    if (strncmp (cmd, "apdu ", 5) == 0)
+        return avr_core_monitor_apdu (core, cmd + 5);
+
+    if (strncmp (cmd, "eeprom ", 7) == 0)
+        return avr_core_monitor_result (avr_core_eeprom_save (core, cmd + 7));
+
+    return avr_strdup (MONITOR_HELP);
+}
+
+/*@}*/
+
+/**
+ * \brief Symbol of the loaded program for a flash byte address.
+ *
+ * NULL if the program was not loaded from an ELF file or the address is not
+ * covered, see image_symbol().
+ */
+const ImageSymbol *
+avr_core_symbol (AvrCore *core, int byte_addr)
+{
+    return image_symbol (core->image, byte_addr);
+}
+
+/** \brief Flash byte address of a symbol, -1 if unknown. */
+
+int
+avr_core_symbol_addr (AvrCore *core, const char *name)
+{
+    return image_symbol_addr (core->image, name);
+}
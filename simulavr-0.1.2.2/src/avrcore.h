@@ -30,14 +30,19 @@
 
 #include "display.h"
 #include "spm_helper.h"
+#include "rng.h"
+#include "hostio.h"
+#include "image.h"
+#include "profile.h"
+#include "sample.h"
+#include "trace.h"
+#include "replay.h"
 /****************************************************************************\
  *
  * AvrCore(AvrClass) Definition
  *
 \****************************************************************************/
 
-extern int global_debug_inst_output;
-
 typedef enum
 {
     STATE_RUNNING,              /* normal running */
@@ -46,7 +51,20 @@ typedef enum
     STATE_SLEEP,                /* Sleep mode (there are many sleep modes. */
 } StateType;
 
+enum _history_constants
+{
+    HISTORY_INTERVAL = 1000000, /* default clock cycles between the
+                                   checkpoints of reverse execution */
+    HISTORY_CHECKPOINTS = 256,  /* checkpoints kept, then the oldest is
+                                   dropped */
+    HISTORY_POLL_STEPS = 4096,  /* instructions run backwards between the
+                                   checks for an interrupt */
+};
+
 typedef struct _AvrCore AvrCore;
+typedef struct _Checkpoint Checkpoint;
+typedef struct _History History;
+typedef struct _WatchPt WatchPt;
 
 struct _AvrCore
 {
@@ -60,6 +78,8 @@ struct _AvrCore
     SREG *sreg;                 /* Status Register */
     GPWR *gpwr;                 /* General Purpose Working Registers */
     Flash *flash;               /* flash program memory */
+    Image *image;               /* program file with symbols (ELF), or
+                                   NULL */
     EEProm *eeprom;             /* internal eeprom memory */
 
     SRAM *sram;                 /* internal sram memory */
@@ -69,8 +89,32 @@ struct _AvrCore
 
     SPMhelper *spmhelper;       /* SPM instruction helper */
 
+    Rng *rng;                   /* random number source for devices */
+
+    Display *display;           /* display coprocess for this core */
+
+    HostIO *host;               /* line channel to the host (stdio or a
+                                   server socket) */
+
     DList *breakpoints;         /* head of list of active breakpoints */
 
+    Checkpoint *checkpoints;    /* innermost in-memory checkpoint, see
+                                   avr_core_checkpoint() */
+
+    Profile *profile;           /* function profiler, NULL unless
+                                   avr_core_profile_start() was called */
+    Sampler *sampler;           /* PC sampling, NULL unless
+                                   avr_core_sample_start() was called */
+    uint64_t sample_at;         /* CK of the next sample, never reached
+                                   without a sampler */
+
+    uint64_t op_count[NUM_OPCODE_HANLDERS]; /* executed instructions per
+                                               opcode_* */
+    uint64_t op_cycles[NUM_OPCODE_HANLDERS]; /* and their clock cycles */
+    uint64_t mon_CK;            /* CK and instructions at the last
+                                   'counters' monitor command */
+    uint64_t mon_insns;
+
     DList *irq_pending;         /* head of list of pending interrupts (sorted
                                    by priority) */
     IntVect *irq_vtable;        /* interrupt vector table array */
@@ -81,6 +125,13 @@ struct _AvrCore
                                    have occurred */
     int inst_CKS;               /* number of clocks the previously executed
                                    instruction took */
+    uint64_t nop_CK;            /* CK at the previous NOP, for the NOP
+                                   timing message */
+    uint64_t program_time;      /* pseudo wall clock for the async
+                                   callbacks, see
+                                   avr_core_get_program_time() */
+
+    int debug_inst_output;      /* print every executed instruction */
 
     DList *clk_cb;              /* head of list of clock callback items. If a
                                    clock callback function uses the time
@@ -116,6 +167,18 @@ struct _AvrCore
                                    word enabling indirect jump and call to the
                                    whole program space on MCUs with more than
                                    64K bytes program space. */
+
+    Trace *trace;               /* binary instruction trace, NULL unless
+                                   avr_core_trace_start() was called */
+    int inst_hook;              /* debug output or trace: the slow path of
+                                   exec_next_instruction() */
+    Replay *replay;             /* input log, NULL unless
+                                   avr_core_replay_start() was called */
+    History *history;           /* checkpoints for reverse execution, NULL
+                                   unless avr_core_history_start() was
+                                   called */
+    WatchPt *watch;             /* the watchpoints, NULL if none is set */
+    int num_watch;
 };
 
 extern AvrCore *avr_core_new (char *dev_name);
@@ -124,6 +187,27 @@ extern void avr_core_destroy (void *core);
 extern void avr_core_get_sizes (AvrCore *core, int *flash, int *sram,
                                 int *sram_start, int *eeprom);
 
+extern inline Display *
+avr_core_get_display (AvrCore *core)
+{
+    return core->display;
+}
+
+extern void avr_core_display_flush (AvrCore *core);
+
+extern inline HostIO *
+avr_core_get_host (AvrCore *core)
+{
+    return core->host;
+}
+
+extern inline void
+avr_core_set_debug_inst_output (AvrCore *core, int on)
+{
+    core->debug_inst_output = on;
+    core->inst_hook = on || core->trace;
+}
+
 /* Attach a Virtual Device to the core */
 
 extern inline void
@@ -132,10 +216,23 @@ avr_core_attach_vdev (AvrCore *core, uint16_t addr, char *name, VDevice *vdev,
                       uint8_t wr_mask)
 {
     vdev_set_core (vdev, (AvrClass *)core);
+    vdev_set_display (vdev, core->display);
     mem_attach (core->mem, addr, name, vdev, flags, reset_value, rd_mask,
                 wr_mask);
 }
 
+extern inline void
+avr_core_attach_vdev_range (AvrCore *core, uint16_t addr, int len,
+                            char *name, VDevice *vdev, int flags,
+                            uint8_t reset_value, uint8_t rd_mask,
+                            uint8_t wr_mask)
+{
+    vdev_set_core (vdev, (AvrClass *)core);
+    vdev_set_display (vdev, core->display);
+    mem_attach_range (core->mem, addr, len, name, vdev, flags, reset_value,
+                      rd_mask, wr_mask);
+}
+
 extern inline VDevice *
 avr_core_get_vdev_by_name (AvrCore *core, char *name)
 {
@@ -318,6 +415,66 @@ avr_core_stack_push (AvrCore *core, int bytes, uint32_t val)
 {
     stack_push (core->stack, bytes, val);
 }
+
+/* Profiler Methods */
+
+extern void avr_core_profile_start (AvrCore *core);
+extern void avr_core_profile_stop (AvrCore *core);
+extern int avr_core_profile_write (AvrCore *core, char *file);
+extern void avr_core_profile_flame_dir (AvrCore *core, char *dir);
+extern void avr_core_apdu_begin (AvrCore *core);
+extern void avr_core_apdu_end (AvrCore *core);
+
+/* PC Sampling Methods */
+
+extern void avr_core_sample_start (AvrCore *core, uint32_t period,
+                                   int callers);
+extern void avr_core_sample_stop (AvrCore *core);
+extern int avr_core_sample_write (AvrCore *core, char *file);
+
+/* Trace Methods */
+
+extern int avr_core_trace_start (AvrCore *core, char *file, int32_t trigger,
+                                 uint32_t size);
+extern void avr_core_trace_stop (AvrCore *core);
+
+/* Record/Replay Methods */
+
+extern int avr_core_replay_start (AvrCore *core, char *file, int play);
+extern void avr_core_replay_stop (AvrCore *core);
+
+/* Opcode Statistics Methods */
+
+extern void avr_core_opstats_clear (AvrCore *core);
+extern void avr_core_opstats_print (AvrCore *core);
+extern char *avr_core_opstats_text (AvrCore *core);
+
+extern char *avr_core_monitor (AvrCore *core, char *cmd);
+
+/* Called by the call instructions with the new PC and the return address,
+   after the return address is pushed and the clocks of the instruction are
+   set. Without a profile this is a single test. A call of the next
+   instruction ("rcall .+0") is how avr-gcc reserves stack space, it is not
+   counted: the space is released without a return. */
+
+extern inline void
+avr_core_profile_call (AvrCore *core, int pc, int ret)
+{
+    if (core->profile && (pc != ret))
+        profile_call (core->profile, pc * 2, stack_pointer (core->stack),
+                      core->CK + core->inst_CKS);
+}
+
+/* Called by the return instructions before the return address is popped
+   and after the clocks of the instruction are set. */
+
+extern inline void
+avr_core_profile_ret (AvrCore *core)
+{
+    if (core->profile)
+        profile_ret (core->profile, stack_pointer (core->stack),
+                     core->CK + core->inst_CKS);
+}
 /* spm emulation */
 extern inline void
 avr_core_spm(AvrCore *core, int reg0, int reg1, int Z)
@@ -325,6 +482,20 @@ avr_core_spm(AvrCore *core, int reg0, int reg1, int Z)
     spm_run (core->spmhelper, reg0, reg1, Z);
 }
 
+/* Random Number Source Methods */
+
+extern void avr_core_rng_seed (AvrCore *core, uint64_t seed);
+extern void avr_core_rng_discard (AvrCore *core);
+extern uint8_t avr_core_replay_rng (AvrCore *core);
+
+extern inline uint8_t
+avr_core_rng_get_byte (AvrCore *core)
+{
+    if (core->replay)
+        return avr_core_replay_rng (core);
+    return rng_get_byte (core->rng);
+}
+
 /* Private
  
    Deal with PC reach-arounds.
@@ -368,7 +539,7 @@ avr_core_PC_set (AvrCore *core, int32_t val)
 {
     core->PC = val;
     _adjust_PC_to_max (core);
-    display_pc (core->PC);
+    display_pc (core->display, core->PC);
 }
 
 extern inline void
@@ -376,7 +547,7 @@ avr_core_PC_incr (AvrCore *core, int val)
 {
     core->PC += val;
     _adjust_PC_to_max (core);
-    display_pc (core->PC);
+    display_pc (core->display, core->PC);
 }
 
 /* Interrupt Access Methods */
@@ -395,7 +566,18 @@ extern IntVect *avr_core_irq_get_pending (AvrCore *core);
 
 /* Loading files into various memory areas */
 extern int avr_core_load_program (AvrCore *core, char *file, int format);
+extern int avr_core_load_program_image (AvrCore *core, uint8_t *image,
+                                        int len);
+extern int avr_core_load_image (AvrCore *core, Image *img);
 extern int avr_core_load_eeprom (AvrCore *core, char *file, int format);
+extern int avr_core_load_eeprom_image (AvrCore *core, Image *img);
+extern int avr_core_eeprom_file (AvrCore *core, char *file, char *journal);
+extern int avr_core_eeprom_sync (AvrCore *core);
+extern int avr_core_eeprom_save (AvrCore *core, char *file);
+
+/* Symbols of the loaded program */
+extern const ImageSymbol *avr_core_symbol (AvrCore *core, int byte_addr);
+extern int avr_core_symbol_addr (AvrCore *core, const char *name);
 
 /* Dump a core file */
 extern void avr_core_dump_core (AvrCore *core, FILE * f_core);
@@ -403,7 +585,55 @@ extern void avr_core_dump_core (AvrCore *core, FILE * f_core);
 /* Methods for running programs */
 extern int avr_core_step (AvrCore *core);
 extern void avr_core_run (AvrCore *core);
+extern void avr_core_continue (AvrCore *core);
 extern void avr_core_reset (AvrCore *core);
+extern void avr_core_power_cycle (AvrCore *core);
+
+/* Saving and restoring the device state */
+extern int avr_core_snapshot_save (AvrCore *core, Snapshot *ss);
+extern int avr_core_snapshot_load (AvrCore *core, Snapshot *ss);
+extern int avr_core_save_state (AvrCore *core, char *file);
+extern int avr_core_load_state (AvrCore *core, char *file);
+
+/* In-memory checkpoints */
+extern int avr_core_checkpoint (AvrCore *core);
+extern int avr_core_rollback (AvrCore *core);
+extern int avr_core_checkpoint_drop (AvrCore *core);
+extern int avr_core_checkpoint_drop_outer (AvrCore *core);
+
+/* Reverse execution */
+extern int avr_core_history_start (AvrCore *core, uint64_t interval);
+extern void avr_core_history_stop (AvrCore *core);
+extern int avr_core_history_step (AvrCore *core);
+extern void avr_core_history_reset (AvrCore *core);
+extern int avr_core_reverse_step (AvrCore *core);
+extern int avr_core_reverse_continue (AvrCore *core,
+                                      int (*interrupted) (void *data),
+                                      void *data);
+
+/* Watchpoints */
+extern int avr_core_watch_insert (AvrCore *core, int eeprom, int addr,
+                                  int len, int flag);
+extern int avr_core_watch_remove (AvrCore *core, int eeprom, int addr,
+                                  int len, int flag);
+extern int avr_core_watch_hit (AvrCore *core, int *eeprom, int *addr);
+extern void avr_core_watch_eeprom (AvrCore *core, int addr, int flag);
+
+/* Bulk access to the memory spaces */
+extern void avr_core_space_sizes (AvrCore *core, int *flash, int *data,
+                                  int *eeprom);
+extern int avr_core_mem_read_block (AvrCore *core, int addr, uint8_t *buf,
+                                    int len);
+extern int avr_core_mem_write_block (AvrCore *core, int addr,
+                                     const uint8_t *buf, int len);
+extern int avr_core_flash_read_block (AvrCore *core, int addr, uint8_t *buf,
+                                      int len);
+extern int avr_core_flash_write_block (AvrCore *core, int addr,
+                                       const uint8_t *buf, int len);
+extern int avr_core_eeprom_read_block (AvrCore *core, int addr, uint8_t *buf,
+                                       int len);
+extern int avr_core_eeprom_write_block (AvrCore *core, int addr,
+                                        const uint8_t *buf, int len);
 
 /* Methods for accessing CK and inst_CKS */
 
@@ -419,7 +649,7 @@ avr_core_CK_incr (AvrCore *core)
     core->CK++;
 
     /* Send clock cycles to display */
-    display_clock (core->CK);
+    display_clock (core->display, core->CK);
 }
 
 extern inline int
@@ -451,6 +681,12 @@ avr_core_clk_cb_exec (AvrCore *core)
 
 /* Methods for handling asynchronous callbacks */
 
+extern inline uint64_t
+avr_core_get_program_time (AvrCore *core)
+{
+    return ++core->program_time;
+}
+
 extern inline void
 avr_core_async_cb_add (AvrCore *core, CallBack *cb)
 {
@@ -461,7 +697,8 @@ extern inline void
 avr_core_async_cb_exec (AvrCore *core)
 {
     core->async_cb =
-        callback_list_execute_all (core->async_cb, get_program_time ());
+        callback_list_execute_all (core->async_cb,
+                                   avr_core_get_program_time (core));
 }
 
 /* For adding external read and write callback functions */
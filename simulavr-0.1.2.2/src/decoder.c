@@ -70,7 +70,11 @@
 
 #include "decoder.h"
 
-struct opcode_info *global_opcode_lookup_table;
+/* Zero (not yet decoded) until an opcode is first used, see
+   decode_fill_entry(). Being static data, an unused part of the table is
+   never even paged in. */
+
+struct opcode_info global_opcode_lookup_table[0x10000];
 
 /** \brief Masks to help extracting information from opcodes. */
 
@@ -818,6 +822,8 @@ avr_op_CALL (AvrCore *core, uint16_t opcode, unsigned int arg1,
     avr_core_PC_set (core, k);
     avr_core_inst_CKS_set (core, pc_bytes + 2);
 
+    avr_core_profile_call (core, k, pc + 2);
+
     return opcode_CALL;
 }
 
@@ -1116,6 +1122,8 @@ avr_op_EICALL (AvrCore *core, uint16_t opcode, unsigned int arg1,
     avr_core_PC_set (core, new_pc);
     avr_core_inst_CKS_set (core, 4);
 
+    avr_core_profile_call (core, new_pc, pc + 1);
+
     return opcode_EICALL;
 }
 
@@ -1466,6 +1474,8 @@ avr_op_ICALL (AvrCore *core, uint16_t opcode, unsigned int arg1,
     avr_core_PC_set (core, new_pc);
     avr_core_inst_CKS_set (core, pc_bytes + 1);
 
+    avr_core_profile_call (core, new_pc, pc + 1);
+
     return opcode_ICALL;
 }
 
@@ -2282,7 +2292,6 @@ static int
 avr_op_NOP (AvrCore *core, uint16_t opcode, unsigned int arg1,
             unsigned int arg2)
 {
-    static uint64_t oldCK;
     uint64_t CK;
     /*
      * No Operation.
@@ -2296,8 +2305,8 @@ avr_op_NOP (AvrCore *core, uint16_t opcode, unsigned int arg1,
     avr_core_PC_incr (core, 1);
     avr_core_inst_CKS_set (core, 1);
     CK = avr_core_CK_get (core);
-    fprintf(stderr, "NOP at address %x, clock cycles %"PRIu64", difference to previous CK: %"PRIu64"\n", avr_core_PC_get(core), CK, CK - oldCK);
-    oldCK = CK;
+    fprintf(stderr, "NOP at address %x, clock cycles %"PRIu64", difference to previous CK: %"PRIu64"\n", avr_core_PC_get(core), CK, CK - core->nop_CK);
+    core->nop_CK = CK;
     return opcode_NOP;
 }
 
@@ -2471,6 +2480,8 @@ avr_op_RCALL (AvrCore *core, uint16_t opcode, unsigned int arg1,
     avr_core_PC_incr (core, k + 1);
     avr_core_inst_CKS_set (core, pc_bytes + 1);
 
+    avr_core_profile_call (core, avr_core_PC_get (core), pc + 1);
+
     return opcode_RCALL;
 }
 
@@ -2488,10 +2499,13 @@ avr_op_RET (AvrCore *core, uint16_t opcode, unsigned int arg1,
      * Num Clocks : 4 / 5
      */
     int pc_bytes = avr_core_PC_size (core);
-    int pc = avr_core_stack_pop (core, pc_bytes);
+    int pc;
 
-    avr_core_PC_set (core, pc);
     avr_core_inst_CKS_set (core, pc_bytes + 2);
+    avr_core_profile_ret (core);
+
+    pc = avr_core_stack_pop (core, pc_bytes);
+    avr_core_PC_set (core, pc);
 
     return opcode_RET;
 }
@@ -2510,10 +2524,13 @@ avr_op_RETI (AvrCore *core, uint16_t opcode, unsigned int arg1,
      * Num Clocks : 4 / 5
      */
     int pc_bytes = avr_core_PC_size (core);
-    int pc = avr_core_stack_pop (core, pc_bytes);
+    int pc;
 
-    avr_core_PC_set (core, pc);
     avr_core_inst_CKS_set (core, pc_bytes + 2);
+    avr_core_profile_ret (core);
+
+    pc = avr_core_stack_pop (core, pc_bytes);
+    avr_core_PC_set (core, pc);
 
     avr_core_sreg_set_bit (core, SREG_I, 1);
 
@@ -3868,28 +3885,43 @@ lookup_opcode (uint16_t opcode, struct opcode_info *opi)
 }                               /* decode opcode function */
 
 /**
- * \brief Initialize the decoder lookup table.
+ * \brief Decode one opcode into its lookup table entry.
  *
- * This is automatically called by avr_core_construct().
+ * Called by decode_opcode() the first time an opcode is seen, so a new core
+ * costs nothing here and only the opcodes a program actually executes are
+ * decoded. Entries are only ever written with the same contents; the handler
+ * is stored last, so a reader on another thread that sees it also sees the
+ * operands.
+ */
+
+void
+decode_fill_entry (uint16_t opcode)
+{
+    struct opcode_info *entry = global_opcode_lookup_table + opcode;
+    struct opcode_info opi;
+
+    lookup_opcode (opcode, &opi);
+
+    entry->arg1 = opi.arg1;
+    entry->arg2 = opi.arg2;
+    __atomic_store_n (&entry->func, opi.func, __ATOMIC_RELEASE);
+}
+
+/**
+ * \brief Decode all the opcodes in advance.
  *
- * It is safe to call this function many times, since if will only create the
- * table the first time it is called.
+ * Not needed any more, the table is filled on demand; it is safe to call at
+ * any time (e.g. to take the decoding out of a timed run).
  */
 
 void
 decode_init_lookup_table (void)
 {
-    if (global_opcode_lookup_table == NULL)
-    {
-        int num_ops = 0x10000;
-        int i;
-        avr_message ("generating opcode lookup_table\n");
-        global_opcode_lookup_table = avr_new0 (struct opcode_info, num_ops);
-        for (i = 0; i < num_ops; i++)
-        {
-            lookup_opcode (i, global_opcode_lookup_table + i);
-        }
-    }
+    int i;
+
+    for (i = 0; i < 0x10000; i++)
+        if (global_opcode_lookup_table[i].func == NULL)
+            decode_fill_entry (i);
 }
 
 /**
@@ -42,9 +42,10 @@ struct opcode_info
     unsigned int arg2;
 };
 
-extern struct opcode_info *global_opcode_lookup_table;
+extern struct opcode_info global_opcode_lookup_table[];
 
 extern void decode_init_lookup_table (void);
+extern void decode_fill_entry (uint16_t opcode);
 extern int  avr_op_UNKNOWN (AvrCore *core, uint16_t opcode, unsigned int arg1,
                             unsigned int arg2);
 
@@ -55,6 +56,9 @@ decode_opcode (uint16_t opcode)
 
     opi = global_opcode_lookup_table + opcode;
 
+    if (__atomic_load_n (&opi->func, __ATOMIC_ACQUIRE) == NULL)
+        decode_fill_entry (opcode);
+
     if (opi->func == avr_op_UNKNOWN)
         avr_warning ("Unknown opcode: 0x%04x\n", opcode);
 
@@ -94,10 +94,14 @@ vdev_construct (VDevice *dev, VDevFP_Read rd, VDevFP_Write wr,
 
     class_construct ((AvrClass *)dev);
 
+    dev->core = NULL;
+    dev->display = NULL;
     dev->read = rd;
     dev->write = wr;
     dev->reset = reset;
     dev->add_addr = add_addr;
+    dev->save = NULL;
+    dev->load = NULL;
 }
 
 /** \brief Destructor for a VDevice. */
@@ -177,6 +181,46 @@ vdev_reset (VDevice *dev)
     dev->reset (dev);
 }
 
+/** \brief Install the snapshot methods of a device.
+
+    Devices without them can not be saved, see vdev_save(). */
+void
+vdev_set_state_fp (VDevice *dev, VDevFP_Save save, VDevFP_Load load)
+{
+    dev->save = save;
+    dev->load = load;
+}
+
+/** \brief Append the state of a device to a snapshot.
+
+    Returns -1 if the device does not support snapshots. */
+int
+vdev_save (VDevice *dev, Snapshot *ss)
+{
+    if (dev->save == NULL)
+        return -1;
+
+    dev->save (dev, ss);
+    return 0;
+}
+
+/** \brief Restore the state of a device saved by vdev_save().
+
+    The device has been reset before, so clock callbacks the device had
+    installed are gone and have to be installed again if the saved state
+    needs them. */
+void
+vdev_load (VDevice *dev, Snapshot *ss)
+{
+    if (dev->load == NULL)
+    {
+        ss->error = 1;
+        return;
+    }
+
+    dev->load (dev, ss);
+}
+
 /** \brief Set the core field. */
 void
 vdev_set_core (VDevice *dev, AvrClass *core)
@@ -187,6 +231,16 @@ vdev_set_core (VDevice *dev, AvrClass *core)
 /** \brief Get the core field. */
 extern inline AvrClass *vdev_get_core (VDevice *dev);
 
+/** \brief Set the display the device reports its changes to. */
+void
+vdev_set_display (VDevice *dev, Display *disp)
+{
+    dev->display = disp;
+}
+
+/** \brief Get the display field. */
+extern inline Display *vdev_get_display (VDevice *dev);
+
 /** \brief Inform the vdevice that it needs to handle another address.
 
     This is primarily used when creating the core in dev_supp_create_core(). */
@@ -29,6 +29,16 @@
  *
  * Simulavr has the ability to use a coprocess to display register and memory
  * values in near real time.
+ *
+ * The core reports every clock cycle, every change of the program counter
+ * and every register write. Sending each of them through the pipe would
+ * cost far more than simulating the instruction, so by default the updates
+ * are collected: the clock and program counter keep their last value, the
+ * registers, io registers and sram keep a shadow with a dirty flag per
+ * address. Everything else (flash, eeprom, io register names) is encoded
+ * into an output buffer. display_flush() sends it all with one write,
+ * DISP_RATE times per second or at the rate given to display_set_rate(),
+ * and whenever the core stops or waits for the host.
  */
 
 #include <config.h>
@@ -42,28 +52,128 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
 #include <signal.h>
 
 #include "avrerror.h"
 #include "avrmalloc.h"
+#include "avrclass.h"
 #include "display.h"
 
 enum
 {
     MAX_BUF = 1024,
+    DISP_RATE = 30,             /* default flushes per second */
+    DISP_CHECK_CYCLES = 4096,   /* clock cycles between looks at the time */
+    DISP_IO_REGS = 256,         /* io registers with a shadow */
+    DISP_SRAM_CHUNK = 256,      /* bytes per sram message */
+};
+
+enum
+{
+    DISP_DIRTY_CLOCK = 0x01,
+    DISP_DIRTY_PC = 0x02,
+    DISP_DIRTY_IO = 0x04,
+    DISP_DIRTY_SRAM = 0x08,
+};
+
+/* Each core has it's own display, so that several cores can live in one
+   process without stepping on each other. */
+
+struct _Display
+{
+    AvrClass parent;
+    int pipe_fd;                /* write side of the pipe, -1 if closed */
+    pid_t child_pid;            /* Need to store the child's pid so that we
+                                   can kill and waitpid it when you close the
+                                   display. Otherwise we have problems with
+                                   zombies. */
+    char buf[MAX_BUF + 1];      /* message formatting buffer */
+
+    int hz;                     /* flushes per second, or */
+    int cycles;                 /* clock cycles between flushes; both 0:
+                                   every update is sent at once */
+    int countdown;              /* clock updates until the next check */
+    uint64_t next_flush;        /* time of the next flush (usec) */
+
+    char *out;                  /* encoded messages not written yet */
+    int out_len;
+    int out_size;
+
+    int dirty;                  /* DISP_DIRTY_* */
+    int clock;
+    int pc;
+    uint32_t reg_dirty;         /* bit n: reg[n] changed */
+    uint8_t reg[32];
+    uint8_t io_dirty[DISP_IO_REGS];
+    uint8_t io_reg[DISP_IO_REGS];
+    int sram_size;              /* addresses with a shadow */
+    uint8_t *sram_dirty;
+    uint8_t *sram;
 };
 
-/* I really don't want to use a global here, but I also don't want to have to
-   track the pipe's fd in the core. */
+static void display_construct (Display *disp);
 
-static int global_pipe_fd = -1;
+/** \brief Allocate a new (closed) Display object. */
 
-/* Need to store the child's pid so that we can kill and waitpid it when you
-   close the display. Otherwise we have problems with zombies. */
+Display *
+display_new (void)
+{
+    Display *disp;
+
+    disp = avr_new (Display, 1);
+    display_construct (disp);
+    class_overload_destroy ((AvrClass *)disp, display_destroy);
 
-static pid_t global_child_pid = -1;
+    return disp;
+}
+
+static void
+display_construct (Display *disp)
+{
+    if (disp == NULL)
+        avr_error ("passed null ptr");
+
+    class_construct ((AvrClass *)disp);
+
+    disp->pipe_fd = -1;
+    disp->child_pid = -1;
+    disp->buf[0] = '\0';
+
+    disp->hz = DISP_RATE;
+    disp->cycles = 0;
+    disp->countdown = 1;
+    disp->next_flush = 0;
+
+    disp->out = NULL;
+    disp->out_len = disp->out_size = 0;
+
+    disp->dirty = 0;
+    disp->reg_dirty = 0;
+    memset (disp->io_dirty, 0, sizeof (disp->io_dirty));
+    disp->sram_size = 0;
+    disp->sram_dirty = NULL;
+    disp->sram = NULL;
+}
+
+/** \brief Destructor for the Display class. Closes the display if it is
+    still open. */
+
+void
+display_destroy (void *disp)
+{
+    if (disp == NULL)
+        return;
+
+    display_close ((Display *)disp);
+
+    avr_free (((Display *)disp)->out);
+
+    class_destroy (disp);
+}
 
 /** \brief Open a display as a coprocess.
+    \param disp        The display object to open.
     \param prog        The program to use as a display coprocess.
     \param no_xterm    If non-zero, don't run the disply in an xterm.
     \param flash_sz    The size of the flash memory space in bytes.
@@ -82,8 +192,8 @@ static pid_t global_child_pid = -1;
     Returns -1 if something failed. */
 
 int
-display_open (char *prog, int no_xterm, int flash_sz, int sram_sz,
-              int sram_start, int eeprom_sz)
+display_open (Display *disp, char *prog, int no_xterm, int flash_sz,
+              int sram_sz, int sram_start, int eeprom_sz)
 {
     pid_t pid;
     int pfd[2];                 /* pipe file desc: pfd[0] is read, pfd[1] is
@@ -122,10 +232,15 @@ display_open (char *prog, int no_xterm, int flash_sz, int sram_sz,
         close (pfd[0]);
 
         /* remember the child's pid */
-        global_child_pid = pid;
+        disp->child_pid = pid;
 
-        global_pipe_fd = pfd[1];
-        return global_pipe_fd;
+        /* shadow of the sram for collecting the updates */
+        disp->sram_size = sram_start + sram_sz;
+        disp->sram = avr_new0 (uint8_t, disp->sram_size);
+        disp->sram_dirty = avr_new0 (uint8_t, disp->sram_size);
+
+        disp->pipe_fd = pfd[1];
+        return disp->pipe_fd;
     }
     else                        /* child process */
     {
@@ -178,17 +293,55 @@ display_open (char *prog, int no_xterm, int flash_sz, int sram_sz,
 /** \brief Close a display and send coprocess a quit message. */
 
 void
-display_close (void)
+display_close (Display *disp)
+{
+    if ((disp == NULL) || (disp->pipe_fd < 0))
+        return;
+
+    display_send_msg (disp, "q");
+    close (disp->pipe_fd);
+    disp->pipe_fd = -1;
+
+    kill (disp->child_pid, SIGINT);
+    waitpid (disp->child_pid, NULL, 0);
+    disp->child_pid = -1;
+
+    avr_free (disp->sram);
+    avr_free (disp->sram_dirty);
+    disp->sram = disp->sram_dirty = NULL;
+    disp->sram_size = 0;
+    disp->dirty = 0;
+    disp->reg_dirty = 0;
+}
+
+/** \brief Set how often the collected updates are sent.
+    \param disp    The display.
+    \param hz      Send the updates hz times per second of host time.
+    \param cycles  If hz is 0, send them every cycles clock cycles.
+
+    With both 0 every update is sent at once, as a display that records
+    each change with its time (simulavr-disp-vcd) needs. */
+
+void
+display_set_rate (Display *disp, int hz, int cycles)
 {
-    if (global_pipe_fd < 0)
+    if (disp == NULL)
         return;
 
-    display_send_msg ("q");
-    close (global_pipe_fd);
-    global_pipe_fd = -1;
+    display_flush (disp);
 
-    kill (global_child_pid, SIGINT);
-    waitpid (0, NULL, 0);
+    disp->hz = (hz > 0) ? hz : 0;
+    disp->cycles = ((hz <= 0) && (cycles > 0)) ? cycles : 0;
+    disp->countdown = 1;
+    disp->next_flush = 0;
+}
+
+/* Send every update at once? */
+
+static int
+display_immediate (Display *disp)
+{
+    return (disp->hz == 0) && (disp->cycles == 0);
 }
 
 static unsigned char
@@ -204,12 +357,58 @@ checksum (char *s)
     return CC;
 }
 
+/* Append the encoded message to the output buffer. */
+
+static void
+display_queue (Display *disp, char *msg)
+{
+    int len = strlen (msg) + 4;
+
+    if (disp->out_len + len + 1 > disp->out_size)
+    {
+        disp->out_size = 2 * (disp->out_len + len + 1) + MAX_BUF;
+        disp->out = avr_renew (char, disp->out, disp->out_size);
+    }
+
+    snprintf (disp->out + disp->out_len, len + 1, "$%s#%02x", msg,
+              checksum (msg));
+#if defined(DISP_DEBUG_OUTPUT_ON)
+    fprintf (stderr, "DISP: %s\n", disp->out + disp->out_len);
+#endif
+    disp->out_len += len;
+}
+
+/* Write the output buffer to the pipe. */
+
+static void
+display_write (Display *disp)
+{
+    int pos = 0;
+    int res;
+
+    while (pos < disp->out_len)
+    {
+        res = write (disp->pipe_fd, disp->out + pos, disp->out_len - pos);
+        if (res < 0)
+        {
+            /* write() was interrupted, try again */
+            if (errno == EINTR)
+                continue;
+            avr_error ("write failed: %s\n", strerror (errno));
+        }
+        pos += res;
+    }
+
+    disp->out_len = 0;
+}
+
 /** \brief Encode the message and send to display.
+    \param disp  The display to send to.
     \param msg   The message string to be sent to the display process.
 
     Encoding is the same as that used by the gdb remote protocol: '\$...\#CC'
     where '...' is msg, CC is checksum. There is no newline termination for
-    encoded messages.
+    encoded messages. Updates collected before are sent first.
 
     FIXME: TRoth: This should be a private function. It is only public so that
     dtest.c can be kept simple. dtest.c should be changed to avoid direct use
@@ -217,113 +416,272 @@ checksum (char *s)
     soon.] */
 
 void
-display_send_msg (char *msg)
+display_send_msg (Display *disp, char *msg)
 {
-    int len = strlen (msg) + 4 + 1;
-    int res;
-    char *enc_msg;              /* the encoded msg */
+    display_flush (disp);
+    display_queue (disp, msg);
+    display_write (disp);
+}
 
-    enc_msg = avr_new0 (char, len + 1);
+/* Queue the sram bytes [start, end) of the shadow. */
 
-    snprintf (enc_msg, len, "$%s#%02x", msg, checksum (msg));
-#if defined(DISP_DEBUG_OUTPUT_ON)
-    fprintf (stderr, "DISP: %s\n", enc_msg);
-#endif
+static void
+display_queue_sram (Display *disp, int start, int end)
+{
+    int bytes, i;
 
-    res = write (global_pipe_fd, enc_msg, len);
-    if ((res < 0) && (errno == EINTR))
+    while (start < end)
     {
-        /* write() was interrupted, try again and if it still fails, let it be
-           fatal. */
-        avr_warning ("Interrupted write()\n");
-        res = write (global_pipe_fd, enc_msg, len);
+        int len = end - start;
+
+        if (len > DISP_SRAM_CHUNK)
+            len = DISP_SRAM_CHUNK;
+
+        bytes = snprintf (disp->buf, MAX_BUF, "s%x,%x:", start, len);
+        for (i = 0; i < len; i++)
+            bytes += snprintf (disp->buf + bytes, MAX_BUF - bytes, "%02x",
+                               disp->sram[start + i]);
+        display_queue (disp, disp->buf);
+
+        start += len;
     }
-    if (res < 0)
-        avr_error ("write failed: %s\n", strerror (errno));
-    if (res < len)
-        avr_error ("incomplete write\n");
+}
+
+/** \brief Send the updates collected so far. */
+
+void
+display_flush (Display *disp)
+{
+    int i, start;
 
-    avr_free (enc_msg);
+    if ((disp == NULL) || (disp->pipe_fd < 0))
+        return;
+
+    if (disp->dirty & DISP_DIRTY_CLOCK)
+    {
+        snprintf (disp->buf, MAX_BUF, "n%x", disp->clock);
+        display_queue (disp, disp->buf);
+    }
+
+    if (disp->dirty & DISP_DIRTY_PC)
+    {
+        snprintf (disp->buf, MAX_BUF, "p%x", disp->pc);
+        display_queue (disp, disp->buf);
+    }
+
+    for (i = 0; disp->reg_dirty; i++)
+    {
+        if (!(disp->reg_dirty & (1UL << i)))
+            continue;
+        disp->reg_dirty &= ~(1UL << i);
+
+        snprintf (disp->buf, MAX_BUF, "r%x:%02x", i, disp->reg[i]);
+        display_queue (disp, disp->buf);
+    }
+
+    if (disp->dirty & DISP_DIRTY_IO)
+    {
+        for (i = 0; i < DISP_IO_REGS; i++)
+        {
+            if (!disp->io_dirty[i])
+                continue;
+            disp->io_dirty[i] = 0;
+
+            snprintf (disp->buf, MAX_BUF, "i%x:%02x", i, disp->io_reg[i]);
+            display_queue (disp, disp->buf);
+        }
+    }
+
+    /* runs of changed bytes */
+    if (disp->dirty & DISP_DIRTY_SRAM)
+    {
+        for (i = 0; i < disp->sram_size; i++)
+        {
+            if (!disp->sram_dirty[i])
+                continue;
+
+            for (start = i; (i < disp->sram_size) && disp->sram_dirty[i];
+                 i++)
+                disp->sram_dirty[i] = 0;
+            display_queue_sram (disp, start, i);
+        }
+    }
+
+    disp->dirty = 0;
+
+    if (disp->out_len)
+        display_write (disp);
 }
 
-static char global_buf[MAX_BUF + 1];
+/* Time for the next flush? Called every DISP_CHECK_CYCLES clock updates,
+   or every disp->cycles ones. */
+
+static void
+display_tick (Display *disp)
+{
+    struct timeval tv;
+    uint64_t now;
+
+    if (disp->cycles)
+    {
+        disp->countdown = disp->cycles;
+        display_flush (disp);
+        return;
+    }
+
+    disp->countdown = DISP_CHECK_CYCLES;
+
+    gettimeofday (&tv, NULL);
+    now = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    if (now < disp->next_flush)
+        return;
+
+    disp->next_flush = now + 1000000 / disp->hz;
+    display_flush (disp);
+}
 
 /** \brief Update the time in the display.
+    \param disp  The display to update.
     \param clock   The new time in number of clocks. */
 
 void
-display_clock (int clock)
+display_clock (Display *disp, int clock)
 {
-    if (global_pipe_fd < 0)
+    if ((disp == NULL) || (disp->pipe_fd < 0))
+        return;
+
+    if (display_immediate (disp))
+    {
+        snprintf (disp->buf, MAX_BUF, "n%x", clock);
+        display_send_msg (disp, disp->buf);
         return;
+    }
 
-    snprintf (global_buf, MAX_BUF, "n%x", clock);
-    global_buf[MAX_BUF] = '\0';
-    display_send_msg (global_buf);
+    disp->clock = clock;
+    disp->dirty |= DISP_DIRTY_CLOCK;
+
+    if (--disp->countdown <= 0)
+        display_tick (disp);
 }
 
 /** \brief Update the Program Counter in the display.
+    \param disp  The display to update.
     \param val   The new value of the program counter. */
 
 void
-display_pc (int val)
+display_pc (Display *disp, int val)
 {
-    if (global_pipe_fd < 0)
+    if ((disp == NULL) || (disp->pipe_fd < 0))
         return;
 
-    snprintf (global_buf, MAX_BUF, "p%x", val);
-    global_buf[MAX_BUF] = '\0';
-    display_send_msg (global_buf);
+    if (display_immediate (disp))
+    {
+        snprintf (disp->buf, MAX_BUF, "p%x", val);
+        display_send_msg (disp, disp->buf);
+        return;
+    }
+
+    disp->pc = val;
+    disp->dirty |= DISP_DIRTY_PC;
 }
 
 /** \brief Update a register in the display.
+    \param disp  The display to update.
     \param reg   The register number.
     \param val   The new value of the register. */
 
 void
-display_reg (int reg, uint8_t val)
+display_reg (Display *disp, int reg, uint8_t val)
 {
-    if (global_pipe_fd < 0)
+    if ((disp == NULL) || (disp->pipe_fd < 0))
         return;
 
-    snprintf (global_buf, MAX_BUF, "r%x:%02x", reg, val);
-    global_buf[MAX_BUF] = '\0';
-    display_send_msg (global_buf);
+    if (display_immediate (disp) || (reg < 0) || (reg >= 32))
+    {
+        snprintf (disp->buf, MAX_BUF, "r%x:%02x", reg, val);
+        display_send_msg (disp, disp->buf);
+        return;
+    }
+
+    disp->reg[reg] = val;
+    disp->reg_dirty |= 1UL << reg;
 }
 
 /** \brief Update an IO register in the display.
+    \param disp  The display to update.
     \param reg   The IO register number.
     \param val   The new value of the register. */
 
 void
-display_io_reg (int reg, uint8_t val)
+display_io_reg (Display *disp, int reg, uint8_t val)
 {
-    if (global_pipe_fd < 0)
+    if ((disp == NULL) || (disp->pipe_fd < 0))
         return;
 
-    snprintf (global_buf, MAX_BUF, "i%x:%02x", reg, val);
-    global_buf[MAX_BUF] = '\0';
-    display_send_msg (global_buf);
+    if (display_immediate (disp) || (reg < 0) || (reg >= DISP_IO_REGS))
+    {
+        snprintf (disp->buf, MAX_BUF, "i%x:%02x", reg, val);
+        display_send_msg (disp, disp->buf);
+        return;
+    }
+
+    disp->io_reg[reg] = val;
+    disp->io_dirty[reg] = 1;
+    disp->dirty |= DISP_DIRTY_IO;
 }
 
 /** \brief Specify a name for an IO register.
+    \param disp   The display to update.
     \param reg    The IO register number.
     \param name   The symbolic name of the register.
 
     Names of IO registers may be different from device to device. */
 
 void
-display_io_reg_name (int reg, char *name)
+display_io_reg_name (Display *disp, int reg, char *name)
 {
-    if (global_pipe_fd < 0)
+    if ((disp == NULL) || (disp->pipe_fd < 0))
         return;
 
-    snprintf (global_buf, MAX_BUF, "I%x:%s", reg, name);
-    global_buf[MAX_BUF] = '\0';
-    display_send_msg (global_buf);
+    snprintf (disp->buf, MAX_BUF, "I%x:%s", reg, name);
+    disp->buf[MAX_BUF] = '\0';
+    display_queue (disp, disp->buf);
+    if (display_immediate (disp))
+        display_write (disp);
+}
+
+/* Queue a block update, width is 2 for flash words and 1 for bytes. */
+
+static void
+display_block (Display *disp, char type, int addr, int len, int width,
+               const void *vals)
+{
+    int bytes;
+    int i;
+
+    bytes = snprintf (disp->buf, MAX_BUF, "%c%x,%x:", type, addr, len);
+
+    for (i = 0; i < len; i++)
+    {
+        if (MAX_BUF - bytes < 0)
+            avr_error ("buffer overflow");
+
+        if (width == 2)
+            bytes += snprintf (disp->buf + bytes, MAX_BUF - bytes, "%04x",
+                               ((const uint16_t *)vals)[i]);
+        else
+            bytes += snprintf (disp->buf + bytes, MAX_BUF - bytes, "%02x",
+                               ((const uint8_t *)vals)[i]);
+    }
+
+    disp->buf[MAX_BUF] = '\0';
+    display_queue (disp, disp->buf);
+    if (display_immediate (disp))
+        display_write (disp);
 }
 
 /** \brief Update a block of flash addresses in the display.
+    \param disp  The display to update.
     \param addr  Address of beginning of the block.
     \param len   Length of the block (number of words).
     \param vals  Pointer to an array of \a len words.
@@ -337,30 +695,16 @@ display_io_reg_name (int reg, char *name)
     indexed by the address. */
 
 void
-display_flash (int addr, int len, uint16_t * vals)
+display_flash (Display *disp, int addr, int len, uint16_t * vals)
 {
-    int bytes;
-    int i;
-
-    if (global_pipe_fd < 0)
+    if ((disp == NULL) || (disp->pipe_fd < 0))
         return;
 
-    bytes = snprintf (global_buf, MAX_BUF, "f%x,%x:", addr, len);
-
-    for (i = 0; i < len; i++)
-    {
-        if (MAX_BUF - bytes < 0)
-            avr_error ("buffer overflow");
-
-        bytes +=
-            snprintf (global_buf + bytes, MAX_BUF - bytes, "%04x", vals[i]);
-    }
-
-    global_buf[MAX_BUF] = '\0';
-    display_send_msg (global_buf);
+    display_block (disp, 'f', addr, len, 2, vals);
 }
 
 /** \brief Update a block of sram addresses in the display.
+    \param disp  The display to update.
     \param addr  Address of beginning of the block.
     \param len   Length of the block (number of bytes).
     \param vals  Pointer to an array of \a len bytes.
@@ -369,30 +713,25 @@ display_flash (int addr, int len, uint16_t * vals)
     in the \a vals array. */
 
 void
-display_sram (int addr, int len, uint8_t * vals)
+display_sram (Display *disp, int addr, int len, uint8_t * vals)
 {
-    int bytes;
-    int i;
-
-    if (global_pipe_fd < 0)
+    if ((disp == NULL) || (disp->pipe_fd < 0))
         return;
 
-    bytes = snprintf (global_buf, MAX_BUF, "s%x,%x:", addr, len);
-
-    for (i = 0; i < len; i++)
+    if (display_immediate (disp) || (addr < 0)
+        || (addr + len > disp->sram_size))
     {
-        if (MAX_BUF - bytes < 0)
-            avr_error ("buffer overflow");
-
-        bytes +=
-            snprintf (global_buf + bytes, MAX_BUF - bytes, "%02x", vals[i]);
+        display_block (disp, 's', addr, len, 1, vals);
+        return;
     }
 
-    global_buf[MAX_BUF] = '\0';
-    display_send_msg (global_buf);
+    memcpy (disp->sram + addr, vals, len);
+    memset (disp->sram_dirty + addr, 1, len);
+    disp->dirty |= DISP_DIRTY_SRAM;
 }
 
 /** \brief Update a block of eeprom addresses in the display.
+    \param disp  The display to update.
     \param addr  Address of beginning of the block.
     \param len   Length of the block (number of bytes).
     \param vals  Pointer to an array of \a len bytes.
@@ -401,25 +740,10 @@ display_sram (int addr, int len, uint8_t * vals)
     in the \a vals array. */
 
 void
-display_eeprom (int addr, int len, uint8_t * vals)
+display_eeprom (Display *disp, int addr, int len, uint8_t * vals)
 {
-    int bytes;
-    int i;
-
-    if (global_pipe_fd < 0)
+    if ((disp == NULL) || (disp->pipe_fd < 0))
         return;
 
-    bytes = snprintf (global_buf, MAX_BUF, "e%x,%x:", addr, len);
-
-    for (i = 0; i < len; i++)
-    {
-        if (MAX_BUF - bytes < 0)
-            avr_error ("buffer overflow");
-
-        bytes +=
-            snprintf (global_buf + bytes, MAX_BUF - bytes, "%02x", vals[i]);
-    }
-
-    global_buf[MAX_BUF] = '\0';
-    display_send_msg (global_buf);
+    display_block (disp, 'e', addr, len, 1, vals);
 }
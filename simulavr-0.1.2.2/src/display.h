@@ -26,22 +26,37 @@
 #ifndef SIM_DISPLAY_H
 #define SIM_DISPLAY_H
 
-extern int display_open (char *prog, int no_xterm, int flash_sz, int sram_sz,
-                         int sram_start, int eeprom_sz);
-extern void display_close (void);
+typedef struct _Display Display;
 
-/* These functions will tell the display to update the given value */
+extern Display *display_new (void);
+extern void display_destroy (void *disp);
 
-extern void display_clock (int clock);
-extern void display_pc (int val);
-extern void display_reg (int reg, uint8_t val);
-extern void display_io_reg (int reg, uint8_t val);
-extern void display_io_reg_name (int reg, char *name);
-extern void display_flash (int addr, int len, uint16_t * vals);
-extern void display_sram (int addr, int len, uint8_t * vals);
-extern void display_eeprom (int addr, int len, uint8_t * vals);
+extern int display_open (Display *disp, char *prog, int no_xterm,
+                         int flash_sz, int sram_sz, int sram_start,
+                         int eeprom_sz);
+extern void display_close (Display *disp);
+
+/* The updates are collected and sent hz times per second, or every cycles
+   clock cycles. With both 0 each update is sent at once. */
+
+extern void display_set_rate (Display *disp, int hz, int cycles);
+extern void display_flush (Display *disp);
+
+/* These functions will tell the display to update the given value. A NULL
+   disp is allowed and does nothing. */
+
+extern void display_clock (Display *disp, int clock);
+extern void display_pc (Display *disp, int val);
+extern void display_reg (Display *disp, int reg, uint8_t val);
+extern void display_io_reg (Display *disp, int reg, uint8_t val);
+extern void display_io_reg_name (Display *disp, int reg, char *name);
+extern void display_flash (Display *disp, int addr, int len,
+                           uint16_t * vals);
+extern void display_sram (Display *disp, int addr, int len, uint8_t * vals);
+extern void display_eeprom (Display *disp, int addr, int len,
+                            uint8_t * vals);
 
 /* FIXME: this isn't going to be public for much longer */
-extern void display_send_msg (char *msg);
+extern void display_send_msg (Display *disp, char *msg);
 
 #endif /* SIM_DISPLAY_H */
@@ -252,9 +252,9 @@ eeprom_wr_eecr (EEProm *ee, uint8_t val)
 
 /*
  * The data sheets say that a write operation takes 2.5 to 4.0 ms to complete
- * depending on Vcc voltage. Since the get_program_time() function only has
- * 10 ms resolution, we'll just simulate a timer with counting down from
- * EEPROM_WR_OP_CLKS to zero. 2500 clocks would be 2.5 ms if simulator is
+ * depending on Vcc voltage. Since the avr_core_get_program_time()
+ * function only has 10 ms resolution, we'll just simulate a timer with
+ * counting down from EEPROM_WR_OP_CLKS to zero. 2500 clocks would be 2.5 ms if simulator is
  * running at 1 MHz. I really don't think that this variation should be 
  * critical in most apps, but I'd wouldn't mind being proven wrong.
  */
@@ -281,7 +281,7 @@ eeprom_wr_op_cb (uint64_t time, AvrClass *data)
     /* write the data in eedr into eeprom at addr */
     addr = (ee->eearh << 8) | ee->eearl;
     avr_warning ("writing 0x%02x to eeprom at 0x%04x\n", ee->eedr, addr);
-    display_eeprom (addr, 1, &ee->eedr);
+    display_eeprom (vdev_get_display ((VDevice *)ee), addr, 1, &ee->eedr);
     storage_writeb (ee->stor, addr, ee->eedr);
 
     /* Now it's ok to start another write operation */
@@ -51,17 +51,10 @@
 
 #include "storage.h"
 #include "flash.h"
+#include "image.h"
 
 #include "display.h"
 
-/***************************************************************************\
- *
- * Local Static Function Prototypes
- *
-\***************************************************************************/
-
-static int flash_load_from_bin_file (Flash *flash, char *file);
-
 /***************************************************************************\
  *
  * Flash(Storage) Methods
@@ -85,7 +78,7 @@ extern inline uint16_t flash_read (Flash *flash, int addr);
 void
 flash_write (Flash *flash, int addr, uint16_t val)
 {
-    display_flash (addr, 1, &val);
+    display_flash (flash->display, addr, 1, &val);
     storage_writew ((Storage *)flash, addr * 2, val);
 }
 
@@ -111,6 +104,68 @@ flash_write_hi8 (Flash *flash, int addr, uint8_t val)
     storage_writeb ((Storage *)flash, addr * 2, val);
 }
 
+/**
+ * \brief Read len bytes of the program at byte address addr.
+ *
+ * The bytes are in program order (the low byte of a word first), like a
+ * binary image. The flash storage holds the high byte first, so the words
+ * covering the block are copied in one go and swapped.
+ */
+
+void
+flash_read_block (Flash *flash, int addr, uint8_t *buf, int len)
+{
+    int start = addr & ~1;
+    int size = ((addr + len + 1) & ~1) - start;
+    uint8_t *tmp;
+    int i;
+
+    if (len <= 0)
+        return;
+
+    tmp = avr_new (uint8_t, size);
+    storage_read_block ((Storage *)flash, start, tmp, size);
+    for (i = 0; i < len; i++)
+        buf[i] = tmp[((addr + i) ^ 1) - start];
+    avr_free (tmp);
+}
+
+/**
+ * \brief Write len bytes of the program at byte address addr.
+ *
+ * The counterpart of flash_read_block(). The bytes of a word outside the
+ * block keep their value. The words are reported to the display.
+ */
+
+void
+flash_write_block (Flash *flash, int addr, const uint8_t *buf, int len)
+{
+    int start = addr & ~1;
+    int size = ((addr + len + 1) & ~1) - start;
+    uint8_t *tmp;
+    uint16_t *vals;
+    int i;
+
+    if (len <= 0)
+        return;
+
+    tmp = avr_new (uint8_t, size);
+    storage_read_block ((Storage *)flash, start, tmp, size);
+    for (i = 0; i < len; i++)
+        tmp[((addr + i) ^ 1) - start] = buf[i];
+    storage_write_block ((Storage *)flash, start, tmp, size);
+
+    /* a display message holds up to 1K of text */
+    vals = avr_new (uint16_t, size / 2);
+    for (i = 0; i < size / 2; i++)
+        vals[i] = (tmp[i * 2] << 8) | tmp[i * 2 + 1];
+    for (i = 0; i < size / 2; i += 128)
+        display_flash (flash->display, start / 2 + i,
+                       size / 2 - i < 128 ? size / 2 - i : 128, vals + i);
+    avr_free (vals);
+    avr_free (tmp);
+}
+
 /** \brief Allocate a new Flash object. */
 
 Flash *
@@ -131,16 +186,25 @@ void
 flash_construct (Flash *flash, int size)
 {
     int base = 0;
-    int i;
 
     if (flash == NULL)
         avr_error ("passed null ptr");
 
     storage_construct ((Storage *)flash, base, size);
 
+    flash->display = NULL;
+    flash->modified = 0;
+
     /* Init the flash to ones. */
-    for (i = 0; i < size; i++)
-        storage_writeb ((Storage *)flash, i, 0xff);
+    storage_fill ((Storage *)flash, 0xff);
+}
+
+/** \brief Set the display which is told about writes to the flash. */
+
+void
+flash_set_display (Flash *flash, Display *disp)
+{
+    flash->display = disp;
 }
 
 /**
@@ -158,48 +222,70 @@ flash_destroy (void *flash)
     storage_destroy (flash);
 }
 
-/** \brief Load program data into flash from a file. */
+/** \brief Load program data into flash from a file.
+
+    See image_read() for the formats. */
 
 int
 flash_load_from_file (Flash *flash, char *file, int format)
 {
-    switch (format)
-    {
-        case FFMT_BIN:
-            return flash_load_from_bin_file (flash, file);
-        case FFMT_IHEX:
-        case FFMT_ELF:
-        default:
-            avr_warning ("Unsupported file format\n");
-    }
+    Image *img;
+    int res;
+
+    img = image_read (file, format);
+    if (img == NULL)
+        return -1;
 
-    return -1;
+    res = flash_load_from_bin_image (flash, img->flash, img->flash_len);
+    class_unref ((AvrClass *)img);
+
+    return res;
 }
 
-static int
-flash_load_from_bin_file (Flash *flash, char *file)
+/**
+ * \brief Load program data into flash from a binary image in memory.
+ *
+ * The image holds little-endian instruction words. A trailing odd byte is
+ * completed with 0xff (erased flash). The image is copied into the flash in
+ * one go and reported to the display in blocks. Returns -1 if it does not
+ * fit.
+ */
+
+int
+flash_load_from_bin_image (Flash *flash, uint8_t *image, int len)
 {
-    int fd, res;
-    int addr = 0;
-    uint16_t inst;
+    int words = (len + 1) / 2;
+    uint16_t *vals;
+    uint8_t *buf;
+    int i;
 
-    fd = open (file, O_RDONLY);
-    if (fd < 0)
-        avr_error ("Couldn't open binary flash image file: %s: %s", file,
-                   strerror (errno));
+    if (words * 2 > flash_get_size (flash))
+    {
+        avr_warning ("flash image too large: %d bytes\n", len);
+        return -1;
+    }
 
-    while ((res = read (fd, &inst, sizeof (inst))) != 0)
+    /* the flash storage holds the high byte of a word first */
+    buf = avr_new (uint8_t, words * 2);
+    vals = avr_new (uint16_t, words);
+    for (i = 0; i < words; i++)
     {
-        if (res == -1)
-            avr_error ("Error reading binary flash image file: %s: %s", file,
-                       strerror (errno));
+        vals[i] = image[i * 2];
+        vals[i] |= (i * 2 + 1 < len) ? image[i * 2 + 1] << 8 : 0xff00;
+        buf[i * 2] = vals[i] >> 8;
+        buf[i * 2 + 1] = vals[i] & 0xff;
+    }
 
-        flash_write (flash, addr, inst);
+    storage_write_block ((Storage *)flash, 0, buf, words * 2);
 
-        addr++;
-    }
+    /* a display message holds up to 1K of text */
+    for (i = 0; i < words; i += 128)
+        display_flash (flash->display, i, words - i < 128 ? words - i : 128,
+                       vals + i);
+    avr_free (buf);
+    avr_free (vals);
 
-    close (fd);
+    flash->modified = 0;
 
     return 0;
 }
@@ -26,6 +26,8 @@
 #ifndef SIM_FLASH_H
 #define SIM_FLASH_H
 
+#include "display.h"
+
 /***************************************************************************\
  *
  * Flash(Storage) Object
@@ -37,12 +39,18 @@ typedef struct _Flash Flash;
 struct _Flash
 {
     Storage parent;
+    Display *display;           /* display to report writes to (may be
+                                   NULL) */
+    int modified;               /* written by SPM since the program was
+                                   loaded */
 };
 
 extern Flash *flash_new (int size);
 extern void flash_construct (Flash *flash, int size);
 extern void flash_destroy (void *flash);
 
+extern void flash_set_display (Flash *flash, Display *disp);
+
 extern int flash_get_size (Flash *flash);
 extern void flash_dump_core (Flash *flash, FILE * f_core);
 
@@ -56,6 +64,12 @@ extern void flash_write (Flash *flash, int addr, uint16_t val);
 extern void flash_write_lo8 (Flash *flash, int addr, uint8_t val);
 extern void flash_write_hi8 (Flash *flash, int addr, uint8_t val);
 
+extern void flash_read_block (Flash *flash, int addr, uint8_t *buf, int len);
+extern void flash_write_block (Flash *flash, int addr, const uint8_t *buf,
+                               int len);
+
 extern int flash_load_from_file (Flash *flash, char *file, int format);
+extern int flash_load_from_bin_image (Flash *flash, uint8_t *image,
+                                      int len);
 
 #endif /* SIM_FLASH_H */
@@ -0,0 +1,328 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file forksrv.c
+ * \brief Boot the firmware once, fork a process per session.
+ *
+ * The firmware is booted to a ready point: by default the first time it
+ * waits for a line from the host, or when the program counter reaches a
+ * given address. The booted core is then frozen and the server accepts
+ * connections on a unix socket. Every connection is a session: the server
+ * forks, and the child continues the booted core with the connection as its
+ * host channel (the same line protocol as on stdin/stdout). The child gets
+ * the booted sram, eeprom and flash through copy-on-write, so a session
+ * starts in a few microseconds no matter how long the boot took.
+ *
+ * A session ends when the client closes the connection or the core stops
+ * (break point, sleep). Children are not waited for, SIGCHLD is ignored.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+#include "utils.h"
+#include "callback.h"
+#include "op_names.h"
+
+#include "storage.h"
+#include "flash.h"
+
+#include "vdevs.h"
+#include "memory.h"
+#include "stack.h"
+#include "register.h"
+#include "sram.h"
+#include "eeprom.h"
+#include "timers.h"
+#include "ports.h"
+
+#include "avrcore.h"
+
+#include "sig.h"
+#include "forksrv.h"
+
+/*
+ * Run the core to the ready point. Returns 0 once it is reached, -1 if the
+ * core stopped or SIGINT arrived before.
+ */
+
+static int
+fork_server_boot (AvrCore *core, int ready_addr)
+{
+    HostIO *host = avr_core_get_host (core);
+    SigWatch sigint;
+    int res = -1;
+
+    signal_watch_start (&sigint, SIGINT);
+
+    while (avr_core_get_state (core) == STATE_RUNNING)
+    {
+        if (signal_has_occurred (&sigint))
+            break;
+
+        if (ready_addr < 0)
+        {
+            if (hostio_waiting (host))
+            {
+                res = 0;
+                break;
+            }
+        }
+        else
+        {
+            if (avr_core_PC_get (core) == ready_addr / 2)
+            {
+                res = 0;
+                break;
+            }
+
+            /* Nobody will ever send that line. */
+            if (hostio_waiting (host))
+            {
+                avr_warning ("device waits for host input at PC 0x%x\n",
+                             avr_core_PC_get (core) * 2);
+                break;
+            }
+        }
+
+        if (avr_core_step (core) == BREAK_POINT)
+            break;
+    }
+
+    signal_watch_stop (&sigint);
+
+    return res;
+}
+
+/* Child side: run the booted core with the connection as host channel. */
+
+static void
+fork_server_session (AvrCore *core, int fd)
+{
+    HostIO *host = avr_core_get_host (core);
+    struct pollfd pfd;
+    uint64_t start = avr_core_CK_get (core);
+
+    hostio_attach_fd (host, fd);
+
+    for (;;)
+    {
+        if (hostio_waiting (host))
+        {
+            if (hostio_has_line (host))
+            {
+                hostio_resume (host);
+                continue;
+            }
+
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            if (poll (&pfd, 1, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                avr_error ("poll failed: %s", strerror (errno));
+            }
+
+            if (hostio_fill (host) == 0)
+                break;          /* client is gone */
+            continue;
+        }
+
+        if (avr_core_get_state (core) != STATE_RUNNING)
+            break;
+
+        if (avr_core_step (core) == BREAK_POINT)
+        {
+            avr_warning ("session stopped at PC 0x%x\n",
+                         avr_core_PC_get (core) * 2);
+            break;
+        }
+    }
+
+    avr_message ("session %d done, %" PRIu64 " clock cycles\n",
+                 (int)getpid (), avr_core_CK_get (core) - start);
+}
+
+static int
+fork_server_listen (char *path)
+{
+    struct sockaddr_un address[1];
+    int sock;
+
+    if (strlen (path) >= sizeof (address->sun_path))
+        avr_error ("Socket path too long: %s", path);
+
+    if ((sock = socket (PF_UNIX, SOCK_STREAM, 0)) < 0)
+        avr_error ("Can't create socket: %s", strerror (errno));
+
+    memset (address, 0, sizeof (address));
+    address->sun_family = AF_UNIX;
+    strcpy (address->sun_path, path);
+
+    /* A stale socket from a previous server. */
+    unlink (path);
+
+    if (bind (sock, (struct sockaddr *)address, sizeof (address)))
+        avr_error ("Can not bind socket %s: %s", path, strerror (errno));
+
+    if (listen (sock, 64))
+        avr_error ("Can not listen on socket %s: %s", path,
+                   strerror (errno));
+
+    return sock;
+}
+
+/**
+ * \brief Boot the firmware and serve sessions until SIGINT.
+ */
+void
+fork_server_run (ForkServerConfig *cfg)
+{
+    AvrCore *core;
+    struct pollfd pfd;
+    SigWatch sigint;
+    pid_t pid;
+    int sock, fd, res;
+
+    if (cfg->flash_file == NULL)
+        avr_error ("A flash image is needed in fork server mode");
+
+    core = avr_core_new (cfg->device);
+    if (core == NULL)
+        avr_error ("Device not supported: %s", cfg->device);
+
+    if (cfg->rng_seeded)
+        avr_core_rng_seed (core, cfg->rng_seed);
+    avr_core_set_debug_inst_output (core, cfg->debug_inst_output);
+
+    if (avr_core_load_program (core, cfg->flash_file, cfg->flash_format) < 0)
+        avr_error ("Could not load flash image %s", cfg->flash_file);
+    if (cfg->eeprom_file
+        && (avr_core_load_eeprom (core, cfg->eeprom_file, cfg->eeprom_format)
+            < 0))
+        avr_error ("Could not load eeprom image %s", cfg->eeprom_file);
+
+    /* No host while booting: output is dropped and the first read parks
+       the device instead of blocking. */
+    hostio_attach_fd (avr_core_get_host (core), -1);
+
+    if (cfg->state_file)
+    {
+        if (avr_core_load_state (core, cfg->state_file) < 0)
+            avr_error ("Could not restore state from %s", cfg->state_file);
+    }
+    else
+    {
+        avr_core_reset (core);
+        avr_core_set_state (core, STATE_RUNNING);
+    }
+
+    if (fork_server_boot (core, cfg->ready_addr) < 0)
+        avr_error ("Device did not reach the ready point (PC 0x%x)",
+                   avr_core_PC_get (core) * 2);
+
+    avr_message ("Ready at PC 0x%x after %" PRIu64 " clock cycles\n",
+                 avr_core_PC_get (core) * 2, avr_core_CK_get (core));
+
+    sock = fork_server_listen (cfg->socket_path);
+    avr_message ("Fork server listening on %s\n", cfg->socket_path);
+
+    signal (SIGCHLD, SIG_IGN);
+    signal_watch_start (&sigint, SIGINT);
+
+    for (;;)
+    {
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        res = poll (&pfd, 1, -1);
+
+        if (signal_has_occurred (&sigint))
+            break;
+
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            avr_error ("poll failed: %s", strerror (errno));
+        }
+
+        fd = accept (sock, NULL, NULL);
+        if (fd < 0)
+        {
+            avr_warning ("accept failed: %s\n", strerror (errno));
+            continue;
+        }
+
+        /* Do not let the child flush our buffered output again. */
+        fflush (NULL);
+
+        pid = fork ();
+        if (pid < 0)
+        {
+            avr_warning ("fork failed: %s\n", strerror (errno));
+            close (fd);
+            continue;
+        }
+
+        if (pid == 0)
+        {
+            signal_watch_stop (&sigint);
+            signal (SIGINT, SIG_DFL);
+            signal (SIGCHLD, SIG_DFL);
+            close (sock);
+
+            avr_core_rng_discard (core);
+            fork_server_session (core, fd);
+
+            close (fd);
+            exit (0);
+        }
+
+        close (fd);
+    }
+
+    signal_watch_stop (&sigint);
+
+    avr_message ("Shutting down fork server\n");
+
+    close (sock);
+    unlink (cfg->socket_path);
+    class_unref ((AvrClass *)core);
+}
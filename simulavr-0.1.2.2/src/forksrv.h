@@ -0,0 +1,48 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+#ifndef SIM_FORKSRV_H
+#define SIM_FORKSRV_H
+
+typedef struct
+{
+    char *device;               /* device type, e.g. OsEID128 */
+    char *flash_file;           /* flash image */
+    int flash_format;           /* FFMT_BIN, FFMT_IHEX or FFMT_ELF */
+    char *eeprom_file;          /* eeprom image or NULL */
+    int eeprom_format;
+    char *state_file;           /* boot from a saved state or NULL */
+    char *socket_path;          /* unix socket for the sessions */
+    int ready_addr;             /* byte address of the ready point, -1:
+                                   the first wait for host input */
+    int rng_seeded;             /* non-zero: every session starts with the
+                                   same random number stream */
+    uint64_t rng_seed;
+    int debug_inst_output;      /* print executed instructions */
+} ForkServerConfig;
+
+extern void fork_server_run (ForkServerConfig *cfg);
+
+#endif /* SIM_FORKSRV_H */
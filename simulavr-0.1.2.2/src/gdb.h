@@ -30,6 +30,10 @@
 #  define BREAK_POINT    -1
 #endif
 
+#ifndef WATCH_POINT
+#  define WATCH_POINT    -2
+#endif
+
 /* Prototypes for pointers to function. */
 
 typedef uint8_t (*CommFuncReadReg) (void *user_data, int reg_num);
@@ -45,6 +49,9 @@ typedef int32_t (*CommFuncMaxPC) (void *user_data);
 typedef uint8_t (*CommFuncReadSRAM) (void *user_data, int addr);
 typedef void (*CommFuncWriteSRAM) (void *user_data, int addr, uint8_t val);
 
+typedef uint8_t (*CommFuncReadEEPROM) (void *user_data, int addr);
+typedef void (*CommFuncWriteEEPROM) (void *user_data, int addr, uint8_t val);
+
 typedef uint16_t (*CommFuncReadFlash) (void *user_data, int addr);
 typedef void (*CommFuncWriteFlash) (void *user_data, int addr, uint16_t val);
 typedef void (*CommFuncWriteFlashLo8) (void *user_data, int addr,
@@ -66,6 +73,59 @@ typedef void (*CommFuncIORegFetch) (void *user_data, int addr, uint8_t * val,
 
 typedef void (*CommFuncIrqRaise) (void *user_data, int irq);
 
+typedef char *(*CommFuncMonitor) (void *user_data, char *cmd);
+
+typedef int (*CommFuncReverse) (void *user_data);
+
+/* A reverse continue calls interrupted(data) now and then and gives up
+   (returns -2) once it is true. */
+
+typedef int (*CommFuncInterrupted) (void *data);
+typedef int (*CommFuncReverseCont) (void *user_data,
+                                    CommFuncInterrupted interrupted,
+                                    void *data);
+
+/* Watchpoints: flag is 1 for write, 2 for read and 4 for any access (the
+   MEM_WATCH_* flags of memory.h), addr is in the data space or, with
+   eeprom set, in the eeprom. Insert and remove return -1 for an invalid
+   address. watch_hit returns the flag of the watchpoint hit by the last
+   instruction and its address, or 0. */
+
+typedef int (*CommFuncWatch) (void *user_data, int eeprom, int addr,
+                              int len, int flag);
+typedef int (*CommFuncWatchHit) (void *user_data, int *eeprom, int *addr);
+
+/* Bulk memory access: len bytes at addr of one memory space, flash
+   addresses are in bytes and flash data in program order (low byte of a
+   word first). Return 0, or -1 if the block is outside the space. The
+   sizes of the spaces (in bytes, data covers the whole data space) are
+   reported to gdb in its memory map. */
+
+typedef int (*CommFuncReadBlock) (void *user_data, int addr, uint8_t *buf,
+                                  int len);
+typedef int (*CommFuncWriteBlock) (void *user_data, int addr,
+                                   const uint8_t *buf, int len);
+typedef void (*CommFuncSizes) (void *user_data, int *flash, int *data,
+                               int *eeprom);
+
+/* Bring what is shown of the target outside of gdb (the display) up to
+   date. Called while gdb has the target stopped. */
+
+typedef void (*CommFuncFlush) (void *user_data);
+
+/* Several cores behind one connection (the cards of server.c), core n is
+   shown to gdb as process n + 1 with a single thread. hold_core takes core
+   n away from whoever runs it and returns the user_data of the functions
+   above for it, release_core lets it run on its own again. trapped_core
+   returns a core that reached a break point while it ran on its own, or
+   -1. core_info describes core n in buf for "info threads". */
+
+typedef int (*CommFuncNumCores) (void *server);
+typedef void *(*CommFuncHoldCore) (void *server, int n);
+typedef void (*CommFuncReleaseCore) (void *server, int n);
+typedef int (*CommFuncTrappedCore) (void *server);
+typedef void (*CommFuncCoreInfo) (void *server, int n, char *buf, int size);
+
 /* This structure allows the target to supply handler functions to the gdb
    interact for performing various tasks. */
 
@@ -90,6 +150,9 @@ struct GdbComm {
     CommFuncReadSRAM       read_sram;
     CommFuncWriteSRAM      write_sram;
 
+    CommFuncReadEEPROM     read_eeprom;
+    CommFuncWriteEEPROM    write_eeprom;
+
     CommFuncReadFlash      read_flash;
     CommFuncWriteFlash     write_flash;
     CommFuncWriteFlashLo8  write_flash_lo8;
@@ -106,6 +169,37 @@ struct GdbComm {
     CommFuncIORegFetch     io_fetch;
 
     CommFuncIrqRaise       irq_raise;
+
+    CommFuncMonitor        monitor;     /* returns the output of a monitor
+                                           command, freed with avr_free() */
+
+    CommFuncReverse        reverse_step;     /* step back, or -1 at the
+                                                start of the history */
+    CommFuncReverseCont    reverse_continue; /* run back to a break point,
+                                                1 at a watchpoint, -1 at
+                                                the start, or -2 if
+                                                interrupted */
+
+    CommFuncWatch          insert_watch;
+    CommFuncWatch          remove_watch;
+    CommFuncWatchHit       watch_hit;
+
+    CommFuncReadBlock      read_sram_block;   /* optional, the byte */
+    CommFuncWriteBlock     write_sram_block;  /* functions are used */
+    CommFuncReadBlock      read_flash_block;  /* without them */
+    CommFuncWriteBlock     write_flash_block;
+    CommFuncReadBlock      read_eeprom_block;
+    CommFuncWriteBlock     write_eeprom_block;
+    CommFuncSizes          space_sizes;       /* no memory map without it */
+    CommFuncFlush          flush;             /* optional */
+
+    void *server;               /* passed to the functions below, user_data
+                                   is set to the selected core */
+    CommFuncNumCores       num_cores;         /* NULL: user_data is the */
+    CommFuncHoldCore       hold_core;         /* only core */
+    CommFuncReleaseCore    release_core;
+    CommFuncTrappedCore    trapped_core;
+    CommFuncCoreInfo       core_info;
 };
 /* *INDENT-ON* */
 
@@ -54,10 +54,13 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 
 #include "avrerror.h"
@@ -65,18 +68,20 @@
 #include "gdb.h"
 #include "sig.h"
 
-// dirty access to EERPOM
-uint8_t gdb_ee_read(int adr);
-void    gdb_ee_write(int adr,uint8_t data);
-
 #define USE_EEPROM_SPACE
 /* *INDENT-OFF* */
 #ifndef DOXYGEN                 /* have doxygen system ignore this. */
 enum
 {
-    MAX_BUF        = 400,       /* Maximum size of read/write buffers. */
+    MAX_BUF        = 16384,     /* Maximum size of read/write buffers, the
+                                   largest packet size gdb takes. */
     MAX_READ_RETRY = 10,        /* Maximum number of retries if a read is
                                    incomplete. */
+    GDB_POLL_STEPS = 4096,      /* Instructions run by gdb_continue()
+                                   between checks for input from gdb. */
+    GDB_AX_STACK   = 64,        /* Stack size of an agent expression. */
+    GDB_FLASH_BLOCK = 256,      /* Erase block of the flash in the memory
+                                   map, a page of the larger devices. */
 
 #if defined(USE_EEPROM_SPACE)
     MEM_SPACE_MASK = 0x00ff0000, /* mask to get bits which determine memory
@@ -108,38 +113,93 @@ enum
 
 /* Use HEX_DIGIT as a lookup table to convert a nibble to hex 
    digit. */
-static char HEX_DIGIT[] = "0123456789abcdef";
+static const char HEX_DIGIT[] = "0123456789abcdef";
+
+/* A condition of a break point, an agent expression sent by gdb with the
+   Z0 packet. The target stops at the break point only if one of its
+   conditions is true. */
+
+typedef struct GdbCond GdbCond_T;
+
+struct GdbCond
+{
+    int core;                   /* core of the break point, see GdbConn */
+    int addr;                   /* byte address of the break point */
+    int len;
+    uint8_t *expr;              /* bytecode of the expression */
+    GdbCond_T *next;
+};
+
+/* State of one gdb connection. Nothing in here is shared with other
+   connections, so several cores can be served from one process. */
 
-/* There are a couple of nested infinite loops, this allows escaping them
-   all. */
-static int global_server_quit = 0;
+typedef struct GdbConn GdbConn_T;
 
-/* Flag if debug messages should be printed out. */
-static int global_debug_on;
+struct GdbConn
+{
+    int fd;                     /* socket connected to gdb */
+    int debug_on;               /* Flag if debug messages should be printed
+                                   out. */
+    int server_quit;            /* There are a couple of nested infinite
+                                   loops, this allows escaping them all. */
+    int is_running;             /* gdb_continue() is running */
+    int block_on;               /* current blocking mode of fd */
+    char *last_reply;           /* for resending on Nak */
+    char reply_buf[MAX_BUF + 4]; /* encoding buffer for gdb_send_reply() */
+    char rx_buf[MAX_BUF];       /* bytes received from gdb */
+    int rx_pos;                 /* next byte of rx_buf to read */
+    int rx_len;                 /* bytes in rx_buf */
+    SigWatch sigint;            /* SIGINT stops the target or the server */
+    GdbCond_T *conds;           /* conditions of the break points */
+
+    /* With several cores (comm->num_cores) each core is a process of its
+       own. gdb picks the core of the register, memory and break point
+       packets with Hg and the one to resume with Hc. Only the cores gdb
+       has looked at are held, all others keep running. */
+    int num_cores;              /* 0: a single core, comm->user_data */
+    int multiprocess;           /* gdb takes "pP.T" thread ids */
+    int cur_core;               /* core selected with Hg */
+    int cont_core;              /* core selected with Hc, -1 for all */
+    void **held;                /* user_data of core n while held */
+};
 
 /* prototypes */
 
-static int gdb_pre_parse_packet (GdbComm_T *comm, int fd, int blocking);
+static int gdb_pre_parse_packet (GdbComm_T *comm, GdbConn_T *conn,
+                                 int blocking);
 
 /* Wrap read(2) so we can read a byte without having
-   to do a shit load of error checking every time. */
+   to do a shit load of error checking every time. Whatever gdb has sent is
+   read in one go and handed out byte by byte, a large packet would cost a
+   system call per byte otherwise. */
 
 static int
-gdb_read_byte (int fd)
+gdb_read_byte (GdbConn_T *conn)
 {
-    char c;
     int res;
     int cnt = MAX_READ_RETRY;
 
+    if (conn->rx_pos < conn->rx_len)
+        return (unsigned char)conn->rx_buf[conn->rx_pos++];
+
     while (cnt--)
     {
-        res = read (fd, &c, 1);
+        res = read (conn->fd, conn->rx_buf, sizeof (conn->rx_buf));
         if (res < 0)
         {
             if (errno == EAGAIN)
                 /* fd was set to non-blocking and no data was available */
                 return -1;
 
+            if (errno == EINTR)
+            {
+                /* SIGINT ends the server, see gdb_pre_parse_packet() */
+                if (!signal_has_occurred (&conn->sigint))
+                    continue;
+                conn->server_quit = 1;
+                return -1;
+            }
+
             avr_error ("read failed: %s", strerror (errno));
         }
 
@@ -149,13 +209,36 @@ gdb_read_byte (int fd)
             continue;
         }
 
-        return c;
+        conn->rx_len = res;
+        conn->rx_pos = 1;
+        return (unsigned char)conn->rx_buf[0];
     }
     avr_error ("Maximum read reties reached");
 
     return 0;                   /* make compiler happy */
 }
 
+/* Check without blocking if gdb has sent anything. A closed or broken
+   connection counts as input, the following read reports it. */
+
+static int
+gdb_input_pending (GdbConn_T *conn)
+{
+    struct pollfd pfd;
+
+    if (conn->rx_pos < conn->rx_len)
+        return 1;
+
+    pfd.fd = conn->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll (&pfd, 1, 0) < 0)
+        return 0;               /* EINTR, look again next time */
+
+    return pfd.revents != 0;
+}
+
 /* Convert a hexidecimal digit to a 4 bit nibble. */
 
 static uint8_t
@@ -203,62 +286,58 @@ gdb_write (int fd, const void *buf, size_t count)
    Otherwise, make a copy of the buffer pointed to by reply. */
 
 static char *
-gdb_last_reply (char *reply)
+gdb_last_reply (GdbConn_T *conn, char *reply)
 {
-    static char *last_reply = NULL;
-
     if (reply == NULL)
     {
-        if (last_reply == NULL)
+        if (conn->last_reply == NULL)
             return "";
         else
-            return last_reply;
+            return conn->last_reply;
     }
 
-    avr_free (last_reply);
-    last_reply = avr_strdup (reply);
+    avr_free (conn->last_reply);
+    conn->last_reply = avr_strdup (reply);
 
-    return last_reply;
+    return conn->last_reply;
 }
 
 /* Acknowledge a packet from GDB */
 
 static void
-gdb_send_ack (int fd)
+gdb_send_ack (GdbConn_T *conn)
 {
-    if (global_debug_on)
+    if (conn->debug_on)
         fprintf (stderr, " Ack -> gdb\n");
 
-    gdb_write (fd, "+", 1);
+    gdb_write (conn->fd, "+", 1);
 }
 
 /* Send a reply to GDB. */
 
 static void
-gdb_send_reply (int fd, char *reply)
+gdb_send_reply (GdbConn_T *conn, char *reply)
 {
     int cksum = 0;
     int bytes;
 
-    static char buf[MAX_BUF];
+    char *buf = conn->reply_buf;
 
     /* Save the reply to last reply so we can resend if need be. */
-    gdb_last_reply (reply);
+    gdb_last_reply (conn, reply);
 
-    if (global_debug_on)
+    if (conn->debug_on)
         fprintf (stderr, "Sent: $%s#", reply);
 
     if (*reply == '\0')
     {
-        gdb_write (fd, "$#00", 4);
+        gdb_write (conn->fd, "$#00", 4);
 
-        if (global_debug_on)
+        if (conn->debug_on)
             fprintf (stderr, "%02x\n", cksum & 0xff);
     }
     else
     {
-        memset (buf, '\0', sizeof (buf));
-
         buf[0] = '$';
         bytes = 1;
 
@@ -269,25 +348,97 @@ gdb_send_reply (int fd, char *reply)
             bytes++;
             reply++;
 
-            /* must account for "#cc" to be added */
-            if (bytes == (MAX_BUF - 3))
+            /* buf has room for "#cc" after MAX_BUF bytes */
+            if (bytes > MAX_BUF + 1)
             {
                 /* FIXME: TRoth 2002/02/18 - splitting reply would be better */
                 avr_error ("buffer overflow");
             }
         }
 
-        if (global_debug_on)
+        if (conn->debug_on)
             fprintf (stderr, "%02x\n", cksum & 0xff);
 
         buf[bytes++] = '#';
         buf[bytes++] = HEX_DIGIT[(cksum >> 4) & 0xf];
         buf[bytes++] = HEX_DIGIT[cksum & 0xf];
 
-        gdb_write (fd, buf, bytes);
+        gdb_write (conn->fd, buf, bytes);
+    }
+}
+
+/* Make core n the one the packets work on, it is held until gdb resumes
+   it. Nothing to do with a single core. */
+
+static void
+gdb_core_select (GdbComm_T *comm, GdbConn_T *conn, int n)
+{
+    if (conn->num_cores == 0)
+        return;
+
+    if (conn->held[n] == NULL)
+        conn->held[n] = comm->hold_core (comm->server, n);
+
+    comm->user_data = conn->held[n];
+    conn->cur_core = n;
+}
+
+/* Let all held cores but keep run on their own, keep is -1 to release all
+   of them. */
+
+static void
+gdb_core_release (GdbComm_T *comm, GdbConn_T *conn, int keep)
+{
+    int n;
+
+    for (n = 0; n < conn->num_cores; n++)
+    {
+        if ((n == keep) || (conn->held[n] == NULL))
+            continue;
+
+        comm->release_core (comm->server, n);
+        conn->held[n] = NULL;
     }
 }
 
+/* Parse a thread id: "pP.T", "pP" or "T" where P and T may be -1 (all)
+   or 0 (any). Core n is process n + 1 and its only thread is n + 1 too.
+   Returns the core, -1 for all or any core, or -2 if there is no such
+   core. */
+
+static int
+gdb_thread_core (GdbConn_T *conn, char *id)
+{
+    long n;
+    char *end;
+
+    if (*id == 'p')
+        id++;
+
+    n = strtol (id, &end, 16);
+    if ((end == id) || ((*end != '\0') && (*end != '.')))
+        return -2;
+
+    if ((n == -1) || (n == 0))
+        return -1;
+
+    if ((n < 0) || (n > conn->num_cores))
+        return -2;
+
+    return n - 1;
+}
+
+/* The thread id of core n in the format gdb asked for. */
+
+static void
+gdb_thread_id (GdbConn_T *conn, int n, char *buf, int size)
+{
+    if (conn->multiprocess)
+        snprintf (buf, size, "p%x.%x", n + 1, n + 1);
+    else
+        snprintf (buf, size, "%x", n + 1);
+}
+
 /* GDB needs the 32 8-bit, gpw registers (r00 - r31), the 
    8-bit SREG, the 16-bit SP (stack pointer) and the 32-bit PC
    (program counter). Thus need to send a reply with
@@ -295,7 +446,7 @@ gdb_send_reply (int fd, char *reply)
    Low bytes before High since AVR is little endian. */
 
 static void
-gdb_read_registers (GdbComm_T *comm, int fd)
+gdb_read_registers (GdbComm_T *comm, GdbConn_T *conn)
 {
     int i;
     uint32_t val;               /* ensure it's 32 bit value */
@@ -351,7 +502,7 @@ gdb_read_registers (GdbComm_T *comm, int fd)
     buf[i * 2 + 6] = HEX_DIGIT[(val >> 4) & 0xf];
     buf[i * 2 + 7] = HEX_DIGIT[val & 0xf];
 
-    gdb_send_reply (fd, buf);
+    gdb_send_reply (conn, buf);
     avr_free (buf);
 }
 
@@ -359,7 +510,7 @@ gdb_read_registers (GdbComm_T *comm, int fd)
    same and in the same order as described in gdb_read_registers() above. */
 
 static void
-gdb_write_registers (GdbComm_T *comm, int fd, char *pkt)
+gdb_write_registers (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
 {
     int i;
     uint8_t bval;
@@ -406,7 +557,7 @@ gdb_write_registers (GdbComm_T *comm, int fd, char *pkt)
     val += ((uint32_t) hex2nib (*pkt++)) << 24;
     comm->write_pc (comm->user_data, val / 2);
 
-    gdb_send_reply (fd, "OK");
+    gdb_send_reply (conn, "OK");
 }
 
 /* Extract a hexidecimal number from the pkt. Keep scanning pkt until stop
@@ -444,7 +595,7 @@ gdb_extract_hex_num (char **pkt, char stop)
    zero padding. */
 
 static void
-gdb_read_register (GdbComm_T *comm, int fd, char *pkt)
+gdb_read_register (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
 {
     int reg;
 
@@ -481,10 +632,10 @@ gdb_read_register (GdbComm_T *comm, int fd, char *pkt)
     else
     {
         avr_warning ("Bad register value: %d\n", reg);
-        gdb_send_reply (fd, "E00");
+        gdb_send_reply (conn, "E00");
         return;
     }
-    gdb_send_reply (fd, reply);
+    gdb_send_reply (conn, reply);
 }
 
 /* Write a single register. Packet form: 'Pn=r' where n is a hex number with
@@ -492,7 +643,7 @@ gdb_read_register (GdbComm_T *comm, int fd, char *pkt)
    byte order). */
 
 static void
-gdb_write_register (GdbComm_T *comm, int fd, char *pkt)
+gdb_write_register (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
 {
     int reg;
     uint32_t dval, hval;
@@ -548,11 +699,11 @@ gdb_write_register (GdbComm_T *comm, int fd, char *pkt)
     else
     {
         avr_warning ("Bad register value: %d\n", reg);
-        gdb_send_reply (fd, "E00");
+        gdb_send_reply (conn, "E00");
         return;
     }
 
-    gdb_send_reply (fd, "OK");
+    gdb_send_reply (conn, "OK");
 }
 
 /* Parse the pkt string for the addr and length.
@@ -584,20 +735,16 @@ gdb_get_addr_len (char *pkt, char a_end, char l_end, int *addr, int *len)
     return (pkt - orig_pkt);
 }
 
-static void
-gdb_read_memory (GdbComm_T *comm, int fd, char *pkt)
+/* Read len bytes at the gdb address addr into buf. The block functions of
+   the target copy a whole block, without them every byte is read on its
+   own. Returns 0, or -1 if gdb asked for a memory space which doesn't
+   exist or a block outside of it. */
+
+static int
+gdb_mem_read (GdbComm_T *comm, int addr, uint8_t *buf, int len)
 {
-    int addr = 0;
-    int len = 0;
-    uint8_t *buf;
-    uint8_t bval;
     uint16_t wval;
     int i;
-    int is_odd_addr;
-
-    pkt += gdb_get_addr_len (pkt, ',', '\0', &addr, &len);
-
-    buf = avr_new0 (uint8_t, (len * 2) + 1);
 
     if (addr >= SRAM_OFFSET && addr < EEPROM_OFFSET)
     {
@@ -605,65 +752,23 @@ gdb_read_memory (GdbComm_T *comm, int fd, char *pkt)
 
         addr -= SRAM_OFFSET;
 
-        /* Return an error to gdb if it tries to read or write any of the 32
-           general purpse registers. This allows gdb to know when a zero
-           pointer has been dereferenced. */
-
-        /* FIXME: [TRoth 2002/03/31] This isn't working quite the way I
-           thought it would so I've removed it for now. */
+        if (comm->read_sram_block)
+            return comm->read_sram_block (comm->user_data, addr, buf, len);
 
-        /* if ( (addr >= 0) && (addr < 32) ) */
-        if (0)
-        {
-            snprintf ((char*)buf, len * 2, "E%02x", EIO);
-        }
-        else
-        {
-            for (i = 0; i < len; i++)
-            {
-                bval = comm->read_sram (comm->user_data, addr + i);
-                buf[i * 2] = HEX_DIGIT[bval >> 4];
-                buf[i * 2 + 1] = HEX_DIGIT[bval & 0xf];
-            }
-        }
+        for (i = 0; i < len; i++)
+            buf[i] = comm->read_sram (comm->user_data, addr + i);
     }
     else if (addr < SRAM_OFFSET)
     {
-        /* addressing flash */
-
-        is_odd_addr = addr % 2;
-        i = 0;
+        /* addressing flash, the low byte of a word comes first */
 
-        if (is_odd_addr)
-        {
-            bval = comm->read_flash (comm->user_data, addr / 2) >> 8;
-            buf[i++] = HEX_DIGIT[bval >> 4];
-            buf[i++] = HEX_DIGIT[bval & 0xf];
-            addr++;
-            len--;
-        }
-
-        while (len > 1)
-        {
-            wval = comm->read_flash (comm->user_data, addr / 2);
-
-            bval = wval & 0xff;
-            buf[i++] = HEX_DIGIT[bval >> 4];
-            buf[i++] = HEX_DIGIT[bval & 0xf];
-
-            bval = wval >> 8;
-            buf[i++] = HEX_DIGIT[bval >> 4];
-            buf[i++] = HEX_DIGIT[bval & 0xf];
-
-            len -= 2;
-            addr += 2;
-        }
+        if (comm->read_flash_block)
+            return comm->read_flash_block (comm->user_data, addr, buf, len);
 
-        if (len == 1)
+        for (i = 0; i < len; i++)
         {
-            bval = comm->read_flash (comm->user_data, addr / 2) & 0xff;
-            buf[i++] = HEX_DIGIT[bval >> 4];
-            buf[i++] = HEX_DIGIT[bval & 0xf];
+            wval = comm->read_flash (comm->user_data, (addr + i) / 2);
+            buf[i] = ((addr + i) % 2) ? (wval >> 8) : (wval & 0xff);
         }
     }
 #if defined(USE_EEPROM_SPACE)
@@ -673,10 +778,14 @@ gdb_read_memory (GdbComm_T *comm, int fd, char *pkt)
 
         addr -= EEPROM_OFFSET;
 
-        for(i=0;i<len;i++){
-                bval = gdb_ee_read (addr + i);
-                buf[i * 2] = HEX_DIGIT[bval >> 4];
-                buf[i * 2 + 1] = HEX_DIGIT[bval & 0xf];
+        if (comm->read_eeprom_block)
+            return comm->read_eeprom_block (comm->user_data, addr, buf, len);
+
+        for (i = 0; i < len; i++)
+        {
+            buf[i] = 0;
+            if (comm->read_eeprom)
+                buf[i] = comm->read_eeprom (comm->user_data, addr + i);
         }
     }
 #endif
@@ -684,29 +793,19 @@ gdb_read_memory (GdbComm_T *comm, int fd, char *pkt)
     {
         /* gdb asked for memory space which doesn't exist */
         avr_warning ("Invalid memory address: 0x%x.\n", addr);
-        snprintf ((char*)buf, len * 2, "E%02x", EIO);
+        return -1;
     }
 
-    gdb_send_reply (fd, (char*)buf);
-
-    avr_free (buf);
+    return 0;
 }
 
-static void
-gdb_write_memory (GdbComm_T *comm, int fd, char *pkt)
+/* Write len bytes of buf at the gdb address addr, the counterpart of
+   gdb_mem_read(). Returns 0, or -1 if the memory can't be written. */
+
+static int
+gdb_mem_write (GdbComm_T *comm, int addr, const uint8_t *buf, int len)
 {
-    int addr = 0;
-    int len = 0;
-    uint8_t bval;
-    uint16_t wval;
-    int is_odd_addr;
     int i;
-    char reply[10];
-
-    /* Set the default reply. */
-    strncpy (reply, "OK", sizeof (reply));
-
-    pkt += gdb_get_addr_len (pkt, ',', ':', &addr, &len);
 
     if (addr >= SRAM_OFFSET && addr < EEPROM_OFFSET)
     {
@@ -714,69 +813,36 @@ gdb_write_memory (GdbComm_T *comm, int fd, char *pkt)
 
         addr -= SRAM_OFFSET;
 
-        /* Return error. See gdb_read_memory for reasoning. */
-        /* FIXME: [TRoth 2002/03/31] This isn't working quite the way I
-           thought it would so I've removed it for now. */
-        /* if ( (addr >= 0) && (addr < 32) ) */
-        if (0)
-        {
-            snprintf (reply, sizeof (reply), "E%02x", EIO);
-        }
-        else
-        {
-            for (i = addr; i < addr + len; i++)
-            {
-                bval = hex2nib (*pkt++) << 4;
-                bval += hex2nib (*pkt++);
-                comm->write_sram (comm->user_data, i, bval);
-            }
-        }
+        if (comm->write_sram_block)
+            return comm->write_sram_block (comm->user_data, addr, buf, len);
+
+        for (i = 0; i < len; i++)
+            comm->write_sram (comm->user_data, addr + i, buf[i]);
     }
     else if (addr < SRAM_OFFSET)
     {
         /* addressing flash */
 
-        /* Some targets might not allow writing to flash */
-
-        if (comm->write_flash && comm->write_flash_lo8
-            && comm->write_flash_hi8)
-        {
-
-            is_odd_addr = addr % 2;
-
-            if (is_odd_addr)
-            {
-                bval = hex2nib (*pkt++) << 4;
-                bval += hex2nib (*pkt++);
-                comm->write_flash_hi8 (comm->user_data, addr / 2, bval);
-                len--;
-                addr++;
-            }
+        if (comm->write_flash_block)
+            return comm->write_flash_block (comm->user_data, addr, buf, len);
 
-            while (len > 1)
-            {
-                wval = hex2nib (*pkt++) << 4; /* low byte first */
-                wval += hex2nib (*pkt++);
-                wval += hex2nib (*pkt++) << 12; /* high byte last */
-                wval += hex2nib (*pkt++) << 8;
-                comm->write_flash (comm->user_data, addr / 2, wval);
-                len -= 2;
-                addr += 2;
-            }
+        /* Some targets might not allow writing to flash */
 
-            if (len == 1)
-            {
-                /* one more byte to write */
-                bval = hex2nib (*pkt++) << 4;
-                bval += hex2nib (*pkt++);
-                comm->write_flash_lo8 (comm->user_data, addr / 2, bval);
-            }
-        }
-        else
+        if (!comm->write_flash_lo8 || !comm->write_flash_hi8)
         {
             /* target can't write to flash, so complain to gdb */
             avr_warning ("Gdb asked to write to flash and target can't.\n");
-            snprintf (reply, sizeof (reply), "E%02x", EIO);
+            return -1;
+        }
+
+        for (i = 0; i < len; i++)
+        {
+            if ((addr + i) % 2)
+                comm->write_flash_hi8 (comm->user_data, (addr + i) / 2,
+                                       buf[i]);
+            else
+                comm->write_flash_lo8 (comm->user_data, (addr + i) / 2,
+                                       buf[i]);
         }
     }
 #if defined (USE_EEPROM_SPACE)
@@ -786,23 +852,130 @@ gdb_write_memory (GdbComm_T *comm, int fd, char *pkt)
 
         addr -= EEPROM_OFFSET;
 
-        avr_warning ("Gdb asked to write eeprom address = %x len %d\n",addr,len);
-            for (i = addr; i < addr + len; i++)
-            {
-                bval = hex2nib (*pkt++) << 4;
-                bval += hex2nib (*pkt++);
-                gdb_ee_write (i, bval);
-            }
+        if (comm->write_eeprom_block)
+            return comm->write_eeprom_block (comm->user_data, addr, buf, len);
+
+        for (i = 0; i < len; i++)
+            if (comm->write_eeprom)
+                comm->write_eeprom (comm->user_data, addr + i, buf[i]);
     }
 #endif
     else
     {
         /* gdb asked for memory space which doesn't exist */
         avr_warning ("Invalid memory address: 0x%x.\n", addr);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Read memory. Packet form: 'maddr,len'. The reply holds two hex digits per
+   byte. If gdb asks for more than fits in a packet, the reply is shorter,
+   gdb asks for the rest. */
+
+static void
+gdb_read_memory (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    int addr = 0;
+    int len = 0;
+    uint8_t *data;
+    char *buf;
+    int i;
+
+    pkt += gdb_get_addr_len (pkt, ',', '\0', &addr, &len);
+
+    if (len > MAX_BUF / 2)
+        len = MAX_BUF / 2;
+
+    data = avr_new (uint8_t, len + 1);
+
+    if (gdb_mem_read (comm, addr, data, len) < 0)
+    {
+        char reply[10];
+
+        snprintf (reply, sizeof (reply), "E%02x", EIO);
+        gdb_send_reply (conn, reply);
+        avr_free (data);
+        return;
+    }
+
+    buf = avr_new (char, (len * 2) + 1);
+
+    for (i = 0; i < len; i++)
+    {
+        buf[i * 2] = HEX_DIGIT[data[i] >> 4];
+        buf[i * 2 + 1] = HEX_DIGIT[data[i] & 0xf];
+    }
+    buf[len * 2] = '\0';
+
+    gdb_send_reply (conn, buf);
+
+    avr_free (buf);
+    avr_free (data);
+}
+
+/* Write memory. Packet form: 'Maddr,len:XX...' with two hex digits per
+   byte. */
+
+static void
+gdb_write_memory (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    int addr = 0;
+    int len = 0;
+    uint8_t *data;
+    int i;
+    char reply[10];
+
+    /* Set the default reply. */
+    strncpy (reply, "OK", sizeof (reply));
+
+    pkt += gdb_get_addr_len (pkt, ',', ':', &addr, &len);
+
+    data = avr_new (uint8_t, len + 1);
+
+    for (i = 0; i < len; i++)
+    {
+        data[i] = hex2nib (*pkt++) << 4;
+        data[i] += hex2nib (*pkt++);
+    }
+
+    if (gdb_mem_write (comm, addr, data, len) < 0)
         snprintf (reply, sizeof (reply), "E%02x", EIO);
+
+    avr_free (data);
+
+    gdb_send_reply (conn, reply);
+}
+
+/* Write memory with binary data. Packet form: 'Xaddr,len:data' where data
+   are the len bytes, unescaped by gdb_pre_parse_packet(). end points after
+   the packet. gdb probes for the packet with a len of 0 before it uses
+   it. */
+
+static void
+gdb_write_memory_binary (GdbComm_T *comm, GdbConn_T *conn, char *pkt,
+                         char *end)
+{
+    int addr = 0;
+    int len = 0;
+    char reply[10];
+
+    /* Set the default reply. */
+    strncpy (reply, "OK", sizeof (reply));
+
+    pkt += gdb_get_addr_len (pkt, ',', ':', &addr, &len);
+
+    if (end - pkt != len)
+    {
+        avr_warning ("X packet has %d bytes instead of %d\n",
+                     (int)(end - pkt), len);
+        snprintf (reply, sizeof (reply), "E%02x", EINVAL);
     }
+    else if (gdb_mem_write (comm, addr, (uint8_t *)pkt, len) < 0)
+        snprintf (reply, sizeof (reply), "E%02x", EIO);
 
-    gdb_send_reply (fd, reply);
+    gdb_send_reply (conn, reply);
 }
 
 /* Format of breakpoint commands (both insert and remove):
@@ -825,79 +998,498 @@ gdb_write_memory (GdbComm_T *comm, int fd, char *pkt)
    memory region to be monitored. To avoid potential problems, the operations
    should be implemented in an idempotent way. -- GDB 5.0 manual. */
 
+/* Remove the conditions of the break point at addr of the selected core,
+   of all break points if addr is -1. */
+
 static void
-gdb_break_point (GdbComm_T *comm, int fd, char *pkt)
+gdb_cond_remove (GdbConn_T *conn, int addr)
 {
-    int addr = 0;
-    int len = 0;
-
-    char z = *(pkt - 1);        /* get char parser already looked at */
-    char t = *pkt++;
-    pkt++;                      /* skip over first ',' */
-
-    gdb_get_addr_len (pkt, ',', '\0', &addr, &len);
+    GdbCond_T **link = &conn->conds;
 
-    switch (t)
+    while (*link)
     {
-        case '0':              /* software breakpoint */
-            /* addr/2 since addr refers to PC */
-            if (comm->max_pc
-                && ((addr / 2) >= comm->max_pc (comm->user_data)))
-            {
-                avr_warning ("Attempt to set break at invalid addr\n");
-                gdb_send_reply (fd, "E01");
-                return;
-            }
+        GdbCond_T *c = *link;
 
-            if (z == 'z')
-                comm->remove_break (comm->user_data, addr / 2);
-            else
-                comm->insert_break (comm->user_data, addr / 2);
-            break;
+        if ((addr >= 0)
+            && ((c->addr != addr) || (c->core != conn->cur_core)))
+        {
+            link = &c->next;
+            continue;
+        }
 
-        case '1':              /* hardware breakpoint */
-        case '2':              /* write watchpoint */
-        case '3':              /* read watchpoint */
-        case '4':              /* access watchpoint */
-            gdb_send_reply (fd, "");
-            return;             /* unsupported yet */
+        *link = c->next;
+        avr_free (c->expr);
+        avr_free (c);
     }
-
-    gdb_send_reply (fd, "OK");
 }
 
-/* Handle an io registers query. Query has two forms:
-   "avr.io_reg" and "avr.io_reg:addr,len".
-
-   The "avr.io_reg" has already been stripped off at this point. 
-
-   The first form means, "return the number of io registers for this target
-   device." Second form means, "send data len io registers starting with
-   register addr." */
+/* Add the conditions "X len,expr;X len,expr..." of the break point at addr.
+   Anything after the conditions (";cmds:...") is ignored. Returns -1 if
+   the list is malformed. */
 
-static void
-gdb_fetch_io_registers (GdbComm_T *comm, int fd, char *pkt)
+static int
+gdb_cond_insert (GdbConn_T *conn, int addr, char *list)
 {
-    int addr, len;
-    int i;
-    uint8_t val;
-    char reply[400];
-    char reg_name[80];
-    int pos = 0;
+    GdbCond_T *c;
+    int i, len;
 
-    if (comm->io_fetch)
+    while (*list == 'X')
     {
-        if (pkt[0] == '\0')
+        list++;
+        len = 0;
+        while (isxdigit ((unsigned char)*list))
+            len = (len << 4) + hex2nib (*list++);
+        if ((*list++ != ',') || (len <= 0))
+            return -1;
+
+        c = avr_new0 (GdbCond_T, 1);
+        c->core = conn->cur_core;
+        c->addr = addr;
+        c->len = len;
+        c->expr = avr_new (uint8_t, len);
+        c->next = conn->conds;
+        conn->conds = c;
+
+        for (i = 0; i < len; i++)
         {
-            /* gdb is asking how many io registers the device has. */
-            gdb_send_reply (fd, "40");
+            if (!isxdigit ((unsigned char)list[0])
+                || !isxdigit ((unsigned char)list[1]))
+                return -1;
+            c->expr[i] = (hex2nib (list[0]) << 4) | hex2nib (list[1]);
+            list += 2;
         }
 
-        else if (pkt[0] == ':')
-        {
-            /* gdb is asking for io registers addr to (addr + len) */
+        if (*list == ';')
+            list++;
+    }
 
-            gdb_get_addr_len (pkt + 1, ',', '\0', &addr, &len);
+    return 0;
+}
+
+/* Read a byte of the target for an agent expression, addr is in the address
+   space of gdb (see gdb_read_memory()). */
+
+static uint8_t
+gdb_cond_read_byte (GdbComm_T *comm, uint64_t addr)
+{
+    if (addr >= SRAM_OFFSET && addr < EEPROM_OFFSET)
+        return comm->read_sram (comm->user_data, addr - SRAM_OFFSET);
+
+    if (addr < SRAM_OFFSET)
+    {
+        uint16_t wval = comm->read_flash (comm->user_data, addr / 2);
+
+        return (addr % 2) ? (wval >> 8) : (wval & 0xff);
+    }
+
+#if defined(USE_EEPROM_SPACE)
+    if (comm->read_eeprom)
+        return comm->read_eeprom (comm->user_data, addr - EEPROM_OFFSET);
+#endif
+
+    return 0;
+}
+
+/* Read register n (numbered as in gdb_read_registers()) for an agent
+   expression. */
+
+static int
+gdb_cond_read_reg (GdbComm_T *comm, int n, uint64_t *val)
+{
+    if (n < 32)
+        *val = comm->read_reg (comm->user_data, n);
+    else if (n == 32)
+        *val = comm->read_sreg (comm->user_data);
+    else if (n == 33)
+        *val = comm->read_sram (comm->user_data, SPL_ADDR)
+            | (comm->read_sram (comm->user_data, SPH_ADDR) << 8);
+    else if (n == 34)
+        *val = comm->read_pc (comm->user_data) * 2;
+    else
+        return -1;
+
+    return 0;
+}
+
+/* Evaluate the agent expression of c (see "Agent Expressions" in the gdb
+   manual) with the registers and memory of the target. Only the bytecodes
+   a condition can use are known, tracing, floating point and trace state
+   variables are not. Returns 0 with the value in *result, or -1 for an
+   invalid or unknown bytecode. */
+
+static int
+gdb_cond_eval (GdbComm_T *comm, GdbCond_T *c, uint64_t *result)
+{
+    uint64_t stack[GDB_AX_STACK];
+    uint64_t top, tmp;
+    uint8_t *op = c->expr;
+    int pc = 0, sp = 0, n, i;
+
+#define AX_ARGS(cnt)   do { if (pc + (cnt) > c->len) return -1; } while (0)
+#define AX_PUSH(v)     do { if (sp == GDB_AX_STACK) return -1; \
+                            stack[sp++] = top; top = (v); } while (0)
+#define AX_POP()       do { if (sp == 0) return -1; top = stack[--sp]; \
+                       } while (0)
+#define AX_NEXT()      (stack[sp - 1])
+#define AX_BINARY()    do { if (sp == 0) return -1; sp--; } while (0)
+
+    top = 0;
+    while (pc < c->len)
+    {
+        switch (op[pc++])
+        {
+            case 0x02:          /* add */
+                AX_BINARY ();
+                top = stack[sp] + top;
+                break;
+            case 0x03:          /* sub */
+                AX_BINARY ();
+                top = stack[sp] - top;
+                break;
+            case 0x04:          /* mul */
+                AX_BINARY ();
+                top = stack[sp] * top;
+                break;
+            case 0x05:          /* div_signed */
+            case 0x07:          /* rem_signed */
+                AX_BINARY ();
+                if (top == 0)
+                    return -1;
+                top = (op[pc - 1] == 0x05)
+                    ? (uint64_t)((int64_t)stack[sp] / (int64_t)top)
+                    : (uint64_t)((int64_t)stack[sp] % (int64_t)top);
+                break;
+            case 0x06:          /* div_unsigned */
+            case 0x08:          /* rem_unsigned */
+                AX_BINARY ();
+                if (top == 0)
+                    return -1;
+                top = (op[pc - 1] == 0x06) ? stack[sp] / top
+                    : stack[sp] % top;
+                break;
+            case 0x09:          /* lsh */
+                AX_BINARY ();
+                top = (top < 64) ? stack[sp] << top : 0;
+                break;
+            case 0x0a:          /* rsh_signed */
+                AX_BINARY ();
+                top = (uint64_t)((int64_t)stack[sp] >> ((top < 64) ? top
+                                                        : 63));
+                break;
+            case 0x0b:          /* rsh_unsigned */
+                AX_BINARY ();
+                top = (top < 64) ? stack[sp] >> top : 0;
+                break;
+            case 0x0e:          /* log_not */
+                top = !top;
+                break;
+            case 0x0f:          /* bit_and */
+                AX_BINARY ();
+                top = stack[sp] & top;
+                break;
+            case 0x10:          /* bit_or */
+                AX_BINARY ();
+                top = stack[sp] | top;
+                break;
+            case 0x11:          /* bit_xor */
+                AX_BINARY ();
+                top = stack[sp] ^ top;
+                break;
+            case 0x12:          /* bit_not */
+                top = ~top;
+                break;
+            case 0x13:          /* equal */
+                AX_BINARY ();
+                top = (stack[sp] == top);
+                break;
+            case 0x14:          /* less_signed */
+                AX_BINARY ();
+                top = ((int64_t)stack[sp] < (int64_t)top);
+                break;
+            case 0x15:          /* less_unsigned */
+                AX_BINARY ();
+                top = (stack[sp] < top);
+                break;
+            case 0x16:          /* ext n */
+                AX_ARGS (1);
+                n = op[pc++];
+                if ((n > 0) && (n < 64))
+                    top = (uint64_t)((int64_t)(top << (64 - n)) >> (64 - n));
+                break;
+            case 0x17:          /* ref8 */
+            case 0x18:          /* ref16 */
+            case 0x19:          /* ref32 */
+            case 0x1a:          /* ref64 */
+                n = 1 << (op[pc - 1] - 0x17);
+                for (tmp = 0, i = n - 1; i >= 0; i--)
+                    tmp = (tmp << 8) | gdb_cond_read_byte (comm, top + i);
+                top = tmp;
+                break;
+            case 0x20:          /* if_goto offset */
+            case 0x21:          /* goto offset */
+                AX_ARGS (2);
+                n = (op[pc] << 8) | op[pc + 1];
+                if (n <= pc)
+                    return -1;  /* a condition never loops */
+                pc += 2;
+                if (op[pc - 3] == 0x21)
+                {
+                    pc = n;
+                    break;
+                }
+                tmp = top;
+                AX_POP ();
+                if (tmp)
+                    pc = n;
+                break;
+            case 0x22:          /* const8 */
+            case 0x23:          /* const16 */
+            case 0x24:          /* const32 */
+            case 0x25:          /* const64 */
+                n = 1 << (op[pc - 1] - 0x22);
+                AX_ARGS (n);
+                for (tmp = 0, i = 0; i < n; i++)
+                    tmp = (tmp << 8) | op[pc++];
+                AX_PUSH (tmp);
+                break;
+            case 0x26:          /* reg n */
+                AX_ARGS (2);
+                n = (op[pc] << 8) | op[pc + 1];
+                pc += 2;
+                if (gdb_cond_read_reg (comm, n, &tmp) < 0)
+                    return -1;
+                AX_PUSH (tmp);
+                break;
+            case 0x27:          /* end */
+                *result = top;
+                return 0;
+            case 0x28:          /* dup */
+                AX_PUSH (top);
+                break;
+            case 0x29:          /* pop */
+                AX_POP ();
+                break;
+            case 0x2a:          /* zero_ext n */
+                AX_ARGS (1);
+                n = op[pc++];
+                if ((n > 0) && (n < 64))
+                    top &= ((uint64_t)1 << n) - 1;
+                break;
+            case 0x2b:          /* swap */
+                if (sp == 0)
+                    return -1;
+                tmp = AX_NEXT ();
+                AX_NEXT () = top;
+                top = tmp;
+                break;
+            case 0x32:          /* pick n */
+                AX_ARGS (1);
+                n = op[pc++];
+                if (n > sp)
+                    return -1;
+                AX_PUSH ((n == 0) ? top : stack[sp - n]);
+                break;
+            case 0x33:          /* rot */
+                if (sp < 2)
+                    return -1;
+                tmp = stack[sp - 1];
+                stack[sp - 1] = stack[sp - 2];
+                stack[sp - 2] = top;
+                top = tmp;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+#undef AX_ARGS
+#undef AX_PUSH
+#undef AX_POP
+#undef AX_NEXT
+#undef AX_BINARY
+
+    return -1;                  /* no end */
+}
+
+/* Decide if the target stops at the break point it has reached: it has no
+   conditions, or one of them is true. A condition that can not be
+   evaluated stops the target too. */
+
+static int
+gdb_cond_stop (GdbComm_T *comm, GdbConn_T *conn)
+{
+    int addr = comm->read_pc (comm->user_data) * 2;
+    int found = 0;
+    uint64_t val;
+    GdbCond_T *c;
+
+    for (c = conn->conds; c; c = c->next)
+    {
+        if ((c->addr != addr) || (c->core != conn->cur_core))
+            continue;
+
+        found = 1;
+        if (gdb_cond_eval (comm, c, &val) < 0)
+        {
+            avr_warning ("Break point condition at 0x%x can not be "
+                         "evaluated\n", addr);
+            return 1;
+        }
+        if (val)
+            return 1;
+    }
+
+    return !found;
+}
+
+/* Execute the instruction under the break point the target has reached. */
+
+static int
+gdb_step_over (GdbComm_T *comm)
+{
+    int res;
+
+    comm->disable_breakpts (comm->user_data);
+    res = comm->step (comm->user_data);
+    comm->enable_breakpts (comm->user_data);
+
+    return res;
+}
+
+/* Insert or remove a watchpoint of type t ('2' write, '3' read, '4'
+   access) in sram or eeprom. There are none in flash. */
+
+static int
+gdb_watch_point (GdbComm_T *comm, char z, char t, int addr, int len)
+{
+    int eeprom;
+    int flag = (t == '2') ? 1 : (t == '3') ? 2 : 4;
+
+    if (addr >= SRAM_OFFSET && addr < EEPROM_OFFSET)
+    {
+        eeprom = 0;
+        addr -= SRAM_OFFSET;
+    }
+#if defined(USE_EEPROM_SPACE)
+    else if (addr >= EEPROM_OFFSET)
+    {
+        eeprom = 1;
+        addr -= EEPROM_OFFSET;
+    }
+#endif
+    else
+        return -1;
+
+    if (z == 'z')
+        return comm->remove_watch (comm->user_data, eeprom, addr, len, flag);
+    else
+        return comm->insert_watch (comm->user_data, eeprom, addr, len, flag);
+}
+
+static void
+gdb_break_point (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    int addr = 0;
+    int len = 0;
+    char *conds;
+
+    char z = *(pkt - 1);        /* get char parser already looked at */
+    char t = *pkt++;
+    pkt++;                      /* skip over first ',' */
+
+    /* "Z0,addr,kind;X len,expr;X len,expr..." for a conditional break */
+    conds = strchr (pkt, ';');
+    if (conds)
+        *conds++ = '\0';
+
+    gdb_get_addr_len (pkt, ',', '\0', &addr, &len);
+
+    switch (t)
+    {
+        case '0':              /* software breakpoint */
+            /* addr/2 since addr refers to PC */
+            if (comm->max_pc
+                && ((addr / 2) >= comm->max_pc (comm->user_data)))
+            {
+                avr_warning ("Attempt to set break at invalid addr\n");
+                gdb_send_reply (conn, "E01");
+                return;
+            }
+
+            /* gdb sends Z0 again when the conditions change */
+            gdb_cond_remove (conn, addr);
+            if ((z == 'Z') && conds
+                && (gdb_cond_insert (conn, addr, conds) < 0))
+            {
+                gdb_cond_remove (conn, addr);
+                avr_warning ("Invalid break point condition\n");
+                gdb_send_reply (conn, "E01");
+                return;
+            }
+
+            if (z == 'z')
+                comm->remove_break (comm->user_data, addr / 2);
+            else
+                comm->insert_break (comm->user_data, addr / 2);
+            break;
+
+        case '2':              /* write watchpoint */
+        case '3':              /* read watchpoint */
+        case '4':              /* access watchpoint */
+            if ((comm->insert_watch == NULL) || (comm->remove_watch == NULL))
+            {
+                gdb_send_reply (conn, "");
+                return;         /* unsupported */
+            }
+
+            if (gdb_watch_point (comm, z, t, addr, len) < 0)
+            {
+                avr_warning ("Attempt to set watchpoint at invalid addr\n");
+                gdb_send_reply (conn, "E01");
+                return;
+            }
+            break;
+
+        case '1':              /* hardware breakpoint */
+            gdb_send_reply (conn, "");
+            return;             /* unsupported yet */
+    }
+
+    gdb_send_reply (conn, "OK");
+}
+
+/* Handle an io registers query. Query has two forms:
+   "avr.io_reg" and "avr.io_reg:addr,len".
+
+   The "avr.io_reg" has already been stripped off at this point. 
+
+   The first form means, "return the number of io registers for this target
+   device." Second form means, "send data len io registers starting with
+   register addr." */
+
+static void
+gdb_fetch_io_registers (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    int addr, len;
+    int i;
+    uint8_t val;
+    char reply[400];
+    char reg_name[80];
+    int pos = 0;
+
+    if (comm->io_fetch)
+    {
+        if (pkt[0] == '\0')
+        {
+            /* gdb is asking how many io registers the device has. */
+            gdb_send_reply (conn, "40");
+        }
+
+        else if (pkt[0] == ':')
+        {
+            /* gdb is asking for io registers addr to (addr + len) */
+
+            gdb_get_addr_len (pkt + 1, ',', '\0', &addr, &len);
 
             memset (reply, '\0', sizeof (reply));
 
@@ -910,39 +1502,411 @@ gdb_fetch_io_registers (GdbComm_T *comm, int fd, char *pkt)
                               reg_name, val);
             }
 
-            gdb_send_reply (fd, reply); /* do nothing for now */
+            gdb_send_reply (conn, reply); /* do nothing for now */
         }
 
         else
-            gdb_send_reply (fd, "E01"); /* An error occurred */
+            gdb_send_reply (conn, "E01"); /* An error occurred */
 
     }
 
     else
-        gdb_send_reply (fd, ""); /* tell gdb we don't handle info io
+        gdb_send_reply (conn, ""); /* tell gdb we don't handle info io
                                     command. */
 }
 
+/* Monitor command format: "qRcmd,<command in hex>"
+
+   The output of the command is sent in "O<hex>" packets, gdb prints them
+   as they come. The command is done with the final "OK". */
+
+static void
+gdb_monitor (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    char cmd[MAX_BUF / 2 + 1];
+    char reply[MAX_BUF];
+    char *out, *p;
+    int i, n;
+
+    if (comm->monitor == NULL)
+    {
+        gdb_send_reply (conn, "");
+        return;
+    }
+
+    for (i = 0; pkt[0] && pkt[1] && (i < sizeof (cmd) - 1); i++, pkt += 2)
+        cmd[i] = (hex2nib (pkt[0]) << 4) | hex2nib (pkt[1]);
+    cmd[i] = '\0';
+
+    out = comm->monitor (comm->user_data, cmd);
+
+    for (p = out; *p;)
+    {
+        reply[0] = 'O';
+        /* must leave room for "$", "#cc" and the terminator */
+        for (n = 1; *p && (n < MAX_BUF - 8); p++)
+        {
+            reply[n++] = HEX_DIGIT[(*p >> 4) & 0xf];
+            reply[n++] = HEX_DIGIT[*p & 0xf];
+        }
+        reply[n] = '\0';
+        gdb_send_reply (conn, reply);
+    }
+    avr_free (out);
+
+    gdb_send_reply (conn, "OK");
+}
+
+/* Can gdb_mem_write() write to the flash? */
+
+static int
+gdb_flash_writable (GdbComm_T *comm)
+{
+    return comm->write_flash_block
+        || (comm->write_flash_lo8 && comm->write_flash_hi8);
+}
+
+/* Send a part of the memory map. Packet form:
+   'qXfer:memory-map:read::offset,length'.
+
+   The map tells gdb where the flash, the data space and the eeprom are in
+   its address space. gdb then refuses to touch memory outside of them, and
+   loads a program into the flash with the vFlash packets. The reply is 'm'
+   with a part of the document, or 'l' with its last part. */
+
+static void
+gdb_memory_map (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    char map[1024];
+    char reply[MAX_BUF];
+    int flash, data, eeprom;
+    int size, offset, len;
+
+    comm->space_sizes (comm->user_data, &flash, &data, &eeprom);
+
+    size = snprintf (map, sizeof (map),
+                     "<?xml version=\"1.0\"?>\n"
+                     "<!DOCTYPE memory-map PUBLIC"
+                     " \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\""
+                     " \"http://sourceware.org/gdb/gdb-memory-map.dtd\">\n"
+                     "<memory-map>\n");
+
+    if (gdb_flash_writable (comm))
+        size += snprintf (map + size, sizeof (map) - size,
+                          "<memory type=\"flash\" start=\"0x%x\""
+                          " length=\"0x%x\">\n"
+                          "<property name=\"blocksize\">0x%x</property>\n"
+                          "</memory>\n", FLASH_OFFSET, flash,
+                          GDB_FLASH_BLOCK);
+    else
+        size += snprintf (map + size, sizeof (map) - size,
+                          "<memory type=\"rom\" start=\"0x%x\""
+                          " length=\"0x%x\"/>\n", FLASH_OFFSET, flash);
+
+    size += snprintf (map + size, sizeof (map) - size,
+                      "<memory type=\"ram\" start=\"0x%x\""
+                      " length=\"0x%x\"/>\n", SRAM_OFFSET, data);
+
+#if defined(USE_EEPROM_SPACE)
+    if (eeprom)
+        size += snprintf (map + size, sizeof (map) - size,
+                          "<memory type=\"ram\" start=\"0x%x\""
+                          " length=\"0x%x\"/>\n", EEPROM_OFFSET, eeprom);
+#endif
+
+    size += snprintf (map + size, sizeof (map) - size, "</memory-map>\n");
+
+    pkt += gdb_get_addr_len (pkt, ',', '\0', &offset, &len);
+
+    if (offset > size)
+    {
+        gdb_send_reply (conn, "E01");
+        return;
+    }
+
+    if (len > size - offset)
+        len = size - offset;
+    if (len > MAX_BUF - 2)
+        len = MAX_BUF - 2;
+
+    reply[0] = (offset + len < size) ? 'm' : 'l';
+    memcpy (reply + 1, map + offset, len);
+    reply[len + 1] = '\0';
+
+    gdb_send_reply (conn, reply);
+}
+
+/* Flash commands, sent by gdb to load a program into the flash region of
+   the memory map:
+
+   "vFlashErase:addr,length"  -  erase the blocks, erased flash reads 0xff
+   "vFlashWrite:addr:data"    -  write binary data, see the X packet
+   "vFlashDone"               -  the program is loaded
+
+   end points after the packet. The simulated flash is written at once, so
+   vFlashDone has nothing left to do. */
+
+static void
+gdb_flash_command (GdbComm_T *comm, GdbConn_T *conn, char *pkt, char *end)
+{
+    int addr = 0;
+    int len = 0;
+    uint8_t *data;
+    int res;
+
+    if (strncmp (pkt, "Erase:", 6) == 0)
+    {
+        pkt += 6;
+        pkt += gdb_get_addr_len (pkt, ',', '\0', &addr, &len);
+
+        /* the range is checked before anything is allocated for it */
+        if ((addr < 0) || (len < 0) || (len > SRAM_OFFSET - addr))
+            res = -1;
+        else
+        {
+            data = avr_new (uint8_t, len + 1);
+            memset (data, 0xff, len);
+            res = gdb_mem_write (comm, addr, data, len);
+            avr_free (data);
+        }
+    }
+    else if (strncmp (pkt, "Write:", 6) == 0)
+    {
+        pkt += 6;
+        addr = gdb_extract_hex_num (&pkt, ':');
+        pkt++;                  /* skip over ':' character */
+        len = end - pkt;
+
+        res = ((addr >= 0) && (len <= SRAM_OFFSET - addr))
+            ? gdb_mem_write (comm, addr, (uint8_t *)pkt, len) : -1;
+    }
+    else if (strcmp (pkt, "Done") == 0)
+        res = 0;
+    else
+    {
+        gdb_send_reply (conn, "");
+        return;
+    }
+
+    gdb_send_reply (conn, (res < 0) ? "E01" : "OK");
+}
+
+/* Supported features query: "qSupported[:<gdb features>]"
+
+   Of the features of gdb only multiprocess matters, tell it the packet
+   size and if it may ask for reverse execution, the memory map or several
+   processes. */
+
+static void
+gdb_supported (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    char reply[MAX_BUF];
+
+    conn->multiprocess = conn->num_cores
+        && (strstr (pkt, "multiprocess+") != NULL);
+
+    snprintf (reply, sizeof (reply), "PacketSize=%x%s%s%s%s", MAX_BUF,
+              (comm->reverse_step && comm->reverse_continue)
+              ? ";ReverseStep+;ReverseContinue+" : "",
+              (comm->enable_breakpts && comm->disable_breakpts)
+              ? ";ConditionalBreakpoints+" : "",
+              comm->space_sizes ? ";qXfer:memory-map:read+" : "",
+              conn->num_cores ? ";multiprocess+" : "");
+    gdb_send_reply (conn, reply);
+}
+
+/* Thread queries with several cores: "qfThreadInfo" and "qsThreadInfo"
+   list the cores, "qC" is the selected one, "qThreadExtraInfo,id"
+   describes a core and "qAttached" tells gdb to detach rather than kill
+   when it quits. Returns 0 if pkt is none of them. */
+
+static int
+gdb_thread_query (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    char reply[MAX_BUF];
+    char info[256];
+    int n, len;
+
+    if (strcmp (pkt, "fThreadInfo") == 0)
+    {
+        reply[0] = 'm';
+        for (n = 0, len = 1; n < conn->num_cores; n++)
+        {
+            if (n > 0)
+                reply[len++] = ',';
+            gdb_thread_id (conn, n, reply + len, sizeof (reply) - len);
+            len += strlen (reply + len);
+            if (len > MAX_BUF - 32)
+                break;          /* gdb lists the first ones only */
+        }
+        gdb_send_reply (conn, reply);
+    }
+    else if (strcmp (pkt, "sThreadInfo") == 0)
+        gdb_send_reply (conn, "l");
+    else if (strcmp (pkt, "C") == 0)
+    {
+        strcpy (reply, "QC");
+        gdb_thread_id (conn, conn->cur_core, reply + 2, sizeof (reply) - 2);
+        gdb_send_reply (conn, reply);
+    }
+    else if (strncmp (pkt, "ThreadExtraInfo,", 16) == 0)
+    {
+        n = gdb_thread_core (conn, pkt + 16);
+        if (n < 0)
+        {
+            gdb_send_reply (conn, "E01");
+            return 1;
+        }
+
+        info[0] = '\0';
+        if (comm->core_info)
+            comm->core_info (comm->server, n, info, sizeof (info));
+        for (len = 0; info[len]; len++)
+        {
+            reply[2 * len] = HEX_DIGIT[(info[len] >> 4) & 0xf];
+            reply[2 * len + 1] = HEX_DIGIT[info[len] & 0xf];
+        }
+        reply[2 * len] = '\0';
+        gdb_send_reply (conn, reply);
+    }
+    else if (strncmp (pkt, "Attached", 8) == 0)
+        gdb_send_reply (conn, "1");
+    else
+        return 0;
+
+    return 1;
+}
+
 /* Dispatch various query request to specific handler functions. If a query is
    not handled, send an empry reply. */
 
 static void
-gdb_query_request (GdbComm_T *comm, int fd, char *pkt)
+gdb_query_request (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
 {
     int len;
 
+    if (conn->num_cores && gdb_thread_query (comm, conn, pkt))
+        return;
+
     switch (*pkt++)
     {
         case 'R':
+            gdb_core_select (comm, conn, conn->cur_core);
             len = strlen ("avr.io_reg");
             if (strncmp (pkt, "avr.io_reg", len) == 0)
             {
-                gdb_fetch_io_registers (comm, fd, pkt + len);
+                gdb_fetch_io_registers (comm, conn, pkt + len);
+                return;
+            }
+            len = strlen ("cmd,");
+            if (strncmp (pkt, "cmd,", len) == 0)
+            {
+                gdb_monitor (comm, conn, pkt + len);
                 return;
             }
+            break;
+
+        case 'S':
+            len = strlen ("upported");
+            if (strncmp (pkt, "upported", len) == 0)
+            {
+                gdb_supported (comm, conn, pkt + len);
+                return;
+            }
+            break;
+
+        case 'X':
+            gdb_core_select (comm, conn, conn->cur_core);
+            len = strlen ("fer:memory-map:read::");
+            if (comm->space_sizes
+                && (strncmp (pkt, "fer:memory-map:read::", len) == 0))
+            {
+                gdb_memory_map (comm, conn, pkt + len);
+                return;
+            }
+    }
+
+    gdb_send_reply (conn, "");
+}
+
+/* Send a stop reply with SREG, SP and PC. reason is put before the
+   registers, e.g. "replaylog:begin;". */
+
+static void
+gdb_send_stop_reply (GdbComm_T *comm, GdbConn_T *conn, int signo,
+                     const char *reason)
+{
+    char reply[MAX_BUF + 1];
+    char thread[64] = "";
+    int pc = comm->read_pc (comm->user_data) * 2;
+
+    /* with several cores gdb is told which one stopped */
+    if (conn->num_cores)
+    {
+        strcpy (thread, "thread:");
+        gdb_thread_id (conn, conn->cur_core, thread + 7, sizeof (thread) - 8);
+        strcat (thread, ";");
     }
 
-    gdb_send_reply (fd, "");
+    snprintf (reply, MAX_BUF,
+              "T%02x%s" "20:%02x;" "21:%02x%02x;" "22:%02x%02x%02x%02x;%s",
+              signo, reason, comm->read_sreg (comm->user_data),
+              comm->read_sram (comm->user_data, SPL_ADDR),
+              comm->read_sram (comm->user_data, SPH_ADDR), pc & 0xff,
+              (pc >> 8) & 0xff, (pc >> 16) & 0xff, (pc >> 24) & 0xff,
+              thread);
+
+    gdb_send_reply (conn, reply);
+}
+
+/* Put the stop reason of the watchpoint hit by the last instruction into
+   reason, e.g. "watch:800100;". */
+
+static void
+gdb_watch_reason (GdbComm_T *comm, char *reason, int size)
+{
+    int eeprom, addr, flag;
+
+    if (comm->watch_hit == NULL)
+        return;
+
+    flag = comm->watch_hit (comm->user_data, &eeprom, &addr);
+    addr += eeprom ? EEPROM_OFFSET : SRAM_OFFSET;
+    snprintf (reason, size, "%s:%x;",
+              (flag == 1) ? "watch" : (flag == 2) ? "rwatch" : "awatch",
+              addr);
+}
+
+/* Look for a core that reached a break point while it ran on its own. A
+   break point whose conditions are all false is passed over and the core
+   let go again. Returns 1 with the core selected if gdb has to be told. */
+
+static int
+gdb_core_trapped (GdbComm_T *comm, GdbConn_T *conn)
+{
+    int cur = conn->cur_core;
+    int n;
+
+    while ((n = comm->trapped_core (comm->server)) >= 0)
+    {
+        gdb_core_select (comm, conn, n);
+
+        if (conn->conds && comm->enable_breakpts && comm->disable_breakpts
+            && !gdb_cond_stop (comm, conn))
+        {
+            gdb_step_over (comm);
+            comm->release_core (comm->server, n);
+            conn->held[n] = NULL;
+            gdb_core_select (comm, conn, cur);
+            continue;
+        }
+
+        if (comm->disable_breakpts)
+            comm->disable_breakpts (comm->user_data);
+        return 1;
+    }
+
+    return 0;
 }
 
 /* Continue command format: "c<addr>" or "s<addr>"
@@ -951,24 +1915,20 @@ gdb_query_request (GdbComm_T *comm, int fd, char *pkt)
    address. */
 
 static void
-gdb_continue (GdbComm_T *comm, int fd, char *pkt)
+gdb_continue (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
 {
-    char reply[MAX_BUF + 1];
     int res;
-    int pc;
     char step = *(pkt - 1);     /* called from 'c' or 's'? */
     int signo = SIGTRAP;
-
-    static int is_running = 0;
+    unsigned int count = 0;
+    char reason[32] = "";
 
     /* This allows gdb_continue to be reentrant while it's running. */
-    if (is_running == 1)
+    if (conn->is_running == 1)
     {
         return;
     }
-    is_running = 1;
-
-    memset (reply, 0, sizeof (reply));
+    conn->is_running = 1;
 
     if (*pkt != '\0')
     {
@@ -980,16 +1940,32 @@ gdb_continue (GdbComm_T *comm, int fd, char *pkt)
         avr_error ("attempt to resume at other than current");
     }
 
+    /* With several cores the one picked with Hc is run here. Hc-1 resumes
+       all of them, the others are let go to run on their own. */
+    if (conn->num_cores)
+    {
+        if (conn->cont_core >= 0)
+            gdb_core_select (comm, conn, conn->cont_core);
+        else
+            gdb_core_release (comm, conn, conn->cur_core);
+    }
+
     while (1)
     {
-        if (signal_has_occurred (SIGINT))
+        if (signal_has_occurred (&conn->sigint))
         {
-            global_server_quit = 1;
+            conn->server_quit = 1;
             break;
         }
 
         res = comm->step (comm->user_data);
 
+        /* a break point whose conditions are all false is passed over
+           without asking gdb */
+        if ((res == BREAK_POINT) && conn->conds && comm->enable_breakpts
+            && comm->disable_breakpts && !gdb_cond_stop (comm, conn))
+            res = gdb_step_over (comm);
+
         if (res == BREAK_POINT)
         {
             if (comm->disable_breakpts)
@@ -997,8 +1973,30 @@ gdb_continue (GdbComm_T *comm, int fd, char *pkt)
             break;
         }
 
-        /* check if gdb sent any messages */
-        res = gdb_pre_parse_packet (comm, fd, GDB_BLOCKING_OFF);
+        if (res == WATCH_POINT)
+        {
+            gdb_watch_reason (comm, reason, sizeof (reason));
+            break;
+        }
+
+        /* If called from 's' or 'S', only want to step once */
+        if ((step == 's') || (step == 'S'))
+            break;
+
+        /* Check if gdb sent any messages (Ctrl-C). A read per instruction
+           costs more than the instruction, so only poll the socket every
+           GDB_POLL_STEPS instructions. */
+        if (++count < GDB_POLL_STEPS)
+            continue;
+        count = 0;
+
+        if (conn->num_cores && gdb_core_trapped (comm, conn))
+            break;
+
+        if (!gdb_input_pending (conn))
+            continue;
+
+        res = gdb_pre_parse_packet (comm, conn, GDB_BLOCKING_OFF);
         if (res < 0)
         {
             if (res == GDB_RET_CTRL_C)
@@ -1007,34 +2005,71 @@ gdb_continue (GdbComm_T *comm, int fd, char *pkt)
             }
             break;
         }
-
-        /* If called from 's' or 'S', only want to step once */
-        if ((step == 's') || (step == 'S'))
-            break;
     }
 
-    /* If reply hasn't been set, respond as if a breakpoint was hit. */
-    if (reply[0] == '\0')
+    /* respond as if a breakpoint was hit */
+    gdb_send_stop_reply (comm, conn, signo, reason);
+
+    conn->is_running = 0;
+}
+
+/* Polled while the core runs backwards: SIGINT or anything gdb sends
+   (Ctrl-C) interrupts it. */
+
+static int
+gdb_reverse_interrupted (void *data)
+{
+    GdbConn_T *conn = (GdbConn_T *)data;
+
+    if (signal_has_occurred (&conn->sigint))
     {
-        /* Send gdb SREG, SP, PC */
-        int bytes = 0;
+        conn->server_quit = 1;
+        return 1;
+    }
 
-        pc = comm->read_pc (comm->user_data) * 2;
+    return gdb_input_pending (conn);
+}
+
+/* Reverse execution format: "bs" (step back) or "bc" (continue back)
 
-        bytes = snprintf (reply, MAX_BUF, "T%02x", signo);
+   At the start of the history the stop reply tells gdb with
+   "replaylog:begin", a watchpoint is reported as by gdb_continue(). An
+   interrupted "bc" stops where it started with SIGINT. */
 
-        /* SREG, SP & PC */
-        snprintf (reply + bytes, MAX_BUF - bytes,
-                  "20:%02x;" "21:%02x%02x;" "22:%02x%02x%02x%02x;",
-                  comm->read_sreg (comm->user_data),
-                  comm->read_sram (comm->user_data, SPL_ADDR),
-                  comm->read_sram (comm->user_data, SPH_ADDR), pc & 0xff,
-                  (pc >> 8) & 0xff, (pc >> 16) & 0xff, (pc >> 24) & 0xff);
+static void
+gdb_reverse (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    int res;
+    int signo = SIGTRAP;
+    char reason[32] = "replaylog:begin;";
+
+    if ((comm->reverse_step == NULL) || (comm->reverse_continue == NULL)
+        || ((pkt[0] != 's') && (pkt[0] != 'c')) || (pkt[1] != '\0'))
+    {
+        gdb_send_reply (conn, "");
+        return;
     }
 
-    gdb_send_reply (fd, reply);
+    if (pkt[0] == 's')
+        res = comm->reverse_step (comm->user_data);
+    else
+        res = comm->reverse_continue (comm->user_data,
+                                      gdb_reverse_interrupted, conn);
+
+    if (res == -2)
+    {
+        /* take the Ctrl-C, as gdb_continue() does */
+        if (!conn->server_quit && gdb_input_pending (conn))
+            gdb_pre_parse_packet (comm, conn, GDB_BLOCKING_OFF);
+        signo = SIGINT;
+        reason[0] = '\0';
+    }
+    else if (res == 0)
+        reason[0] = '\0';
+    else if (res > 0)
+        gdb_watch_reason (comm, reason, sizeof (reason));
 
-    is_running = 0;
+    gdb_send_stop_reply (comm, conn, signo, reason);
 }
 
 /* Continue with signal command format: "C<sig>;<addr>" or "S<sig>;<addr>"
@@ -1045,7 +2080,7 @@ gdb_continue (GdbComm_T *comm, int fd, char *pkt)
    address. */
 
 static void
-gdb_continue_with_signal (GdbComm_T *comm, int fd, char *pkt)
+gdb_continue_with_signal (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
 {
     int signo;
     char step = *(pkt - 1);
@@ -1055,7 +2090,7 @@ gdb_continue_with_signal (GdbComm_T *comm, int fd, char *pkt)
     signo = (hex2nib (*pkt++) << 4);
     signo += (hex2nib (*pkt++) & 0xf);
 
-    if (global_debug_on)
+    if (conn->debug_on)
         fprintf (stderr, "GDB sent signal: %d\n", signo);
 
     /* Process signals send via remote protocol from gdb. Signals really don't
@@ -1069,7 +2104,7 @@ gdb_continue_with_signal (GdbComm_T *comm, int fd, char *pkt)
                itself. We reply with a SIGTRAP the same as we do when gdb
                makes first connection with simulator. */
             comm->reset (comm->user_data);
-            gdb_send_reply (fd, "S05");
+            gdb_send_reply (conn, "S05");
             return;
         default:
             /* Gdb user issuing the 'signal <signum>' command where signum is
@@ -1099,88 +2134,204 @@ gdb_continue_with_signal (GdbComm_T *comm, int fd, char *pkt)
     else
     {
         avr_warning ("Malformed packet: \"%s\"\n", pkt);
-        gdb_send_reply (fd, "");
+        gdb_send_reply (conn, "");
         return;
     }
 
-    gdb_continue (comm, fd, pkt);
+    gdb_continue (comm, conn, pkt);
 }
 
-/* Parse the packet. Assumes that packet is null terminated.
+/* Thread packets with several cores: "Hg<id>" selects the core of the
+   following packets, "Hc<id>" the one to resume, "T<id>" asks if a core
+   exists. */
+
+static void
+gdb_thread_packet (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    char op = *(pkt - 1);
+    int n;
+
+    if (op == 'H')
+        op = *pkt++;
+
+    n = gdb_thread_core (conn, pkt);
+    if (n < -1)
+    {
+        gdb_send_reply (conn, "E01");
+        return;
+    }
+
+    switch (op)
+    {
+        case 'g':
+            gdb_core_select (comm, conn, (n < 0) ? conn->cur_core : n);
+            break;
+
+        case 'c':
+            conn->cont_core = n;
+            break;
+
+        case 'T':
+            if (n < 0)
+            {
+                gdb_send_reply (conn, "E01");
+                return;
+            }
+            break;
+
+        default:
+            gdb_send_reply (conn, "");
+            return;
+    }
+
+    gdb_send_reply (conn, "OK");
+}
+
+/* Detach with several cores: "D;pid" lets that core go, the session goes
+   on. A plain "D" or "k" lets all of them go and ends the session, the
+   cores are not reset as they may be in use by their hosts. */
+
+static int
+gdb_detach (GdbComm_T *comm, GdbConn_T *conn, char *pkt)
+{
+    int n;
+
+    if (*pkt == ';')
+    {
+        n = gdb_thread_core (conn, pkt + 1);
+        if (n < 0)
+        {
+            gdb_send_reply (conn, "E01");
+            return GDB_RET_OK;
+        }
+
+        if (conn->held[n])
+        {
+            comm->release_core (comm->server, n);
+            conn->held[n] = NULL;
+        }
+        gdb_send_reply (conn, "OK");
+        return GDB_RET_OK;
+    }
+
+    gdb_core_release (comm, conn, -1);
+    gdb_send_reply (conn, "OK");
+    return GDB_RET_KILL_REQUEST;
+}
+
+/* Parse the packet. Assumes that packet is null terminated, len is needed
+   for the binary data of some packets.
    Return GDB_RET_KILL_REQUEST if packet is 'kill' command,
    GDB_RET_OK otherwise. */
 
 static int
-gdb_parse_packet (GdbComm_T *comm, int fd, char *pkt)
+gdb_parse_packet (GdbComm_T *comm, GdbConn_T *conn, char *pkt, int len)
 {
+    char *end = pkt + len;
+
+    /* the packets working on a core need the selected one held */
+    if (conn->num_cores && strchr ("?gGpPmMXcsCSbzZv", *pkt))
+        gdb_core_select (comm, conn, conn->cur_core);
+
     switch (*pkt++)
     {
         case '?':              /* last signal */
-            gdb_send_reply (fd, "S05"); /* signal # 5 is SIGTRAP */
+            if (conn->num_cores)
+                gdb_send_stop_reply (comm, conn, SIGTRAP, "");
+            else
+                gdb_send_reply (conn, "S05"); /* signal # 5 is SIGTRAP */
             break;
 
         case 'g':              /* read registers */
-            gdb_read_registers (comm, fd);
+            gdb_read_registers (comm, conn);
             break;
 
         case 'G':              /* write registers */
-            gdb_write_registers (comm, fd, pkt);
+            gdb_write_registers (comm, conn, pkt);
             break;
 
         case 'p':              /* read a single register */
-            gdb_read_register (comm, fd, pkt);
+            gdb_read_register (comm, conn, pkt);
             break;
 
         case 'P':              /* write single register */
-            gdb_write_register (comm, fd, pkt);
+            gdb_write_register (comm, conn, pkt);
             break;
 
         case 'm':              /* read memory */
-            gdb_read_memory (comm, fd, pkt);
+            gdb_read_memory (comm, conn, pkt);
             break;
 
         case 'M':              /* write memory */
-            gdb_write_memory (comm, fd, pkt);
+            gdb_write_memory (comm, conn, pkt);
+            break;
+
+        case 'X':              /* write memory, binary data */
+            gdb_write_memory_binary (comm, conn, pkt, end);
             break;
 
         case 'k':              /* kill request */
         case 'D':              /* Detach request */
+            if (conn->num_cores)
+                return gdb_detach (comm, conn, pkt);
+
             /* Reset the simulator since there may be another connection
                before the simulator stops running. */
 
             comm->reset (comm->user_data);
-            gdb_send_reply (fd, "OK");
+            gdb_send_reply (conn, "OK");
             return GDB_RET_KILL_REQUEST;
 
         case 'C':              /* continue with signal */
         case 'S':              /* step with signal */
-            gdb_continue_with_signal (comm, fd, pkt);
+            gdb_continue_with_signal (comm, conn, pkt);
             break;
 
         case 'c':              /* continue */
         case 's':              /* step */
-            gdb_continue (comm, fd, pkt);
+            gdb_continue (comm, conn, pkt);
+            break;
+
+        case 'b':              /* reverse step or continue */
+            gdb_reverse (comm, conn, pkt);
             break;
 
         case 'z':              /* remove break/watch point */
         case 'Z':              /* insert break/watch point */
-            gdb_break_point (comm, fd, pkt);
+            gdb_break_point (comm, conn, pkt);
             break;
 
         case 'q':              /* query requests */
-            gdb_query_request (comm, fd, pkt);
+            gdb_query_request (comm, conn, pkt);
+            break;
+
+        case 'H':              /* set thread */
+        case 'T':              /* thread alive */
+            if (conn->num_cores)
+                gdb_thread_packet (comm, conn, pkt);
+            else
+                gdb_send_reply (conn, "");
+            break;
+
+        case 'v':              /* flash commands */
+            if (strncmp (pkt, "Flash", 5) == 0)
+                gdb_flash_command (comm, conn, pkt + 5, end);
+            else
+                gdb_send_reply (conn, "");
             break;
 
         default:
-            gdb_send_reply (fd, "");
+            gdb_send_reply (conn, "");
     }
 
     return GDB_RET_OK;
 }
 
 static void
-gdb_set_blocking_mode (int fd, int mode)
+gdb_set_blocking_mode (GdbConn_T *conn, int mode)
 {
+    int fd = conn->fd;
+
     if (mode)
     {
         /* turn non-blocking mode off */
@@ -1193,30 +2344,37 @@ gdb_set_blocking_mode (int fd, int mode)
         if (fcntl (fd, F_SETFL, fcntl (fd, F_GETFL, 0) | O_NONBLOCK) < 0)
             avr_warning ("fcntl failed: %s\n", strerror (errno));
     }
+
+    conn->block_on = mode;
 }
 
 /* Perform pre-packet parsing. This will handle messages from gdb which are
    outside the realm of packets or prepare a packet for parsing.
 
-   Use the static block_on flag to reduce the over head of turning blocking on
-   and off every time this function is called. */
+   Use the block_on flag of the connection to reduce the over head of turning
+   blocking on and off every time this function is called.
+
+   The binary data of the X and vFlashWrite packets escapes '#', '$', '}'
+   and '*' with a '}' and the byte xor 0x20, the packet is unescaped before
+   parsing. */
 
 static int
-gdb_pre_parse_packet (GdbComm_T *comm, int fd, int blocking)
+gdb_pre_parse_packet (GdbComm_T *comm, GdbConn_T *conn, int blocking)
 {
     int i, res;
     int c;
     char pkt_buf[MAX_BUF + 1];
     int cksum, pkt_cksum;
-    static int block_on = 1;    /* default is blocking mode */
+    int binary;
 
-    if (block_on != blocking)
-    {
-        gdb_set_blocking_mode (fd, blocking);
-        block_on = blocking;
-    }
+    if (conn->block_on != blocking)
+        gdb_set_blocking_mode (conn, blocking);
+
+    /* the target is stopped while gdb is waited for */
+    if ((blocking == GDB_BLOCKING_ON) && comm->flush)
+        comm->flush (comm->user_data);
 
-    c = gdb_read_byte (fd);
+    c = gdb_read_byte (conn);
 
     switch (c)
     {
@@ -1225,19 +2383,31 @@ gdb_pre_parse_packet (GdbComm_T *comm, int fd, int blocking)
             memset (pkt_buf, 0, sizeof (pkt_buf));
 
             /* make sure we block on fd */
-            gdb_set_blocking_mode (fd, GDB_BLOCKING_ON);
+            if (conn->block_on != GDB_BLOCKING_ON)
+                gdb_set_blocking_mode (conn, GDB_BLOCKING_ON);
 
             pkt_cksum = i = 0;
-            c = gdb_read_byte (fd);
-            while ((c != '#') && (i < MAX_BUF))
+            c = gdb_read_byte (conn);
+            binary = (c == 'X') || (c == 'v');
+            while ((c >= 0) && (c != '#') && (i < MAX_BUF))
             {
-                pkt_buf[i++] = c;
                 pkt_cksum += (unsigned char)c;
-                c = gdb_read_byte (fd);
+                if (binary && (c == '}'))
+                {
+                    c = gdb_read_byte (conn);
+                    pkt_cksum += (unsigned char)c;
+                    c ^= 0x20;
+                }
+                pkt_buf[i++] = c;
+                c = gdb_read_byte (conn);
             }
 
-            cksum = hex2nib (gdb_read_byte (fd)) << 4;
-            cksum |= hex2nib (gdb_read_byte (fd));
+            /* interrupted by SIGINT */
+            if (c < 0)
+                return GDB_RET_KILL_REQUEST;
+
+            cksum = hex2nib (gdb_read_byte (conn)) << 4;
+            cksum |= hex2nib (gdb_read_byte (conn));
 
             /* FIXME: Should send "-" (Nak) instead of aborting when we get
                checksum errors. Leave this as an error until it is actually
@@ -1249,26 +2419,26 @@ gdb_pre_parse_packet (GdbComm_T *comm, int fd, int blocking)
                 avr_error ("Bad checksum: sent 0x%x <--> computed 0x%x",
                            cksum, pkt_cksum);
 
-            if (global_debug_on)
+            if (conn->debug_on)
                 fprintf (stderr, "Recv: \"$%s#%02x\"\n", pkt_buf, cksum);
 
             /* always acknowledge a well formed packet immediately */
-            gdb_send_ack (fd);
+            gdb_send_ack (conn);
 
-            res = gdb_parse_packet (comm, fd, pkt_buf);
+            res = gdb_parse_packet (comm, conn, pkt_buf, i);
             if (res < 0)
                 return res;
 
             break;
 
         case '-':
-            if (global_debug_on)
+            if (conn->debug_on)
                 fprintf (stderr, " gdb -> Nak\n");
-            gdb_send_reply (fd, gdb_last_reply (NULL));
+            gdb_send_reply (conn, gdb_last_reply (conn, NULL));
             break;
 
         case '+':
-            if (global_debug_on)
+            if (conn->debug_on)
                 fprintf (stderr, " gdb -> Ack\n");
             break;
 
@@ -1279,7 +2449,10 @@ gdb_pre_parse_packet (GdbComm_T *comm, int fd, int blocking)
             return GDB_RET_CTRL_C;
 
         case -1:
-            /* fd is non-blocking and no data to read */
+            /* fd is non-blocking and no data to read, or a blocking read
+               was interrupted by SIGINT */
+            if (conn->server_quit && (conn->block_on == GDB_BLOCKING_ON))
+                return GDB_RET_KILL_REQUEST;
             break;
 
         default:
@@ -1290,23 +2463,29 @@ gdb_pre_parse_packet (GdbComm_T *comm, int fd, int blocking)
 }
 
 static void
-gdb_main_loop (GdbComm_T *comm, int fd)
+gdb_main_loop (GdbComm_T *comm, GdbConn_T *conn)
 {
     int res;
     char reply[MAX_BUF];
 
     while (1)
     {
-        res = gdb_pre_parse_packet (comm, fd, GDB_BLOCKING_ON);
+        res = gdb_pre_parse_packet (comm, conn, GDB_BLOCKING_ON);
         switch (res)
         {
             case GDB_RET_KILL_REQUEST:
                 return;
 
             case GDB_RET_CTRL_C:
-                gdb_send_ack (fd);
+                gdb_send_ack (conn);
+                if (conn->num_cores)
+                {
+                    gdb_core_select (comm, conn, conn->cur_core);
+                    gdb_send_stop_reply (comm, conn, SIGINT, "");
+                    break;
+                }
                 snprintf (reply, MAX_BUF, "S%02x", SIGINT);
-                gdb_send_reply (fd, reply);
+                gdb_send_reply (conn, reply);
                 break;
 
             default:
@@ -1325,15 +2504,27 @@ gdb_main_loop (GdbComm_T *comm, int fd)
  * given port. Once a connection is established, enter an infinite loop and
  * process command requests from gdb using the remote serial protocol. Only a
  * single connection is allowed at a time.
+ *
+ * If comm->num_cores is set, gdb sees every core as a process and only the
+ * cores it selects are held, see GdbConn.
  */
 void
 gdb_interact (GdbComm_T *comm, int port, int debug_on)
 {
     struct sockaddr_in address[1];
-    int sock, conn, i;
+    int sock, i;
     socklen_t addrLength[1];
+    GdbConn_T conn[1];
 
-    global_debug_on = debug_on;
+    memset (conn, 0, sizeof (conn));
+    conn->fd = -1;
+    conn->debug_on = debug_on;
+
+    if (comm->num_cores)
+    {
+        conn->num_cores = comm->num_cores (comm->server);
+        conn->held = avr_new0 (void *, conn->num_cores);
+    }
 
     if ((sock = socket (PF_INET, SOCK_STREAM, 0)) < 0)
         avr_error ("Can't create socket: %s", strerror (errno));
@@ -1351,15 +2542,15 @@ gdb_interact (GdbComm_T *comm, int port, int debug_on)
     if (bind (sock, (struct sockaddr *)address, sizeof (address)))
         avr_error ("Can not bind socket: %s", strerror (errno));
 
-    signal_watch_start (SIGINT);
+    signal_watch_start (&conn->sigint, SIGINT);
 
-    while (global_server_quit == 0)
+    while (conn->server_quit == 0)
     {
         if (listen (sock, 1))
         {
             int saved_errno = errno;
 
-            if (signal_has_occurred (SIGINT))
+            if (signal_has_occurred (&conn->sigint))
             {
                 break;          /* SIGINT will cause listen to be
                                    interrupted */
@@ -1376,12 +2567,12 @@ gdb_interact (GdbComm_T *comm, int port, int debug_on)
 
         /* We only want to accept a single connection, thus don't need a
            loop. */
-        conn = accept (sock, (struct sockaddr *)address, addrLength);
-        if (conn < 0)
+        conn->fd = accept (sock, (struct sockaddr *)address, addrLength);
+        if (conn->fd < 0)
         {
             int saved_errno = errno;
 
-            if (signal_has_occurred (SIGINT))
+            if (signal_has_occurred (&conn->sigint))
             {
                 break;          /* SIGINT will cause accept to be
                                    interrupted */
@@ -1398,7 +2589,7 @@ gdb_interact (GdbComm_T *comm, int port, int debug_on)
            Programming", Vol 1, 2nd Ed, page 202 for more info) */
 
         i = 1;
-        setsockopt (conn, IPPROTO_TCP, TCP_NODELAY, &i, sizeof (i));
+        setsockopt (conn->fd, IPPROTO_TCP, TCP_NODELAY, &i, sizeof (i));
 
         /* If we got this far, we now have a client connected and can start 
            processing. */
@@ -1406,11 +2597,25 @@ gdb_interact (GdbComm_T *comm, int port, int debug_on)
         fprintf (stderr, "Connection opened by host %s, port %hd.\n",
                  inet_ntoa (address->sin_addr), ntohs (address->sin_port));
 
+        /* a new connection starts in blocking mode */
+        conn->block_on = GDB_BLOCKING_ON;
+        conn->rx_pos = conn->rx_len = 0;
+        conn->is_running = 0;
+        conn->multiprocess = 0;
+        conn->cur_core = 0;
+        conn->cont_core = -1;
+
         gdb_main_loop (comm, conn);
 
-        comm->reset (comm->user_data);
+        /* several cores are let go, they may be in use by their hosts */
+        if (conn->num_cores)
+            gdb_core_release (comm, conn, -1);
+        else
+            comm->reset (comm->user_data);
+        gdb_cond_remove (conn, -1);
 
-        close (conn);
+        close (conn->fd);
+        conn->fd = -1;
 
         /* FIXME: How do we correctly break out of this loop? This keeps the
            simulator server up so you don't have to restart it with every gdb
@@ -1418,13 +2623,16 @@ gdb_interact (GdbComm_T *comm, int port, int debug_on)
            signal which causes the program to terminate, in which case, you
            won't get a dump of the simulator's state. This might actually be
            acceptable behavior. */
-        if (signal_has_occurred (SIGINT))
+        if (signal_has_occurred (&conn->sigint))
         {
             break;
         }
     }
 
-    signal_watch_stop (SIGINT);
+    signal_watch_stop (&conn->sigint);
+
+    avr_free (conn->last_reply);
+    avr_free (conn->held);
 
     close (sock);
 }
@@ -0,0 +1,460 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file hostio.c
+ * \brief Line based channel between the simulated card and the host.
+ *
+ * In the default HOSTIO_STDIO mode lines are read from stdin (blocking) and
+ * written to stdout, exactly as the single card simulator always did.
+ *
+ * In HOSTIO_FD mode (used by the multi card server, see server.c) the
+ * channel is a socket. Reading never blocks: hostio_read_line() returns 0
+ * if no complete line was received yet. The device then calls hostio_wait()
+ * to tell the scheduler that the core must not be stepped until more data
+ * arrives; the server fills the buffer with hostio_fill() and calls
+ * hostio_resume() once hostio_has_line() is true.
+ *
+ * HOSTIO_MEM mode works the same way, but the input is given with
+ * hostio_put_input() and the output is collected in memory until
+ * hostio_take_output() is called. This is used by the library API.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+
+#include "hostio.h"
+#include "snapshot.h"
+#include "replay.h"
+
+/** \brief Allocate a new HostIO object connected to stdin/stdout. */
+
+HostIO *
+hostio_new (void)
+{
+    HostIO *host;
+
+    host = avr_new (HostIO, 1);
+    hostio_construct (host);
+    class_overload_destroy ((AvrClass *)host, hostio_destroy);
+
+    return host;
+}
+
+/** \brief Constructor for the HostIO class. */
+
+void
+hostio_construct (HostIO *host)
+{
+    if (host == NULL)
+        avr_error ("passed null ptr");
+
+    class_construct ((AvrClass *)host);
+
+    host->mode = HOSTIO_STDIO;
+    host->fd = -1;
+    host->eof = 0;
+    host->in_len = 0;
+    host->skip = 0;
+    host->overlong = 0;
+    host->out_buf = NULL;
+    host->out_len = 0;
+    host->out_size = 0;
+    host->resume = NULL;
+    host->resume_data = NULL;
+    host->replay = NULL;
+    host->mute = 0;
+}
+
+/** \brief Destructor for the HostIO class.
+
+    The socket is owned by the caller of hostio_attach_fd() and is not
+    closed here. */
+
+void
+hostio_destroy (void *host)
+{
+    HostIO *_host = (HostIO *)host;
+
+    if (host == NULL)
+        return;
+
+    avr_free (_host->out_buf);
+
+    class_destroy (host);
+}
+
+/**
+ * \brief Switch the channel to socket mode.
+ *
+ * Any data buffered from a previous connection is dropped. Passing -1 keeps
+ * the socket mode, but output is discarded and no input arrives until a new
+ * socket is attached.
+ */
+void
+hostio_attach_fd (HostIO *host, int fd)
+{
+    host->mode = HOSTIO_FD;
+    host->fd = fd;
+    host->in_len = 0;
+    host->skip = 0;
+    host->overlong = 0;
+}
+
+/* Drop the received data up to the end of the overlong line. */
+
+static void
+hostio_skip_line (HostIO *host)
+{
+    char *nl = memchr (host->in_buf, '\n', host->in_len);
+
+    if (nl == NULL)
+    {
+        host->in_len = 0;
+        return;
+    }
+
+    host->in_len -= nl - host->in_buf + 1;
+    memmove (host->in_buf, nl + 1, host->in_len);
+    host->skip = 0;
+    host->overlong = 1;
+}
+
+/**
+ * \brief Read whatever is available on the socket into the input buffer.
+ *
+ * Returns the number of bytes read, 0 if the peer closed the connection
+ * and -1 if no data was available (or the buffer is full).
+ */
+int
+hostio_fill (HostIO *host)
+{
+    ssize_t n;
+
+    if (host->fd < 0)
+        return 0;
+
+    /* The buffer is only filled while the device waits for a line, so a
+       full buffer holds a single line that does not fit. Drop it up to its
+       newline, hostio_read_line() then reports it. */
+    if (host->in_len >= HOSTIO_BUF_SIZE)
+    {
+        host->in_len = 0;
+        host->skip = 1;
+    }
+
+    do
+    {
+        n = recv (host->fd, host->in_buf + host->in_len,
+                  HOSTIO_BUF_SIZE - host->in_len, MSG_DONTWAIT);
+    } while ((n < 0) && (errno == EINTR));
+
+    if (n < 0)
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            return -1;
+        return 0;               /* treat errors like a hang up */
+    }
+
+    host->in_len += n;
+
+    if (host->skip)
+        hostio_skip_line (host);
+
+    return n;
+}
+
+/** \brief Switch the channel to memory buffer mode. */
+
+void
+hostio_use_buffers (HostIO *host)
+{
+    host->mode = HOSTIO_MEM;
+    host->fd = -1;
+    host->in_len = 0;
+    host->skip = 0;
+    host->overlong = 0;
+    host->out_len = 0;
+}
+
+/**
+ * \brief Queue data for the device (memory buffer mode).
+ *
+ * In stdio mode the queued lines are read before the next line of stdin
+ * (the 'apdu' monitor command of the gdbserver). Returns the number of
+ * bytes queued or -1 if they do not fit.
+ */
+int
+hostio_put_input (HostIO *host, const char *data, int len)
+{
+    if (len > HOSTIO_BUF_SIZE - host->in_len)
+        return -1;
+
+    memcpy (host->in_buf + host->in_len, data, len);
+    host->in_len += len;
+
+    return len;
+}
+
+/**
+ * \brief Take up to \a size bytes of device output (memory buffer mode).
+ *
+ * Returns the number of bytes copied to \a buf. No terminating zero is
+ * added.
+ */
+int
+hostio_take_output (HostIO *host, char *buf, int size)
+{
+    int len = (host->out_len < size) ? host->out_len : size;
+
+    if (len <= 0)
+        return 0;
+
+    memcpy (buf, host->out_buf, len);
+    host->out_len -= len;
+    memmove (host->out_buf, host->out_buf + len, host->out_len);
+
+    return len;
+}
+
+/** \brief Return non-zero if a complete line is buffered (stdio mode:
+    until the end of the input). */
+
+int
+hostio_has_line (HostIO *host)
+{
+    if (host->replay && replay_playing (host->replay))
+        return replay_pending (host->replay, REPLAY_LINE);
+
+    if (host->overlong || memchr (host->in_buf, '\n', host->in_len))
+        return 1;
+
+    return (host->mode == HOSTIO_STDIO) && !host->eof;
+}
+
+/* Report a dropped line. */
+
+static int
+hostio_overlong (HostIO *host)
+{
+    host->overlong = 0;
+    avr_warning ("host line too long, dropped\n");
+
+    return -1;
+}
+
+/* Read a line from the input of the mode, see hostio_read_line(). */
+
+static int
+hostio_get_line (HostIO *host, char *buf, int size)
+{
+    char *nl = memchr (host->in_buf, '\n', host->in_len);
+    int len, c;
+
+    if (host->overlong)
+        return hostio_overlong (host);
+
+    if ((host->mode == HOSTIO_STDIO) && (nl == NULL))
+    {
+        fflush (stdin);
+        while (buf != fgets (buf, size, stdin))
+        {
+            if (feof (stdin))
+            {
+                host->eof = 1;
+                return 0;
+            }
+            clearerr (stdin);
+        }
+        fprintf (stderr, "%s", buf);
+
+        /* fgets() stopped before the newline, drop the rest */
+        len = strlen (buf);
+        if ((len == size - 1) && (buf[len - 1] != '\n'))
+        {
+            do
+                c = getchar ();
+            while ((c != '\n') && (c != EOF));
+            fprintf (stderr, "\n");
+            return hostio_overlong (host);
+        }
+        return 1;
+    }
+
+    if (nl == NULL)
+        return 0;
+
+    len = nl - host->in_buf + 1;
+    if (len < size)
+    {
+        memcpy (buf, host->in_buf, len);
+        buf[len] = '\0';
+    }
+
+    host->in_len -= len;
+    memmove (host->in_buf, host->in_buf + len, host->in_len);
+
+    if (len >= size)
+        return hostio_overlong (host);
+
+    if (host->mode == HOSTIO_STDIO)
+        fprintf (stderr, "%s", buf);
+
+    return 1;
+}
+
+/**
+ * \brief Read one line (including the trailing newline) into \a buf.
+ *
+ * In stdio mode this blocks until a line is available and returns 0 at the
+ * end of the input. In socket and memory mode it returns 0 if no complete
+ * line is buffered, 1 otherwise. A line that does not fit into \a buf is
+ * dropped with a warning and -1 is returned, the device should tell the
+ * host. While replaying (see replay.c) the lines come from the log only,
+ * its end is the end of the input.
+ */
+int
+hostio_read_line (HostIO *host, char *buf, int size)
+{
+    int res;
+
+    if (host->replay && replay_playing (host->replay))
+    {
+        if (replay_get (host->replay, REPLAY_LINE, buf, size) < 0)
+            return 0;
+        if ((host->mode == HOSTIO_STDIO) && !host->mute)
+            fprintf (stderr, "%s", buf);
+        return 1;
+    }
+
+    res = hostio_get_line (host, buf, size);
+    if (res <= 0)
+        return res;
+    if (host->replay)
+        replay_put (host->replay, REPLAY_LINE, buf, strlen (buf));
+
+    return 1;
+}
+
+/** \brief Send formatted output to the host. */
+
+void
+hostio_printf (HostIO *host, const char *fmt, ...)
+{
+    char buf[HOSTIO_BUF_SIZE * 3];
+    va_list ap;
+    int len, off;
+    ssize_t n;
+
+    if (host->mute)
+        return;
+
+    va_start (ap, fmt);
+    if (host->mode == HOSTIO_STDIO)
+    {
+        vfprintf (stdout, fmt, ap);
+        va_end (ap);
+        return;
+    }
+    len = vsnprintf (buf, sizeof (buf), fmt, ap);
+    va_end (ap);
+
+    if (len >= (int)sizeof (buf))
+        len = sizeof (buf) - 1;
+
+    if (host->mode == HOSTIO_MEM)
+    {
+        if (host->out_len + len > host->out_size)
+        {
+            host->out_size = (host->out_len + len) * 2;
+            host->out_buf = avr_realloc (host->out_buf, host->out_size);
+        }
+        memcpy (host->out_buf + host->out_len, buf, len);
+        host->out_len += len;
+        return;
+    }
+
+    /* A write error means the peer is gone, the server notices the hang
+       up on the next read, so just drop the output here. */
+    for (off = 0; (host->fd >= 0) && (off < len); off += n)
+    {
+        n = send (host->fd, buf + off, len - off, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                n = 0;
+                continue;
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * \brief Suspend the device until the host sends a line.
+ *
+ * While waiting, the core must not be stepped. When a line arrives,
+ * hostio_resume() calls \a resume with \a data.
+ */
+void
+hostio_wait (HostIO *host, HostIOFP_Resume resume, void *data)
+{
+    host->resume = resume;
+    host->resume_data = data;
+}
+
+/** \brief Give the waiting device a chance to consume buffered input.
+
+    The callback may call hostio_wait() again if the data it found was not
+    enough. */
+
+void
+hostio_resume (HostIO *host)
+{
+    HostIOFP_Resume resume = host->resume;
+
+    if (resume == NULL)
+        return;
+
+    host->resume = NULL;
+    resume (host->resume_data);
+}
+
+/** \brief Return non-zero while a device waits for input. */
+
+extern inline int hostio_waiting (HostIO *host);
@@ -0,0 +1,102 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+#ifndef SIM_HOSTIO_H
+#define SIM_HOSTIO_H
+
+/****************************************************************************\
+ *
+ * HostIO(AvrClass) Definition
+ *
+\****************************************************************************/
+
+enum _hostio_constants
+{
+    HOSTIO_BUF_SIZE = 4096,     /* longest line accepted from the host */
+};
+
+typedef enum
+{
+    HOSTIO_STDIO,               /* blocking, stdin/stdout */
+    HOSTIO_FD,                  /* non-blocking, socket given to
+                                   hostio_attach_fd() */
+    HOSTIO_MEM,                 /* non-blocking, memory buffers (library
+                                   use, see simavr.c) */
+} HostIOMode;
+
+typedef void (*HostIOFP_Resume) (void *data);
+
+typedef struct _HostIO HostIO;
+
+struct _HostIO
+{
+    AvrClass parent;
+    HostIOMode mode;
+    int fd;                     /* HOSTIO_FD: connected socket or -1 */
+    int eof;                    /* HOSTIO_STDIO: end of input seen */
+    char in_buf[HOSTIO_BUF_SIZE]; /* HOSTIO_FD/MEM: received, unparsed
+                                     data */
+    int in_len;
+    int skip;                   /* HOSTIO_FD: dropping the rest of a line
+                                   longer than in_buf */
+    int overlong;               /* a line was dropped, hostio_read_line()
+                                   has not reported it yet */
+    char *out_buf;              /* HOSTIO_MEM: output not yet taken */
+    int out_len;
+    int out_size;
+    HostIOFP_Resume resume;     /* non-NULL while a device waits for a
+                                   line */
+    void *resume_data;
+    struct _Replay *replay;     /* records or replays the lines read, see
+                                   replay.c (owned by the core) */
+    int mute;                   /* drop the output (the core executes again
+                                   what the host has seen) */
+};
+
+extern HostIO *hostio_new (void);
+extern void hostio_construct (HostIO *host);
+extern void hostio_destroy (void *host);
+
+extern void hostio_attach_fd (HostIO *host, int fd);
+extern int hostio_fill (HostIO *host);
+extern int hostio_has_line (HostIO *host);
+
+extern void hostio_use_buffers (HostIO *host);
+extern int hostio_put_input (HostIO *host, const char *data, int len);
+extern int hostio_take_output (HostIO *host, char *buf, int size);
+
+extern int hostio_read_line (HostIO *host, char *buf, int size);
+extern void hostio_printf (HostIO *host, const char *fmt, ...);
+
+extern void hostio_wait (HostIO *host, HostIOFP_Resume resume, void *data);
+extern void hostio_resume (HostIO *host);
+
+extern inline int
+hostio_waiting (HostIO *host)
+{
+    return host->resume != NULL;
+}
+
+#endif /* SIM_HOSTIO_H */
@@ -0,0 +1,567 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file image.c
+ * \brief Program and eeprom images read from files.
+ *
+ * An Image holds what a firmware file contributes to the device: the flash
+ * contents, the eeprom contents and, for an ELF file, the code symbols.
+ * Three formats are read:
+ *
+ *  - raw binary (flash or eeprom contents starting at address 0),
+ *  - Intel HEX,
+ *  - ELF as produced by avr-gcc (the PT_LOAD segments and .symtab).
+ *
+ * Intel HEX and ELF use the avr-gcc linear address map: flash at 0, eeprom at
+ * IMAGE_EEPROM_BASE. A HEX file made from the .eeprom section with
+ * objcopy starts at 0 and therefore shows up as flash data; the eeprom
+ * loader uses it as eeprom in that case.
+ *
+ * The file is mapped and parsed in place, the data is copied to the image
+ * with memcpy(). A binary image starting with the ELF magic is read as ELF.
+ *
+ * The symbol table is kept for profilers and tracers, see image_symbol().
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+#include "utils.h"
+
+#include "image.h"
+
+/* ELF constants, only what is needed for avr-gcc output. */
+
+enum
+{
+    ELF_EHDR_SIZE = 52,
+    ELF_PHDR_SIZE = 32,
+    ELF_SHDR_SIZE = 40,
+    ELF_SYM_SIZE = 16,
+
+    ELF_CLASS32 = 1,
+    ELF_DATA2LSB = 1,
+    ELF_EM_AVR = 83,
+
+    ELF_PT_LOAD = 1,
+    ELF_SHT_SYMTAB = 2,
+    ELF_SHN_UNDEF = 0,
+    ELF_SHN_LORESERVE = 0xff00,
+
+    ELF_STT_NOTYPE = 0,
+    ELF_STT_FUNC = 2,
+    ELF_STB_LOCAL = 0,
+};
+
+/** \brief Allocate a new, empty Image. */
+
+Image *
+image_new (void)
+{
+    Image *img;
+
+    img = avr_new (Image, 1);
+    image_construct (img);
+    class_overload_destroy ((AvrClass *)img, image_destroy);
+
+    return img;
+}
+
+/** \brief Constructor for the Image class. */
+
+void
+image_construct (Image *img)
+{
+    if (img == NULL)
+        avr_error ("passed null ptr");
+
+    class_construct ((AvrClass *)img);
+
+    img->flash = NULL;
+    img->flash_len = 0;
+    img->eeprom = NULL;
+    img->eeprom_len = 0;
+    img->syms = NULL;
+    img->num_syms = 0;
+    img->names = NULL;
+}
+
+/** \brief Destructor for the Image class. */
+
+void
+image_destroy (void *img)
+{
+    Image *_img = (Image *)img;
+
+    if (img == NULL)
+        return;
+
+    avr_free (_img->flash);
+    avr_free (_img->eeprom);
+    avr_free (_img->syms);
+    avr_free (_img->names);
+
+    class_destroy (img);
+}
+
+/* Grow a memory area of the image to at least len bytes, erased. */
+
+static void
+image_grow (uint8_t **buf, int *buf_len, int len)
+{
+    if (len <= *buf_len)
+        return;
+
+    *buf = avr_realloc (*buf, len);
+    memset (*buf + *buf_len, 0xff, len - *buf_len);
+    *buf_len = len;
+}
+
+/* Store data at a linear address. Data for sram (initial values of
+   variables without a flash copy) and unknown spaces is dropped. */
+
+static void
+image_put (Image *img, uint32_t addr, const uint8_t *data, uint32_t len)
+{
+    if ((addr < IMAGE_FLASH_END) && (len <= IMAGE_FLASH_END - addr))
+    {
+        image_grow (&img->flash, &img->flash_len, addr + len);
+        memcpy (img->flash + addr, data, len);
+    }
+    else if ((addr >= IMAGE_EEPROM_BASE) && (addr < IMAGE_EEPROM_END)
+             && (len <= IMAGE_EEPROM_END - addr))
+    {
+        addr -= IMAGE_EEPROM_BASE;
+        image_grow (&img->eeprom, &img->eeprom_len, addr + len);
+        memcpy (img->eeprom + addr, data, len);
+    }
+}
+
+/***************************************************************************\
+ *
+ * Intel HEX
+ *
+\***************************************************************************/
+
+static int
+image_hex_digit (uint8_t c)
+{
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F'))
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int
+image_read_ihex (Image *img, char *file, const uint8_t *p, size_t len)
+{
+    const uint8_t *end = p + len;
+    uint8_t rec[5 + 255];
+    uint32_t base = 0;
+    int line = 0;
+    int i, n, hi, lo;
+    uint8_t sum;
+
+    while (p < end)
+    {
+        /* skip to the next record */
+        while ((p < end) && (*p != ':'))
+        {
+            if (*p == '\n')
+                line++;
+            else if ((*p != '\r') && (*p != ' ') && (*p != '\t'))
+                goto bad;
+            p++;
+        }
+        if (p == end)
+            break;
+        p++;
+
+        /* count, address, type, data and checksum */
+        for (i = 0, n = 5, sum = 0; i < n; i++)
+        {
+            if ((end - p < 2) || ((hi = image_hex_digit (p[0])) < 0)
+                || ((lo = image_hex_digit (p[1])) < 0))
+                goto bad;
+            rec[i] = (hi << 4) | lo;
+            sum += rec[i];
+            p += 2;
+            if (i == 0)
+                n = rec[0] + 5;
+        }
+        if (sum != 0)
+        {
+            avr_warning ("%s:%d: checksum error\n", file, line + 1);
+            return -1;
+        }
+
+        switch (rec[3])
+        {
+            case 0:             /* data */
+                image_put (img, base + ((rec[1] << 8) | rec[2]), rec + 4,
+                           rec[0]);
+                break;
+            case 1:             /* end of file */
+                return 0;
+            case 2:             /* extended segment address */
+                base = ((rec[4] << 8) | rec[5]) << 4;
+                break;
+            case 4:             /* extended linear address */
+                base = ((uint32_t) rec[4] << 24) | (rec[5] << 16);
+                break;
+            default:            /* start addresses */
+                break;
+        }
+    }
+
+    return 0;
+
+  bad:
+    avr_warning ("%s:%d: not an Intel HEX record\n", file, line + 1);
+    return -1;
+}
+
+/***************************************************************************\
+ *
+ * ELF
+ *
+\***************************************************************************/
+
+static uint16_t
+elf_u16 (const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t
+elf_u32 (const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Is [off, off + len) inside a file of size size? */
+
+static int
+elf_inside (size_t size, uint32_t off, uint32_t len)
+{
+    return (off <= size) && (len <= size - off);
+}
+
+static int
+image_sym_cmp (const void *a, const void *b)
+{
+    const ImageSymbol *sa = a, *sb = b;
+
+    if (sa->addr != sb->addr)
+        return sa->addr < sb->addr ? -1 : 1;
+    /* sized symbols (functions) first at the same address */
+    return (sa->size == 0) - (sb->size == 0);
+}
+
+/* Keep the code symbols of the symbol table: functions and global labels
+   defined in flash. Section and file symbols and local labels are dropped.
+   The string table is copied, the names point into the copy. */
+
+static void
+image_read_elf_symbols (Image *img, const uint8_t *p, size_t len,
+                        const uint8_t *symtab, const uint8_t *strtab_hdr)
+{
+    uint32_t off = elf_u32 (symtab + 16);
+    uint32_t size = elf_u32 (symtab + 20);
+    uint32_t str_off = elf_u32 (strtab_hdr + 16);
+    uint32_t str_size = elf_u32 (strtab_hdr + 20);
+    int num = size / ELF_SYM_SIZE;
+    int i, n = 0;
+    const uint8_t *sym;
+    const char *name;
+
+    if (!elf_inside (len, off, size) || !elf_inside (len, str_off, str_size)
+        || (str_size == 0) || (p[str_off + str_size - 1] != '\0'))
+        return;
+
+    img->syms = avr_new (ImageSymbol, num);
+    img->names = avr_new (char, str_size);
+    memcpy (img->names, p + str_off, str_size);
+
+    for (i = 0; i < num; i++)
+    {
+        uint32_t st_name, st_value;
+        uint16_t st_shndx;
+        uint8_t type, bind;
+
+        sym = p + off + i * ELF_SYM_SIZE;
+        st_name = elf_u32 (sym);
+        st_value = elf_u32 (sym + 4);
+        type = sym[12] & 0xf;
+        bind = sym[12] >> 4;
+        st_shndx = elf_u16 (sym + 14);
+
+        if ((st_name == 0) || (st_name >= str_size)
+            || (st_shndx == ELF_SHN_UNDEF)
+            || (st_shndx >= ELF_SHN_LORESERVE)
+            || (st_value >= IMAGE_FLASH_END))
+            continue;
+
+        /* functions, global labels of assembler code */
+        if ((type != ELF_STT_FUNC)
+            && ((type != ELF_STT_NOTYPE) || (bind == ELF_STB_LOCAL)))
+            continue;
+
+        name = img->names + st_name;
+        if ((name[0] == '.') && (name[1] == 'L'))
+            continue;
+
+        img->syms[n].addr = st_value;
+        img->syms[n].size = elf_u32 (sym + 8);
+        img->syms[n].name = (char *)name;
+        n++;
+    }
+
+    qsort (img->syms, n, sizeof (ImageSymbol), image_sym_cmp);
+    img->num_syms = n;
+}
+
+static int
+image_read_elf (Image *img, char *file, const uint8_t *p, size_t len)
+{
+    uint32_t phoff, shoff;
+    int phnum, shnum, phentsize, shentsize;
+    int i;
+
+    if ((len < ELF_EHDR_SIZE) || (p[4] != ELF_CLASS32)
+        || (p[5] != ELF_DATA2LSB))
+    {
+        avr_warning ("%s: not a 32 bit little endian ELF file\n", file);
+        return -1;
+    }
+    if (elf_u16 (p + 18) != ELF_EM_AVR)
+    {
+        avr_warning ("%s: not an AVR ELF file\n", file);
+        return -1;
+    }
+
+    phoff = elf_u32 (p + 28);
+    shoff = elf_u32 (p + 32);
+    phentsize = elf_u16 (p + 42);
+    phnum = elf_u16 (p + 44);
+    shentsize = elf_u16 (p + 46);
+    shnum = elf_u16 (p + 48);
+
+    if ((phnum && (phentsize < ELF_PHDR_SIZE))
+        || !elf_inside (len, phoff, phnum * phentsize)
+        || (shnum && (shentsize < ELF_SHDR_SIZE))
+        || !elf_inside (len, shoff, shnum * shentsize))
+    {
+        avr_warning ("%s: bad ELF header\n", file);
+        return -1;
+    }
+
+    /* Segments by load address: .text and the flash copy of .data go to
+       flash, .eeprom to the eeprom. */
+    for (i = 0; i < phnum; i++)
+    {
+        const uint8_t *ph = p + phoff + i * phentsize;
+        uint32_t offset = elf_u32 (ph + 4);
+        uint32_t paddr = elf_u32 (ph + 12);
+        uint32_t filesz = elf_u32 (ph + 16);
+
+        if ((elf_u32 (ph) != ELF_PT_LOAD) || (filesz == 0))
+            continue;
+        if (!elf_inside (len, offset, filesz))
+        {
+            avr_warning ("%s: bad ELF program header\n", file);
+            return -1;
+        }
+        image_put (img, paddr, p + offset, filesz);
+    }
+
+    for (i = 0; i < shnum; i++)
+    {
+        const uint8_t *sh = p + shoff + i * shentsize;
+        uint32_t link = elf_u32 (sh + 24);
+
+        if ((elf_u32 (sh + 4) == ELF_SHT_SYMTAB) && (link < (uint32_t) shnum))
+        {
+            image_read_elf_symbols (img, p, len, sh,
+                                    p + shoff + link * shentsize);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/***************************************************************************\
+ *
+ * Reading files
+ *
+\***************************************************************************/
+
+/**
+ * \brief Read a flash or eeprom image file.
+ *
+ * \a format is one of FFMT_BIN, FFMT_IHEX or FFMT_ELF. A binary image goes to
+ * the flash part of the image. Returns NULL with a warning on error.
+ */
+Image *
+image_read (char *file, int format)
+{
+    struct stat st;
+    const uint8_t *map = NULL;
+    Image *img;
+    int fd, res = -1;
+
+    fd = open (file, O_RDONLY);
+    if (fd < 0)
+    {
+        avr_warning ("%s: %s\n", file, strerror (errno));
+        return NULL;
+    }
+
+    if (fstat (fd, &st) < 0)
+    {
+        avr_warning ("%s: %s\n", file, strerror (errno));
+        close (fd);
+        return NULL;
+    }
+
+    if (st.st_size > 0)
+    {
+        map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            avr_warning ("%s: mmap: %s\n", file, strerror (errno));
+            close (fd);
+            return NULL;
+        }
+    }
+    close (fd);
+
+    if ((format == FFMT_BIN) && (st.st_size >= 4)
+        && (memcmp (map, "\177ELF", 4) == 0))
+        format = FFMT_ELF;
+
+    img = image_new ();
+    switch (format)
+    {
+        case FFMT_BIN:
+            image_put (img, 0, map, st.st_size);
+            res = 0;
+            break;
+        case FFMT_IHEX:
+            res = image_read_ihex (img, file, map, st.st_size);
+            break;
+        case FFMT_ELF:
+            if ((st.st_size < 4) || (memcmp (map, "\177ELF", 4) != 0))
+                avr_warning ("%s: not an ELF file\n", file);
+            else
+                res = image_read_elf (img, file, map, st.st_size);
+            break;
+        default:
+            avr_warning ("Unsupported file format\n");
+    }
+
+    if (map)
+        munmap ((void *)map, st.st_size);
+
+    if (res < 0)
+    {
+        class_unref ((AvrClass *)img);
+        return NULL;
+    }
+
+    return img;
+}
+
+/**
+ * \brief Find the symbol an address belongs to.
+ *
+ * Returns the symbol with the highest address not above \a addr (a flash byte
+ * address), NULL if there is none or \a addr is past the end of a sized
+ * symbol with no label in between.
+ */
+const ImageSymbol *
+image_symbol (Image *img, uint32_t addr)
+{
+    int lo = 0, hi, mid;
+    const ImageSymbol *sym;
+
+    if ((img == NULL) || (img->num_syms == 0) || (addr < img->syms[0].addr))
+        return NULL;
+
+    /* last symbol with sym->addr <= addr */
+    hi = img->num_syms - 1;
+    while (lo < hi)
+    {
+        mid = (lo + hi + 1) / 2;
+        if (img->syms[mid].addr <= addr)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    /* prefer the sized symbol (a function) at that address */
+    while ((lo > 0) && (img->syms[lo - 1].addr == img->syms[lo].addr))
+        lo--;
+
+    sym = &img->syms[lo];
+    if (sym->size && (addr >= sym->addr + sym->size))
+        return NULL;
+
+    return sym;
+}
+
+/** \brief Address of the named symbol, -1 if there is no such symbol. */
+
+int
+image_symbol_addr (Image *img, const char *name)
+{
+    int i;
+
+    if (img == NULL)
+        return -1;
+
+    for (i = 0; i < img->num_syms; i++)
+        if (strcmp (img->syms[i].name, name) == 0)
+            return img->syms[i].addr;
+
+    return -1;
+}
@@ -0,0 +1,78 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+#ifndef SIM_IMAGE_H
+#define SIM_IMAGE_H
+
+/****************************************************************************\
+ *
+ * Image(AvrClass) Definition
+ *
+\****************************************************************************/
+
+/* Linear addresses used by avr-gcc for the memory spaces (ELF load
+   addresses and Intel HEX records). */
+
+enum _image_constants
+{
+    IMAGE_FLASH_END = 0x800000, /* flash: 0 .. IMAGE_FLASH_END - 1 */
+    IMAGE_EEPROM_BASE = 0x810000,
+    IMAGE_EEPROM_END = 0x820000,
+};
+
+typedef struct _ImageSymbol ImageSymbol;
+
+struct _ImageSymbol
+{
+    uint32_t addr;              /* flash byte address */
+    uint32_t size;              /* 0 if unknown (assembler labels) */
+    char *name;
+};
+
+typedef struct _Image Image;
+
+struct _Image
+{
+    AvrClass parent;
+    uint8_t *flash;             /* flash bytes (little endian words), gaps
+                                   are 0xff */
+    int flash_len;
+    uint8_t *eeprom;            /* eeprom bytes, NULL if none */
+    int eeprom_len;
+    ImageSymbol *syms;          /* code symbols sorted by address */
+    int num_syms;
+    char *names;                /* storage of the symbol names */
+};
+
+extern Image *image_new (void);
+extern void image_construct (Image *img);
+extern void image_destroy (void *img);
+
+extern Image *image_read (char *file, int format);
+
+extern const ImageSymbol *image_symbol (Image *img, uint32_t addr);
+extern int image_symbol_addr (Image *img, const char *name);
+
+#endif /* SIM_IMAGE_H */
@@ -55,6 +55,9 @@
 #include "display.h"
 
 #include "gdb.h"
+#include "server.h"
+#include "forksrv.h"
+#include "OsEID.h"
 #include "gnu_getopt.h"
 
 /****************************************************************************\
@@ -67,6 +70,8 @@ static char *global_device_type = NULL;
 
 static int global_eeprom_image_type = FFMT_BIN;
 static char *global_eeprom_image_file = NULL;
+static char *global_eeprom_backing_file = NULL;
+static char *global_eeprom_journal_file = NULL;
 
 static int global_flash_image_type = FFMT_BIN;
 static char *global_flash_image_file = NULL;
@@ -75,13 +80,45 @@ static int global_gdbserver_mode = 0;
 static int global_gdbserver_port = 1212; /* default port number */
 static int global_gdb_debug = 0;
 
+static int global_debug_inst_output = 0;
+
 static char *global_disp_prog = NULL;
 static int global_disp_without_xterm = 0;
+static int global_disp_hz = 30;     /* display updates per second, or */
+static int global_disp_cycles = 0;  /* every n clock cycles */
 
 static int global_dump_core = 0;
 
 static int global_clock_freq = 8000000; /* Default is 8 MHz. */
 
+static int global_rng_seeded = 0;
+static uint64_t global_rng_seed = 0;
+
+static char *global_load_state_file = NULL;
+static char *global_save_state_file = NULL;
+
+static int global_server_cards = 0; /* 0: single card on stdin/stdout */
+static int global_server_threads = 1;
+
+static char *global_fork_server_socket = NULL;
+static int global_ready_addr = -1; /* -1: first wait for host input */
+
+static char *global_profile_file = NULL;
+static char *global_flame_dir = NULL;
+
+static char *global_sample_file = NULL;
+static uint32_t global_sample_period = SAMPLE_PERIOD;
+static int global_sample_callers = 0;
+
+static char *global_trace_file = NULL;
+static char *global_trace_trigger = NULL;
+static uint32_t global_trace_size = TRACE_SIZE;
+
+static char *global_record_file = NULL;
+static char *global_replay_file = NULL;
+
+static uint64_t global_history_interval = HISTORY_INTERVAL;
+
 /* If the user needs more than LEN_BREAK_LIST on the command line, they've got
    bigger problems. */
 
@@ -108,6 +145,9 @@ static GdbComm_T global_gdb_comm[1] = {{
     .read_sram = (CommFuncReadSRAM) avr_core_mem_read,
     .write_sram = (CommFuncWriteSRAM) avr_core_mem_write,
     
+    .read_eeprom = (CommFuncReadEEPROM) oseid_ee_read,
+    .write_eeprom = (CommFuncWriteEEPROM) oseid_ee_write,
+
     .read_flash = (CommFuncReadFlash) avr_core_flash_read,
     .write_flash = (CommFuncWriteFlash) avr_core_flash_write,
     .write_flash_lo8 = (CommFuncWriteFlashLo8) avr_core_flash_write_lo8,
@@ -118,12 +158,30 @@ static GdbComm_T global_gdb_comm[1] = {{
     .enable_breakpts = (CommFuncEnableBrkpts) avr_core_enable_breakpoints,
     .disable_breakpts = (CommFuncDisableBrkpts) avr_core_disable_breakpoints,
     
-    .step = (CommFuncStep) avr_core_step,
-    .reset = (CommFuncReset) avr_core_reset,
+    .step = (CommFuncStep) avr_core_history_step,
+    .reset = (CommFuncReset) avr_core_history_reset,
     
     .io_fetch = (CommFuncIORegFetch) avr_core_io_fetch,
     
     .irq_raise = (CommFuncIrqRaise) avr_core_irq_raise,
+
+    .monitor = (CommFuncMonitor) avr_core_monitor,
+
+    .reverse_step = (CommFuncReverse) avr_core_reverse_step,
+    .reverse_continue = (CommFuncReverseCont) avr_core_reverse_continue,
+
+    .insert_watch = (CommFuncWatch) avr_core_watch_insert,
+    .remove_watch = (CommFuncWatch) avr_core_watch_remove,
+    .watch_hit = (CommFuncWatchHit) avr_core_watch_hit,
+
+    .read_sram_block = (CommFuncReadBlock) avr_core_mem_read_block,
+    .write_sram_block = (CommFuncWriteBlock) avr_core_mem_write_block,
+    .read_flash_block = (CommFuncReadBlock) avr_core_flash_read_block,
+    .write_flash_block = (CommFuncWriteBlock) avr_core_flash_write_block,
+    .read_eeprom_block = (CommFuncReadBlock) avr_core_eeprom_read_block,
+    .write_eeprom_block = (CommFuncWriteBlock) avr_core_eeprom_write_block,
+    .space_sizes = (CommFuncSizes) avr_core_space_sizes,
+    .flush = (CommFuncFlush) avr_core_display_flush,
 }};
 
 static char *usage_fmt_str =
@@ -139,25 +197,105 @@ static char *usage_fmt_str =
 "  -d, --device <dev>        : Specify device type\n"
 "  -e, --eeprom-image <img>  : Specify an eeprom image file\n"
 "  -E, --eeprom-type <type>  : Specify the type of the eeprom image file\n"
+"  -m, --eeprom-file <file>  : Keep the eeprom in file (created if missing)\n"
+"  -j, --eeprom-journal <f>  : Journal eeprom writes to f (with -m)\n"
 "  -F, --flash-type <type>   : Specify the type of the flash image file\n"
 "  -L, --list-devices        : Print supported devices to stdout and exit\n"
 "  -P, --disp-prog <prog>    : Display register and memory info with prog\n"
 "  -X, --without-xterm       : Don't start disp prog in an xterm\n"
+"  -W, --disp-rate <rate>    : Update the display rate times per second,\n"
+"                              every n cycles with 'nc', 0: every change\n"
 "  -C, --core-dump           : Dump a core memory image to file on exit\n"
 "  -c, --clock-freq <freq>   : Set the simulated mcu clock freqency (in Hz)\n"
 "  -B, --breakpoint <addr>   : Set a breakpoint (address is a byte address)\n"
+"  -R, --rng-seed <seed>     : Use a deterministic random number generator\n"
+"  -s, --load-state <file>   : Restore the device state saved in file\n"
+"  -S, --save-state <file>   : Save the device state to file on exit\n"
+"  -N, --cards <n>           : Run a server simulating n cards\n"
+"  -T, --threads <n>         : Number of worker threads for the server\n"
+"  -f, --fork-server <path>  : Boot once, fork a session per connection\n"
+"  -a, --ready-at <addr>     : Fork server ready point (byte address)\n"
+"  -o, --profile <file>      : Write a function profile (callgrind) to file\n"
+"  -y, --flame-dir <dir>     : Write folded stacks of every APDU to dir\n"
+"  -q, --sample <file>       : Write PC samples to file\n"
+"  -Q, --sample-period <n>   : Sample every n clock cycles (default 1009)\n"
+"  -K, --sample-callers      : Sample the return address at SP too\n"
+"  -t, --trace <file>        : Write a binary instruction trace to file\n"
+"  -u, --trace-trigger <addr>: Trace only around addr (byte address or\n"
+"                              symbol)\n"
+"  -U, --trace-size <n>      : Records kept in memory (default 65536)\n"
+"  -r, --record <file>       : Log the host input of the run to file\n"
+"  -Y, --replay <file>       : Repeat the run logged with --record\n"
+"  -I, --history-interval <n>: Checkpoint every n clock cycles for reverse\n"
+"                              execution in gdb (default 1000000, 0: off)\n"
 "\n" "If the image file types for eeprom or flash images are not given,\n"
-"the default file type is binary.\n" "\n"
+"the default file type is binary. The types are bin, ihex and elf; a\n"
+"binary image that is an ELF file is read as ELF. From an ELF file the\n"
+"flash gets the program and the eeprom the .eeprom section, the symbol\n"
+"table is kept for symbolic output.\n" "\n"
 "If you wish to run the simulator in gdbserver mode, you do not\n"
 "have to specify a flash-image file since the program can be loaded\n"
 "from gdb via the `load` command.\n" "\n"
-"If '--port' option is given, and '--gdbserver' is not, port is ignored\n"
+"If '--port' option is given, and neither '--gdbserver' nor '--cards' is,\n"
+"port is ignored\n"
 "\n" "If running in gdbserver mode and port is not specified, a default\n"
 "port of 1212 is used.\n" "\n"
+"In gdbserver mode the simulator keeps checkpoints of the last 256\n"
+"intervals and logs the host input, so gdb can use reverse-step and\n"
+"reverse-continue. A step back returns to a checkpoint and executes\n"
+"again from there with the same input.\n" "\n"
+"The executed instructions are counted per opcode and printed at exit, in\n"
+"gdbserver mode gdb shows them with 'monitor opstats'. 'monitor help' lists\n"
+"the other monitor commands (counters, profiler, state, APDUs, eeprom).\n" "\n"
 "If using the '--breakpoint' option, note the simulator will terminate when\n"
 "the address is hit if you are not running in gdbserver mode. This feature\n"
 "not intended for use in gdbserver mode. It is really intended for testing\n"
 "the simulator itself, but may be useful for testing avr programs too.\n"
+"\n" "Random bytes for the device come from the host (getrandom or\n"
+"/dev/urandom) unless '--rng-seed' is given. With a seed the byte stream\n"
+"(and therefore the cycle count of a run) is reproducible.\n"
+"\n" "With '--cards' the simulator runs n independent cards, card i\n"
+"talks the stdin/stdout line protocol on TCP port (port + i). The\n"
+"default base port is 1212. With '--rng-seed', card i uses seed + i.\n"
+"With '--gdbserver' too, gdb connects to port (port + n) and sees card i\n"
+"as process i + 1. Only the cards gdb stops are held, the others keep\n"
+"running.\n"
+"\n" "A state file holds the complete device (registers, sram, eeprom, io\n"
+"devices, clock counter and the random number generator). It is written\n"
+"with '--save-state' when the run ends: end of input on stdin, SIGINT or\n"
+"a stopped core. '--load-state' restores it after the flash image is\n"
+"loaded (the flash image must be the same) and the run continues without\n"
+"a reset.\n"
+"\n" "With '--fork-server' the firmware is booted to the ready point (the\n"
+"first wait for host input unless '--ready-at' is given), then every\n"
+"connection to the unix socket path gets a forked copy of the booted\n"
+"device talking the stdin/stdout line protocol. With '--load-state' the\n"
+"boot starts from the saved state.\n"
+"\n" "With '--eeprom-file' the eeprom is the file itself (mapped into\n"
+"memory), so the card keeps its keys, PINs and filesystem between runs.\n"
+"A new file starts erased. '--eeprom-image' and '--load-state' write\n"
+"into the file. The file is written back on exit, with '--eeprom-journal'\n"
+"every eeprom write also goes synchronously to the journal first, and a\n"
+"journal left by a crash is replayed on the next start.\n"
+"\n" "With '--profile' the calls, interrupts and returns are followed on a\n"
+"shadow call stack and the clock cycles of each function (self and per\n"
+"call) are written in the callgrind format when the run ends, named from\n"
+"the ELF symbols. Open the file with kcachegrind or callgrind_annotate.\n"
+"With '--flame-dir' the cycles of every APDU (from the command line to\n"
+"the response) go to dir/apdu-0001.folded, apdu-0002.folded and so on, in\n"
+"the folded stack format of flamegraph.pl.\n"
+"\n" "With '--sample' the PC is sampled every n clock cycles of the device,\n"
+"which is cheap enough for long runs and (with '--rng-seed') gives the\n"
+"same samples every run. Report them with simulavr-pcprof.\n"
+"\n" "'--trace' is the fast form of '--debug': every instruction fills a\n"
+"binary record, the records are written in blocks of n. With a trigger\n"
+"only the n instructions before it and the n from it on are written.\n"
+"simulavr-trace prints the trace as text or JSON.\n"
+"\n" "'--record' logs every line read from the host and every random byte\n"
+"with the clock cycle it was taken at. '--replay' feeds them back at the\n"
+"same cycles instead of reading stdin, so the run is repeated exactly and\n"
+"as fast as the simulator goes, e.g. to debug it with '--trace' or in\n"
+"gdbserver mode. Give the same program (and '--load-state') as recorded.\n"
 "\n" "Currently available device types:\n";
 
 /* *INDENT-ON* */
@@ -187,13 +325,34 @@ static struct option long_opts[] = {
     { "device",          1,       0,     'd' },
     { "eeprom-type",     1,       0,     'E' },
     { "eeprom-image",    1,       0,     'e' },
+    { "eeprom-file",     1,       0,     'm' },
+    { "eeprom-journal",  1,       0,     'j' },
     { "flash-type",      1,       0,     'F' },
     { "list-devices",    0,       0,     'L' },
     { "disp-prog",       1,       0,     'P' },
     { "without-xterm",   1,       0,     'X' },
+    { "disp-rate",       1,       0,     'W' },
     { "core-dump",       0,       0,     'C' },
     { "clock-freq",      1,       0,     'c' },
     { "breakpoint",      1,       0,     'B' },
+    { "rng-seed",        1,       0,     'R' },
+    { "load-state",      1,       0,     's' },
+    { "save-state",      1,       0,     'S' },
+    { "cards",           1,       0,     'N' },
+    { "threads",         1,       0,     'T' },
+    { "fork-server",     1,       0,     'f' },
+    { "ready-at",        1,       0,     'a' },
+    { "profile",         1,       0,     'o' },
+    { "flame-dir",       1,       0,     'y' },
+    { "sample",          1,       0,     'q' },
+    { "sample-period",   1,       0,     'Q' },
+    { "sample-callers",  0,       0,     'K' },
+    { "trace",           1,       0,     't' },
+    { "trace-trigger",   1,       0,     'u' },
+    { "trace-size",      1,       0,     'U' },
+    { "record",          1,       0,     'r' },
+    { "replay",          1,       0,     'Y' },
+    { "history-interval", 1,      0,     'I' },
     { NULL,              0,       0,      0  }
 };
 /* *INDENT-ON* */
@@ -210,13 +369,15 @@ parse_cmd_line (int argc, char **argv)
     int option_index;
     char dummy_char;
     int break_addr;
+    char *endp;
 
     opterr = 0;                 /* disable default error message */
 
     while (1)
     {
-        c = getopt_long (argc, argv, "hgGvDLd:e:E:F:p:P:XCc:B:", long_opts,
-                         &option_index);
+        c = getopt_long (argc, argv,
+                         "hgGvDLd:e:E:m:j:F:p:P:XW:Cc:B:R:s:S:N:T:f:a:o:y:q:"
+                         "Q:Kt:u:U:r:Y:I:", long_opts, &option_index);
         if (c == -1)
             break;              /* no more options */
 
@@ -254,9 +415,15 @@ parse_cmd_line (int argc, char **argv)
             case 'e':
                 global_eeprom_image_file = avr_strdup (optarg);
                 break;
-            case 'E':
+            case 'm':
+                global_eeprom_backing_file = avr_strdup (optarg);
+                break;
+            case 'j':
+                global_eeprom_journal_file = avr_strdup (optarg);
                 break;
+            case 'E':
                 global_eeprom_image_type = str2ffmt (optarg);
+                break;
             case 'F':
                 global_flash_image_type = str2ffmt (optarg);
                 break;
@@ -269,6 +436,18 @@ parse_cmd_line (int argc, char **argv)
             case 'X':
                 global_disp_without_xterm = 1;
                 break;
+            case 'W':
+                global_disp_hz = strtol (optarg, &endp, 10);
+                if ((endp[0] == 'c') && (endp[1] == '\0')
+                    && (global_disp_hz > 0))
+                {
+                    global_disp_cycles = global_disp_hz;
+                    global_disp_hz = 0;
+                }
+                else if ((endp == optarg) || (*endp != '\0')
+                         || (global_disp_hz < 0))
+                    avr_error ("Invalid display rate: %s", optarg);
+                break;
             case 'C':
                 global_dump_core = 1;
                 break;
@@ -298,6 +477,92 @@ parse_cmd_line (int argc, char **argv)
                                  optarg);
                 }
 
+                break;
+            case 'R':
+                errno = 0;
+                global_rng_seed = strtoull (optarg, &endp, 0);
+                if ((errno != 0) || (endp == optarg) || (*endp != '\0'))
+                {
+                    avr_error ("Invalid rng seed: %s", optarg);
+                }
+                global_rng_seeded = 1;
+                break;
+            case 's':
+                global_load_state_file = avr_strdup (optarg);
+                break;
+            case 'S':
+                global_save_state_file = avr_strdup (optarg);
+                break;
+            case 'N':
+                if ((sscanf (optarg, "%d%c", &global_server_cards,
+                             &dummy_char) != 1) || (global_server_cards < 1))
+                {
+                    avr_error ("Invalid number of cards: %s", optarg);
+                }
+                break;
+            case 'T':
+                if ((sscanf (optarg, "%d%c", &global_server_threads,
+                             &dummy_char) != 1)
+                    || (global_server_threads < 1))
+                {
+                    avr_error ("Invalid number of threads: %s", optarg);
+                }
+                break;
+            case 'f':
+                global_fork_server_socket = avr_strdup (optarg);
+                break;
+            case 'a':
+                if ((sscanf (optarg, "%i%c", &global_ready_addr, &dummy_char)
+                     != 1) || (global_ready_addr < 0))
+                {
+                    avr_error ("Invalid ready address: %s", optarg);
+                }
+                break;
+            case 'o':
+                global_profile_file = avr_strdup (optarg);
+                break;
+            case 'y':
+                global_flame_dir = avr_strdup (optarg);
+                break;
+            case 'q':
+                global_sample_file = avr_strdup (optarg);
+                break;
+            case 'Q':
+                if ((sscanf (optarg, "%u%c", &global_sample_period,
+                             &dummy_char) != 1) || (global_sample_period < 1))
+                {
+                    avr_error ("Invalid sample period: %s", optarg);
+                }
+                break;
+            case 'K':
+                global_sample_callers = 1;
+                break;
+            case 't':
+                global_trace_file = avr_strdup (optarg);
+                break;
+            case 'u':
+                global_trace_trigger = avr_strdup (optarg);
+                break;
+            case 'U':
+                if ((sscanf (optarg, "%u%c", &global_trace_size,
+                             &dummy_char) != 1) || (global_trace_size < 1))
+                {
+                    avr_error ("Invalid trace size: %s", optarg);
+                }
+                break;
+            case 'r':
+                global_record_file = avr_strdup (optarg);
+                break;
+            case 'Y':
+                global_replay_file = avr_strdup (optarg);
+                break;
+            case 'I':
+                errno = 0;
+                global_history_interval = strtoull (optarg, &endp, 0);
+                if ((errno != 0) || (endp == optarg) || (*endp != '\0'))
+                {
+                    avr_error ("Invalid history interval: %s", optarg);
+                }
                 break;
             default:
                 avr_error ("getop() did something screwey");
@@ -309,17 +574,8 @@ parse_cmd_line (int argc, char **argv)
     else if (optind != argc)
         usage (prog);
 
-    /* FIXME: Issue a warning and bail out if user selects a file format type
-       we haven't implemented yet. */
-
-    if ((global_eeprom_image_type != FFMT_BIN)
-        || (global_flash_image_type != FFMT_BIN))
-    {
-        fprintf (stderr,
-                 "Only the bin file format is currently "
-                 "implemented. Sorry.\n");
-        exit (1);
-    }
+    if ((global_eeprom_image_type < 0) || (global_flash_image_type < 0))
+        avr_error ("Unknown image file type (bin, ihex or elf)");
 
     /* If user didn't specify a device type, see if it can be gleaned from the
        name of the program. */
@@ -405,6 +661,80 @@ main (int argc, char **argv)
 
     parse_cmd_line (argc, argv);
 
+    if (global_eeprom_journal_file && !global_eeprom_backing_file)
+        avr_error ("--eeprom-journal needs --eeprom-file");
+
+    if (global_record_file && global_replay_file)
+        avr_error ("--record can not be used with --replay");
+
+    if (global_server_cards)
+    {
+        ServerConfig cfg;
+
+        if (global_load_state_file || global_save_state_file)
+            avr_error ("State files can not be used with --cards");
+        if (global_fork_server_socket)
+            avr_error ("The fork server can not be used with --cards");
+        if (global_eeprom_backing_file)
+            avr_error ("--eeprom-file can not be used with --cards");
+        if (global_profile_file || global_flame_dir || global_sample_file)
+            avr_error ("Profiling can not be used with --cards");
+        if (global_trace_file)
+            avr_error ("--trace can not be used with --cards");
+        if (global_record_file || global_replay_file)
+            avr_error ("Record/replay can not be used with --cards");
+
+        cfg.device = global_device_type;
+        cfg.flash_file = global_flash_image_file;
+        cfg.flash_format = global_flash_image_type;
+        cfg.eeprom_file = global_eeprom_image_file;
+        cfg.eeprom_format = global_eeprom_image_type;
+        cfg.cards = global_server_cards;
+        cfg.threads = global_server_threads;
+        cfg.port = global_gdbserver_port;
+        cfg.rng_seeded = global_rng_seeded;
+        cfg.rng_seed = global_rng_seed;
+        cfg.debug_inst_output = global_debug_inst_output;
+        cfg.gdb_comm = global_gdbserver_mode ? global_gdb_comm : NULL;
+        cfg.gdb_debug = global_gdb_debug;
+
+        server_run (&cfg);
+        exit (0);
+    }
+
+    if (global_fork_server_socket)
+    {
+        ForkServerConfig cfg;
+
+        if (global_gdbserver_mode)
+            avr_error ("The gdbserver can not be used with --fork-server");
+        if (global_save_state_file)
+            avr_error ("--save-state can not be used with --fork-server");
+        if (global_eeprom_backing_file)
+            avr_error ("--eeprom-file can not be used with --fork-server");
+        if (global_profile_file || global_flame_dir || global_sample_file)
+            avr_error ("Profiling can not be used with --fork-server");
+        if (global_trace_file)
+            avr_error ("--trace can not be used with --fork-server");
+        if (global_record_file || global_replay_file)
+            avr_error ("Record/replay can not be used with --fork-server");
+
+        cfg.device = global_device_type;
+        cfg.flash_file = global_flash_image_file;
+        cfg.flash_format = global_flash_image_type;
+        cfg.eeprom_file = global_eeprom_image_file;
+        cfg.eeprom_format = global_eeprom_image_type;
+        cfg.state_file = global_load_state_file;
+        cfg.socket_path = global_fork_server_socket;
+        cfg.ready_addr = global_ready_addr;
+        cfg.rng_seeded = global_rng_seeded;
+        cfg.rng_seed = global_rng_seed;
+        cfg.debug_inst_output = global_debug_inst_output;
+
+        fork_server_run (&cfg);
+        exit (0);
+    }
+
     global_core = avr_core_new (global_device_type);
     if (global_core == NULL)
     {
@@ -414,14 +744,26 @@ main (int argc, char **argv)
 
     avr_message ("Simulating clock frequency of %d Hz\n", global_clock_freq);
 
+    avr_core_set_debug_inst_output (global_core, global_debug_inst_output);
+
+    if (global_rng_seeded)
+    {
+        avr_message ("Using deterministic rng, seed %" PRIu64 "\n",
+                     global_rng_seed);
+        avr_core_rng_seed (global_core, global_rng_seed);
+    }
+
     avr_core_get_sizes (global_core, &flash_sz, &sram_sz, &sram_start,
                         &eeprom_sz);
-    display_open (global_disp_prog, global_disp_without_xterm, flash_sz,
-                  sram_sz, sram_start, eeprom_sz);
+    display_open (avr_core_get_display (global_core), global_disp_prog,
+                  global_disp_without_xterm, flash_sz, sram_sz, sram_start,
+                  eeprom_sz);
+    display_set_rate (avr_core_get_display (global_core), global_disp_hz,
+                      global_disp_cycles);
     avr_core_io_display_names (global_core);
 
     /* Send initial clock cycles to display */
-    display_clock (0);
+    display_clock (avr_core_get_display (global_core), 0);
 
     /* install my_atexit to be called when exit() is called */
     if (atexit (atexit_cleanup))
@@ -439,13 +781,30 @@ main (int argc, char **argv)
 
     /* Load program into flash */
     if (global_flash_image_file)
-        avr_core_load_program (global_core, global_flash_image_file,
-                               global_flash_image_type);
+    {
+        if (avr_core_load_program (global_core, global_flash_image_file,
+                                   global_flash_image_type) < 0)
+            avr_error ("Could not load flash image %s",
+                       global_flash_image_file);
+    }
+
+    /* Map the eeprom backing file, an eeprom image is loaded into it */
+    if (global_eeprom_backing_file)
+    {
+        if (avr_core_eeprom_file (global_core, global_eeprom_backing_file,
+                                  global_eeprom_journal_file) < 0)
+            avr_error ("Could not use eeprom file %s",
+                       global_eeprom_backing_file);
+    }
 
     /* Load eeprom data image into eeprom */
     if (global_eeprom_image_file)
-        avr_core_load_eeprom (global_core, global_eeprom_image_file,
-                              global_eeprom_image_type);
+    {
+        if (avr_core_load_eeprom (global_core, global_eeprom_image_file,
+                                  global_eeprom_image_type) < 0)
+            avr_error ("Could not load eeprom image %s",
+                       global_eeprom_image_file);
+    }
 
     for (i = 0; i < global_break_count; i++)
     {
@@ -457,22 +816,119 @@ main (int argc, char **argv)
         avr_core_insert_breakpoint (global_core, global_break_list[i] / 2);
     }
 
+    if (global_load_state_file)
+    {
+        if (avr_core_load_state (global_core, global_load_state_file) < 0)
+            avr_error ("Could not restore state from %s",
+                       global_load_state_file);
+        avr_message ("Restored state from %s at clock cycle %" PRIu64 "\n",
+                     global_load_state_file, avr_core_CK_get (global_core));
+    }
+
+    if (global_profile_file)
+        avr_core_profile_start (global_core);
+    if (global_flame_dir)
+        avr_core_profile_flame_dir (global_core, global_flame_dir);
+    if (global_sample_file)
+        avr_core_sample_start (global_core, global_sample_period,
+                               global_sample_callers);
+
+    if (global_trace_file)
+    {
+        int32_t trigger = TRACE_NO_TRIGGER;
+        int addr;
+        char c;
+
+        if (global_trace_trigger)
+        {
+            if ((sscanf (global_trace_trigger, "%i%c", &addr, &c) != 1)
+                && ((addr = avr_core_symbol_addr (global_core,
+                                                  global_trace_trigger)) < 0))
+                avr_error ("Unknown trace trigger: %s", global_trace_trigger);
+            trigger = addr / 2;
+        }
+
+        if (avr_core_trace_start (global_core, global_trace_file, trigger,
+                                  global_trace_size) < 0)
+            avr_error ("Could not write trace to %s", global_trace_file);
+    }
+
+    if (global_record_file)
+    {
+        if (avr_core_replay_start (global_core, global_record_file, 0) < 0)
+            avr_error ("Could not record to %s", global_record_file);
+        avr_message ("Recording the input to %s\n", global_record_file);
+    }
+    if (global_replay_file)
+    {
+        if (avr_core_replay_start (global_core, global_replay_file, 1) < 0)
+            avr_error ("Could not replay %s", global_replay_file);
+        avr_message ("Replaying the input of %s\n", global_replay_file);
+    }
+
     if (global_gdbserver_mode == 1)
     {
         global_gdb_comm->user_data = global_core;
+        if ((global_history_interval == 0)
+            || (avr_core_history_start (global_core,
+                                        global_history_interval) < 0))
+        {
+            global_gdb_comm->reverse_step = NULL;
+            global_gdb_comm->reverse_continue = NULL;
+        }
         gdb_interact (global_gdb_comm, global_gdbserver_port,
                       global_gdb_debug);
     }
     else
     {
-        if (global_flash_image_file)
+        if (global_flash_image_file == NULL)
+            fprintf (stderr, "No program was specified to be run.\n");
+        else if (global_load_state_file)
+            /* Continue the restored program */
+            avr_core_continue (global_core);
+        else
             /* Run the program */
             avr_core_run (global_core);
+    }
+
+    if (global_save_state_file)
+    {
+        if (avr_core_save_state (global_core, global_save_state_file) < 0)
+            avr_warning ("Could not save state to %s\n",
+                         global_save_state_file);
         else
-            fprintf (stderr, "No program was specified to be run.\n");
+            avr_message ("Saved state to %s\n", global_save_state_file);
+    }
+
+    if (global_profile_file)
+    {
+        if (avr_core_profile_write (global_core, global_profile_file) < 0)
+            avr_warning ("Could not write profile to %s\n",
+                         global_profile_file);
+        else
+            avr_message ("Wrote profile to %s\n", global_profile_file);
+    }
+
+    if (global_sample_file)
+    {
+        if (avr_core_sample_write (global_core, global_sample_file) < 0)
+            avr_warning ("Could not write samples to %s\n",
+                         global_sample_file);
+        else
+            avr_message ("Wrote samples to %s\n", global_sample_file);
     }
 
-    display_close ();           /* close down the display coprocess */
+    if (global_trace_file)
+    {
+        avr_core_trace_stop (global_core);
+        avr_message ("Wrote trace to %s\n", global_trace_file);
+    }
+
+    if (global_record_file || global_replay_file)
+        avr_core_replay_stop (global_core);
+
+    /* close down the display coprocess */
+    display_close (avr_core_get_display (global_core));
 
     exit (0);
     return 0;
@@ -90,6 +90,17 @@ mem_construct (Memory *mem, int gpwr_end, int io_reg_end, int sram_end,
 
     mem->cell = avr_new0 (MemoryCell, xram_end + 1);
 
+    mem->range = NULL;
+    mem->num_ranges = 0;
+
+    mem->dev_addr = NULL;
+    mem->num_devs = 0;
+
+    mem->trace_rec = NULL;
+
+    mem->watch = NULL;
+    mem->watch_hit = 0;
+
     class_construct ((AvrClass *)mem);
 }
 
@@ -105,15 +116,15 @@ mem_destroy (void *mem)
     if (mem == NULL)
         return;
 
-    for (i = 0; i < this->xram_end; i++)
-    {
-        if (this->cell[i].vdev)
-        {
-            class_unref ((AvrClass *)this->cell[i].vdev);
-        }
-    }
+    /* Only the attached cells are touched, the rest of the (mostly unused)
+       64K cell array is never paged in. */
+    for (i = 0; i < this->num_ranges; i++)
+        class_unref ((AvrClass *)this->range[i].vdev);
 
+    avr_free (this->range);
     avr_free (this->cell);
+    avr_free (this->dev_addr);
+    avr_free (this->watch);
 
     class_destroy (mem);
 }
@@ -129,8 +140,26 @@ mem_destroy (void *mem)
 void
 mem_attach (Memory *mem, int addr, char *name, VDevice *vdev, int flags,
             uint8_t reset_value, uint8_t rd_mask, uint8_t wr_mask)
+{
+    mem_attach_range (mem, addr, 1, name, vdev, flags, reset_value, rd_mask,
+                      wr_mask);
+}
+
+/** \brief Attach a device to \a len addresses starting at \a addr.
+
+  All the cells get the same name, flags and masks. The range is recorded
+  once (a single attachment directly after the previous one of the same
+  device extends it), so attaching the sram costs one call, not one per
+  byte. */
+
+void
+mem_attach_range (Memory *mem, int addr, int len, char *name, VDevice *vdev,
+                  int flags, uint8_t reset_value, uint8_t rd_mask,
+                  uint8_t wr_mask)
 {
     MemoryCell *cell;
+    MemRange *last;
+    int i;
 
     if (mem == NULL)
         avr_error ("passed null ptr");
@@ -138,19 +167,35 @@ mem_attach (Memory *mem, int addr, char *name, VDevice *vdev, int flags,
     if (vdev == NULL)
         avr_error ("attempt to attach null device");
 
-    if ((addr < 0) || (addr >= mem->xram_end))
+    if ((addr < 0) || (len < 1) || (addr + len > mem->xram_end))
         avr_error ("address out of range");
 
-    cell = &mem->cell[addr];
+    for (i = 0, cell = &mem->cell[addr]; i < len; i++, cell++)
+    {
+        cell->name = name;
+        cell->flags = flags;
+        cell->reset_value = reset_value;
+        cell->rd_mask = rd_mask;
+        cell->wr_mask = wr_mask;
+        cell->vdev = vdev;
+    }
 
-    cell->name = name;
-    cell->flags = flags;
-    cell->reset_value = reset_value;
-    cell->rd_mask = rd_mask;
-    cell->wr_mask = wr_mask;
+    last = mem->num_ranges ? &mem->range[mem->num_ranges - 1] : NULL;
+    if (last && (last->vdev == vdev) && (last->addr + last->len == addr))
+        last->len += len;
+    else
+    {
+        mem->range = avr_renew (MemRange, mem->range, mem->num_ranges + 1);
+        last = &mem->range[mem->num_ranges++];
+        last->addr = addr;
+        last->len = len;
+        last->vdev = vdev;
+        class_ref ((AvrClass *)vdev);
+    }
 
-    class_ref ((AvrClass *)vdev);
-    cell->vdev = vdev;
+    /* rebuilt by mem_devices() */
+    avr_free (mem->dev_addr);
+    mem->dev_addr = NULL;
 }
 
 /** \brief Find the VDevice associated with the given address. */
@@ -201,6 +246,45 @@ mem_set_addr_name (Memory *mem, int addr, char *name)
     mem->cell[addr].name = name;
 }
 
+/** \brief Set the watchpoint \a flag on \a len addresses from \a addr.
+ *
+ * The map is only allocated with the first watchpoint, without one the
+ * check in mem_read() and mem_write() is a test of a NULL pointer.
+ */
+
+void
+mem_watch_add (Memory *mem, int addr, int len, int flag)
+{
+    if (mem->watch == NULL)
+        mem->watch = avr_new0 (uint8_t, mem->xram_end + 1);
+
+    for (; (len > 0) && (addr <= mem->xram_end); addr++, len--)
+        mem->watch[addr] |= flag;
+}
+
+/** \brief Remove all watchpoints. */
+
+void
+mem_watch_clear (Memory *mem)
+{
+    avr_free (mem->watch);
+    mem->watch = NULL;
+    mem->watch_hit = 0;
+}
+
+/* Note the first watchpoint hit by the instruction, a watchpoint for any
+   access is reported as such. */
+
+static void
+mem_watch_hit (Memory *mem, int addr, int flag)
+{
+    if (mem->watch_hit)
+        return;
+
+    mem->watch_hit = (mem->watch[addr] & flag) ? flag : MEM_WATCH_ACCESS;
+    mem->watch_addr = addr;
+}
+
 /** \brief Reads byte from memory and sanity-checks for valid address. 
  * 
  * \param mem A pointer to the memory object
@@ -233,6 +317,9 @@ mem_read (Memory *mem, int addr)
         return 0;
     }
 
+    if (mem->watch && (mem->watch[addr] & (MEM_WATCH_READ | MEM_WATCH_ACCESS)))
+        mem_watch_hit (mem, addr, MEM_WATCH_READ);
+
     return (vdev_read (cell->vdev, addr) & cell->rd_mask);
 }
 
@@ -268,14 +355,76 @@ mem_write (Memory *mem, int addr, uint8_t val)
         return;
     }
 
+    if (mem->watch
+        && (mem->watch[addr] & (MEM_WATCH_WRITE | MEM_WATCH_ACCESS)))
+        mem_watch_hit (mem, addr, MEM_WATCH_WRITE);
+
     /* update the display for io registers here */
 
     if (mem_is_io_reg (mem, addr))
-        display_io_reg (addr - (mem->gpwr_end + 1), val & cell->wr_mask);
+        display_io_reg (vdev_get_display (cell->vdev),
+                        addr - (mem->gpwr_end + 1), val & cell->wr_mask);
+
+    /* the registers are compared at the end of the instruction */
+    if (mem->trace_rec && (addr > mem->gpwr_end))
+        trace_rec_write (mem->trace_rec, addr, val & cell->wr_mask);
 
     vdev_write (cell->vdev, addr, val & cell->wr_mask);
 }
 
+static int
+mem_addr_cmp (const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/* Build the list of devices (by their lowest address) once, mem_reset(),
+   mem_save() and mem_load() then do not have to walk the whole data space
+   (64K cells with xram).
+
+   A device may be attached at several, not necessarily adjacent addresses
+   (e.g. a port with its PIN register in the low and DDR/PORT in the
+   extended io space); snapshots handle it at the lowest one. Cells taken
+   over by a later attachment do not count for the earlier device. */
+
+static void
+mem_devices (Memory *mem)
+{
+    MemRange *r;
+    int j, addr;
+
+    if (mem->dev_addr)
+        return;
+
+    mem->num_devs = 0;
+    for (r = mem->range; r < mem->range + mem->num_ranges; r++)
+    {
+        for (addr = r->addr; addr < r->addr + r->len; addr++)
+        {
+            if (mem->cell[addr].vdev != r->vdev)
+                continue;
+            if ((addr > r->addr) && (mem->cell[addr - 1].vdev == r->vdev))
+                continue;       /* fast path for sram and gpwr */
+
+            for (j = 0; j < mem->num_devs; j++)
+                if (mem->cell[mem->dev_addr[j]].vdev == r->vdev)
+                    break;
+
+            if (j == mem->num_devs)
+            {
+                mem->dev_addr = avr_renew (int, mem->dev_addr,
+                                           mem->num_devs + 1);
+                mem->dev_addr[mem->num_devs++] = addr;
+            }
+            else if (addr < mem->dev_addr[j])
+                mem->dev_addr[j] = addr;
+        }
+    }
+
+    /* keep the address order, it is the snapshot layout */
+    qsort (mem->dev_addr, mem->num_devs, sizeof (int), mem_addr_cmp);
+}
+
 /** \brief Resets every device in the memory object.
  * \param mem A pointer to the memory object.
  */
@@ -285,13 +434,96 @@ mem_reset (Memory *mem)
 {
     int i;
 
-    for (i = 0; i < mem->xram_end; i++)
+    mem_devices (mem);
+
+    for (i = 0; i < mem->num_devs; i++)
+        vdev_reset (mem->cell[mem->dev_addr[i]].vdev);
+}
+
+/** \brief Append the state of all devices on the memory bus to a snapshot.
+
+    Each device is stored as its lowest address and the length of its data,
+    so a mismatch between the saved and the loading device is detected.
+    Returns -1 if a device does not support snapshots. */
+
+int
+mem_save (Memory *mem, Snapshot *ss)
+{
+    VDevice *dev;
+    int i, addr, len_pos;
+
+    mem_devices (mem);
+
+    for (i = 0; i < mem->num_devs; i++)
     {
-        MemoryCell *cell = mem_get_cell (mem, i);
+        addr = mem->dev_addr[i];
+        dev = mem->cell[addr].vdev;
+
+        snapshot_put_u32 (ss, addr);
+        len_pos = ss->len;
+        snapshot_put_u32 (ss, 0);
 
-        if (cell->vdev)
-            vdev_reset (cell->vdev);
+        if (vdev_save (dev, ss) < 0)
+        {
+            avr_warning ("device '%s' at 0x%04x does not support"
+                         " snapshots\n", mem->cell[addr].name, addr);
+            return -1;
+        }
+
+        snapshot_patch_u32 (ss, len_pos, ss->len - len_pos - 4);
+    }
+
+    /* end marker */
+    snapshot_put_u32 (ss, 0xffffffff);
+
+    return 0;
+}
+
+/** \brief Restore the devices on the memory bus from a snapshot.
+
+    The devices must have been reset. Returns -1 if the snapshot does not
+    match the devices of this memory bus. */
+
+int
+mem_load (Memory *mem, Snapshot *ss)
+{
+    VDevice *dev;
+    int i, addr, start;
+    uint32_t len;
+
+    mem_devices (mem);
+
+    for (i = 0; i < mem->num_devs; i++)
+    {
+        addr = mem->dev_addr[i];
+        dev = mem->cell[addr].vdev;
+
+        len = snapshot_get_u32 (ss);
+        if (len != (uint32_t) addr)
+        {
+            avr_warning ("snapshot: no device at 0x%04x\n", addr);
+            return -1;
+        }
+
+        len = snapshot_get_u32 (ss);
+        start = ss->pos;
+        vdev_load (dev, ss);
+
+        if (ss->error || (ss->pos - start != (int)len))
+        {
+            avr_warning ("snapshot: bad data for device '%s' at 0x%04x\n",
+                         mem->cell[addr].name, addr);
+            return -1;
+        }
+    }
+
+    if (snapshot_get_u32 (ss) != 0xffffffff)
+    {
+        avr_warning ("snapshot: device list does not match\n");
+        return -1;
     }
+
+    return 0;
 }
 
 static void
@@ -37,6 +37,28 @@ struct _MemoryCell {
     uint8_t wr_mask;
 };
 
+/* One attachment of a device to a contiguous address range. It holds a
+   reference to the device, the cells only point to it. */
+
+typedef struct _MemRange MemRange;
+
+struct _MemRange {
+    int addr;
+    int len;
+    VDevice *vdev;
+};
+
+/* Watchpoint flags of an address (see mem_watch_add()). A hit is reported
+   with the flag of the watchpoint, plus MEM_WATCH_EEPROM for an eeprom
+   address (see avr_core_watch_eeprom()). */
+
+enum _mem_watch_flags {
+    MEM_WATCH_WRITE  = 0x01,
+    MEM_WATCH_READ   = 0x02,
+    MEM_WATCH_ACCESS = 0x04,
+    MEM_WATCH_EEPROM = 0x08,
+};
+
 /****************************************************************************\
  *
  * Memory(AvrClass) Definition.
@@ -59,6 +81,22 @@ struct _Memory
                                    sram_end. */
 
     MemoryCell *cell;           /* Dynamically allocated to len xram_end+1. */
+
+    MemRange *range;            /* the attachments, in order */
+    int num_ranges;
+
+    int *dev_addr;              /* lowest address of every attached device,
+                                   built on demand (NULL: not yet) */
+    int num_devs;
+
+    struct _TraceRec *trace_rec; /* record of the instruction being traced,
+                                    gets the writes (see trace.h) */
+
+    uint8_t *watch;             /* MEM_WATCH_* flags of every address, NULL
+                                   while no watchpoint is set */
+    int watch_hit;              /* first watchpoint hit by the instruction,
+                                   0: none */
+    int watch_addr;             /* address of the hit */
 };
 
 extern Memory *mem_new (int gpwr_end, int io_reg_end, int sram_end,
@@ -71,13 +109,22 @@ extern void mem_attach (Memory *mem, int addr, char *name, VDevice *vdev,
                         int flags, uint8_t reset_value, uint8_t rd_mask,
                         uint8_t wr_mask);
 
+extern void mem_attach_range (Memory *mem, int addr, int len, char *name,
+                              VDevice *vdev, int flags, uint8_t reset_value,
+                              uint8_t rd_mask, uint8_t wr_mask);
+
 extern VDevice *mem_get_vdevice_by_addr (Memory *mem, int addr);
 extern VDevice *mem_get_vdevice_by_name (Memory *mem, char *name);
 extern void mem_set_addr_name (Memory *mem, int addr, char *name);
 
+extern void mem_watch_add (Memory *mem, int addr, int len, int flag);
+extern void mem_watch_clear (Memory *mem);
+
 extern uint8_t mem_read (Memory *mem, int addr);
 extern void mem_write (Memory *mem, int addr, uint8_t val);
 extern void mem_reset (Memory *mem);
+extern int mem_save (Memory *mem, Snapshot *ss);
+extern int mem_load (Memory *mem, Snapshot *ss);
 
 extern void mem_io_fetch (Memory *mem, int addr, uint8_t * val, char *buf,
                           int bufsiz);
@@ -167,6 +167,10 @@ enum _opcode_name
 #  define BREAK_POINT    -1
 #endif
 
+#ifndef WATCH_POINT
+#  define WATCH_POINT    -2
+#endif
+
 /* global array for mapping handler codes to name strings */
 extern char *global_opcode_name[NUM_OPCODE_HANLDERS];
 
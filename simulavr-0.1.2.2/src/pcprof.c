@@ -0,0 +1,396 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file pcprof.c
+ * \brief simulavr-pcprof: report the PC samples written by '--sample'.
+ *
+ * The samples are summed up per symbol of the ELF program, per address or,
+ * with the help of avr-addr2line, per source line. See sample.c for the
+ * file layout.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+#include "utils.h"
+
+#include "snapshot.h"
+#include "image.h"
+#include "sample.h"
+
+#include "gnu_getopt.h"
+
+/* Samples at one address (flash byte address) or summed up for a name. */
+
+typedef struct _Entry Entry;
+
+struct _Entry
+{
+    uint32_t addr;
+    uint32_t count;
+    const char *name;           /* symbol or source line, NULL: unknown */
+};
+
+/* addresses passed to one avr-addr2line run */
+#define ADDR2LINE_BATCH 256
+
+static char *usage_str =
+    "\nUsage: %s [OPTIONS]... samples [program.elf]\n"
+    "\n"
+    "Report the PC samples written by simulavr-oseid --sample. With an ELF\n"
+    "program the samples are summed up per function.\n"
+    "\n" "Options:\n"
+    "  -h, --help             : Show this message\n"
+    "  -a, --addresses        : Report every sampled address\n"
+    "  -l, --lines            : Report per source line (avr-addr2line)\n"
+    "  -c, --callers          : Report the callers (needs --sample-callers)\n"
+    "  -n, --top <n>          : Print only the first n entries\n"
+    "  -A, --addr2line <prog> : Use prog instead of avr-addr2line\n" "\n";
+
+static struct option long_opts[] = {
+    /* name,             has_arg, flag,   val */
+    { "help",            0,       0,     'h' },
+    { "addresses",       0,       0,     'a' },
+    { "lines",           0,       0,     'l' },
+    { "callers",         0,       0,     'c' },
+    { "top",             1,       0,     'n' },
+    { "addr2line",       1,       0,     'A' },
+    { NULL,              0,       0,      0  }
+};
+
+static void
+usage (char *prog)
+{
+    fprintf (stdout, usage_str, prog);
+    exit (1);
+}
+
+static int
+cmp_count (const void *a, const void *b)
+{
+    const Entry *e1 = (const Entry *)a;
+    const Entry *e2 = (const Entry *)b;
+
+    if (e1->count != e2->count)
+        return (e1->count < e2->count) ? 1 : -1;
+    return (e1->addr < e2->addr) ? -1 : (e1->addr > e2->addr);
+}
+
+static int
+cmp_name (const void *a, const void *b)
+{
+    const Entry *e1 = (const Entry *)a;
+    const Entry *e2 = (const Entry *)b;
+
+    if (e1->name == e2->name)
+        return 0;
+    if (e1->name == NULL)
+        return 1;
+    if (e2->name == NULL)
+        return -1;
+    return strcmp (e1->name, e2->name);
+}
+
+/* Read one histogram of the samples file. */
+
+static Entry *
+read_hist (Snapshot *ss, int *num)
+{
+    Entry *ent;
+    int i, n = snapshot_get_u32 (ss);
+
+    if (ss->error || (n < 0) || (n > (ss->len - ss->pos) / 8))
+        avr_error ("samples file is damaged");
+
+    ent = avr_new0 (Entry, n ? n : 1);
+    for (i = 0; i < n; i++)
+    {
+        ent[i].addr = snapshot_get_u32 (ss) * 2;
+        ent[i].count = snapshot_get_u32 (ss);
+    }
+    *num = n;
+
+    return ent;
+}
+
+/* Fill in the source line of the addresses from avr-addr2line. */
+
+static void
+name_lines (Entry *ent, int num, char *prog, char *elf)
+{
+    char *argv[ADDR2LINE_BATCH + 4];
+    char addr[ADDR2LINE_BATCH][16];
+    char line[1024];
+    int pfd[2];
+    pid_t pid;
+    FILE *fp;
+    int i, j, n, status;
+
+    for (i = 0; i < num; i += n)
+    {
+        n = num - i;
+        if (n > ADDR2LINE_BATCH)
+            n = ADDR2LINE_BATCH;
+
+        argv[0] = prog;
+        argv[1] = "-e";
+        argv[2] = elf;
+        for (j = 0; j < n; j++)
+        {
+            snprintf (addr[j], sizeof (addr[j]), "0x%x", ent[i + j].addr);
+            argv[3 + j] = addr[j];
+        }
+        argv[3 + n] = NULL;
+
+        if (pipe (pfd) < 0)
+            avr_error ("pipe failed: %s", strerror (errno));
+
+        pid = fork ();
+        if (pid < 0)
+            avr_error ("fork failed: %s", strerror (errno));
+        if (pid == 0)
+        {
+            dup2 (pfd[1], 1);
+            close (pfd[0]);
+            close (pfd[1]);
+            execvp (prog, argv);
+            fprintf (stderr, "%s: %s\n", prog, strerror (errno));
+            _exit (127);
+        }
+
+        close (pfd[1]);
+        fp = fdopen (pfd[0], "r");
+        for (j = 0; (j < n) && fgets (line, sizeof (line), fp); j++)
+        {
+            line[strcspn (line, "\n")] = '\0';
+            /* "file:line (discriminator n)" */
+            line[strcspn (line, " ")] = '\0';
+            if (strncmp (line, "??", 2) != 0)
+                ent[i + j].name = avr_strdup (line);
+        }
+        fclose (fp);
+
+        if ((waitpid (pid, &status, 0) < 0) || !WIFEXITED (status)
+            || (WEXITSTATUS (status) != 0))
+            avr_error ("%s failed", prog);
+    }
+}
+
+/* Name the addresses by the symbols of the program, off is added to the
+   address first (the call instruction before a return address). */
+
+static void
+name_symbols (Entry *ent, int num, Image *img, int off, int with_offset)
+{
+    const ImageSymbol *sym;
+    char buf[300];
+    int i;
+
+    for (i = 0; i < num; i++)
+    {
+        sym = image_symbol (img, ent[i].addr + off);
+        if (sym == NULL)
+            continue;
+        if (with_offset)
+        {
+            snprintf (buf, sizeof (buf), "%s+0x%x", sym->name,
+                      ent[i].addr + off - sym->addr);
+            ent[i].name = avr_strdup (buf);
+        }
+        else
+            ent[i].name = sym->name;
+    }
+}
+
+/* Sum up the entries with the same name, the unnamed ones stay per
+   address. Returns the new number of entries. */
+
+static int
+merge_names (Entry *ent, int num)
+{
+    int i, n = 0;
+
+    qsort (ent, num, sizeof (Entry), cmp_name);
+    for (i = 0; i < num; i++)
+    {
+        if ((n > 0) && ent[i].name && ent[n - 1].name
+            && (strcmp (ent[i].name, ent[n - 1].name) == 0))
+        {
+            ent[n - 1].count += ent[i].count;
+            if (ent[i].addr < ent[n - 1].addr)
+                ent[n - 1].addr = ent[i].addr;
+        }
+        else
+            ent[n++] = ent[i];
+    }
+
+    return n;
+}
+
+static void
+report (char *title, Entry *ent, int num, uint64_t total, int top)
+{
+    uint64_t sum = 0;
+    int i;
+
+    qsort (ent, num, sizeof (Entry), cmp_count);
+
+    printf ("%s\n\n%10s %7s %7s  %-8s %s\n", title, "samples", "%", "cum%",
+            "address", "where");
+    for (i = 0; (i < num) && ((top <= 0) || (i < top)); i++)
+    {
+        sum += ent[i].count;
+        printf ("%10u %6.2f%% %6.2f%%  0x%06x %s\n", ent[i].count,
+                total ? 100.0 * ent[i].count / total : 0.0,
+                total ? 100.0 * sum / total : 0.0, ent[i].addr,
+                ent[i].name ? ent[i].name : "??");
+    }
+    printf ("\n");
+}
+
+int
+main (int argc, char **argv)
+{
+    char *prog = argv[0];
+    char *addr2line = "avr-addr2line";
+    int by_addr = 0, by_line = 0, callers = 0, top = 0;
+    char *file, *elf = NULL;
+    Image *img = NULL;
+    Snapshot *ss;
+    Entry *pc, *ret = NULL;
+    int num_pc, num_ret = 0;
+    uint32_t period, flags;
+    uint64_t total;
+    int c, option_index;
+
+    opterr = 0;                 /* disable default error message */
+
+    while ((c = getopt_long (argc, argv, "halcn:A:", long_opts,
+                             &option_index)) != -1)
+    {
+        switch (c)
+        {
+            case 'a':
+                by_addr = 1;
+                break;
+            case 'l':
+                by_line = 1;
+                break;
+            case 'c':
+                callers = 1;
+                break;
+            case 'n':
+                top = atoi (optarg);
+                break;
+            case 'A':
+                addr2line = optarg;
+                break;
+            default:
+                usage (prog);
+        }
+    }
+
+    if ((optind == argc) || (optind + 2 < argc))
+        usage (prog);
+    file = argv[optind];
+    if (optind + 1 < argc)
+        elf = argv[optind + 1];
+
+    if (by_line && (elf == NULL))
+        avr_error ("Source lines need the ELF program");
+
+    if ((ss = snapshot_read_file (file)) == NULL)
+        exit (1);
+
+    if ((ss->len < 8) || memcmp (ss->data, SAMPLE_MAGIC, 8) != 0)
+        avr_error ("%s: not a samples file", file);
+    ss->pos = 8;
+    if (snapshot_get_u32 (ss) != SAMPLE_VERSION)
+        avr_error ("%s: samples file version not supported", file);
+    period = snapshot_get_u32 (ss);
+    flags = snapshot_get_u32 (ss);
+    snapshot_get_u32 (ss);      /* flash words */
+    total = snapshot_get_u64 (ss);
+
+    pc = read_hist (ss, &num_pc);
+    if (flags & SAMPLE_CALLERS)
+        ret = read_hist (ss, &num_ret);
+    else if (callers)
+        avr_error ("%s: taken without --sample-callers", file);
+
+    if (elf && ((img = image_read (elf, FFMT_ELF)) == NULL))
+        avr_error ("Could not read %s", elf);
+
+    printf ("%llu samples, one every %u clock cycles\n\n",
+            (unsigned long long)total, period);
+
+    if (by_line)
+    {
+        name_lines (pc, num_pc, addr2line, elf);
+        if (!by_addr)
+            num_pc = merge_names (pc, num_pc);
+        report ("Per source line:", pc, num_pc, total, top);
+    }
+    else if (by_addr)
+    {
+        name_symbols (pc, num_pc, img, 0, 1);
+        report ("Per address:", pc, num_pc, total, top);
+    }
+    else
+    {
+        name_symbols (pc, num_pc, img, 0, 0);
+        num_pc = merge_names (pc, num_pc);
+        report ("Per function:", pc, num_pc, total, top);
+    }
+
+    if (callers)
+    {
+        /* a return address points after the call, name the call site */
+        name_symbols (ret, num_ret, img, -2, by_addr);
+        if (!by_addr)
+            num_ret = merge_names (ret, num_ret);
+        report ("Callers (return address at the top of the stack):", ret,
+                num_ret, total, top);
+    }
+
+    avr_free (pc);
+    avr_free (ret);
+    if (img)
+        class_unref ((AvrClass *)img);
+    class_unref ((AvrClass *)ss);
+
+    return 0;
+}
@@ -74,6 +74,8 @@ static void port_destroy (void *p);
 static uint8_t port_reg_read (VDevice *dev, int addr);
 static void port_reg_write (VDevice *dev, int addr, uint8_t val);
 static void port_reset (VDevice *dev);
+static void port_save (VDevice *dev, Snapshot *ss);
+static void port_load (VDevice *dev, Snapshot *ss);
 
 static uint8_t port_read_pin (Port *p, int addr);
 
@@ -130,6 +132,7 @@ port_construct (Port *p, int addr, char *name)
 
     vdev_construct ((VDevice *)p, port_reg_read, port_reg_write, port_reset,
                     port_add_addr);
+    vdev_set_state_fp ((VDevice *)p, port_save, port_load);
 
     port_add_addr ((VDevice *)p, addr, name, 0, NULL);
 
@@ -177,6 +180,29 @@ port_reset (VDevice *dev)
     p->ext_enable = 1;
 }
 
+static void
+port_save (VDevice *dev, Snapshot *ss)
+{
+    Port *p = (Port *)dev;
+
+    snapshot_put_u8 (ss, p->port);
+    snapshot_put_u8 (ss, p->ddr);
+    snapshot_put_u8 (ss, p->pin);
+}
+
+/* The external hardware is not told about the restored port value, it is
+   not part of the snapshot. */
+
+static void
+port_load (VDevice *dev, Snapshot *ss)
+{
+    Port *p = (Port *)dev;
+
+    p->port = snapshot_get_u8 (ss);
+    p->ddr = snapshot_get_u8 (ss);
+    p->pin = snapshot_get_u8 (ss);
+}
+
 /**
  * \brief Destructor for the Port object
  *
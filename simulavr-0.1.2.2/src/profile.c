@@ -0,0 +1,687 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file profile.c
+ * \brief Function level cycle profiler.
+ *
+ * The core reports every CALL, RCALL, ICALL, EICALL and interrupt entry with
+ * profile_call() and every RET and RETI with profile_ret(). From these a
+ * shadow call stack is kept, a frame is closed with the cycle count (CK) at
+ * its return and its cycles are split into the exclusive cycles of the
+ * function and the inclusive cycles of the call arc.
+ *
+ * Firmware does not always return the way it was called (setjmp/longjmp,
+ * a return address pushed to jump, tail jumps out of a function). A frame
+ * therefore remembers the stack pointer after the return address was
+ * pushed; a return closes the frame with the same stack pointer together
+ * with the deeper frames which were left without a return, and a return
+ * which matches no frame is not a return for the profiler. On a device
+ * without a stack pointer (hardware stack) the frames are simply popped.
+ *
+ * Functions are keyed by their entry address and named from the symbol
+ * table of the ELF program, see image_symbol(). The result is written in
+ * the callgrind format, kcachegrind reads it directly.
+ *
+ * For flame graphs every frame also points to a node of a calling context
+ * tree (the function and the context of the caller). The cycles between two
+ * changes of the top frame go to its node, and profile_write_folded() writes
+ * each node with cycles as one line of the folded stack format
+ * ("main;f;g 1234"). With profile_flame_dir() one such file is written for
+ * every APDU the card processes.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+
+#include "image.h"
+#include "profile.h"
+
+/* The root frame is never closed by a return. */
+#define PROFILE_ROOT_SP 0x7fffffff
+
+static void profile_push (Profile *prof, int func, int arc, int sp,
+                          uint64_t ck);
+static void profile_tick (Profile *prof, uint64_t ck);
+static void profile_close (Profile *prof, ProfFunc *funcs, ProfArc *arcs,
+                           ProfFrame *frame, ProfFrame *parent, uint64_t ck);
+
+/** \brief Allocate a new Profile object.
+
+    The root frame starts at \a pc (word address) and clock cycle \a ck. A
+    reference to \a image is kept for the names. */
+
+Profile *
+profile_new (Image *image, uint32_t pc, uint64_t ck)
+{
+    Profile *prof;
+
+    prof = avr_new (Profile, 1);
+    profile_construct (prof, image, pc, ck);
+    class_overload_destroy ((AvrClass *)prof, profile_destroy);
+
+    return prof;
+}
+
+/** \brief Constructor for the Profile class. */
+
+void
+profile_construct (Profile *prof, Image *image, uint32_t pc, uint64_t ck)
+{
+    int i;
+
+    if (prof == NULL)
+        avr_error ("passed null ptr");
+
+    class_construct ((AvrClass *)prof);
+
+    prof->image = image;
+    if (image)
+        class_ref ((AvrClass *)image);
+
+    prof->num_funcs = 0;
+    prof->max_funcs = 64;
+    prof->funcs = avr_new (ProfFunc, prof->max_funcs);
+
+    prof->hash_size = 128;
+    prof->hash = avr_new (int, prof->hash_size);
+    for (i = 0; i < prof->hash_size; i++)
+        prof->hash[i] = -1;
+
+    prof->num_arcs = 0;
+    prof->max_arcs = 128;
+    prof->arcs = avr_new (ProfArc, prof->max_arcs);
+
+    /* node 0 is the parent of the root frames and never gets cycles */
+    prof->num_nodes = 1;
+    prof->max_nodes = 128;
+    prof->nodes = avr_new (ProfNode, prof->max_nodes);
+    prof->nodes[0].parent = -1;
+    prof->nodes[0].func = -1;
+    prof->nodes[0].cycles = 0;
+    prof->nodes[0].child = -1;
+    prof->nodes[0].sibling = -1;
+    prof->mark = ck;
+
+    prof->depth = 0;
+    prof->max_depth = 32;
+    prof->stack = avr_new (ProfFrame, prof->max_depth);
+
+    prof->flame_dir = NULL;
+    prof->apdu = 0;
+    prof->apdu_open = 0;
+
+    profile_restart (prof, pc, ck);
+}
+
+/** \brief Destructor for the Profile class. */
+
+void
+profile_destroy (void *prof)
+{
+    Profile *_prof = (Profile *)prof;
+
+    if (prof == NULL)
+        return;
+
+    if (_prof->image)
+        class_unref ((AvrClass *)_prof->image);
+
+    avr_free (_prof->funcs);
+    avr_free (_prof->hash);
+    avr_free (_prof->arcs);
+    avr_free (_prof->nodes);
+    avr_free (_prof->stack);
+    avr_free (_prof->flame_dir);
+
+    class_destroy (prof);
+}
+
+static inline unsigned int
+profile_hash (Profile *prof, uint32_t addr)
+{
+    return (addr * 2654435761U >> 8) & (prof->hash_size - 1);
+}
+
+static void
+profile_rehash (Profile *prof)
+{
+    unsigned int h;
+    int i;
+
+    prof->hash_size *= 2;
+    prof->hash = avr_renew (int, prof->hash, prof->hash_size);
+    for (i = 0; i < prof->hash_size; i++)
+        prof->hash[i] = -1;
+
+    for (i = 0; i < prof->num_funcs; i++)
+    {
+        h = profile_hash (prof, prof->funcs[i].addr);
+        while (prof->hash[h] >= 0)
+            h = (h + 1) & (prof->hash_size - 1);
+        prof->hash[h] = i;
+    }
+}
+
+/* Return the index of the function entered at addr, add it if new. */
+
+static int
+profile_func (Profile *prof, uint32_t addr)
+{
+    unsigned int h = profile_hash (prof, addr);
+    ProfFunc *func;
+    int i;
+
+    while ((i = prof->hash[h]) >= 0)
+    {
+        if (prof->funcs[i].addr == addr)
+            return i;
+        h = (h + 1) & (prof->hash_size - 1);
+    }
+
+    if (prof->num_funcs == prof->max_funcs)
+    {
+        prof->max_funcs *= 2;
+        prof->funcs = avr_renew (ProfFunc, prof->funcs, prof->max_funcs);
+    }
+
+    i = prof->num_funcs++;
+    func = &prof->funcs[i];
+    func->addr = addr;
+    func->calls = 0;
+    func->self = 0;
+    func->arcs = -1;
+
+    if (prof->num_funcs * 2 > prof->hash_size)
+        profile_rehash (prof);
+    else
+        prof->hash[h] = i;
+
+    return i;
+}
+
+/* Return the index of the arc from caller to callee, add it if new. A
+   function calls only a few others, so the list of the caller is short. */
+
+static int
+profile_arc (Profile *prof, int caller, int callee)
+{
+    ProfArc *arc;
+    int i;
+
+    for (i = prof->funcs[caller].arcs; i >= 0; i = prof->arcs[i].next)
+    {
+        if (prof->arcs[i].callee == callee)
+            return i;
+    }
+
+    if (prof->num_arcs == prof->max_arcs)
+    {
+        prof->max_arcs *= 2;
+        prof->arcs = avr_renew (ProfArc, prof->arcs, prof->max_arcs);
+    }
+
+    i = prof->num_arcs++;
+    arc = &prof->arcs[i];
+    arc->caller = caller;
+    arc->callee = callee;
+    arc->calls = 0;
+    arc->incl = 0;
+    arc->next = prof->funcs[caller].arcs;
+    prof->funcs[caller].arcs = i;
+
+    return i;
+}
+
+/* Return the index of the context of func called from context parent, add
+   it if new. */
+
+static int
+profile_node (Profile *prof, int parent, int func)
+{
+    ProfNode *node;
+    int i;
+
+    for (i = prof->nodes[parent].child; i >= 0; i = prof->nodes[i].sibling)
+    {
+        if (prof->nodes[i].func == func)
+            return i;
+    }
+
+    if (prof->num_nodes == prof->max_nodes)
+    {
+        prof->max_nodes *= 2;
+        prof->nodes = avr_renew (ProfNode, prof->nodes, prof->max_nodes);
+    }
+
+    i = prof->num_nodes++;
+    node = &prof->nodes[i];
+    node->parent = parent;
+    node->func = func;
+    node->cycles = 0;
+    node->child = -1;
+    node->sibling = prof->nodes[parent].child;
+    prof->nodes[parent].child = i;
+
+    return i;
+}
+
+/* Give the cycles since the last change of the top frame to its context. */
+
+static void
+profile_tick (Profile *prof, uint64_t ck)
+{
+    if ((prof->depth > 0) && (ck > prof->mark))
+        prof->nodes[prof->stack[prof->depth - 1].node].cycles +=
+            ck - prof->mark;
+    prof->mark = ck;
+}
+
+static void
+profile_push (Profile *prof, int func, int arc, int sp, uint64_t ck)
+{
+    ProfFrame *frame;
+    int parent = prof->depth ? prof->stack[prof->depth - 1].node : 0;
+
+    if (prof->depth == prof->max_depth)
+    {
+        prof->max_depth *= 2;
+        prof->stack = avr_renew (ProfFrame, prof->stack, prof->max_depth);
+    }
+
+    frame = &prof->stack[prof->depth++];
+    frame->func = func;
+    frame->arc = arc;
+    frame->sp = sp;
+    frame->node = profile_node (prof, parent, func);
+    frame->entry = ck;
+    frame->child = 0;
+}
+
+/* Account the cycles of a frame ending at ck to its function and call arc
+   and hand them to the parent. The counters are passed in, so that the
+   output can close the open frames on copies. */
+
+static void
+profile_close (Profile *prof, ProfFunc *funcs, ProfArc *arcs,
+               ProfFrame *frame, ProfFrame *parent, uint64_t ck)
+{
+    uint64_t incl = (ck > frame->entry) ? ck - frame->entry : 0;
+
+    if (incl >= frame->child)
+        funcs[frame->func].self += incl - frame->child;
+    if (frame->arc >= 0)
+        arcs[frame->arc].incl += incl;
+    if (parent)
+        parent->child += incl;
+}
+
+/** \brief Enter the function at \a addr (flash byte address).
+
+    \a sp is the stack pointer after the return address was pushed, -1 if
+    the device has none. Interrupt entries are reported the same way. */
+
+void
+profile_call (Profile *prof, uint32_t addr, int sp, uint64_t ck)
+{
+    int caller = prof->stack[prof->depth - 1].func;
+    int callee = profile_func (prof, addr);
+    int arc = profile_arc (prof, caller, callee);
+
+    profile_tick (prof, ck);
+
+    prof->funcs[callee].calls++;
+    prof->arcs[arc].calls++;
+
+    profile_push (prof, callee, arc, sp, ck);
+}
+
+/** \brief Return from a function, \a sp is the stack pointer before the
+    return address is popped. */
+
+void
+profile_ret (Profile *prof, int sp, uint64_t ck)
+{
+    ProfFrame *top;
+
+    profile_tick (prof, ck);
+
+    if (sp < 0)
+    {
+        /* no stack pointer, trust the calls and returns to pair up */
+        if (prof->depth > 1)
+        {
+            prof->depth--;
+            profile_close (prof, prof->funcs, prof->arcs,
+                           &prof->stack[prof->depth],
+                           &prof->stack[prof->depth - 1], ck);
+        }
+        return;
+    }
+
+    /* frames left without a return (longjmp and the like) */
+    while ((top = &prof->stack[prof->depth - 1])->sp < sp)
+    {
+        prof->depth--;
+        profile_close (prof, prof->funcs, prof->arcs, top, top - 1, ck);
+    }
+
+    if (top->sp == sp)
+    {
+        prof->depth--;
+        profile_close (prof, prof->funcs, prof->arcs, top, top - 1, ck);
+    }
+}
+
+/** \brief Close all frames at clock cycle \a ck and start a new root frame
+    at \a pc (word address), e.g. after a reset of the device.
+
+    The root frame belongs to the function around \a pc. */
+
+void
+profile_restart (Profile *prof, uint32_t pc, uint64_t ck)
+{
+    const ImageSymbol *sym = image_symbol (prof->image, pc * 2);
+    uint32_t addr = sym ? sym->addr : pc * 2;
+
+    profile_tick (prof, ck);
+
+    while (prof->depth > 0)
+    {
+        prof->depth--;
+        profile_close (prof, prof->funcs, prof->arcs,
+                       &prof->stack[prof->depth],
+                       prof->depth ? &prof->stack[prof->depth - 1] : NULL,
+                       ck);
+    }
+
+    profile_push (prof, profile_func (prof, addr), -1, PROFILE_ROOT_SP, ck);
+}
+
+/** \brief Format the name of function \a func into \a buf.
+
+    The symbol at the entry address if there is one, else the nearest
+    symbol below and the offset, else the address. */
+
+const char *
+profile_func_name (Profile *prof, int func, char *buf, int len)
+{
+    uint32_t addr = prof->funcs[func].addr;
+    const ImageSymbol *sym = image_symbol (prof->image, addr);
+
+    if (sym == NULL)
+        snprintf (buf, len, "0x%05x", addr);
+    else if (sym->addr == addr)
+        snprintf (buf, len, "%s", sym->name);
+    else
+        snprintf (buf, len, "%s+0x%x", sym->name, addr - sym->addr);
+
+    return buf;
+}
+
+static int
+profile_cmp_arc (const void *a, const void *b)
+{
+    const ProfArc *a1 = (const ProfArc *)a;
+    const ProfArc *a2 = (const ProfArc *)b;
+
+    if (a1->caller != a2->caller)
+        return a1->caller - a2->caller;
+    return a1->callee - a2->callee;
+}
+
+/* Write a function name, the first use defines the compressed id. */
+
+static void
+profile_put_name (Profile *prof, FILE *fp, const char *key, int func,
+                  char *defined)
+{
+    char name[256];
+
+    if (defined[func])
+        fprintf (fp, "%s=(%d)\n", key, func + 1);
+    else
+    {
+        fprintf (fp, "%s=(%d) %s\n", key, func + 1,
+                 profile_func_name (prof, func, name, sizeof (name)));
+        defined[func] = 1;
+    }
+}
+
+/** \brief Write the profile in the callgrind format to \a file.
+
+    Frames still open are counted up to clock cycle \a ck, the profile
+    itself is not changed and may go on. Returns 0, or -1 with a warning. */
+
+int
+profile_write_callgrind (Profile *prof, char *file, uint64_t ck)
+{
+    ProfFunc *funcs;
+    ProfArc *arcs;
+    ProfFrame *frames;
+    char *defined;
+    uint64_t total = 0;
+    FILE *fp;
+    int i, j, res = 0;
+
+    if ((fp = fopen (file, "w")) == NULL)
+    {
+        avr_warning ("fopen failed: %s: %s\n", file, strerror (errno));
+        return -1;
+    }
+
+    /* close the open frames on copies of the counters */
+    funcs = avr_new (ProfFunc, prof->num_funcs);
+    memcpy (funcs, prof->funcs, prof->num_funcs * sizeof (ProfFunc));
+    arcs = avr_new (ProfArc, prof->num_arcs);
+    memcpy (arcs, prof->arcs, prof->num_arcs * sizeof (ProfArc));
+    frames = avr_new (ProfFrame, prof->depth);
+    memcpy (frames, prof->stack, prof->depth * sizeof (ProfFrame));
+
+    for (i = prof->depth - 1; i >= 0; i--)
+        profile_close (prof, funcs, arcs, &frames[i],
+                       i ? &frames[i - 1] : NULL, ck);
+
+    for (i = 0; i < prof->num_funcs; i++)
+        total += funcs[i].self;
+
+    qsort (arcs, prof->num_arcs, sizeof (ProfArc), profile_cmp_arc);
+
+    defined = avr_new0 (char, prof->num_funcs);
+
+    fprintf (fp, "# callgrind format\n");
+    fprintf (fp, "version: 1\n");
+    fprintf (fp, "creator: %s %s\n", PACKAGE, VERSION);
+    fprintf (fp, "positions: instr\n");
+    fprintf (fp, "events: Cycles\n");
+    fprintf (fp, "summary: %llu\n", (unsigned long long)total);
+    fprintf (fp, "\nfl=(1) ???\n");
+
+    /* Positions are the entry addresses: the profile is per function. */
+    for (i = 0, j = 0; i < prof->num_funcs; i++)
+    {
+        if (i)
+            fprintf (fp, "\n");
+        profile_put_name (prof, fp, "fn", i, defined);
+        fprintf (fp, "0x%x %llu\n", funcs[i].addr,
+                 (unsigned long long)funcs[i].self);
+
+        for (; (j < prof->num_arcs) && (arcs[j].caller == i); j++)
+        {
+            profile_put_name (prof, fp, "cfn", arcs[j].callee, defined);
+            fprintf (fp, "calls=%llu 0x%x\n",
+                     (unsigned long long)arcs[j].calls,
+                     funcs[arcs[j].callee].addr);
+            fprintf (fp, "0x%x %llu\n", funcs[i].addr,
+                     (unsigned long long)arcs[j].incl);
+        }
+    }
+
+    if (ferror (fp))
+        res = -1;
+    if (fclose (fp) != 0)
+        res = -1;
+    if (res < 0)
+        avr_warning ("write failed: %s\n", file);
+
+    avr_free (defined);
+    avr_free (frames);
+    avr_free (arcs);
+    avr_free (funcs);
+
+    return res;
+}
+
+/** \brief Drop the cycles of the calling contexts counted up to \a ck. */
+
+void
+profile_fold_clear (Profile *prof, uint64_t ck)
+{
+    int i;
+
+    profile_tick (prof, ck);
+
+    for (i = 0; i < prof->num_nodes; i++)
+        prof->nodes[i].cycles = 0;
+}
+
+/** \brief Write the cycles of the calling contexts up to \a ck to \a file
+    in the folded stack format (one "outer;...;inner cycles" line per
+    context), the input of flamegraph.pl and similar tools.
+
+    Returns 0, or -1 with a warning. */
+
+int
+profile_write_folded (Profile *prof, char *file, uint64_t ck)
+{
+    char name[256];
+    int *path;
+    int max_path = 32;
+    FILE *fp;
+    int i, n, res = 0;
+
+    if ((fp = fopen (file, "w")) == NULL)
+    {
+        avr_warning ("fopen failed: %s: %s\n", file, strerror (errno));
+        return -1;
+    }
+
+    profile_tick (prof, ck);
+
+    path = avr_new (int, max_path);
+
+    for (i = 1; i < prof->num_nodes; i++)
+    {
+        if (prof->nodes[i].cycles == 0)
+            continue;
+
+        /* the contexts from the node up to the root frame */
+        for (n = 0, path[n++] = i; prof->nodes[path[n - 1]].parent > 0; n++)
+        {
+            if (n == max_path)
+            {
+                max_path *= 2;
+                path = avr_renew (int, path, max_path);
+            }
+            path[n] = prof->nodes[path[n - 1]].parent;
+        }
+
+        while (n--)
+            fprintf (fp, "%s%c",
+                     profile_func_name (prof, prof->nodes[path[n]].func,
+                                        name, sizeof (name)),
+                     n ? ';' : ' ');
+        fprintf (fp, "%llu\n", (unsigned long long)prof->nodes[i].cycles);
+    }
+
+    avr_free (path);
+
+    if (ferror (fp))
+        res = -1;
+    if (fclose (fp) != 0)
+        res = -1;
+    if (res < 0)
+        avr_warning ("write failed: %s\n", file);
+
+    return res;
+}
+
+/** \brief Write the folded stacks of every APDU to a file in \a dir.
+
+    The files are named apdu-0001.folded, apdu-0002.folded and so on. NULL
+    stops the output. */
+
+void
+profile_flame_dir (Profile *prof, char *dir)
+{
+    avr_free (prof->flame_dir);
+    prof->flame_dir = dir ? avr_strdup (dir) : NULL;
+    prof->apdu_open = 0;
+}
+
+/** \brief The card got an APDU at clock cycle \a ck, the cycles counted so
+    far (boot, previous responses) do not belong to it. */
+
+void
+profile_apdu_begin (Profile *prof, uint64_t ck)
+{
+    if (prof->flame_dir == NULL)
+        return;
+
+    profile_fold_clear (prof, ck);
+    prof->apdu_open = 1;
+}
+
+/** \brief The card sent the response to the APDU at clock cycle \a ck,
+    write the folded stacks of the APDU. Returns 0 or -1. */
+
+int
+profile_apdu_end (Profile *prof, uint64_t ck)
+{
+    char *file;
+    int len, res;
+
+    if ((prof->flame_dir == NULL) || !prof->apdu_open)
+        return 0;
+
+    prof->apdu_open = 0;
+    prof->apdu++;
+
+    len = strlen (prof->flame_dir) + 32;
+    file = avr_new (char, len);
+    snprintf (file, len, "%s/apdu-%04d.folded", prof->flame_dir, prof->apdu);
+    res = profile_write_folded (prof, file, ck);
+    avr_free (file);
+
+    return res;
+}
@@ -0,0 +1,140 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+#ifndef SIM_PROFILE_H
+#define SIM_PROFILE_H
+
+/****************************************************************************\
+ *
+ * Profile(AvrClass) Definition
+ *
+\****************************************************************************/
+
+typedef struct _ProfFunc ProfFunc;
+
+struct _ProfFunc
+{
+    uint32_t addr;              /* entry point, flash byte address */
+    uint64_t calls;             /* times entered by a call or an irq */
+    uint64_t self;              /* exclusive cycles */
+    int arcs;                   /* head of the list of calls made from here,
+                                   index into Profile.arcs or -1 */
+};
+
+typedef struct _ProfArc ProfArc;
+
+struct _ProfArc
+{
+    int caller;                 /* index into Profile.funcs */
+    int callee;
+    uint64_t calls;
+    uint64_t incl;              /* inclusive cycles of the callee */
+    int next;                   /* next arc of the same caller or -1 */
+};
+
+typedef struct _ProfNode ProfNode;
+
+struct _ProfNode
+{
+    int parent;                 /* calling context, index into
+                                   Profile.nodes, -1 for node 0 (above the
+                                   root frames) */
+    int func;                   /* index into Profile.funcs */
+    uint64_t cycles;            /* exclusive cycles in this context since
+                                   the last profile_fold_clear() */
+    int child;                  /* first callee context or -1 */
+    int sibling;                /* next callee context of the parent or -1 */
+};
+
+typedef struct _ProfFrame ProfFrame;
+
+struct _ProfFrame
+{
+    int func;                   /* index into Profile.funcs */
+    int arc;                    /* arc of the call which made the frame, -1
+                                   for the root frame */
+    int sp;                     /* stack pointer after pushing the return
+                                   address, -1 if unknown */
+    int node;                   /* calling context, index into
+                                   Profile.nodes */
+    uint64_t entry;             /* CK at entry */
+    uint64_t child;             /* cycles spent in the callees */
+};
+
+typedef struct _Profile Profile;
+
+struct _Profile
+{
+    AvrClass parent;
+    Image *image;               /* symbols for the output, or NULL */
+
+    ProfFunc *funcs;
+    int num_funcs;
+    int max_funcs;
+    int *hash;                  /* open addressing, entry address to index
+                                   into funcs, -1 for a free slot */
+    int hash_size;              /* power of two */
+
+    ProfArc *arcs;
+    int num_arcs;
+    int max_arcs;
+
+    ProfNode *nodes;            /* calling context tree, for the folded
+                                   stacks */
+    int num_nodes;
+    int max_nodes;
+    uint64_t mark;              /* CK of the last change of the top frame */
+
+    ProfFrame *stack;           /* the shadow call stack, stack[0] is the
+                                   root frame */
+    int depth;
+    int max_depth;
+
+    char *flame_dir;            /* folded stacks per APDU go here, or NULL */
+    int apdu;                   /* number of the APDU files written */
+    int apdu_open;              /* an APDU is being processed */
+};
+
+extern Profile *profile_new (Image *image, uint32_t pc, uint64_t ck);
+extern void profile_construct (Profile *prof, Image *image, uint32_t pc,
+                               uint64_t ck);
+extern void profile_destroy (void *prof);
+
+extern void profile_call (Profile *prof, uint32_t addr, int sp, uint64_t ck);
+extern void profile_ret (Profile *prof, int sp, uint64_t ck);
+extern void profile_restart (Profile *prof, uint32_t pc, uint64_t ck);
+
+extern const char *profile_func_name (Profile *prof, int func, char *buf,
+                                      int len);
+extern int profile_write_callgrind (Profile *prof, char *file, uint64_t ck);
+
+extern void profile_fold_clear (Profile *prof, uint64_t ck);
+extern int profile_write_folded (Profile *prof, char *file, uint64_t ck);
+
+extern void profile_flame_dir (Profile *prof, char *dir);
+extern void profile_apdu_begin (Profile *prof, uint64_t ck);
+extern int profile_apdu_end (Profile *prof, uint64_t ck);
+
+#endif /* SIM_PROFILE_H */
@@ -61,6 +61,8 @@
 static inline uint8_t sreg_read (VDevice *dev, int addr);
 static inline void sreg_write (VDevice *dev, int addr, uint8_t val);
 static inline void sreg_reset (VDevice *dev);
+static void sreg_save (VDevice *dev, Snapshot *ss);
+static void sreg_load (VDevice *dev, Snapshot *ss);
 static void sreg_add_addr (VDevice *dev, int addr, char *name, int rel_addr,
                            void *data);
 
@@ -90,6 +92,7 @@ sreg_construct (SREG *sreg)
 
     vdev_construct ((VDevice *)sreg, sreg_read, sreg_write, sreg_reset,
                     sreg_add_addr);
+    vdev_set_state_fp ((VDevice *)sreg, sreg_save, sreg_load);
 
     sreg->sreg.reg = 0;
 }
@@ -126,10 +129,22 @@ sreg_write (VDevice *dev, int addr, uint8_t val)
 static inline void
 sreg_reset (VDevice *dev)
 {
-    display_io_reg (SREG_IO_REG, 0);
+    display_io_reg (vdev_get_display (dev), SREG_IO_REG, 0);
     ((SREG *)dev)->sreg.reg = 0;
 }
 
+static void
+sreg_save (VDevice *dev, Snapshot *ss)
+{
+    snapshot_put_u8 (ss, ((SREG *)dev)->sreg.reg);
+}
+
+static void
+sreg_load (VDevice *dev, Snapshot *ss)
+{
+    sreg_set ((SREG *)dev, snapshot_get_u8 (ss));
+}
+
 static void
 sreg_add_addr (VDevice *dev, int addr, char *name, int rel_addr, void *data)
 {
@@ -146,6 +161,8 @@ sreg_add_addr (VDevice *dev, int addr, char *name, int rel_addr, void *data)
 static inline uint8_t gpwr_read (VDevice *dev, int addr);
 static inline void gpwr_write (VDevice *dev, int addr, uint8_t val);
 static inline void gpwr_reset (VDevice *dev);
+static void gpwr_save (VDevice *dev, Snapshot *ss);
+static void gpwr_load (VDevice *dev, Snapshot *ss);
 
 GPWR *
 gpwr_new (void)
@@ -166,6 +183,7 @@ gpwr_construct (GPWR *gpwr)
         avr_error ("passed null ptr");
 
     vdev_construct ((VDevice *)gpwr, gpwr_read, gpwr_write, gpwr_reset, NULL);
+    vdev_set_state_fp ((VDevice *)gpwr, gpwr_save, gpwr_load);
 
     gpwr_reset ((VDevice *)gpwr);
 }
@@ -204,6 +222,18 @@ gpwr_reset (VDevice *dev)
         gpwr_set ((GPWR *)dev, i, 0);
 }
 
+static void
+gpwr_save (VDevice *dev, Snapshot *ss)
+{
+    snapshot_put (ss, ((GPWR *)dev)->reg, GPWR_SIZE);
+}
+
+static void
+gpwr_load (VDevice *dev, Snapshot *ss)
+{
+    snapshot_get (ss, ((GPWR *)dev)->reg, GPWR_SIZE);
+}
+
 /****************************************************************************\
  *
  * ACSR(VDevice) : Analog Comparator Control and Status Register Definition
@@ -421,7 +451,9 @@ wdtcr_destroy (void *wdtcr)
 void
 wdtcr_update (WDTCR *wdtcr)
 {
-    wdtcr->last_WDR = get_program_time ();
+    AvrCore *core = (AvrCore *)vdev_get_core ((VDevice *)wdtcr);
+
+    wdtcr->last_WDR = avr_core_get_program_time (core);
 }
 
 #if 0                           /* This doesn't seem to be used anywhere. */
@@ -503,11 +535,14 @@ static void
 wdtcr_reset (VDevice *dev)
 {
     WDTCR *wdtcr = (WDTCR *)dev;
+    AvrCore *core;
 
     wdtcr->wdtcr = 0;
 
-    wdtcr->last_WDR = get_program_time (); /* FIXME: This might not be the
-                                              right thing to do */
+    /* FIXME: This might not be the right thing to do. The device is reset
+       once before it is attached to a core. */
+    core = (AvrCore *)vdev_get_core (dev);
+    wdtcr->last_WDR = core ? avr_core_get_program_time (core) : 0;
     wdtcr->timer_cb = NULL;
 
     wdtcr->toe_clk = TOE_CLKS;
@@ -581,6 +616,8 @@ wdtcr_toe_clr_cb (uint64_t time, AvrClass *data)
 static uint8_t rampz_read (VDevice *dev, int addr);
 static void rampz_write (VDevice *dev, int addr, uint8_t val);
 static void rampz_reset (VDevice *dev);
+static void rampz_save (VDevice *dev, Snapshot *ss);
+static void rampz_load (VDevice *dev, Snapshot *ss);
 
 VDevice *
 rampz_create (int addr, char *name, int rel_addr, void *data)
@@ -608,6 +645,7 @@ rampz_construct (RAMPZ *rampz)
 
     vdev_construct ((VDevice *)rampz, rampz_read, rampz_write, rampz_reset,
                     vdev_def_AddAddr);
+    vdev_set_state_fp ((VDevice *)rampz, rampz_save, rampz_load);
 
     rampz->reg = 0;
 }
@@ -648,6 +686,18 @@ rampz_write (VDevice *dev, int addr, uint8_t val)
 static void
 rampz_reset (VDevice *dev)
 {
-    display_io_reg (RAMPZ_IO_REG, 0);
+    display_io_reg (vdev_get_display (dev), RAMPZ_IO_REG, 0);
     ((RAMPZ *)dev)->reg = 0;
 }
+
+static void
+rampz_save (VDevice *dev, Snapshot *ss)
+{
+    snapshot_put_u8 (ss, ((RAMPZ *)dev)->reg);
+}
+
+static void
+rampz_load (VDevice *dev, Snapshot *ss)
+{
+    rampz_set ((RAMPZ *)dev, snapshot_get_u8 (ss));
+}
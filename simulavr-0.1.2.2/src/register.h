@@ -94,7 +94,8 @@ extern inline void
 sreg_set (SREG *sreg, uint8_t val)
 {
     sreg->sreg.reg = val;
-    display_io_reg (SREG_IO_REG, sreg->sreg.reg);
+    display_io_reg (vdev_get_display ((VDevice *)sreg), SREG_IO_REG,
+                    sreg->sreg.reg);
 }
 
 extern inline uint8_t
@@ -107,7 +108,8 @@ extern inline void
 sreg_set_bit (SREG *sreg, int bit, int val)
 {
     sreg->sreg.reg = set_bit_in_byte (sreg->sreg.reg, bit, val);
-    display_io_reg (SREG_IO_REG, sreg->sreg.reg);
+    display_io_reg (vdev_get_display ((VDevice *)sreg), SREG_IO_REG,
+                    sreg->sreg.reg);
 }
 
 /****************************************************************************\
@@ -155,7 +157,7 @@ gpwr_set (GPWR *gpwr, int reg, uint8_t val)
 
     gpwr->reg[reg] = val;
 
-    display_reg (reg, val);
+    display_reg (vdev_get_display ((VDevice *)gpwr), reg, val);
 }
 
 /****************************************************************************\
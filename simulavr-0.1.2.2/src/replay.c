@@ -0,0 +1,381 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file replay.c
+ * \brief Record and replay the input of a run.
+ *
+ * Everything that makes two runs of the same program differ comes from the
+ * host: the lines read by hostio_read_line() and the bytes of the random
+ * number source. With '--record' each of them is logged together with the
+ * clock cycle (CK) it was taken at. '--replay' feeds the logged events back
+ * instead of reading stdin or the random source, so the device takes them
+ * at the same cycles and the run is repeated exactly, without waiting for
+ * any input. A line is read while the core is parked (see hostio_wait()),
+ * and CK does not advance while parked, so the stamps do not depend on the
+ * host timing.
+ *
+ * The log is:
+ *
+ *   "SIMAVRRP" u32 version, u64 CK at the start,
+ *   and per event: u64 CK, u8 kind, u16 length, length bytes of data.
+ *
+ * All numbers are little endian. The log is written when REPLAY_FLUSH bytes
+ * are buffered and after every line, so a run that dies is still recorded
+ * up to its last input.
+ *
+ * Without a file the log is only kept in memory. Reverse execution (see
+ * avr_core_reverse_step()) records into such a log and moves back in it with
+ * replay_seek() when the core returns to a checkpoint; the events are then
+ * replayed until the end of the log, where recording goes on. The offsets
+ * into the log are ints, so a log in memory is kept short: replay_trim()
+ * drops the events no checkpoint needs any more, and the history gives up
+ * its oldest checkpoints when replay_full() says the log has grown past
+ * REPLAY_MEMORY_MAX.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+
+#include "snapshot.h"
+#include "replay.h"
+
+/** \brief Allocate a new Replay.
+ *
+ * With \a play 0 the events are recorded to \a file, otherwise they are
+ * replayed from it. A NULL \a file records to memory. \a clock is read as
+ * the stamp of each event. Returns NULL with a warning if the file can not
+ * be used.
+ */
+
+Replay *
+replay_new (char *file, int play, uint64_t *clock)
+{
+    Replay *rp;
+    Snapshot *ss = NULL;
+    FILE *fp = NULL;
+    uint64_t start;
+
+    if (file == NULL)
+    {
+        rp = avr_new (Replay, 1);
+        replay_construct (rp, 0, clock);
+        class_overload_destroy ((AvrClass *)rp, replay_destroy);
+        rp->memory = 1;
+
+        return rp;
+    }
+
+    if (play)
+    {
+        if ((ss = snapshot_read_file (file)) == NULL)
+            return NULL;
+        if ((ss->len < 20) || memcmp (ss->data, REPLAY_MAGIC, 8) != 0)
+        {
+            avr_warning ("%s: not a replay log\n", file);
+            class_unref ((AvrClass *)ss);
+            return NULL;
+        }
+        ss->pos = 8;
+        if (snapshot_get_u32 (ss) != REPLAY_VERSION)
+        {
+            avr_warning ("%s: replay log version not supported\n", file);
+            class_unref ((AvrClass *)ss);
+            return NULL;
+        }
+        start = snapshot_get_u64 (ss);
+        if (start != *clock)
+            avr_warning ("%s: recorded from CK %llu, the device is at "
+                         "CK %llu\n", file, (unsigned long long)start,
+                         (unsigned long long)*clock);
+    }
+    else if ((fp = fopen (file, "wb")) == NULL)
+    {
+        avr_warning ("%s: %s\n", file, strerror (errno));
+        return NULL;
+    }
+
+    rp = avr_new (Replay, 1);
+    replay_construct (rp, play, clock);
+    class_overload_destroy ((AvrClass *)rp, replay_destroy);
+
+    if (play)
+    {
+        class_unref ((AvrClass *)rp->ss);
+        rp->ss = ss;
+    }
+    else
+    {
+        rp->fp = fp;
+        snapshot_put (rp->ss, REPLAY_MAGIC, 8);
+        snapshot_put_u32 (rp->ss, REPLAY_VERSION);
+        snapshot_put_u64 (rp->ss, *clock);
+        replay_flush (rp);
+    }
+
+    return rp;
+}
+
+/** \brief Constructor for the Replay class. */
+
+void
+replay_construct (Replay *rp, int play, uint64_t *clock)
+{
+    if (rp == NULL)
+        avr_error ("passed null ptr");
+
+    class_construct ((AvrClass *)rp);
+
+    rp->play = play;
+    rp->fp = NULL;
+    rp->ss = snapshot_new ();
+    rp->clock = clock;
+    rp->events = 0;
+    rp->diverged = 0;
+    rp->memory = 0;
+}
+
+/** \brief Destructor for the Replay class, the recorded events still
+    buffered are written. */
+
+void
+replay_destroy (void *rp)
+{
+    Replay *_rp = (Replay *)rp;
+
+    if (rp == NULL)
+        return;
+
+    if (_rp->play && !_rp->memory && (_rp->ss->pos < _rp->ss->len))
+        avr_warning ("replay ended after %llu events, the log has more\n",
+                     (unsigned long long)_rp->events);
+
+    if (_rp->fp)
+    {
+        replay_flush (_rp);
+        if (fclose (_rp->fp) != 0)
+            avr_warning ("replay log: %s\n", strerror (errno));
+    }
+    class_unref ((AvrClass *)_rp->ss);
+
+    class_destroy (rp);
+}
+
+/** \brief Write the buffered events to the log (record mode). */
+
+void
+replay_flush (Replay *rp)
+{
+    if ((rp->fp == NULL) || (rp->ss->len == 0))
+        return;
+
+    if ((fwrite (rp->ss->data, 1, rp->ss->len, rp->fp)
+         != (size_t) rp->ss->len)
+        || (fflush (rp->fp) != 0))
+        avr_warning ("replay log: %s\n", strerror (errno));
+    rp->ss->len = 0;
+}
+
+/** \brief Log an event of \a kind with \a len bytes of \a data, stamped
+    with the current clock. */
+
+void
+replay_put (Replay *rp, int kind, const void *data, int len)
+{
+    if (rp->play)
+        return;
+
+    snapshot_put_u64 (rp->ss, *rp->clock);
+    snapshot_put_u8 (rp->ss, kind);
+    snapshot_put_u16 (rp->ss, len);
+    snapshot_put (rp->ss, data, len);
+    rp->events++;
+
+    if ((kind == REPLAY_LINE) || (rp->ss->len >= REPLAY_FLUSH))
+        replay_flush (rp);
+}
+
+/* Report the first mismatch between the run and the log. */
+
+static void
+replay_diverged (Replay *rp, const char *what, uint64_t ck)
+{
+    if (rp->diverged)
+        return;
+    rp->diverged = 1;
+
+    avr_warning ("replay diverged at CK %llu after %llu events: %s "
+                 "(logged at CK %llu)\n", (unsigned long long)*rp->clock,
+                 (unsigned long long)rp->events, what,
+                 (unsigned long long)ck);
+}
+
+/** \brief Returns true while the events come from the log.
+ *
+ * A log in memory goes back to recording at its end.
+ */
+int
+replay_playing (Replay *rp)
+{
+    if (rp->play && rp->memory && (rp->ss->pos >= rp->ss->len))
+        rp->play = 0;
+
+    return rp->play;
+}
+
+/** \brief Returns the position in the log, for replay_seek(). */
+
+int
+replay_tell (Replay *rp)
+{
+    return rp->play ? rp->ss->pos : rp->ss->len;
+}
+
+/**
+ * \brief Continue with the event at \a pos (from replay_tell()).
+ *
+ * The events from there on are replayed. Returns -1 when recording to a
+ * file, which can not go back.
+ */
+int
+replay_seek (Replay *rp, int pos)
+{
+    if (!rp->play && !rp->memory)
+        return -1;
+
+    rp->ss->pos = pos;
+    if (rp->memory)
+        rp->play = (pos < rp->ss->len);
+
+    return 0;
+}
+
+/**
+ * \brief Drop the events of a log in memory before \a pos.
+ *
+ * Returns the number of bytes dropped, the positions from replay_tell()
+ * move down by as much. A log in a file is not changed (returns 0).
+ */
+int
+replay_trim (Replay *rp, int pos)
+{
+    Snapshot *ss = rp->ss;
+
+    if (!rp->memory || (pos <= 0))
+        return 0;
+    if (pos > ss->len)
+        pos = ss->len;
+
+    memmove (ss->data, ss->data + pos, ss->len - pos);
+    ss->len -= pos;
+    ss->pos = (ss->pos > pos) ? ss->pos - pos : 0;
+
+    return pos;
+}
+
+/** \brief Returns true if a log in memory has grown past
+    REPLAY_MEMORY_MAX and should be trimmed. */
+
+int
+replay_full (Replay *rp)
+{
+    return rp->memory && (rp->ss->len >= REPLAY_MEMORY_MAX);
+}
+
+/** \brief Returns true if the next logged event is of \a kind. */
+
+int
+replay_pending (Replay *rp, int kind)
+{
+    Snapshot *ss = rp->ss;
+
+    /* u64 CK, then the kind */
+    return rp->play && (ss->len - ss->pos >= 11)
+        && (ss->data[ss->pos + 8] == kind);
+}
+
+/**
+ * \brief Take the next logged event, which must be of \a kind.
+ *
+ * The data is copied to \a buf, a string of at most \a size - 1 bytes.
+ * Returns its length, or -1 at the end of the log or if the next event is
+ * of another kind (the run no longer follows the log). An event taken at
+ * another cycle than it was logged at is reported, but returned.
+ */
+int
+replay_get (Replay *rp, int kind, void *buf, int size)
+{
+    Snapshot *ss = rp->ss;
+    uint64_t ck;
+    int len, pos;
+
+    if (!rp->play || (ss->len - ss->pos < 11))
+    {
+        if (rp->memory)
+            rp->play = 0;
+        return -1;
+    }
+
+    pos = ss->pos;
+    ck = snapshot_get_u64 (ss);
+    if (snapshot_get_u8 (ss) != kind)
+    {
+        replay_diverged (rp, (kind == REPLAY_LINE) ? "reads a line"
+                         : "takes a random byte", ck);
+        ss->pos = pos;
+        if (rp->memory)
+        {
+            /* the rest of the log is of no use, record from here on */
+            ss->len = pos;
+            rp->play = 0;
+        }
+        return -1;
+    }
+    len = snapshot_get_u16 (ss);
+    if (ss->error || (len > ss->len - ss->pos))
+    {
+        avr_warning ("replay log is damaged\n");
+        ss->pos = ss->len;
+        return -1;
+    }
+
+    if (ck != *rp->clock)
+        replay_diverged (rp, "input taken at another cycle", ck);
+
+    memcpy (buf, ss->data + ss->pos, (len < size) ? len : size - 1);
+    ((char *)buf)[(len < size) ? len : size - 1] = '\0';
+    ss->pos += len;
+    rp->events++;
+
+    return len;
+}
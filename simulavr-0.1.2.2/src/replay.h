@@ -0,0 +1,85 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+#ifndef SIM_REPLAY_H
+#define SIM_REPLAY_H
+
+/****************************************************************************\
+ *
+ * Replay(AvrClass) Definition
+ *
+\****************************************************************************/
+
+#define REPLAY_MAGIC "SIMAVRRP"
+
+enum _replay_constants
+{
+    REPLAY_VERSION = 1,         /* bump on any change of the file layout */
+    REPLAY_FLUSH = 4096,        /* write the log when this much is
+                                   buffered */
+    REPLAY_MEMORY_MAX = 1 << 26, /* a log in memory is full at this size,
+                                    see replay_full() */
+};
+
+/* Kinds of logged events. */
+
+enum _replay_kind
+{
+    REPLAY_LINE = 1,            /* line read by hostio_read_line() */
+    REPLAY_RNG = 2,             /* byte of avr_core_rng_get_byte() */
+};
+
+typedef struct _Replay Replay;
+
+struct _Replay
+{
+    AvrClass parent;
+    int play;                   /* 0: record the events, 1: replay them */
+    FILE *fp;                   /* record: the log file */
+    struct _Snapshot *ss;       /* record: events not yet written, play:
+                                   the whole log */
+    uint64_t *clock;            /* stamp of the events (the core's CK) */
+    uint64_t events;            /* events recorded or replayed */
+    int diverged;               /* play: a mismatch was reported */
+    int memory;                 /* no file, the log is kept for
+                                   replay_seek() */
+};
+
+extern Replay *replay_new (char *file, int play, uint64_t *clock);
+extern void replay_construct (Replay *rp, int play, uint64_t *clock);
+extern void replay_destroy (void *rp);
+
+extern void replay_put (Replay *rp, int kind, const void *data, int len);
+extern int replay_get (Replay *rp, int kind, void *buf, int size);
+extern int replay_pending (Replay *rp, int kind);
+extern void replay_flush (Replay *rp);
+
+extern int replay_playing (Replay *rp);
+extern int replay_tell (Replay *rp);
+extern int replay_seek (Replay *rp, int pos);
+extern int replay_trim (Replay *rp, int pos);
+extern int replay_full (Replay *rp);
+
+#endif /* SIM_REPLAY_H */
@@ -0,0 +1,299 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file rng.c
+ * \brief Random number source for the simulated device.
+ *
+ * By default random bytes come from the host: getrandom() where available,
+ * /dev/urandom otherwise. Bytes are fetched in blocks of RNG_POOL_SIZE and
+ * handed out one by one, so a key generation in the firmware does not cost
+ * a system call per byte.
+ *
+ * After rng_seed() the host is not used any more, the bytes are produced by
+ * a xoshiro256** generator seeded with splitmix64. The same seed always
+ * gives the same byte stream, which makes test runs (and their cycle counts)
+ * reproducible. This is NOT suitable for anything but testing.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#if defined(HAVE_SYS_RANDOM_H)
+#include <sys/random.h>
+#endif
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+
+#include "snapshot.h"
+#include "rng.h"
+
+/** \brief Allocate a new Rng object, reading entropy from the host. */
+
+Rng *
+rng_new (void)
+{
+    Rng *rng;
+
+    rng = avr_new (Rng, 1);
+    rng_construct (rng);
+    class_overload_destroy ((AvrClass *)rng, rng_destroy);
+
+    return rng;
+}
+
+/** \brief Constructor for the Rng class. */
+
+void
+rng_construct (Rng *rng)
+{
+    if (rng == NULL)
+        avr_error ("passed null ptr");
+
+    class_construct ((AvrClass *)rng);
+
+    rng->seeded = 0;
+    rng->seed = 0;
+    memset (rng->state, 0, sizeof (rng->state));
+    rng->fd = -1;
+    rng->pool_pos = RNG_POOL_SIZE; /* empty, filled on first use */
+}
+
+/** \brief Destructor for the Rng class. */
+
+void
+rng_destroy (void *rng)
+{
+    Rng *_rng = (Rng *)rng;
+
+    if (rng == NULL)
+        return;
+
+    if (_rng->fd >= 0)
+        close (_rng->fd);
+
+    class_destroy (rng);
+}
+
+/*
+ * splitmix64, only used to expand the user seed into the generator state.
+ */
+static uint64_t
+rng_splitmix64 (uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t
+rng_rotl (uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/*
+ * One step of xoshiro256**.
+ */
+static uint64_t
+rng_next (Rng *rng)
+{
+    uint64_t *s = rng->state;
+    uint64_t result = rng_rotl (s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl (s[3], 45);
+
+    return result;
+}
+
+/**
+ * \brief Switch the generator to deterministic mode.
+ *
+ * Any bytes already buffered from the host are discarded, so the byte stream
+ * seen by the device depends only on \a seed.
+ */
+void
+rng_seed (Rng *rng, uint64_t seed)
+{
+    uint64_t x = seed;
+    int i;
+
+    rng->seeded = 1;
+    rng->seed = seed;
+    for (i = 0; i < 4; i++)
+        rng->state[i] = rng_splitmix64 (&x);
+
+    rng->pool_pos = RNG_POOL_SIZE;
+}
+
+/**
+ * \brief Drop the host random bytes buffered so far.
+ *
+ * Called in a child after fork(): the pool was copied from the parent and
+ * must not be handed out by two processes. A seeded generator is left
+ * alone, the children are meant to repeat the same stream there.
+ */
+void
+rng_discard (Rng *rng)
+{
+    if (!rng->seeded)
+        rng->pool_pos = RNG_POOL_SIZE;
+}
+
+/*
+ * Fill buf from the host entropy source. If getrandom() turns out to be
+ * missing at run time, /dev/urandom is opened and kept open from then on.
+ */
+static void
+rng_read_host (Rng *rng, uint8_t *buf, int len)
+{
+    ssize_t n;
+
+#if defined(HAVE_GETRANDOM)
+    while ((rng->fd < 0) && (len > 0))
+    {
+        n = getrandom (buf, len, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOSYS)
+                break;
+            avr_error ("getrandom failed: %s", strerror (errno));
+        }
+        buf += n;
+        len -= n;
+    }
+#endif
+
+    if ((len > 0) && (rng->fd < 0))
+    {
+        rng->fd = open ("/dev/urandom", O_RDONLY);
+        if (rng->fd < 0)
+            avr_error ("open failed: /dev/urandom: %s", strerror (errno));
+    }
+
+    while (len > 0)
+    {
+        n = read (rng->fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            avr_error ("read failed: /dev/urandom: %s", strerror (errno));
+        }
+        if (n == 0)
+            avr_error ("read failed: /dev/urandom: end of file");
+        buf += n;
+        len -= n;
+    }
+}
+
+static void
+rng_refill (Rng *rng)
+{
+    if (rng->seeded)
+    {
+        int i, j;
+        uint64_t r;
+
+        for (i = 0; i < RNG_POOL_SIZE; i += 8)
+        {
+            r = rng_next (rng);
+            for (j = 0; j < 8; j++, r >>= 8)
+                rng->pool[i + j] = r & 0xff;
+        }
+    }
+    else
+    {
+        rng_read_host (rng, rng->pool, RNG_POOL_SIZE);
+    }
+
+    rng->pool_pos = 0;
+}
+
+/** \brief Return the next random byte. */
+
+uint8_t
+rng_get_byte (Rng *rng)
+{
+    if (rng->pool_pos >= RNG_POOL_SIZE)
+        rng_refill (rng);
+
+    return rng->pool[rng->pool_pos++];
+}
+
+/**
+ * \brief Append the generator state to a snapshot.
+ *
+ * The buffered bytes are saved too, so a restored seeded generator continues
+ * the same byte stream.
+ */
+void
+rng_save (Rng *rng, Snapshot *ss)
+{
+    int i;
+
+    snapshot_put_u8 (ss, rng->seeded);
+    snapshot_put_u64 (ss, rng->seed);
+    for (i = 0; i < 4; i++)
+        snapshot_put_u64 (ss, rng->state[i]);
+    snapshot_put_u16 (ss, rng->pool_pos);
+    snapshot_put (ss, rng->pool, RNG_POOL_SIZE);
+}
+
+/** \brief Restore the generator state saved by rng_save(). */
+
+void
+rng_load (Rng *rng, Snapshot *ss)
+{
+    int i;
+
+    rng->seeded = snapshot_get_u8 (ss);
+    rng->seed = snapshot_get_u64 (ss);
+    for (i = 0; i < 4; i++)
+        rng->state[i] = snapshot_get_u64 (ss);
+    rng->pool_pos = snapshot_get_u16 (ss);
+    snapshot_get (ss, rng->pool, RNG_POOL_SIZE);
+
+    if (rng->pool_pos > RNG_POOL_SIZE)
+        ss->error = 1;
+}
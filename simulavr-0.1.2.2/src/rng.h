@@ -0,0 +1,66 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+#ifndef SIM_RNG_H
+#define SIM_RNG_H
+
+#include "snapshot.h"
+
+/****************************************************************************\
+ *
+ * Rng(AvrClass) Definition
+ *
+\****************************************************************************/
+
+enum _rng_constants
+{
+    RNG_POOL_SIZE = 256,        /* bytes fetched from the backend at once */
+};
+
+typedef struct _Rng Rng;
+
+struct _Rng
+{
+    AvrClass parent;
+    int seeded;                 /* non-zero: deterministic generator */
+    uint64_t seed;              /* seed given to rng_seed() */
+    uint64_t state[4];          /* xoshiro256** state (seeded mode) */
+    int fd;                     /* /dev/urandom fallback, -1 if unused */
+    uint8_t pool[RNG_POOL_SIZE];
+    int pool_pos;               /* next unused byte in pool */
+};
+
+extern Rng *rng_new (void);
+extern void rng_construct (Rng *rng);
+extern void rng_destroy (void *rng);
+
+extern void rng_seed (Rng *rng, uint64_t seed);
+extern void rng_discard (Rng *rng);
+extern uint8_t rng_get_byte (Rng *rng);
+
+extern void rng_save (Rng *rng, Snapshot *ss);
+extern void rng_load (Rng *rng, Snapshot *ss);
+
+#endif /* SIM_RNG_H */
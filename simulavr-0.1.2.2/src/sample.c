@@ -0,0 +1,169 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file sample.c
+ * \brief Statistical PC sampling.
+ *
+ * Every period clock cycles of the simulated device (not of the host, so a
+ * run with '--rng-seed' gives the same samples every time) the core counts
+ * the address of the executing instruction, and if asked for, the return
+ * address at the top of the stack, which is mostly the caller of a leaf
+ * function. See avr_core_sample_start().
+ *
+ * The file holds only the addresses that were hit:
+ *
+ *   "SIMAVRPC" u32 version, u32 period, u32 flags, u32 flash words,
+ *   u64 samples, u32 n, n * (u32 word address, u32 count),
+ *   and with SAMPLE_CALLERS in flags: u32 m, m * (u32 word address, u32
+ *   count) of the return addresses.
+ *
+ * All numbers are little endian. simulavr-pcprof maps the file to the
+ * symbols and source lines of the ELF program.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+
+#include "snapshot.h"
+#include "sample.h"
+
+/** \brief Allocate a new Sampler for a flash of \a words words. */
+
+Sampler *
+sampler_new (uint32_t period, int words, int callers)
+{
+    Sampler *smp;
+
+    smp = avr_new (Sampler, 1);
+    sampler_construct (smp, period, words, callers);
+    class_overload_destroy ((AvrClass *)smp, sampler_destroy);
+
+    return smp;
+}
+
+/** \brief Constructor for the Sampler class. */
+
+void
+sampler_construct (Sampler *smp, uint32_t period, int words, int callers)
+{
+    if (smp == NULL)
+        avr_error ("passed null ptr");
+    if (period == 0)
+        avr_error ("sample period must not be 0");
+
+    class_construct ((AvrClass *)smp);
+
+    smp->period = period;
+    smp->words = words;
+    smp->pc = avr_new0 (uint32_t, words);
+    smp->caller = callers ? avr_new0 (uint32_t, words) : NULL;
+    smp->samples = 0;
+}
+
+/** \brief Destructor for the Sampler class. */
+
+void
+sampler_destroy (void *smp)
+{
+    Sampler *_smp = (Sampler *)smp;
+
+    if (smp == NULL)
+        return;
+
+    avr_free (_smp->pc);
+    avr_free (_smp->caller);
+
+    class_destroy (smp);
+}
+
+/** \brief Count \a n samples at word address \a pc.
+
+    \a ret is the return address at the top of the stack, -1 if there is
+    none. 0 is not counted either, no call returns there and it is what an
+    empty stack mostly holds. */
+
+void
+sampler_add (Sampler *smp, uint32_t pc, int ret, uint32_t n)
+{
+    smp->samples += n;
+    if (pc < (uint32_t) smp->words)
+        smp->pc[pc] += n;
+    if (smp->caller && (ret > 0) && (ret < smp->words))
+        smp->caller[ret] += n;
+}
+
+static void
+sampler_put_hist (Snapshot *ss, uint32_t *hist, int words)
+{
+    int i, n = 0;
+
+    for (i = 0; i < words; i++)
+        if (hist[i])
+            n++;
+
+    snapshot_put_u32 (ss, n);
+    for (i = 0; i < words; i++)
+    {
+        if (hist[i])
+        {
+            snapshot_put_u32 (ss, i);
+            snapshot_put_u32 (ss, hist[i]);
+        }
+    }
+}
+
+/** \brief Write the samples to \a file. Returns 0, or -1 with a
+    warning. */
+
+int
+sampler_write (Sampler *smp, char *file)
+{
+    Snapshot *ss = snapshot_new ();
+    int res;
+
+    snapshot_put (ss, SAMPLE_MAGIC, 8);
+    snapshot_put_u32 (ss, SAMPLE_VERSION);
+    snapshot_put_u32 (ss, smp->period);
+    snapshot_put_u32 (ss, smp->caller ? SAMPLE_CALLERS : 0);
+    snapshot_put_u32 (ss, smp->words);
+    snapshot_put_u64 (ss, smp->samples);
+
+    sampler_put_hist (ss, smp->pc, smp->words);
+    if (smp->caller)
+        sampler_put_hist (ss, smp->caller, smp->words);
+
+    res = snapshot_write_file (ss, file);
+    class_unref ((AvrClass *)ss);
+
+    return res;
+}
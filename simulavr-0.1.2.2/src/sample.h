@@ -0,0 +1,66 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+#ifndef SIM_SAMPLE_H
+#define SIM_SAMPLE_H
+
+/****************************************************************************\
+ *
+ * Sampler(AvrClass) Definition
+ *
+\****************************************************************************/
+
+#define SAMPLE_MAGIC "SIMAVRPC"
+
+enum _sample_constants
+{
+    SAMPLE_VERSION = 1,         /* bump on any change of the file layout */
+    SAMPLE_PERIOD = 1009,       /* default, prime so that it does not beat
+                                   with the loops of the firmware */
+    SAMPLE_CALLERS = 0x1,       /* file flag: return addresses included */
+};
+
+typedef struct _Sampler Sampler;
+
+struct _Sampler
+{
+    AvrClass parent;
+    uint32_t period;            /* clock cycles between two samples */
+    int words;                  /* flash size in words */
+    uint32_t *pc;               /* samples per flash word address */
+    uint32_t *caller;           /* samples per return address found at the
+                                   top of the stack, NULL if not wanted */
+    uint64_t samples;
+};
+
+extern Sampler *sampler_new (uint32_t period, int words, int callers);
+extern void sampler_construct (Sampler *smp, uint32_t period, int words,
+                               int callers);
+extern void sampler_destroy (void *smp);
+
+extern void sampler_add (Sampler *smp, uint32_t pc, int ret, uint32_t n);
+extern int sampler_write (Sampler *smp, char *file);
+
+#endif /* SIM_SAMPLE_H */
@@ -0,0 +1,785 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file server.c
+ * \brief Run many independent simulated cards in one process.
+ *
+ * Every card is a complete AvrCore with its own flash, sram, eeprom, random
+ * number source and host channel. Card N accepts one connection at a time
+ * on TCP port (base port + N) and talks the same line protocol as the
+ * single card simulator on stdin/stdout.
+ *
+ * A small pool of worker threads executes the cards. A card is in one of
+ * these states:
+ *
+ *   - CARD_QUEUED:  runnable, in the run queue.
+ *   - CARD_RUNNING: a worker is stepping it. The worker owns the core and
+ *                   the input buffer of its host channel.
+ *   - CARD_PARKED:  the firmware waits for a line from the host (see
+ *                   hostio_wait()). The main thread owns the card and polls
+ *                   its socket; once a complete line is buffered the card
+ *                   is queued again.
+ *   - CARD_STOPPED: the core left the running state (break point, sleep).
+ *                   The main thread closes the connection, if any, and
+ *                   powers the card up again for the next client.
+ *   - CARD_IDLE:    a card that stopped without a client, powered up again.
+ *                   It is queued once a client connects, so a firmware that
+ *                   stops at once does not keep a worker busy.
+ *   - CARD_HELD:    the gdb thread has taken the card, see below.
+ *   - CARD_TRAPPED: with gdb, the card reached a break point and waits
+ *                   until gdb takes it.
+ *
+ * A running card gives up its worker after SERVER_SLICE instructions, so a
+ * long operation on one card (RSA key generation) does not starve the
+ * others. Idle cards cost nothing but memory.
+ *
+ * The firmware image is read from disk once and loaded into every card.
+ * The display coprocess is not supported in server mode.
+ *
+ * With a gdb comm in the config, a gdb thread serves one debugger session
+ * on the port after the last card. gdb sees card N as process N + 1. Only
+ * a card gdb selects is taken away from the workers (held), it is stepped
+ * by the gdb thread until gdb resumes the others, so the cards nobody
+ * looks at keep running at full speed. The socket of a held card is read
+ * by the gdb thread, the main thread leaves it alone.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+#include "utils.h"
+#include "callback.h"
+#include "op_names.h"
+
+#include "storage.h"
+#include "flash.h"
+
+#include "vdevs.h"
+#include "memory.h"
+#include "stack.h"
+#include "register.h"
+#include "sram.h"
+#include "eeprom.h"
+#include "timers.h"
+#include "ports.h"
+
+#include "avrcore.h"
+
+#include "sig.h"
+#include "gdb.h"
+#include "server.h"
+
+enum _server_constants
+{
+    SERVER_SLICE = 100000,      /* instructions per scheduling slice */
+};
+
+enum
+{
+    CARD_QUEUED,
+    CARD_RUNNING,
+    CARD_PARKED,
+    CARD_STOPPED,
+    CARD_HELD,
+    CARD_TRAPPED,
+    CARD_IDLE,
+};
+
+typedef struct _Card Card;
+
+struct _Card
+{
+    int index;
+    AvrCore *core;
+    int port;
+    int listen_fd;              /* listening socket */
+    int conn_fd;                /* connected client or -1 */
+    int state;                  /* CARD_* */
+    int hold;                   /* gdb waits for the card */
+    Card *next;                 /* run queue link */
+};
+
+typedef struct _Server Server;
+
+struct _Server
+{
+    Card *cards;
+    int num_cards;
+
+    pthread_mutex_t lock;       /* protects state, run queue and quit */
+    pthread_cond_t cond;        /* signalled when a card is queued */
+    pthread_cond_t held;        /* signalled when a worker holds a card */
+    Card *queue_head;
+    Card *queue_tail;
+    int quit;
+
+    int wake_fd[2];             /* workers poke the main thread here */
+
+    GdbComm_T *gdb_comm;        /* NULL: no gdb thread */
+    int gdb_port;
+    int gdb_debug;
+    int gdb_done;               /* gdb_interact() has returned */
+    pthread_t gdb_thread;
+};
+
+/* Append a card to the run queue. Called with srv->lock held. */
+
+static void
+server_enqueue (Server *srv, Card *card)
+{
+    card->state = CARD_QUEUED;
+    card->next = NULL;
+    if (srv->queue_tail)
+        srv->queue_tail->next = card;
+    else
+        srv->queue_head = card;
+    srv->queue_tail = card;
+
+    pthread_cond_signal (&srv->cond);
+}
+
+/* Remove the first card from the run queue. Called with srv->lock held. */
+
+static Card *
+server_dequeue (Server *srv)
+{
+    Card *card = srv->queue_head;
+
+    if (card)
+    {
+        srv->queue_head = card->next;
+        if (srv->queue_head == NULL)
+            srv->queue_tail = NULL;
+        card->next = NULL;
+    }
+
+    return card;
+}
+
+/* Take a card out of the run queue. Called with srv->lock held. */
+
+static void
+server_unqueue (Server *srv, Card *card)
+{
+    Card **link = &srv->queue_head;
+
+    srv->queue_tail = NULL;
+    while (*link)
+    {
+        if (*link == card)
+            *link = card->next;
+        else
+        {
+            srv->queue_tail = *link;
+            link = &(*link)->next;
+        }
+    }
+    card->next = NULL;
+}
+
+/* Make the main thread rebuild its poll set. */
+
+static void
+server_wake (Server *srv)
+{
+    char c = 0;
+
+    /* The pipe is non-blocking, if it is full the main thread is awake
+       anyway. */
+    while ((write (srv->wake_fd[1], &c, 1) < 0) && (errno == EINTR)) ;
+}
+
+/*
+ * Step a card for at most one slice. Returns the state the card should be
+ * put in, with trap set a break point traps the card for gdb.
+ */
+
+static int
+server_card_run (Card *card, int trap)
+{
+    AvrCore *core = card->core;
+    HostIO *host = avr_core_get_host (core);
+    int n;
+
+    /* Let the firmware consume the line that woke the card up. */
+    hostio_resume (host);
+
+    for (n = 0; n < SERVER_SLICE; n++)
+    {
+        if (hostio_waiting (host))
+            return hostio_has_line (host) ? CARD_QUEUED : CARD_PARKED;
+
+        if (avr_core_get_state (core) != STATE_RUNNING)
+            break;
+
+        if (avr_core_step (core) == BREAK_POINT)
+        {
+            if (trap)
+                return CARD_TRAPPED;
+            break;
+        }
+    }
+
+    if (n < SERVER_SLICE)
+    {
+        avr_warning ("card %d stopped at PC 0x%x\n", card->index,
+                     avr_core_PC_get (core) * 2);
+        return CARD_STOPPED;
+    }
+
+    return CARD_QUEUED;
+}
+
+static void *
+server_worker (void *data)
+{
+    Server *srv = (Server *)data;
+    Card *card;
+    int state;
+
+    pthread_mutex_lock (&srv->lock);
+    for (;;)
+    {
+        while (!srv->quit && (srv->queue_head == NULL))
+            pthread_cond_wait (&srv->cond, &srv->lock);
+
+        if (srv->quit)
+            break;
+
+        card = server_dequeue (srv);
+        card->state = CARD_RUNNING;
+        pthread_mutex_unlock (&srv->lock);
+
+        state = server_card_run (card, srv->gdb_comm != NULL);
+
+        pthread_mutex_lock (&srv->lock);
+        if (card->hold)
+        {
+            card->state = CARD_HELD;
+            pthread_cond_broadcast (&srv->held);
+        }
+        else if (state == CARD_QUEUED)
+            server_enqueue (srv, card);
+        else
+        {
+            card->state = state;
+            server_wake (srv);
+        }
+    }
+    pthread_mutex_unlock (&srv->lock);
+
+    return NULL;
+}
+
+static int
+server_listen (int port)
+{
+    struct sockaddr_in address[1];
+    int sock, i;
+
+    if ((sock = socket (PF_INET, SOCK_STREAM, 0)) < 0)
+        avr_error ("Can't create socket: %s", strerror (errno));
+
+    i = 1;
+    setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, &i, sizeof (i));
+
+    address->sin_family = AF_INET;
+    address->sin_port = htons (port);
+    memset (&address->sin_addr, 0, sizeof (address->sin_addr));
+
+    if (bind (sock, (struct sockaddr *)address, sizeof (address)))
+        avr_error ("Can not bind socket (port %d): %s", port,
+                   strerror (errno));
+
+    if (listen (sock, 1))
+        avr_error ("Can not listen on socket (port %d): %s", port,
+                   strerror (errno));
+
+    return sock;
+}
+
+static void
+server_card_init (Card *card, int index, ServerConfig *cfg, Image *image,
+                  Image *eeprom)
+{
+    card->index = index;
+    card->port = cfg->port + index;
+    card->conn_fd = -1;
+    card->next = NULL;
+
+    card->core = avr_core_new (cfg->device);
+    if (card->core == NULL)
+        avr_error ("Device not supported: %s", cfg->device);
+
+    if (cfg->rng_seeded)
+        avr_core_rng_seed (card->core, cfg->rng_seed + index);
+    avr_core_set_debug_inst_output (card->core, cfg->debug_inst_output);
+
+    if (avr_core_load_image (card->core, image) < 0)
+        avr_error ("Could not load flash image %s", cfg->flash_file);
+    if (eeprom && (avr_core_load_eeprom_image (card->core, eeprom) < 0))
+        avr_error ("Could not load eeprom image %s", cfg->eeprom_file);
+
+    hostio_attach_fd (avr_core_get_host (card->core), -1);
+
+    avr_core_reset (card->core);
+    avr_core_set_state (card->core, STATE_RUNNING);
+
+    card->listen_fd = server_listen (card->port);
+}
+
+/* A client connected to a card without a connection. */
+
+static void
+server_accept (Card *card)
+{
+    struct sockaddr_in address[1];
+    socklen_t len = sizeof (address);
+    int fd, i;
+
+    fd = accept (card->listen_fd, (struct sockaddr *)address, &len);
+    if (fd < 0)
+    {
+        avr_warning ("card %d: accept failed: %s\n", card->index,
+                     strerror (errno));
+        return;
+    }
+
+    i = 1;
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &i, sizeof (i));
+
+    avr_message ("card %d: connection opened by host %s, port %hu.\n",
+                 card->index, inet_ntoa (address->sin_addr),
+                 ntohs (address->sin_port));
+
+    card->conn_fd = fd;
+    hostio_attach_fd (avr_core_get_host (card->core), fd);
+}
+
+/* Power a card down and up again for the next client, so that nothing of
+   the session (selected file, verified PIN, a half received APDU) is left;
+   the eeprom keeps its contents as on a real card. */
+
+static void
+server_power_cycle (Card *card)
+{
+    avr_core_power_cycle (card->core);
+    avr_core_set_state (card->core, STATE_RUNNING);
+}
+
+/* The client of a card went away. Called with srv->lock held. */
+
+static void
+server_disconnect (Server *srv, Card *card)
+{
+    avr_message ("card %d: connection closed\n", card->index);
+
+    hostio_attach_fd (avr_core_get_host (card->core), -1);
+    close (card->conn_fd);
+    card->conn_fd = -1;
+
+    server_power_cycle (card);
+    server_enqueue (srv, card);
+}
+
+/* The cores of the gdb session, see CommFuncHoldCore in gdb.h. */
+
+static int
+server_gdb_num_cores (void *data)
+{
+    return ((Server *)data)->num_cards;
+}
+
+/* Take a card from whoever runs it, a worker finishes its slice first. */
+
+static void *
+server_gdb_hold (void *data, int n)
+{
+    Server *srv = (Server *)data;
+    Card *card = &srv->cards[n];
+
+    pthread_mutex_lock (&srv->lock);
+    card->hold = 1;
+    while (card->state == CARD_RUNNING)
+        pthread_cond_wait (&srv->held, &srv->lock);
+    if (card->state == CARD_QUEUED)
+        server_unqueue (srv, card);
+    card->state = CARD_HELD;
+    pthread_mutex_unlock (&srv->lock);
+
+    return card->core;
+}
+
+/* Give a held card back, it goes wherever its core says it belongs. */
+
+static void
+server_gdb_release (void *data, int n)
+{
+    Server *srv = (Server *)data;
+    Card *card = &srv->cards[n];
+    HostIO *host = avr_core_get_host (card->core);
+
+    pthread_mutex_lock (&srv->lock);
+    card->hold = 0;
+    if (avr_core_get_state (card->core) != STATE_RUNNING)
+    {
+        card->state = CARD_STOPPED;
+        server_wake (srv);
+    }
+    else if (hostio_waiting (host) && !hostio_has_line (host))
+    {
+        card->state = CARD_PARKED;
+        server_wake (srv);
+    }
+    else
+        server_enqueue (srv, card);
+    pthread_mutex_unlock (&srv->lock);
+}
+
+static int
+server_gdb_trapped (void *data)
+{
+    Server *srv = (Server *)data;
+    int i, n = -1;
+
+    pthread_mutex_lock (&srv->lock);
+    for (i = 0; i < srv->num_cards; i++)
+    {
+        if (srv->cards[i].state == CARD_TRAPPED)
+        {
+            n = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock (&srv->lock);
+
+    return n;
+}
+
+static void
+server_gdb_info (void *data, int n, char *buf, int size)
+{
+    static const char *names[] = {
+        "running", "running", "waiting for the host", "stopped",
+        "held by gdb", "at a break point", "waiting for a client"
+    };
+    Server *srv = (Server *)data;
+    Card *card = &srv->cards[n];
+
+    pthread_mutex_lock (&srv->lock);
+    snprintf (buf, size, "card %d, port %d, %s%s", card->index, card->port,
+              names[card->state],
+              (card->conn_fd >= 0) ? ", connected" : "");
+    pthread_mutex_unlock (&srv->lock);
+}
+
+/* avr_core_history_step() for a held card. The main thread does not poll
+   the socket of a held card, the firmware would wait for the host for
+   ever. */
+
+static int
+server_gdb_step (void *data)
+{
+    AvrCore *core = (AvrCore *)data;
+    HostIO *host = avr_core_get_host (core);
+
+    if (hostio_waiting (host) && !hostio_has_line (host))
+        hostio_fill (host);
+
+    return avr_core_history_step (core);
+}
+
+static void *
+server_gdb (void *data)
+{
+    Server *srv = (Server *)data;
+
+    gdb_interact (srv->gdb_comm, srv->gdb_port, srv->gdb_debug);
+
+    pthread_mutex_lock (&srv->lock);
+    srv->gdb_done = 1;
+    pthread_mutex_unlock (&srv->lock);
+    server_wake (srv);
+
+    return NULL;
+}
+
+/* Hook the gdb comm of the config up to the cards. Reverse execution
+   would need a history of every card, it is not offered. */
+
+static void
+server_gdb_init (Server *srv, ServerConfig *cfg)
+{
+    GdbComm_T *comm = cfg->gdb_comm;
+
+    srv->gdb_comm = comm;
+    srv->gdb_port = cfg->port + cfg->cards;
+    srv->gdb_debug = cfg->gdb_debug;
+
+    comm->user_data = srv->cards[0].core;
+    comm->step = server_gdb_step;
+    comm->reverse_step = NULL;
+    comm->reverse_continue = NULL;
+
+    comm->server = srv;
+    comm->num_cores = server_gdb_num_cores;
+    comm->hold_core = server_gdb_hold;
+    comm->release_core = server_gdb_release;
+    comm->trapped_core = server_gdb_trapped;
+    comm->core_info = server_gdb_info;
+}
+
+/**
+ * \brief Run the multi card server until SIGINT.
+ */
+void
+server_run (ServerConfig *cfg)
+{
+    Server srv[1];
+    pthread_t *workers;
+    struct pollfd *pfd;
+    Card **pcard;
+    sigset_t set, oset;
+    SigWatch sigint;
+    Image *image, *eeprom = NULL;
+    int i, n, res;
+    char buf[64];
+
+    if (cfg->flash_file == NULL)
+        avr_error ("A flash image is needed in server mode");
+    if ((cfg->cards < 1) || (cfg->threads < 1))
+        avr_error ("Invalid number of cards or threads");
+
+    memset (srv, 0, sizeof (srv));
+    pthread_mutex_init (&srv->lock, NULL);
+    pthread_cond_init (&srv->cond, NULL);
+    pthread_cond_init (&srv->held, NULL);
+    if (pipe (srv->wake_fd) < 0)
+        avr_error ("pipe failed: %s", strerror (errno));
+    fcntl (srv->wake_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl (srv->wake_fd[1], F_SETFL, O_NONBLOCK);
+
+    image = image_read (cfg->flash_file, cfg->flash_format);
+    if (image == NULL)
+        avr_error ("Could not read flash image %s", cfg->flash_file);
+    if (cfg->eeprom_file)
+    {
+        eeprom = image_read (cfg->eeprom_file, cfg->eeprom_format);
+        if (eeprom == NULL)
+            avr_error ("Could not read eeprom image %s", cfg->eeprom_file);
+    }
+
+    srv->num_cards = cfg->cards;
+    srv->cards = avr_new0 (Card, cfg->cards);
+    for (i = 0; i < cfg->cards; i++)
+    {
+        server_card_init (&srv->cards[i], i, cfg, image, eeprom);
+        server_enqueue (srv, &srv->cards[i]);
+    }
+    class_unref ((AvrClass *)image);
+    if (eeprom)
+        class_unref ((AvrClass *)eeprom);
+
+    avr_message ("%d cards listening on ports %d-%d, %d worker threads\n",
+                 cfg->cards, cfg->port, cfg->port + cfg->cards - 1,
+                 cfg->threads);
+
+    if (cfg->gdb_comm)
+        server_gdb_init (srv, cfg);
+
+    /* SIGINT is handled by the main thread only. */
+    sigemptyset (&set);
+    sigaddset (&set, SIGINT);
+    pthread_sigmask (SIG_BLOCK, &set, &oset);
+
+    workers = avr_new0 (pthread_t, cfg->threads);
+    for (i = 0; i < cfg->threads; i++)
+    {
+        res = pthread_create (&workers[i], NULL, server_worker, srv);
+        if (res != 0)
+            avr_error ("pthread_create failed: %s", strerror (res));
+    }
+
+    pthread_sigmask (SIG_SETMASK, &oset, NULL);
+    signal_watch_start (&sigint, SIGINT);
+
+    /* The gdb thread takes SIGINT too, it must leave a blocking read. */
+    if (srv->gdb_comm)
+    {
+        res = pthread_create (&srv->gdb_thread, NULL, server_gdb, srv);
+        if (res != 0)
+            avr_error ("pthread_create failed: %s", strerror (res));
+    }
+
+    pfd = avr_new0 (struct pollfd, cfg->cards + 1);
+    pcard = avr_new0 (Card *, cfg->cards + 1);
+
+    for (;;)
+    {
+        n = 0;
+        pfd[n].fd = srv->wake_fd[0];
+        pfd[n].events = POLLIN;
+        pcard[n++] = NULL;
+
+        pthread_mutex_lock (&srv->lock);
+        for (i = 0; i < srv->num_cards; i++)
+        {
+            Card *card = &srv->cards[i];
+
+            if (card->state == CARD_STOPPED)
+            {
+                if (card->conn_fd >= 0)
+                {
+                    server_disconnect (srv, card);
+                    continue;
+                }
+                server_power_cycle (card);
+                card->state = CARD_IDLE;
+            }
+
+            /* Queued and running cards belong to the workers, even a new
+               connection waits until the card parks. */
+            if ((card->state != CARD_PARKED) && (card->state != CARD_IDLE))
+                continue;
+
+            if (card->conn_fd < 0)
+                pfd[n].fd = card->listen_fd;
+            else
+                pfd[n].fd = card->conn_fd;
+
+            pfd[n].events = POLLIN;
+            pcard[n++] = card;
+        }
+        pthread_mutex_unlock (&srv->lock);
+
+        res = poll (pfd, n, -1);
+
+        if (signal_has_occurred (&sigint))
+            break;
+
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            avr_error ("poll failed: %s", strerror (errno));
+        }
+
+        if (pfd[0].revents)
+            while (read (srv->wake_fd[0], buf, sizeof (buf)) > 0) ;
+
+        for (i = 1; i < n; i++)
+        {
+            Card *card = pcard[i];
+            HostIO *host = avr_core_get_host (card->core);
+
+            if (pfd[i].revents == 0)
+                continue;
+
+            /* Parked or idle card, the main thread owns it until it is
+               queued or gdb takes it. */
+            pthread_mutex_lock (&srv->lock);
+            if (card->state == CARD_IDLE)
+            {
+                server_accept (card);
+                if (card->conn_fd >= 0)
+                    server_enqueue (srv, card);
+            }
+            else if (card->state != CARD_PARKED)
+                ;               /* held by gdb since the poll */
+            else if (pfd[i].fd == card->listen_fd)
+                server_accept (card);
+            else if (hostio_fill (host) == 0)
+                server_disconnect (srv, card);
+            else if (hostio_has_line (host))
+                server_enqueue (srv, card);
+            pthread_mutex_unlock (&srv->lock);
+        }
+    }
+
+    /* The SIGINT may have gone to this thread only, poke the gdb thread
+       until it is out of gdb_interact(). It may wait for a worker. */
+    if (srv->gdb_comm)
+    {
+        pthread_mutex_lock (&srv->lock);
+        while (!srv->gdb_done)
+        {
+            pthread_mutex_unlock (&srv->lock);
+            pthread_kill (srv->gdb_thread, SIGINT);
+            usleep (10000);
+            pthread_mutex_lock (&srv->lock);
+        }
+        pthread_mutex_unlock (&srv->lock);
+        pthread_join (srv->gdb_thread, NULL);
+    }
+
+    signal_watch_stop (&sigint);
+
+    avr_message ("Shutting down server\n");
+
+    pthread_mutex_lock (&srv->lock);
+    srv->quit = 1;
+    pthread_cond_broadcast (&srv->cond);
+    pthread_mutex_unlock (&srv->lock);
+
+    for (i = 0; i < cfg->threads; i++)
+        pthread_join (workers[i], NULL);
+
+    for (i = 0; i < srv->num_cards; i++)
+    {
+        if (srv->cards[i].conn_fd >= 0)
+            close (srv->cards[i].conn_fd);
+        close (srv->cards[i].listen_fd);
+        class_unref ((AvrClass *)srv->cards[i].core);
+    }
+
+    close (srv->wake_fd[0]);
+    close (srv->wake_fd[1]);
+    pthread_cond_destroy (&srv->cond);
+    pthread_cond_destroy (&srv->held);
+    pthread_mutex_destroy (&srv->lock);
+
+    avr_free (pfd);
+    avr_free (pcard);
+    avr_free (workers);
+    avr_free (srv->cards);
+}
@@ -39,11 +39,21 @@
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include "avrerror.h"
 #include "sig.h"
 
-static volatile int global_got_sigint = 0;
+/* The handler only counts signals. Each SigWatch remembers the count it has
+   seen, so no user can swallow a signal meant for another one. */
+
+static volatile sig_atomic_t global_sigint_count = 0;
+
+/* Number of active watches, the handler is installed while it is not zero.
+   Watches may be started and stopped from several threads. */
+
+static pthread_mutex_t global_watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static int global_sigint_watches = 0;
 
 /*
  * Private.
@@ -53,84 +63,103 @@ static volatile int global_got_sigint = 0;
 static void
 signal_handle_sigint (int signo)
 {
-    global_got_sigint = 1;
+    global_sigint_count++;
 }
 
 /**
  * \brief Start watching for the occurrance of the given signal.
  *
- * This function will install a signal handler which will set a flag when the
- * signal occurs. Once the watch has been started, periodically call
- * signal_has_occurred() to check if the signal was raised. 
+ * The first watch installs a signal handler which counts the signals. Once
+ * the watch has been started, periodically call signal_has_occurred() to
+ * check if the signal was raised. 
  */
 void
-signal_watch_start (int signo)
+signal_watch_start (SigWatch *watch, int signo)
 {
     struct sigaction act, oact;
 
-    sigemptyset (&act.sa_mask);
-    act.sa_flags = 0;
+    watch->signo = signo;
 
     switch (signo)
     {
         case SIGINT:
-            global_got_sigint = 0;
-            act.sa_handler = signal_handle_sigint;
+            watch->seen = global_sigint_count;
             break;
         default:
             avr_warning ("Invalid signal: %d\n", signo);
             return;
     }
 
-    if (sigaction (signo, &act, &oact) < 0)
-        avr_warning ("Failed to install signal handler: sig=%d: %s\n", signo,
-                     strerror (errno));
+    pthread_mutex_lock (&global_watch_lock);
+    if (global_sigint_watches++ == 0)
+    {
+        sigemptyset (&act.sa_mask);
+        act.sa_flags = 0;
+        act.sa_handler = signal_handle_sigint;
+
+        if (sigaction (signo, &act, &oact) < 0)
+            avr_warning ("Failed to install signal handler: sig=%d: %s\n",
+                         signo, strerror (errno));
+    }
+    pthread_mutex_unlock (&global_watch_lock);
 }
 
 /**
  * \brief Stop watching signal.
  *
- * Restores the default signal handler for the given signal and resets the
- * signal flag. 
+ * When the last watch is stopped, the default signal handler for the given
+ * signal is restored. 
  */
 void
-signal_watch_stop (int signo)
+signal_watch_stop (SigWatch *watch)
 {
     struct sigaction act, oact;
 
-    sigemptyset (&act.sa_mask);
-    act.sa_flags = 0;
-    act.sa_handler = SIG_DFL;
+    if (watch->signo != SIGINT)
+        return;
 
-    signal_reset (signo);
+    signal_reset (watch);
 
-    if (sigaction (signo, &act, &oact) < 0)
-        avr_warning ("Failed to restore default signal handler: sig=%d: %s\n",
-                     signo, strerror (errno));
+    pthread_mutex_lock (&global_watch_lock);
+    if (--global_sigint_watches == 0)
+    {
+        sigemptyset (&act.sa_mask);
+        act.sa_flags = 0;
+        act.sa_handler = SIG_DFL;
+
+        if (sigaction (watch->signo, &act, &oact) < 0)
+            avr_warning ("Failed to restore default signal handler: "
+                         "sig=%d: %s\n", watch->signo, strerror (errno));
+    }
+    pthread_mutex_unlock (&global_watch_lock);
 }
 
 /**
  * \brief Check to see if a signal has occurred.
  *
- * \return Non-zero if signal has occurred. The flag will always be reset
- * automatically. 
+ * \return Non-zero if signal has occurred since the last check. The watch
+ * will always be reset automatically. 
  */
 int
-signal_has_occurred (int signo)
+signal_has_occurred (SigWatch *watch)
 {
-    int res = 0;
+    unsigned int count;
 
-    switch (signo)
+    switch (watch->signo)
     {
         case SIGINT:
-            res = global_got_sigint;
-            global_got_sigint = 0;
+            count = global_sigint_count;
             break;
         default:
-            avr_warning ("Invalid signal: %d", signo);
+            avr_warning ("Invalid signal: %d", watch->signo);
+            return 0;
     }
 
-    return res;
+    if (count == watch->seen)
+        return 0;
+
+    watch->seen = count;
+    return 1;
 }
 
 /**
@@ -139,7 +168,7 @@ signal_has_occurred (int signo)
  * Use signal_reset to manually reset (i.e. clear) the flag.
  */
 void
-signal_reset (int signo)
+signal_reset (SigWatch *watch)
 {
-    signal_has_occurred (signo);
+    signal_has_occurred (watch);
 }
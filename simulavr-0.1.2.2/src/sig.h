@@ -26,10 +26,21 @@
 #ifndef SIM_SIGNAL_H
 #define SIM_SIGNAL_H
 
-extern void signal_watch_start (int signo);
-extern void signal_watch_stop (int signo);
+/* One user of a signal. Every user sees each signal once, so several cores
+   running on different threads can each poll for SIGINT. */
 
-extern int signal_has_occurred (int signo);
-extern void signal_reset (int signo);
+typedef struct _SigWatch SigWatch;
+
+struct _SigWatch
+{
+    int signo;
+    unsigned int seen;          /* signal count at the last check */
+};
+
+extern void signal_watch_start (SigWatch *watch, int signo);
+extern void signal_watch_stop (SigWatch *watch);
+
+extern int signal_has_occurred (SigWatch *watch);
+extern void signal_reset (SigWatch *watch);
 
 #endif /* SIM_SIGNAL_H */
@@ -0,0 +1,689 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file simavr.c
+ * \brief Stable C API of libsimavr.
+ *
+ * A thin layer over AvrCore for programs that link the simulator directly
+ * (test harnesses, language bindings) instead of talking to simulavr-oseid
+ * over stdin/stdout or the gdb remote protocol.
+ *
+ * The host channel of the core is switched to memory buffers (see
+ * hostio.c): lines for the OsEID FIFO are queued with simavr_host_send()
+ * or simavr_apdu(), and simavr_run() returns SIMAVR_RUN_WAIT once the
+ * firmware waits for a line that was not sent yet.
+ *
+ * Fatal simulator errors still go through avr_error(), which terminates
+ * the process.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+#include "utils.h"
+#include "callback.h"
+#include "op_names.h"
+
+#include "storage.h"
+#include "flash.h"
+
+#include "vdevs.h"
+#include "memory.h"
+#include "stack.h"
+#include "register.h"
+#include "sram.h"
+#include "eeprom.h"
+#include "timers.h"
+#include "ports.h"
+
+#include "avrcore.h"
+
+#include "OsEID.h"
+#include "simavr.h"
+
+#if SIMAVR_APDU_MAX != OSEID_APDU_MAX
+#error "SIMAVR_APDU_MAX must be the longest APDU the OsEID FIFO takes"
+#endif
+
+struct _SimAvr
+{
+    AvrCore *core;
+};
+
+/** \brief Return the SIMAVR_API_VERSION the library was built with. */
+
+int
+simavr_api_version (void)
+{
+    return SIMAVR_API_VERSION;
+}
+
+/**
+ * \brief Create a simulated device.
+ *
+ * Returns NULL if the device type is not supported. The core is reset and
+ * ready to run once a program is loaded.
+ */
+SimAvr *
+simavr_new (const char *device)
+{
+    SimAvr *sim;
+    AvrCore *core;
+
+    core = avr_core_new ((char *)device);
+    if (core == NULL)
+        return NULL;
+
+    sim = avr_new0 (SimAvr, 1);
+    sim->core = core;
+
+    hostio_use_buffers (avr_core_get_host (core));
+    simavr_reset (sim);
+
+    return sim;
+}
+
+/** \brief Destroy a device created with simavr_new(). */
+
+void
+simavr_destroy (SimAvr *sim)
+{
+    if (sim == NULL)
+        return;
+
+    class_unref ((AvrClass *)sim->core);
+    avr_free (sim);
+}
+
+/** \brief Load a flash image file (binary, or ELF with symbols). */
+
+int
+simavr_load_flash (SimAvr *sim, const char *file)
+{
+    return avr_core_load_program (sim->core, (char *)file, FFMT_BIN);
+}
+
+/** \brief Load a binary flash image from memory. */
+
+int
+simavr_load_flash_image (SimAvr *sim, const uint8_t *image, int len)
+{
+    return avr_core_load_program_image (sim->core, (uint8_t *)image, len);
+}
+
+/** \brief Load a binary eeprom image file. */
+
+int
+simavr_load_eeprom (SimAvr *sim, const char *file)
+{
+    return avr_core_load_eeprom (sim->core, (char *)file, FFMT_BIN);
+}
+
+/** \brief Keep the eeprom in a file, see avr_core_eeprom_file().
+
+    \a journal may be NULL. Call it before the first checkpoint. */
+
+int
+simavr_eeprom_file (SimAvr *sim, const char *file, const char *journal)
+{
+    return avr_core_eeprom_file (sim->core, (char *)file, (char *)journal);
+}
+
+/** \brief Write the eeprom back to its file now. */
+
+int
+simavr_eeprom_sync (SimAvr *sim)
+{
+    return avr_core_eeprom_sync (sim->core);
+}
+
+/** \brief Make the random number source of the device deterministic. */
+
+void
+simavr_rng_seed (SimAvr *sim, uint64_t seed)
+{
+    avr_core_rng_seed (sim->core, seed);
+}
+
+/**
+ * \brief Reset the device.
+ *
+ * Host data not yet consumed by the firmware and output not yet read are
+ * dropped. The clock counter is not reset.
+ */
+void
+simavr_reset (SimAvr *sim)
+{
+    HostIO *host = avr_core_get_host (sim->core);
+
+    avr_core_reset (sim->core);
+    avr_core_set_state (sim->core, STATE_RUNNING);
+
+    hostio_use_buffers (host);
+    hostio_wait (host, NULL, NULL);
+}
+
+/**
+ * \brief Run the device for at most \a cycles clock cycles.
+ *
+ * Returns one of the SIMAVR_RUN_* values. A break point stays in place, it
+ * has to be removed before the run can continue past it.
+ */
+int
+simavr_run (SimAvr *sim, uint64_t cycles)
+{
+    AvrCore *core = sim->core;
+    HostIO *host = avr_core_get_host (core);
+    uint64_t end = avr_core_CK_get (core) + cycles;
+
+    while (avr_core_CK_get (core) < end)
+    {
+        if (hostio_waiting (host))
+        {
+            if (!hostio_has_line (host))
+                return SIMAVR_RUN_WAIT;
+            hostio_resume (host);
+            continue;
+        }
+
+        if (avr_core_get_state (core) != STATE_RUNNING)
+            return SIMAVR_RUN_STOPPED;
+
+        if (avr_core_step (core) == BREAK_POINT)
+            return SIMAVR_RUN_BREAK;
+    }
+
+    return SIMAVR_RUN_LIMIT;
+}
+
+/**
+ * \brief Save the complete device state to a file.
+ *
+ * Host input not yet consumed and output not yet read are not part of the
+ * state. Returns 0 on success, -1 on error.
+ */
+int
+simavr_save_state (SimAvr *sim, const char *file)
+{
+    return avr_core_save_state (sim->core, (char *)file);
+}
+
+/**
+ * \brief Restore a device state saved by simavr_save_state().
+ *
+ * The same device type and program must be loaded. Pending host data is
+ * dropped. Returns 0 on success, -1 on error (the device is reset then).
+ */
+int
+simavr_load_state (SimAvr *sim, const char *file)
+{
+    HostIO *host = avr_core_get_host (sim->core);
+
+    hostio_use_buffers (host);
+    return avr_core_load_state (sim->core, (char *)file);
+}
+
+/**
+ * \brief Take an in-memory checkpoint of the device.
+ *
+ * Cheap: memory pages are only copied when they are written afterwards.
+ * Checkpoints nest. Returns the number of checkpoints or -1 on error.
+ */
+int
+simavr_checkpoint (SimAvr *sim)
+{
+    return avr_core_checkpoint (sim->core);
+}
+
+/**
+ * \brief Return the device to the innermost checkpoint.
+ *
+ * The checkpoint stays in place. Pending host data is dropped. Returns 0
+ * on success, -1 if there is no checkpoint.
+ */
+int
+simavr_rollback (SimAvr *sim)
+{
+    if (sim->core->checkpoints == NULL)
+        return -1;
+
+    hostio_use_buffers (avr_core_get_host (sim->core));
+    return avr_core_rollback (sim->core);
+}
+
+/** \brief Drop the innermost checkpoint. Returns 0 or -1 if there is none. */
+
+int
+simavr_checkpoint_drop (SimAvr *sim)
+{
+    return avr_core_checkpoint_drop (sim->core);
+}
+
+/** \brief Execute a single instruction. Returns a SIMAVR_RUN_* value. */
+
+int
+simavr_step (SimAvr *sim)
+{
+    AvrCore *core = sim->core;
+    HostIO *host = avr_core_get_host (core);
+
+    if (hostio_waiting (host))
+    {
+        if (!hostio_has_line (host))
+            return SIMAVR_RUN_WAIT;
+        hostio_resume (host);
+        if (hostio_waiting (host))
+            return SIMAVR_RUN_WAIT;
+    }
+
+    if (avr_core_get_state (core) != STATE_RUNNING)
+        return SIMAVR_RUN_STOPPED;
+
+    if (avr_core_step (core) == BREAK_POINT)
+        return SIMAVR_RUN_BREAK;
+
+    return SIMAVR_RUN_LIMIT;
+}
+
+/** \brief Return the number of clock cycles executed so far. */
+
+uint64_t
+simavr_get_cycles (SimAvr *sim)
+{
+    return avr_core_CK_get (sim->core);
+}
+
+/** \brief Insert a break point (byte address, as used by binutils). */
+
+void
+simavr_break_insert (SimAvr *sim, uint32_t byte_addr)
+{
+    avr_core_insert_breakpoint (sim->core, byte_addr / 2);
+}
+
+/** \brief Remove a break point (byte address). */
+
+void
+simavr_break_remove (SimAvr *sim, uint32_t byte_addr)
+{
+    avr_core_remove_breakpoint (sim->core, byte_addr / 2);
+}
+
+/** \brief Return the program counter as a byte address. */
+
+uint32_t
+simavr_pc_get (SimAvr *sim)
+{
+    return avr_core_PC_get (sim->core) * 2;
+}
+
+/**
+ * \brief Name of the symbol (function) containing a flash byte address.
+ *
+ * Needs a program loaded from an ELF file. Returns NULL if no symbol covers
+ * the address, otherwise the name; the distance from the symbol start is
+ * stored in \a offset (may be NULL).
+ */
+const char *
+simavr_symbol (SimAvr *sim, uint32_t byte_addr, uint32_t *offset)
+{
+    const ImageSymbol *sym = avr_core_symbol (sim->core, byte_addr);
+
+    if (sym == NULL)
+        return NULL;
+    if (offset)
+        *offset = byte_addr - sym->addr;
+    return sym->name;
+}
+
+/** \brief Flash byte address of a symbol, -1 if unknown. */
+
+int
+simavr_symbol_addr (SimAvr *sim, const char *name)
+{
+    return avr_core_symbol_addr (sim->core, name);
+}
+
+/** \brief Start the function profiler, see avr_core_profile_start(). */
+
+void
+simavr_profile_start (SimAvr *sim)
+{
+    avr_core_profile_start (sim->core);
+}
+
+/** \brief Stop the function profiler and drop the profile. */
+
+void
+simavr_profile_stop (SimAvr *sim)
+{
+    avr_core_profile_stop (sim->core);
+}
+
+/** \brief Write the profile in the callgrind format, the profiler keeps
+    running. */
+
+int
+simavr_profile_write (SimAvr *sim, const char *file)
+{
+    return avr_core_profile_write (sim->core, (char *)file);
+}
+
+/** \brief Write folded stacks for every APDU to files in \a dir (NULL
+    stops it), see avr_core_profile_flame_dir(). */
+
+void
+simavr_profile_flame_dir (SimAvr *sim, const char *dir)
+{
+    avr_core_profile_flame_dir (sim->core, (char *)dir);
+}
+
+/** \brief Sample the PC every \a period clock cycles (0: the default),
+    see avr_core_sample_start(). */
+
+void
+simavr_sample_start (SimAvr *sim, uint32_t period, int callers)
+{
+    avr_core_sample_start (sim->core, period ? period : SAMPLE_PERIOD,
+                           callers);
+}
+
+/** \brief Stop the PC sampling and drop the samples. */
+
+void
+simavr_sample_stop (SimAvr *sim)
+{
+    avr_core_sample_stop (sim->core);
+}
+
+/** \brief Write the samples for simulavr-pcprof. */
+
+int
+simavr_sample_write (SimAvr *sim, const char *file)
+{
+    return avr_core_sample_write (sim->core, (char *)file);
+}
+
+/** \brief Trace the executed instructions to \a file for simulavr-trace.
+
+    \a byte_addr is the trigger address, -1 to trace everything, and \a
+    size the number of records kept in memory (0: the default). Returns 0
+    or -1. */
+
+int
+simavr_trace_start (SimAvr *sim, const char *file, int32_t byte_addr,
+                    uint32_t size)
+{
+    return avr_core_trace_start (sim->core, (char *)file,
+                                 (byte_addr < 0) ? TRACE_NO_TRIGGER
+                                 : byte_addr / 2, size ? size : TRACE_SIZE);
+}
+
+/** \brief End the trace, see avr_core_trace_stop(). */
+
+void
+simavr_trace_stop (SimAvr *sim)
+{
+    avr_core_trace_stop (sim->core);
+}
+
+/** \brief Record the host input and random bytes to \a file, or with \a
+    play feed them back from there. Returns 0 or -1. */
+
+int
+simavr_replay_start (SimAvr *sim, const char *file, int play)
+{
+    return avr_core_replay_start (sim->core, (char *)file, play);
+}
+
+/** \brief End recording or replaying, see avr_core_replay_stop(). */
+
+void
+simavr_replay_stop (SimAvr *sim)
+{
+    avr_core_replay_stop (sim->core);
+}
+
+/** \brief Set the program counter (byte address). */
+
+void
+simavr_pc_set (SimAvr *sim, uint32_t byte_addr)
+{
+    avr_core_PC_set (sim->core, byte_addr / 2);
+}
+
+/** \brief Read general purpose register r0 - r31. */
+
+uint8_t
+simavr_reg_get (SimAvr *sim, int reg)
+{
+    return avr_core_gpwr_get (sim->core, reg);
+}
+
+/** \brief Write general purpose register r0 - r31. */
+
+void
+simavr_reg_set (SimAvr *sim, int reg, uint8_t val)
+{
+    avr_core_gpwr_set (sim->core, reg, val);
+}
+
+/** \brief Read the status register. */
+
+uint8_t
+simavr_sreg_get (SimAvr *sim)
+{
+    return avr_core_sreg_get (sim->core);
+}
+
+/** \brief Write the status register. */
+
+void
+simavr_sreg_set (SimAvr *sim, uint8_t val)
+{
+    avr_core_sreg_set (sim->core, val);
+}
+
+/**
+ * \brief Read a byte of the data space.
+ *
+ * Reading an I/O register has the same side effects as a read by the
+ * firmware (e.g. reading the OsEID FIFO consumes a byte).
+ */
+uint8_t
+simavr_mem_read (SimAvr *sim, int addr)
+{
+    return avr_core_mem_read (sim->core, addr);
+}
+
+/** \brief Write a byte of the data space. */
+
+void
+simavr_mem_write (SimAvr *sim, int addr, uint8_t val)
+{
+    avr_core_mem_write (sim->core, addr, val);
+}
+
+/** \brief Read a flash word. */
+
+uint16_t
+simavr_flash_read (SimAvr *sim, int word_addr)
+{
+    return avr_core_flash_read (sim->core, word_addr);
+}
+
+/** \brief Write a flash word. */
+
+void
+simavr_flash_write (SimAvr *sim, int word_addr, uint16_t val)
+{
+    avr_core_flash_write (sim->core, word_addr, val);
+}
+
+/** \brief Read an eeprom byte (0 if the device has no OsEID eeprom). */
+
+uint8_t
+simavr_eeprom_read (SimAvr *sim, int addr)
+{
+    return oseid_ee_read (sim->core, addr);
+}
+
+/** \brief Write an eeprom byte. */
+
+void
+simavr_eeprom_write (SimAvr *sim, int addr, uint8_t val)
+{
+    oseid_ee_write (sim->core, addr, val);
+}
+
+/**
+ * \brief Queue one line of host input (the stdin protocol, e.g. "> P").
+ *
+ * A missing trailing newline is added. Returns 0 on success, -1 if the
+ * input buffer is full.
+ */
+int
+simavr_host_send (SimAvr *sim, const char *line)
+{
+    HostIO *host = avr_core_get_host (sim->core);
+    int len = strlen (line);
+
+    if (hostio_put_input (host, line, len) < 0)
+        return -1;
+
+    if ((len == 0) || (line[len - 1] != '\n'))
+    {
+        if (hostio_put_input (host, "\n", 1) < 0)
+        {
+            host->in_len -= len;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Take the output of the device (the stdout protocol).
+ *
+ * At most size - 1 bytes are copied, the result is zero terminated.
+ * Returns the number of bytes copied.
+ */
+int
+simavr_host_recv (SimAvr *sim, char *buf, int size)
+{
+    int len;
+
+    if (size <= 0)
+        return 0;
+
+    len = hostio_take_output (avr_core_get_host (sim->core), buf, size - 1);
+    buf[len] = '\0';
+
+    return len;
+}
+
+/* Collect the bytes of all "< xx xx .." lines in the output. */
+
+static int
+simavr_parse_response (char *out, uint8_t *resp, int resp_size)
+{
+    char *line, *p, *save;
+    int n = 0;
+
+    /* strtok_r(): several devices may answer in threads of their own */
+    for (line = strtok_r (out, "\n", &save); line;
+         line = strtok_r (NULL, "\n", &save))
+    {
+        if (strncmp (line, "< ", 2) != 0)
+            continue;
+
+        for (p = line + 2;; p += 2)
+        {
+            while (*p == ' ')
+                p++;
+            if (!isxdigit ((unsigned char)p[0])
+                || !isxdigit ((unsigned char)p[1]))
+                break;
+            if (n >= resp_size)
+                return -1;
+            sscanf (p, "%2hhx", &resp[n++]);
+        }
+    }
+
+    return n;
+}
+
+/**
+ * \brief Send a command APDU to the OsEID firmware and return its answer.
+ *
+ * The device runs until it waits for the next command, at most
+ * \a max_cycles clock cycles. Output not yet read with simavr_host_recv()
+ * is discarded first. Returns the length of the response or -1 if the
+ * command is longer than SIMAVR_APDU_MAX bytes (the card would refuse it)
+ * or could not be sent, the device did not finish in time or the response
+ * does not fit into \a resp.
+ */
+int
+simavr_apdu (SimAvr *sim, const uint8_t *cmd, int cmd_len, uint8_t *resp,
+             int resp_size, uint64_t max_cycles)
+{
+    HostIO *host = avr_core_get_host (sim->core);
+    char line[HOSTIO_BUF_SIZE];
+    char *out;
+    int i, pos, len;
+
+    if ((cmd_len < 0) || (cmd_len > SIMAVR_APDU_MAX))
+        return -1;
+
+    pos = sprintf (line, ">");
+    for (i = 0; i < cmd_len; i++)
+        pos += sprintf (line + pos, " %02x", cmd[i]);
+    line[pos++] = '\n';
+
+    host->out_len = 0;
+    if (hostio_put_input (host, line, pos) < 0)
+        return -1;
+
+    if (simavr_run (sim, max_cycles) != SIMAVR_RUN_WAIT)
+        return -1;
+
+    out = avr_malloc (host->out_len + 1);
+    len = hostio_take_output (host, out, host->out_len);
+    out[len] = '\0';
+
+    len = simavr_parse_response (out, resp, resp_size);
+    avr_free (out);
+
+    return len;
+}
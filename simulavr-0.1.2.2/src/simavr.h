@@ -0,0 +1,130 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/*
+ * Public interface of libsimavr. This is the only header a program linking
+ * the simulator needs, none of the internal headers are required. The
+ * SimAvr handle is opaque; new functions may be added, but existing ones
+ * keep their meaning for a given SIMAVR_API_VERSION.
+ */
+
+#ifndef SIMAVR_H
+#define SIMAVR_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIMAVR_API_VERSION 1
+
+#define SIMAVR_APDU_MAX 266     /* longest command simavr_apdu() sends */
+
+typedef struct _SimAvr SimAvr;
+
+/* Return values of simavr_run(). */
+
+enum
+{
+    SIMAVR_RUN_LIMIT = 0,       /* the cycle budget is used up */
+    SIMAVR_RUN_WAIT = 1,        /* the device waits for host input */
+    SIMAVR_RUN_BREAK = 2,       /* a break point was reached */
+    SIMAVR_RUN_STOPPED = 3,     /* the core left the running state */
+};
+
+extern int simavr_api_version (void);
+
+extern SimAvr *simavr_new (const char *device);
+extern void simavr_destroy (SimAvr *sim);
+
+extern int simavr_load_flash (SimAvr *sim, const char *file);
+extern int simavr_load_flash_image (SimAvr *sim, const uint8_t *image,
+                                    int len);
+extern int simavr_load_eeprom (SimAvr *sim, const char *file);
+extern int simavr_eeprom_file (SimAvr *sim, const char *file,
+                               const char *journal);
+extern int simavr_eeprom_sync (SimAvr *sim);
+extern void simavr_rng_seed (SimAvr *sim, uint64_t seed);
+
+extern void simavr_reset (SimAvr *sim);
+extern int simavr_run (SimAvr *sim, uint64_t cycles);
+extern int simavr_step (SimAvr *sim);
+extern uint64_t simavr_get_cycles (SimAvr *sim);
+
+extern int simavr_save_state (SimAvr *sim, const char *file);
+extern int simavr_load_state (SimAvr *sim, const char *file);
+
+extern int simavr_checkpoint (SimAvr *sim);
+extern int simavr_rollback (SimAvr *sim);
+extern int simavr_checkpoint_drop (SimAvr *sim);
+
+extern void simavr_break_insert (SimAvr *sim, uint32_t byte_addr);
+extern void simavr_break_remove (SimAvr *sim, uint32_t byte_addr);
+
+extern const char *simavr_symbol (SimAvr *sim, uint32_t byte_addr,
+                                  uint32_t *offset);
+extern int simavr_symbol_addr (SimAvr *sim, const char *name);
+
+extern void simavr_profile_start (SimAvr *sim);
+extern void simavr_profile_stop (SimAvr *sim);
+extern int simavr_profile_write (SimAvr *sim, const char *file);
+extern void simavr_profile_flame_dir (SimAvr *sim, const char *dir);
+
+extern void simavr_sample_start (SimAvr *sim, uint32_t period, int callers);
+extern void simavr_sample_stop (SimAvr *sim);
+extern int simavr_sample_write (SimAvr *sim, const char *file);
+
+extern int simavr_trace_start (SimAvr *sim, const char *file,
+                               int32_t byte_addr, uint32_t size);
+extern void simavr_trace_stop (SimAvr *sim);
+
+extern int simavr_replay_start (SimAvr *sim, const char *file, int play);
+extern void simavr_replay_stop (SimAvr *sim);
+
+extern uint32_t simavr_pc_get (SimAvr *sim);
+extern void simavr_pc_set (SimAvr *sim, uint32_t byte_addr);
+extern uint8_t simavr_reg_get (SimAvr *sim, int reg);
+extern void simavr_reg_set (SimAvr *sim, int reg, uint8_t val);
+extern uint8_t simavr_sreg_get (SimAvr *sim);
+extern void simavr_sreg_set (SimAvr *sim, uint8_t val);
+
+extern uint8_t simavr_mem_read (SimAvr *sim, int addr);
+extern void simavr_mem_write (SimAvr *sim, int addr, uint8_t val);
+extern uint16_t simavr_flash_read (SimAvr *sim, int word_addr);
+extern void simavr_flash_write (SimAvr *sim, int word_addr, uint16_t val);
+extern uint8_t simavr_eeprom_read (SimAvr *sim, int addr);
+extern void simavr_eeprom_write (SimAvr *sim, int addr, uint8_t val);
+
+extern int simavr_host_send (SimAvr *sim, const char *line);
+extern int simavr_host_recv (SimAvr *sim, char *buf, int size);
+extern int simavr_apdu (SimAvr *sim, const uint8_t *cmd, int cmd_len,
+                        uint8_t *resp, int resp_size, uint64_t max_cycles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMAVR_H */
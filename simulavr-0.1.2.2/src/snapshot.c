@@ -0,0 +1,288 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file snapshot.c
+ * \brief Serialized machine state.
+ *
+ * A Snapshot is a byte buffer holding the complete state of a core (see
+ * avr_core_snapshot_save()). Each part of the core appends its state with
+ * the snapshot_put_*() functions and reads it back in the same order with
+ * snapshot_get_*(). Integers are stored little endian, memory regions (sram,
+ * eeprom, flash) are stored raw, so a state file can be mapped and restored
+ * with a few memcpy() calls.
+ *
+ * A read past the end of the data does not abort, it sets the error flag
+ * and returns zeros. The reader checks the flag once it is done.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+
+#include "snapshot.h"
+
+/** \brief Allocate a new, empty Snapshot. */
+
+Snapshot *
+snapshot_new (void)
+{
+    Snapshot *ss;
+
+    ss = avr_new (Snapshot, 1);
+    snapshot_construct (ss);
+    class_overload_destroy ((AvrClass *)ss, snapshot_destroy);
+
+    return ss;
+}
+
+/** \brief Constructor for the Snapshot class. */
+
+void
+snapshot_construct (Snapshot *ss)
+{
+    if (ss == NULL)
+        avr_error ("passed null ptr");
+
+    class_construct ((AvrClass *)ss);
+
+    ss->data = NULL;
+    ss->len = 0;
+    ss->size = 0;
+    ss->pos = 0;
+    ss->error = 0;
+    ss->skip_storage = 0;
+    ss->map = NULL;
+    ss->map_len = 0;
+}
+
+/** \brief Destructor for the Snapshot class. */
+
+void
+snapshot_destroy (void *ss)
+{
+    Snapshot *_ss = (Snapshot *)ss;
+
+    if (ss == NULL)
+        return;
+
+    if (_ss->map)
+        munmap (_ss->map, _ss->map_len);
+    else
+        avr_free (_ss->data);
+
+    class_destroy (ss);
+}
+
+/**
+ * \brief Map a state file written by snapshot_write_file().
+ *
+ * Returns NULL (with a warning) if the file can not be read.
+ */
+Snapshot *
+snapshot_read_file (char *file)
+{
+    Snapshot *ss;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open (file, O_RDONLY);
+    if (fd < 0)
+    {
+        avr_warning ("%s: %s\n", file, strerror (errno));
+        return NULL;
+    }
+
+    if ((fstat (fd, &st) < 0) || (st.st_size == 0))
+    {
+        avr_warning ("%s: not a state file\n", file);
+        close (fd);
+        return NULL;
+    }
+
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+    {
+        avr_warning ("%s: mmap: %s\n", file, strerror (errno));
+        return NULL;
+    }
+
+    ss = snapshot_new ();
+    ss->map = map;
+    ss->map_len = st.st_size;
+    ss->data = map;
+    ss->len = st.st_size;
+
+    return ss;
+}
+
+/** \brief Write the snapshot to a file. Returns 0 or -1 on error. */
+
+int
+snapshot_write_file (Snapshot *ss, char *file)
+{
+    FILE *fp;
+
+    fp = fopen (file, "wb");
+    if (fp == NULL)
+    {
+        avr_warning ("%s: %s\n", file, strerror (errno));
+        return -1;
+    }
+
+    if ((fwrite (ss->data, 1, ss->len, fp) != (size_t) ss->len)
+        || (fclose (fp) != 0))
+    {
+        avr_warning ("%s: write failed\n", file);
+        return -1;
+    }
+
+    return 0;
+}
+
+/** \brief Append \a len bytes to the snapshot. */
+
+void
+snapshot_put (Snapshot *ss, const void *data, int len)
+{
+    if (ss->map)
+        avr_error ("snapshot is read only");
+
+    if (ss->len + len > ss->size)
+    {
+        ss->size = (ss->len + len) * 2;
+        ss->data = avr_realloc (ss->data, ss->size);
+    }
+
+    memcpy (ss->data + ss->len, data, len);
+    ss->len += len;
+}
+
+void
+snapshot_put_u8 (Snapshot *ss, uint8_t val)
+{
+    snapshot_put (ss, &val, 1);
+}
+
+void
+snapshot_put_u16 (Snapshot *ss, uint16_t val)
+{
+    uint8_t b[2] = { val, val >> 8 };
+
+    snapshot_put (ss, b, 2);
+}
+
+void
+snapshot_put_u32 (Snapshot *ss, uint32_t val)
+{
+    snapshot_put_u16 (ss, val);
+    snapshot_put_u16 (ss, val >> 16);
+}
+
+void
+snapshot_put_u64 (Snapshot *ss, uint64_t val)
+{
+    snapshot_put_u32 (ss, val);
+    snapshot_put_u32 (ss, val >> 32);
+}
+
+/** \brief Overwrite a value written before (e.g. a length field). */
+
+void
+snapshot_patch_u32 (Snapshot *ss, int offset, uint32_t val)
+{
+    int i;
+
+    if ((offset < 0) || (offset + 4 > ss->len))
+        avr_error ("bad offset: %d", offset);
+
+    for (i = 0; i < 4; i++)
+        ss->data[offset + i] = val >> (8 * i);
+}
+
+/** \brief Read \a len bytes from the snapshot. */
+
+void
+snapshot_get (Snapshot *ss, void *data, int len)
+{
+    if ((len < 0) || (ss->pos + len > ss->len))
+    {
+        ss->error = 1;
+        if (len > 0)
+            memset (data, 0, len);
+        return;
+    }
+
+    memcpy (data, ss->data + ss->pos, len);
+    ss->pos += len;
+}
+
+uint8_t
+snapshot_get_u8 (Snapshot *ss)
+{
+    uint8_t val;
+
+    snapshot_get (ss, &val, 1);
+    return val;
+}
+
+uint16_t
+snapshot_get_u16 (Snapshot *ss)
+{
+    uint8_t b[2];
+
+    snapshot_get (ss, b, 2);
+    return b[0] | (b[1] << 8);
+}
+
+uint32_t
+snapshot_get_u32 (Snapshot *ss)
+{
+    uint32_t lo = snapshot_get_u16 (ss);
+
+    return lo | ((uint32_t) snapshot_get_u16 (ss) << 16);
+}
+
+uint64_t
+snapshot_get_u64 (Snapshot *ss)
+{
+    uint64_t lo = snapshot_get_u32 (ss);
+
+    return lo | ((uint64_t) snapshot_get_u32 (ss) << 32);
+}
@@ -0,0 +1,76 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+#ifndef SIM_SNAPSHOT_H
+#define SIM_SNAPSHOT_H
+
+/****************************************************************************\
+ *
+ * Snapshot(AvrClass) Definition
+ *
+\****************************************************************************/
+
+enum _snapshot_constants
+{
+    SNAPSHOT_VERSION = 2,       /* bump on any change of the layout */
+};
+
+typedef struct _Snapshot Snapshot;
+
+struct _Snapshot
+{
+    AvrClass parent;
+    uint8_t *data;              /* the serialized machine state */
+    int len;                    /* bytes used in data */
+    int size;                   /* bytes allocated (0: data is mapped) */
+    int pos;                    /* read position */
+    int error;                  /* set by a short or bad read */
+    int skip_storage;           /* checkpoint: sram, eeprom and flash
+                                   contents are not stored */
+    void *map;                  /* mapping of a state file (or NULL) */
+    size_t map_len;
+};
+
+extern Snapshot *snapshot_new (void);
+extern void snapshot_construct (Snapshot *ss);
+extern void snapshot_destroy (void *ss);
+
+extern Snapshot *snapshot_read_file (char *file);
+extern int snapshot_write_file (Snapshot *ss, char *file);
+
+extern void snapshot_put (Snapshot *ss, const void *data, int len);
+extern void snapshot_put_u8 (Snapshot *ss, uint8_t val);
+extern void snapshot_put_u16 (Snapshot *ss, uint16_t val);
+extern void snapshot_put_u32 (Snapshot *ss, uint32_t val);
+extern void snapshot_put_u64 (Snapshot *ss, uint64_t val);
+extern void snapshot_patch_u32 (Snapshot *ss, int offset, uint32_t val);
+
+extern void snapshot_get (Snapshot *ss, void *data, int len);
+extern uint8_t snapshot_get_u8 (Snapshot *ss);
+extern uint16_t snapshot_get_u16 (Snapshot *ss);
+extern uint32_t snapshot_get_u32 (Snapshot *ss);
+extern uint64_t snapshot_get_u64 (Snapshot *ss);
+
+#endif /* SIM_SNAPSHOT_H */
@@ -70,6 +70,8 @@ static void spii_add_addr (VDevice *vdev, int addr, char *name, int rel_addr,
 static uint8_t spi_intr_read (VDevice *dev, int addr);
 static void spi_intr_write (VDevice *dev, int addr, uint8_t val);
 static void spi_intr_reset (VDevice *dev);
+static void spi_intr_save (VDevice *dev, Snapshot *ss);
+static void spi_intr_load (VDevice *dev, Snapshot *ss);
 static int spi_intr_cb (uint64_t time, AvrClass *data);
 
 /** \brief Allocate a new SPI interrupt */
@@ -102,6 +104,7 @@ spi_intr_construct (SPIIntr_T *spi, int addr, char *name)
 
     vdev_construct ((VDevice *)spi, spi_intr_read, spi_intr_write,
                     spi_intr_reset, spii_add_addr);
+    vdev_set_state_fp ((VDevice *)spi, spi_intr_save, spi_intr_load);
 
     spii_add_addr ((VDevice *)spi, addr, name, 0, NULL);
     spi_intr_reset ((VDevice *)spi);
@@ -207,6 +210,35 @@ spi_intr_reset (VDevice *dev)
     spi->spsr_read = 0;
 }
 
+static void
+spi_intr_save (VDevice *dev, Snapshot *ss)
+{
+    SPIIntr_T *spi = (SPIIntr_T *)dev;
+
+    snapshot_put_u8 (ss, spi->spcr);
+    snapshot_put_u8 (ss, spi->spsr);
+    snapshot_put_u8 (ss, spi->spsr_read);
+    snapshot_put_u8 (ss, spi->intr_cb != NULL);
+}
+
+static void
+spi_intr_load (VDevice *dev, Snapshot *ss)
+{
+    SPIIntr_T *spi = (SPIIntr_T *)dev;
+    CallBack *cb;
+
+    spi->spcr = snapshot_get_u8 (ss);
+    spi->spsr = snapshot_get_u8 (ss);
+    spi->spsr_read = snapshot_get_u8 (ss);
+
+    if (snapshot_get_u8 (ss))
+    {
+        cb = callback_new (spi_intr_cb, (AvrClass *)spi);
+        spi->intr_cb = cb;
+        avr_core_async_cb_add ((AvrCore *)vdev_get_core (dev), cb);
+    }
+}
+
 static int
 spi_intr_cb (uint64_t time, AvrClass *data)
 {
@@ -239,6 +271,8 @@ static void spi_add_addr (VDevice *vdev, int addr, char *name, int rel_addr,
 static uint8_t spi_read (VDevice *dev, int addr);
 static void spi_write (VDevice *dev, int addr, uint8_t val);
 static void spi_reset (VDevice *dev);
+static void spi_save (VDevice *dev, Snapshot *ss);
+static void spi_load (VDevice *dev, Snapshot *ss);
 static int spi_clk_incr_cb (uint64_t ck, AvrClass *data);
 
 /** \brief Allocate a new SPI structure. */
@@ -271,6 +305,7 @@ spi_construct (SPI_T *spi, int addr, char *name, int rel_addr)
 
     vdev_construct ((VDevice *)spi, spi_read, spi_write, spi_reset,
                     spi_add_addr);
+    vdev_set_state_fp ((VDevice *)spi, spi_save, spi_load);
 
     spi_add_addr ((VDevice *)spi, addr, name, 0, NULL);
     if (rel_addr)
@@ -417,6 +452,37 @@ spi_reset (VDevice *dev)
     spi->divisor = 0;
 }
 
+static void
+spi_save (VDevice *dev, Snapshot *ss)
+{
+    SPI_T *spi = (SPI_T *)dev;
+
+    snapshot_put_u8 (ss, spi->spdr);
+    snapshot_put_u8 (ss, spi->spdr_in);
+    snapshot_put_u8 (ss, spi->tcnt);
+    snapshot_put_u8 (ss, spi->divisor);
+    snapshot_put_u8 (ss, spi->clk_cb != NULL);
+}
+
+static void
+spi_load (VDevice *dev, Snapshot *ss)
+{
+    SPI_T *spi = (SPI_T *)dev;
+    CallBack *cb;
+
+    spi->spdr = snapshot_get_u8 (ss);
+    spi->spdr_in = snapshot_get_u8 (ss);
+    spi->tcnt = snapshot_get_u8 (ss);
+    spi->divisor = snapshot_get_u8 (ss);
+
+    if (snapshot_get_u8 (ss))
+    {
+        cb = callback_new (spi_clk_incr_cb, (AvrClass *)spi);
+        spi->clk_cb = cb;
+        avr_core_clk_cb_add ((AvrCore *)vdev_get_core (dev), cb);
+    }
+}
+
 static int
 spi_clk_incr_cb (uint64_t ck, AvrClass *data)
 {
@@ -58,6 +58,8 @@ static void spm_destroy (void *sp);
 static uint8_t spm_read (VDevice * dev, int addr);
 static void spm_write (VDevice * dev, int addr, uint8_t val);
 static void spm_reset (VDevice * dev);
+static void spm_save (VDevice * dev, Snapshot * ss);
+static void spm_load (VDevice * dev, Snapshot * ss);
 static void spm_add_addr (VDevice * vdev, int addr, char *name, int rel_addr,
 			  void *data);
 
@@ -87,6 +89,7 @@ spm_construct (SPMdata * spm, int addr, char *name)
 
   vdev_construct ((VDevice *) spm, spm_read, spm_write, spm_reset,
 		  spm_add_addr);
+  vdev_set_state_fp ((VDevice *) spm, spm_save, spm_load);
 
   spm_add_addr ((VDevice *) spm, addr, name, 0, NULL);
 
@@ -153,6 +156,25 @@ spm_reset (VDevice * dev)
 //  core->spmhelper->SPMCSR = 0;
 }
 
+/* The state lives in the core's SPM helper, the page buffer included. */
+static void
+spm_save (VDevice * dev, Snapshot * ss)
+{
+  AvrCore *core = (AvrCore *) vdev_get_core ((VDevice *) dev);
+
+  snapshot_put_u8 (ss, core->spmhelper->SPMCSR);
+  snapshot_put (ss, core->spmhelper->page_buffer, 256);
+}
+
+static void
+spm_load (VDevice * dev, Snapshot * ss)
+{
+  AvrCore *core = (AvrCore *) vdev_get_core ((VDevice *) dev);
+
+  core->spmhelper->SPMCSR = snapshot_get_u8 (ss);
+  snapshot_get (ss, core->spmhelper->page_buffer, 256);
+}
+
 static void
 spm_add_addr (VDevice * vdev, int addr, char *name, int rel_addr, void *data)
 {
@@ -201,6 +223,7 @@ spm_run (SPMhelper * spmhelper, int reg0, int reg1, int Z)
       for (i = 0; i < 128; i++)
 	flash_write (spmhelper->flash, Z + i, 0xffff);
 
+      spmhelper->flash->modified = 1;
       spmhelper->SPMCSR = 0;
       return;
     }
@@ -223,6 +246,7 @@ spm_run (SPMhelper * spmhelper, int reg0, int reg1, int Z)
 	  
 	  flash_write (spmhelper->flash, Z + i, hi << 8 | lo);
 	}
+      spmhelper->flash->modified = 1;
       spmhelper->SPMCSR = 0;
       return;
     }
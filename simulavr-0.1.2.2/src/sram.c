@@ -54,6 +54,8 @@
 static uint8_t sram_read (VDevice *dev, int addr);
 static void sram_write (VDevice *dev, int addr, uint8_t val);
 static void sram_reset (VDevice *dev);
+static void sram_save (VDevice *dev, Snapshot *ss);
+static void sram_load (VDevice *dev, Snapshot *ss);
 
 SRAM *
 sram_new (int base, int size)
@@ -76,6 +78,7 @@ sram_construct (SRAM *sram, int base, int size)
     sram->stor = storage_new (base, size);
     vdev_construct ((VDevice *)sram, sram_read, sram_write, sram_reset,
                     vdev_def_AddAddr);
+    vdev_set_state_fp ((VDevice *)sram, sram_save, sram_load);
 }
 
 void
@@ -103,6 +106,30 @@ sram_get_base (SRAM *sram)
     return storage_get_base (sram->stor);
 }
 
+/** \brief Read len bytes at addr with one copy, bypassing the memory bus. */
+
+void
+sram_read_block (SRAM *sram, int addr, uint8_t *buf, int len)
+{
+    storage_read_block (sram->stor, addr, buf, len);
+}
+
+/** \brief Write len bytes at addr with one copy, bypassing the memory bus.
+    The bytes are reported to the display. */
+
+void
+sram_write_block (SRAM *sram, int addr, const uint8_t *buf, int len)
+{
+    int i;
+
+    storage_write_block (sram->stor, addr, buf, len);
+
+    /* a display message holds up to 1K of text */
+    for (i = 0; i < len; i += 256)
+        display_sram (vdev_get_display ((VDevice *)sram), addr + i,
+                      len - i < 256 ? len - i : 256, (uint8_t *)buf + i);
+}
+
 static uint8_t
 sram_read (VDevice *dev, int addr)
 {
@@ -116,7 +143,7 @@ sram_write (VDevice *dev, int addr, uint8_t val)
 {
     SRAM *sram = (SRAM *)dev;
 
-    display_sram (addr, 1, &val);
+    display_sram (vdev_get_display (dev), addr, 1, &val);
 
     storage_writeb (sram->stor, addr, val);
 }
@@ -126,3 +153,15 @@ sram_reset (VDevice *dev)
 {
     return;                     /* FIXME: should the array be cleared? */
 }
+
+static void
+sram_save (VDevice *dev, Snapshot *ss)
+{
+    storage_save (((SRAM *)dev)->stor, ss);
+}
+
+static void
+sram_load (VDevice *dev, Snapshot *ss)
+{
+    storage_load (((SRAM *)dev)->stor, ss);
+}
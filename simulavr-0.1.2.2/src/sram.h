@@ -53,4 +53,8 @@ extern void sram_destroy (void *sram);
 extern int sram_get_size (SRAM *sram);
 extern int sram_get_base (SRAM *sram);
 
+extern void sram_read_block (SRAM *sram, int addr, uint8_t *buf, int len);
+extern void sram_write_block (SRAM *sram, int addr, const uint8_t *buf,
+                              int len);
+
 #endif /* SIM_SRAM_H */
@@ -63,9 +63,12 @@
 
 static uint32_t hw_pop (Stack *stack, int bytes);
 static void hw_push (Stack *stack, int bytes, uint32_t val);
+static void hw_save (Stack *stack, Snapshot *ss);
+static void hw_load (Stack *stack, Snapshot *ss);
 
 static uint32_t mem_pop (Stack *stack, int bytes);
 static void mem_push (Stack *stack, int bytes, uint32_t val);
+static int mem_pointer (Stack *stack);
 
 /****************************************************************************\
  *
@@ -105,6 +108,9 @@ stack_construct (Stack *stack, StackFP_Pop pop, StackFP_Push push)
 
     stack->pop = pop;
     stack->push = push;
+    stack->save = NULL;
+    stack->load = NULL;
+    stack->pointer = NULL;
 }
 
 /** \brief Destructor for the Stack class.
@@ -148,6 +154,38 @@ stack_push (Stack *stack, int bytes, uint32_t val)
     stack->push (stack, bytes, val);
 }
 
+/** \brief Append the contents of the stack to a snapshot.
+
+    A stack living in the data space is saved with the memory, only a
+    hardware stack has state of its own. */
+
+void
+stack_save (Stack *stack, Snapshot *ss)
+{
+    if (stack->save)
+        stack->save (stack, ss);
+}
+
+/** \brief Restore the contents of the stack saved by stack_save(). */
+
+void
+stack_load (Stack *stack, Snapshot *ss)
+{
+    if (stack->load)
+        stack->load (stack, ss);
+}
+
+/** \brief Returns the stack pointer, or -1 for a stack without one (the
+    hardware stack). */
+
+int
+stack_pointer (Stack *stack)
+{
+    if (stack->pointer)
+        return stack->pointer (stack);
+    return -1;
+}
+
 /****************************************************************************\
  *
  * HWStack(Stack) Definition.
@@ -180,6 +218,8 @@ hwstack_construct (HWStack *stack, int depth)
         avr_error ("passed null ptr");
 
     stack_construct ((Stack *)stack, hw_pop, hw_push);
+    ((Stack *)stack)->save = hw_save;
+    ((Stack *)stack)->load = hw_load;
 
     stack->depth = depth;
     stack->stack = avr_new0 (uint32_t, depth);
@@ -230,6 +270,35 @@ hw_push (Stack *stack, int bytes, uint32_t val)
     hwst->stack[0] = val;
 }
 
+/* The HWStack snapshot methods. */
+
+static void
+hw_save (Stack *stack, Snapshot *ss)
+{
+    HWStack *hwst = (HWStack *)stack;
+    int i;
+
+    snapshot_put_u32 (ss, hwst->depth);
+    for (i = 0; i < hwst->depth; i++)
+        snapshot_put_u32 (ss, hwst->stack[i]);
+}
+
+static void
+hw_load (Stack *stack, Snapshot *ss)
+{
+    HWStack *hwst = (HWStack *)stack;
+    int i;
+
+    if (snapshot_get_u32 (ss) != (uint32_t) hwst->depth)
+    {
+        ss->error = 1;
+        return;
+    }
+
+    for (i = 0; i < hwst->depth; i++)
+        hwst->stack[i] = snapshot_get_u32 (ss);
+}
+
 /****************************************************************************\
  *
  * StackPointer(VDevice) Definition.
@@ -259,6 +328,8 @@ static void sp_destroy (void *sp);
 static uint8_t sp_read (VDevice *dev, int addr);
 static void sp_write (VDevice *dev, int addr, uint8_t val);
 static void sp_reset (VDevice *dev);
+static void sp_save (VDevice *dev, Snapshot *ss);
+static void sp_load (VDevice *dev, Snapshot *ss);
 static uint16_t sp_get (VDevice *sp);
 static void sp_set (VDevice *sp, uint16_t val);
 static void sp_add_addr (VDevice *vdev, int addr, char *name, int rel_addr,
@@ -293,6 +364,7 @@ sp_construct (StackPointer *sp, int addr, char *name)
         avr_error ("passed null ptr");
 
     vdev_construct ((VDevice *)sp, sp_read, sp_write, sp_reset, sp_add_addr);
+    vdev_set_state_fp ((VDevice *)sp, sp_save, sp_load);
 
     sp_add_addr ((VDevice *)sp, addr, name, 0, NULL);
 
@@ -344,8 +416,20 @@ sp_reset (VDevice *dev)
 {
     StackPointer *sp = (StackPointer *)dev;
 
-    display_io_reg (SPL_IO_REG, sp->SPL = 0);
-    display_io_reg (SPH_IO_REG, sp->SPH = 0);
+    display_io_reg (vdev_get_display (dev), SPL_IO_REG, sp->SPL = 0);
+    display_io_reg (vdev_get_display (dev), SPH_IO_REG, sp->SPH = 0);
+}
+
+static void
+sp_save (VDevice *dev, Snapshot *ss)
+{
+    snapshot_put_u16 (ss, sp_get (dev));
+}
+
+static void
+sp_load (VDevice *dev, Snapshot *ss)
+{
+    sp_set (dev, snapshot_get_u16 (ss));
 }
 
 static uint16_t
@@ -357,8 +441,10 @@ sp_get (VDevice *sp)
 static void
 sp_set (VDevice *sp, uint16_t val)
 {
-    display_io_reg (SPL_IO_REG, ((StackPointer *)sp)->SPL = val & 0xff);
-    display_io_reg (SPH_IO_REG, ((StackPointer *)sp)->SPH = val >> 8);
+    display_io_reg (vdev_get_display (sp), SPL_IO_REG,
+                    ((StackPointer *)sp)->SPL = val & 0xff);
+    display_io_reg (vdev_get_display (sp), SPH_IO_REG,
+                    ((StackPointer *)sp)->SPH = val >> 8);
 }
 
 static void
@@ -405,6 +491,7 @@ memstack_construct (MemStack *stack, Memory *mem, int spl_addr)
         avr_error ("passed null ptr");
 
     stack_construct ((Stack *)stack, mem_pop, mem_push);
+    ((Stack *)stack)->pointer = mem_pointer;
 
     class_ref ((AvrClass *)mem);
     stack->mem = mem;
@@ -478,3 +565,11 @@ mem_push (Stack *stack, int bytes, uint32_t val)
 
     sp_set (mst->SP, sp);
 }
+
+/* The MemStack pointer method. */
+
+static int
+mem_pointer (Stack *stack)
+{
+    return sp_get (((MemStack *)stack)->SP);
+}
@@ -39,6 +39,9 @@ typedef struct _Stack Stack;
 
 typedef uint32_t (*StackFP_Pop) (Stack *stack, int bytes);
 typedef void (*StackFP_Push) (Stack *stack, int bytes, uint32_t val);
+typedef void (*StackFP_Save) (Stack *stack, Snapshot *ss);
+typedef void (*StackFP_Load) (Stack *stack, Snapshot *ss);
+typedef int (*StackFP_Pointer) (Stack *stack);
 
 typedef enum
 {
@@ -51,6 +54,9 @@ struct _Stack
     AvrClass parent;
     StackFP_Pop pop;
     StackFP_Push push;
+    StackFP_Save save;          /* NULL if the stack lives in memory */
+    StackFP_Load load;
+    StackFP_Pointer pointer;    /* NULL if there is no stack pointer */
 };
 
 extern Stack *stack_new (StackFP_Pop pop, StackFP_Push push);
@@ -60,6 +66,9 @@ extern void stack_destroy (void *stack);
 
 extern uint32_t stack_pop (Stack *stack, int bytes);
 extern void stack_push (Stack *stack, int bytes, uint32_t val);
+extern void stack_save (Stack *stack, Snapshot *ss);
+extern void stack_load (Stack *stack, Snapshot *ss);
+extern int stack_pointer (Stack *stack);
 
 /****************************************************************************\
  *
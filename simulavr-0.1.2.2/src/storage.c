@@ -27,10 +27,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "avrerror.h"
 #include "avrmalloc.h"
 #include "avrclass.h"
+#include "snapshot.h"
 #include "storage.h"
 
 /***************************************************************************\
@@ -39,6 +47,21 @@
  *
 \***************************************************************************/
 
+#ifndef DOXYGEN                 /* don't expose to doxygen */
+
+/* One checkpoint: the pages written since it was taken, as they were at that
+   time. */
+
+struct _StorageLevel
+{
+    uint8_t **undo;             /* per page: saved copy or NULL */
+    StorageLevel *prev;         /* enclosing checkpoint */
+};
+
+#endif /* DOXYGEN */
+
+static void storage_free_levels (Storage *stor);
+
 Storage *
 storage_new (int base, int size)
 {
@@ -63,6 +86,9 @@ storage_construct (Storage *stor, int base, int size)
     stor->size = size;          /* bytes   */
 
     stor->data = avr_new0 (uint8_t, size);
+    stor->cow = NULL;
+    stor->fd = -1;
+    stor->journal = -1;
 }
 
 /*
@@ -72,10 +98,22 @@ storage_construct (Storage *stor, int base, int size)
 void
 storage_destroy (void *stor)
 {
+    Storage *_stor = (Storage *)stor;
+
     if (stor == NULL)
         return;
 
-    avr_free (((Storage *)stor)->data);
+    storage_free_levels (_stor);
+    if (_stor->fd >= 0)
+    {
+        storage_sync (_stor);
+        munmap (_stor->data, _stor->size);
+        close (_stor->fd);
+        if (_stor->journal >= 0)
+            close (_stor->journal);
+    }
+    else
+        avr_free (_stor->data);
     class_destroy (stor);
 }
 
@@ -85,6 +123,204 @@ storage_readb (Storage *stor, int addr);
 extern inline uint16_t
 storage_readw (Storage *stor, int addr);
 
+static int
+storage_num_pages (Storage *stor)
+{
+    return (stor->size + (1 << STORAGE_PAGE_SHIFT) - 1) >> STORAGE_PAGE_SHIFT;
+}
+
+/* Save the page holding offset _addr before it is written for the first
+   time since the innermost checkpoint. */
+
+static void
+storage_cow (Storage *stor, int _addr)
+{
+    int page = _addr >> STORAGE_PAGE_SHIFT;
+    int start = page << STORAGE_PAGE_SHIFT;
+    int len = 1 << STORAGE_PAGE_SHIFT;
+
+    if (stor->cow->undo[page])
+        return;
+
+    if (start + len > stor->size)
+        len = stor->size - start;
+
+    stor->cow->undo[page] = avr_new (uint8_t, len);
+    memcpy (stor->cow->undo[page], stor->data + start, len);
+}
+
+/* Journal records: 32 bit offset (little endian) and the new value. */
+
+enum
+{
+    STORAGE_JOURNAL_REC = 5,
+};
+
+/* Append one write to the journal. The journal is opened with O_DSYNC, the
+   record is on the disk before the byte reaches the mapping. */
+
+static void
+storage_journal (Storage *stor, int _addr, uint8_t val)
+{
+    uint8_t rec[STORAGE_JOURNAL_REC];
+
+    rec[0] = _addr & 0xff;
+    rec[1] = (_addr >> 8) & 0xff;
+    rec[2] = (_addr >> 16) & 0xff;
+    rec[3] = (_addr >> 24) & 0xff;
+    rec[4] = val;
+
+    while (write (stor->journal, rec, sizeof (rec)) < 0)
+    {
+        if (errno != EINTR)
+            avr_error ("journal write failed: %s", strerror (errno));
+    }
+}
+
+/* Apply the complete records of a journal left behind by a crash. A torn
+   last record is ignored, that write never reached the mapping. */
+
+static void
+storage_journal_replay (Storage *stor)
+{
+    uint8_t rec[STORAGE_JOURNAL_REC];
+    uint32_t off;
+    int n = 0;
+
+    if (lseek (stor->journal, 0, SEEK_SET) < 0)
+        return;
+
+    while (read (stor->journal, rec, sizeof (rec)) == sizeof (rec))
+    {
+        off = rec[0] | (rec[1] << 8) | (rec[2] << 16)
+            | ((uint32_t) rec[3] << 24);
+        if (off < (uint32_t) stor->size)
+            stor->data[off] = rec[4];
+        n++;
+    }
+
+    if (n)
+        avr_message ("journal: replayed %d writes\n", n);
+}
+
+/**
+ * \brief Back the storage with a file mapped shared into memory.
+ *
+ * The file is created if needed; a new or short file is extended to the
+ * storage size and the new part filled with \a fill. The current contents
+ * are dropped, from then on every write to the storage is a write to the
+ * file. The kernel writes the pages back on its own, storage_sync() (and
+ * storage_destroy()) forces it.
+ *
+ * With a \a journal file each write is also appended to the journal before
+ * it reaches the mapping, and storage_sync() empties it again. Records found
+ * in the journal here are replayed, so writes survive a host crash too.
+ *
+ * Returns 0 or -1 on error (with a warning), also while a checkpoint is
+ * active.
+ */
+int
+storage_map_file (Storage *stor, const char *file, const char *journal,
+                  uint8_t fill)
+{
+    struct stat st;
+    uint8_t *map;
+    int fd, jfd = -1;
+
+    if (stor->cow || (stor->fd >= 0))
+    {
+        avr_warning ("%s: storage already mapped or checkpointed\n", file);
+        return -1;
+    }
+
+    fd = open (file, O_RDWR | O_CREAT, 0644);
+    if ((fd < 0) || (fstat (fd, &st) < 0))
+    {
+        avr_warning ("%s: %s\n", file, strerror (errno));
+        goto fail;
+    }
+
+    if (st.st_size < stor->size)
+    {
+        uint8_t *pad = avr_new (uint8_t, stor->size - st.st_size);
+        ssize_t res;
+
+        memset (pad, fill, stor->size - st.st_size);
+        res = pwrite (fd, pad, stor->size - st.st_size, st.st_size);
+        avr_free (pad);
+        if (res != stor->size - st.st_size)
+        {
+            avr_warning ("%s: %s\n", file,
+                         res < 0 ? strerror (errno) : "short write");
+            goto fail;
+        }
+    }
+
+    if (journal)
+    {
+        jfd = open (journal, O_RDWR | O_CREAT | O_APPEND | O_DSYNC, 0644);
+        if (jfd < 0)
+        {
+            avr_warning ("%s: %s\n", journal, strerror (errno));
+            goto fail;
+        }
+    }
+
+    map = mmap (NULL, stor->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        avr_warning ("%s: mmap: %s\n", file, strerror (errno));
+        goto fail;
+    }
+
+    avr_free (stor->data);
+    stor->data = map;
+    stor->fd = fd;
+    stor->journal = jfd;
+
+    if (jfd >= 0)
+    {
+        storage_journal_replay (stor);
+        storage_sync (stor);
+    }
+
+    return 0;
+
+  fail:
+    if (fd >= 0)
+        close (fd);
+    if (jfd >= 0)
+        close (jfd);
+    return -1;
+}
+
+/**
+ * \brief Write the contents back to the backing file.
+ *
+ * Empties the journal once the file is on the disk. Returns 0, or -1 on
+ * error; a storage without a backing file has nothing to do.
+ */
+int
+storage_sync (Storage *stor)
+{
+    if (stor->fd < 0)
+        return 0;
+
+    if (msync (stor->data, stor->size, MS_SYNC) < 0)
+    {
+        avr_warning ("msync: %s\n", strerror (errno));
+        return -1;
+    }
+
+    if ((stor->journal >= 0) && (ftruncate (stor->journal, 0) < 0))
+    {
+        avr_warning ("journal: %s\n", strerror (errno));
+        return -1;
+    }
+
+    return 0;
+}
+
 void
 storage_writeb (Storage *stor, int addr, uint8_t val)
 {
@@ -96,6 +332,11 @@ storage_writeb (Storage *stor, int addr, uint8_t val)
     if ((_addr < 0) || (_addr >= stor->size))
         avr_error ("address out of bounds: 0x%x", addr);
 
+    if (stor->cow)
+        storage_cow (stor, _addr);
+    if (stor->journal >= 0)
+        storage_journal (stor, _addr, val);
+
     stor->data[_addr] = val;
 }
 
@@ -110,10 +351,79 @@ storage_writew (Storage *stor, int addr, uint16_t val)
     if ((_addr < 0) || (_addr >= stor->size))
         avr_error ("address out of bounds: 0x%x", addr);
 
+    if (stor->cow)
+    {
+        storage_cow (stor, _addr);
+        storage_cow (stor, _addr + 1);
+    }
+    if (stor->journal >= 0)
+    {
+        storage_journal (stor, _addr, val >> 8);
+        storage_journal (stor, _addr + 1, val);
+    }
+
     stor->data[_addr] = (uint8_t) (val >> 8 & 0xff);
     stor->data[_addr + 1] = (uint8_t) (val & 0xff);
 }
 
+/** \brief Read len bytes at addr with one copy. */
+
+void
+storage_read_block (Storage *stor, int addr, uint8_t *buf, int len)
+{
+    int _addr = addr - stor->base;
+
+    if (stor == NULL)
+        avr_error ("passed null ptr");
+
+    if ((_addr < 0) || (len < 0) || (len > stor->size - _addr))
+        avr_error ("address out of bounds: 0x%x", addr);
+
+    memcpy (buf, stor->data + _addr, len);
+}
+
+/** \brief Write len bytes at addr with one copy (bulk loading). */
+
+void
+storage_write_block (Storage *stor, int addr, const uint8_t *buf, int len)
+{
+    int _addr = addr - stor->base;
+    int i;
+
+    if (stor == NULL)
+        avr_error ("passed null ptr");
+
+    if ((_addr < 0) || (len < 0) || (len > stor->size - _addr))
+        avr_error ("address out of bounds: 0x%x", addr);
+
+    if (stor->cow)
+        for (i = _addr & ~((1 << STORAGE_PAGE_SHIFT) - 1); i < _addr + len;
+             i += 1 << STORAGE_PAGE_SHIFT)
+            storage_cow (stor, i);
+    if (stor->journal >= 0)
+        for (i = 0; i < len; i++)
+            storage_journal (stor, _addr + i, buf[i]);
+
+    memcpy (stor->data + _addr, buf, len);
+}
+
+/** \brief Set every byte of the storage to val. */
+
+void
+storage_fill (Storage *stor, uint8_t val)
+{
+    int i;
+
+    if (stor->cow)
+        for (i = 0; i < stor->size; i += 1 << STORAGE_PAGE_SHIFT)
+            storage_cow (stor, i);
+    if (stor->journal >= 0)
+        for (i = 0; i < stor->size; i++)
+            storage_journal (stor, i, val);
+
+    memset (stor->data, val, stor->size);
+}
+
 int
 storage_get_size (Storage *stor)
 {
@@ -125,3 +435,171 @@ storage_get_base (Storage *stor)
 {
     return stor->base;
 }
+
+/** \brief Append the contents of the storage to a snapshot (raw).
+
+    Only the size is stored in a checkpoint snapshot, the contents are
+    tracked by storage_checkpoint(). */
+
+void
+storage_save (Storage *stor, Snapshot *ss)
+{
+    snapshot_put_u32 (ss, stor->size);
+    if (!ss->skip_storage)
+        snapshot_put (ss, stor->data, stor->size);
+}
+
+/** \brief Restore the contents saved by storage_save().
+
+    Sets the snapshot error flag if the size does not match. */
+
+void
+storage_load (Storage *stor, Snapshot *ss)
+{
+    if (snapshot_get_u32 (ss) != (uint32_t) stor->size)
+    {
+        ss->error = 1;
+        return;
+    }
+
+    if (ss->skip_storage)
+        return;
+
+    /* keep the checkpoints valid */
+    if (stor->cow)
+    {
+        int i;
+
+        for (i = 0; i < stor->size; i += 1 << STORAGE_PAGE_SHIFT)
+            storage_cow (stor, i);
+    }
+
+    snapshot_get (ss, stor->data, stor->size);
+
+    /* the journal does not see this, make the file current instead */
+    if (stor->journal >= 0)
+        storage_sync (stor);
+}
+
+/**
+ * \brief Take a checkpoint of the contents.
+ *
+ * Nothing is copied now. The first write to a page after the checkpoint
+ * saves the page, so the cost is proportional to the pages written, not to
+ * the size. Checkpoints nest.
+ */
+void
+storage_checkpoint (Storage *stor)
+{
+    StorageLevel *level = avr_new (StorageLevel, 1);
+
+    level->undo = avr_new0 (uint8_t *, storage_num_pages (stor));
+    level->prev = stor->cow;
+    stor->cow = level;
+}
+
+/**
+ * \brief Restore the contents at the innermost checkpoint.
+ *
+ * The checkpoint stays in place. Returns -1 if there is no checkpoint.
+ */
+int
+storage_rollback (Storage *stor)
+{
+    StorageLevel *level = stor->cow;
+    int i, start, len;
+
+    if (level == NULL)
+        return -1;
+
+    for (i = 0; i < storage_num_pages (stor); i++)
+    {
+        if (level->undo[i] == NULL)
+            continue;
+
+        start = i << STORAGE_PAGE_SHIFT;
+        len = 1 << STORAGE_PAGE_SHIFT;
+        if (start + len > stor->size)
+            len = stor->size - start;
+
+        memcpy (stor->data + start, level->undo[i], len);
+        avr_free (level->undo[i]);
+        level->undo[i] = NULL;
+    }
+
+    if (stor->journal >= 0)
+        storage_sync (stor);
+
+    return 0;
+}
+
+/**
+ * \brief Drop the innermost checkpoint, keep the current contents.
+ *
+ * Pages it saved are handed to the enclosing checkpoint unless that has
+ * an older copy. Returns -1 if there is no checkpoint.
+ */
+int
+storage_release (Storage *stor)
+{
+    StorageLevel *level = stor->cow;
+    StorageLevel *prev;
+    int i;
+
+    if (level == NULL)
+        return -1;
+
+    prev = level->prev;
+    for (i = 0; i < storage_num_pages (stor); i++)
+    {
+        if (level->undo[i] == NULL)
+            continue;
+
+        if (prev && (prev->undo[i] == NULL))
+            prev->undo[i] = level->undo[i];
+        else
+            avr_free (level->undo[i]);
+    }
+
+    avr_free (level->undo);
+    avr_free (level);
+    stor->cow = prev;
+
+    return 0;
+}
+
+/**
+ * \brief Drop the outermost checkpoint.
+ *
+ * The contents can no longer be rolled back that far, the checkpoints
+ * inside it are not affected. Returns -1 if there is no checkpoint.
+ */
+int
+storage_release_outer (Storage *stor)
+{
+    StorageLevel **link = &stor->cow;
+    StorageLevel *level;
+    int i;
+
+    if (*link == NULL)
+        return -1;
+
+    while ((*link)->prev)
+        link = &(*link)->prev;
+    level = *link;
+
+    for (i = 0; i < storage_num_pages (stor); i++)
+        avr_free (level->undo[i]);
+    avr_free (level->undo);
+    avr_free (level);
+    *link = NULL;
+
+    return 0;
+}
+
+static void
+storage_free_levels (Storage *stor)
+{
+    while (stor->cow)
+        storage_release (stor);
+}
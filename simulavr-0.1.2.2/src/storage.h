@@ -26,13 +26,21 @@
 #ifndef SIM_STORAGE_H
 #define SIM_STORAGE_H
 
+#include "snapshot.h"
+
 /***************************************************************************\
  *
  * Storage(AvrClass) Object
  *
 \***************************************************************************/
 
+enum _storage_constants
+{
+    STORAGE_PAGE_SHIFT = 8,     /* checkpoints copy 256 byte pages */
+};
+
 typedef struct _Storage Storage;
+typedef struct _StorageLevel StorageLevel;
 
 struct _Storage
 {
@@ -40,6 +48,9 @@ struct _Storage
     int base;                   /* address */
     int size;                   /* bytes */
     uint8_t *data;
+    StorageLevel *cow;          /* innermost checkpoint or NULL */
+    int fd;                     /* mapped backing file or -1 */
+    int journal;                /* write journal or -1 */
 };
 
 extern Storage *storage_new (int base, int size);
@@ -80,8 +91,25 @@ storage_readw (Storage *stor, int addr)
 
 extern void storage_writeb (Storage *stor, int addr, uint8_t val);
 extern void storage_writew (Storage *stor, int addr, uint16_t val);
+extern void storage_read_block (Storage *stor, int addr, uint8_t *buf,
+                                int len);
+extern void storage_write_block (Storage *stor, int addr, const uint8_t *buf,
+                                 int len);
+extern void storage_fill (Storage *stor, uint8_t val);
+
+extern int storage_map_file (Storage *stor, const char *file,
+                              const char *journal, uint8_t fill);
+extern int storage_sync (Storage *stor);
 
 extern int storage_get_size (Storage *stor);
 extern int storage_get_base (Storage *stor);
 
+extern void storage_save (Storage *stor, Snapshot *ss);
+extern void storage_load (Storage *stor, Snapshot *ss);
+
+extern void storage_checkpoint (Storage *stor);
+extern int storage_rollback (Storage *stor);
+extern int storage_release (Storage *stor);
+extern int storage_release_outer (Storage *stor);
+
 #endif /* SIM_STORAGE_H */
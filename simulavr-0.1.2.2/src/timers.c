@@ -130,6 +130,8 @@ static void timer_iadd_addr (VDevice *vdev, int addr, char *name,
 static uint8_t timer_intr_read (VDevice *dev, int addr);
 static void timer_intr_write (VDevice *dev, int addr, uint8_t val);
 static void timer_intr_reset (VDevice *dev);
+static void timer_intr_save (VDevice *dev, Snapshot *ss);
+static void timer_intr_load (VDevice *dev, Snapshot *ss);
 static int timer_intr_cb (uint64_t time, AvrClass *data);
 
 /** \brief Allocate a new timer interrupt */
@@ -168,6 +170,7 @@ timer_intr_construct (TimerIntr_T *ti, int addr, char *name,
 
     vdev_construct ((VDevice *)ti, timer_intr_read, timer_intr_write,
                     timer_intr_reset, timer_iadd_addr);
+    vdev_set_state_fp ((VDevice *)ti, timer_intr_save, timer_intr_load);
 
     ti->func_mask = func_mask;
 
@@ -278,6 +281,33 @@ timer_intr_reset (VDevice *dev)
     ti->tifr = 0;
 }
 
+static void
+timer_intr_save (VDevice *dev, Snapshot *ss)
+{
+    TimerIntr_T *ti = (TimerIntr_T *)dev;
+
+    snapshot_put_u8 (ss, ti->timsk);
+    snapshot_put_u8 (ss, ti->tifr);
+    snapshot_put_u8 (ss, ti->intr_cb != NULL);
+}
+
+static void
+timer_intr_load (VDevice *dev, Snapshot *ss)
+{
+    TimerIntr_T *ti = (TimerIntr_T *)dev;
+    CallBack *cb;
+
+    ti->timsk = snapshot_get_u8 (ss);
+    ti->tifr = snapshot_get_u8 (ss);
+
+    if (snapshot_get_u8 (ss))
+    {
+        cb = callback_new (timer_intr_cb, (AvrClass *)ti);
+        ti->intr_cb = cb;
+        avr_core_async_cb_add ((AvrCore *)vdev_get_core (dev), cb);
+    }
+}
+
 static int
 timer_intr_cb (uint64_t time, AvrClass *data)
 {
@@ -342,6 +372,8 @@ static void timer0_add_addr (VDevice *vdev, int addr, char *name,
 static uint8_t timer0_read (VDevice *dev, int addr);
 static void timer0_write (VDevice *dev, int addr, uint8_t val);
 static void timer0_reset (VDevice *dev);
+static void timer0_save (VDevice *dev, Snapshot *ss);
+static void timer0_load (VDevice *dev, Snapshot *ss);
 static int timer0_clk_incr_cb (uint64_t ck, AvrClass *data);
 
 /** \brief Allocate a new timer/counter 0. */
@@ -374,6 +406,7 @@ timer0_construct (Timer0_T *timer, int addr, char *name, int rel_addr)
 
     vdev_construct ((VDevice *)timer, timer0_read, timer0_write, timer0_reset,
                     timer0_add_addr);
+    vdev_set_state_fp ((VDevice *)timer, timer0_save, timer0_load);
 
     timer0_add_addr ((VDevice *)timer, addr, name, 0, NULL);
     if (rel_addr)
@@ -521,6 +554,35 @@ timer0_reset (VDevice *dev)
     timer->divisor = 0;
 }
 
+static void
+timer0_save (VDevice *dev, Snapshot *ss)
+{
+    Timer0_T *timer = (Timer0_T *)dev;
+
+    snapshot_put_u8 (ss, timer->tccr);
+    snapshot_put_u8 (ss, timer->tcnt);
+    snapshot_put_u32 (ss, timer->divisor);
+    snapshot_put_u8 (ss, timer->clk_cb != NULL);
+}
+
+static void
+timer0_load (VDevice *dev, Snapshot *ss)
+{
+    Timer0_T *timer = (Timer0_T *)dev;
+    CallBack *cb;
+
+    timer->tccr = snapshot_get_u8 (ss);
+    timer->tcnt = snapshot_get_u8 (ss);
+    timer->divisor = snapshot_get_u32 (ss);
+
+    if (snapshot_get_u8 (ss))
+    {
+        cb = callback_new (timer0_clk_incr_cb, (AvrClass *)timer);
+        timer->clk_cb = cb;
+        avr_core_clk_cb_add ((AvrCore *)vdev_get_core (dev), cb);
+    }
+}
+
 static int
 timer0_clk_incr_cb (uint64_t ck, AvrClass *data)
 {
@@ -573,6 +635,8 @@ static void timer16_destroy (void *timer);
 static uint8_t timer16_read (VDevice *dev, int addr);
 static void timer16_write (VDevice *dev, int addr, uint8_t val);
 static void timer16_reset (VDevice *dev);
+static void timer16_save (VDevice *dev, Snapshot *ss);
+static void timer16_load (VDevice *dev, Snapshot *ss);
 static int timer16_clk_incr_cb (uint64_t time, AvrClass *data);
 static void timer16_handle_tccr_write (Timer16_T *timer);
 
@@ -613,6 +677,7 @@ timer16_construct (Timer16_T *timer, int addr, char *name, int rel_addr,
 
     vdev_construct ((VDevice *)timer, timer16_read, timer16_write,
                     timer16_reset, timer16_add_addr);
+    vdev_set_state_fp ((VDevice *)timer, timer16_save, timer16_load);
 
     timer->timerdef = timerdef;
 
@@ -763,6 +828,41 @@ timer16_reset (VDevice *dev)
     timer->divisor = 0;
 }
 
+static void
+timer16_save (VDevice *dev, Snapshot *ss)
+{
+    Timer16_T *timer = (Timer16_T *)dev;
+
+    snapshot_put_u8 (ss, timer->tccra);
+    snapshot_put_u8 (ss, timer->tccrb);
+    snapshot_put_u8 (ss, timer->tccrc);
+    snapshot_put_u16 (ss, timer->tcnt);
+    snapshot_put_u32 (ss, timer->divisor);
+    snapshot_put_u8 (ss, timer->TEMP);
+    snapshot_put_u8 (ss, timer->clk_cb != NULL);
+}
+
+static void
+timer16_load (VDevice *dev, Snapshot *ss)
+{
+    Timer16_T *timer = (Timer16_T *)dev;
+    CallBack *cb;
+
+    timer->tccra = snapshot_get_u8 (ss);
+    timer->tccrb = snapshot_get_u8 (ss);
+    timer->tccrc = snapshot_get_u8 (ss);
+    timer->tcnt = snapshot_get_u16 (ss);
+    timer->divisor = snapshot_get_u32 (ss);
+    timer->TEMP = snapshot_get_u8 (ss);
+
+    if (snapshot_get_u8 (ss))
+    {
+        cb = callback_new (timer16_clk_incr_cb, (AvrClass *)timer);
+        timer->clk_cb = cb;
+        avr_core_clk_cb_add ((AvrCore *)vdev_get_core (dev), cb);
+    }
+}
+
 static void
 timer_intr_set_flag (TimerIntr_T *ti, uint8_t bitnr)
 {
@@ -900,6 +1000,8 @@ static void ocreg16_destroy (void *ocr);
 static uint8_t ocreg16_read (VDevice *dev, int addr);
 static void ocreg16_write (VDevice *dev, int addr, uint8_t val);
 static void ocreg16_reset (VDevice *dev);
+static void ocreg16_save (VDevice *dev, Snapshot *ss);
+static void ocreg16_load (VDevice *dev, Snapshot *ss);
 
 /** \brief Allocate a new 16 bit Output Compare Register
   * \param ocrdef The definition struct for the \a OCR to be created
@@ -939,6 +1041,7 @@ ocreg16_construct (OCReg16_T *ocreg, int addr, char *name, OCReg16Def ocrdef)
 
     vdev_construct ((VDevice *)ocreg, ocreg16_read, ocreg16_write,
                     ocreg16_reset, ocr_add_addr);
+    vdev_set_state_fp ((VDevice *)ocreg, ocreg16_save, ocreg16_load);
 
     ocreg->ocrdef = ocrdef;
 
@@ -1033,4 +1136,22 @@ ocreg16_reset (VDevice *dev)
     ocreg->ocr = 0;
 }
 
+static void
+ocreg16_save (VDevice *dev, Snapshot *ss)
+{
+    OCReg16_T *ocreg = (OCReg16_T *)dev;
+
+    snapshot_put_u16 (ss, ocreg->ocr);
+    snapshot_put_u8 (ss, ocreg->TEMP);
+}
+
+static void
+ocreg16_load (VDevice *dev, Snapshot *ss)
+{
+    OCReg16_T *ocreg = (OCReg16_T *)dev;
+
+    ocreg->ocr = snapshot_get_u16 (ss);
+    ocreg->TEMP = snapshot_get_u8 (ss);
+}
+
 /*@}*/
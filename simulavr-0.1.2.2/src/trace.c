@@ -0,0 +1,284 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file trace.c
+ * \brief Binary instruction trace.
+ *
+ * Every executed instruction fills a fixed size record (see TraceRec) in a
+ * ring in memory: the PC, the opcode, CK, SREG and the first data space
+ * writes. Memory writes are noted by mem_write(), changed registers are
+ * found by comparing the register file before and after the instruction,
+ * so nothing is added to the register access when not tracing. The ring
+ * is written to the file with a single write() whenever it is full, so
+ * tracing costs little more than filling the records.
+ *
+ * With a trigger address nothing is written until the PC reaches it. The
+ * ring then holds the records of the instructions before the trigger; they
+ * are written together with as many records after it, and the trace ends.
+ *
+ * simulavr-trace turns the file into the text of '--debug' or into JSON.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "avrerror.h"
+#include "avrmalloc.h"
+#include "avrclass.h"
+
+#include "trace.h"
+
+#ifndef DOXYGEN                 /* don't expose to doxygen */
+
+enum _trace_state
+{
+    TRACE_WAIT,                 /* keep the last records, wait for the
+                                   trigger */
+    TRACE_ON,                   /* write every record */
+    TRACE_DONE,                 /* trace ended (after the trigger window or
+                                   on a write error) */
+};
+
+#endif /* DOXYGEN */
+
+/** \brief Allocate a new Trace writing to \a file.
+ *
+ * The ring holds \a size records. With a \a trigger word address only the
+ * \a size records before and after the PC first reaches it are written.
+ * Returns NULL with a warning if the file can not be created.
+ */
+
+Trace *
+trace_new (char *file, int32_t trigger, uint32_t size)
+{
+    Trace *trace;
+    int fd;
+
+    fd = open (file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        avr_warning ("%s: %s\n", file, strerror (errno));
+        return NULL;
+    }
+
+    trace = avr_new (Trace, 1);
+    trace_construct (trace, fd, trigger, size);
+    class_overload_destroy ((AvrClass *)trace, trace_destroy);
+
+    return trace;
+}
+
+static int
+trace_write (Trace *trace, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t res;
+
+    while (len > 0)
+    {
+        res = write (trace->fd, p, len);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            avr_warning ("trace write failed: %s\n", strerror (errno));
+            trace->state = TRACE_DONE;
+            return -1;
+        }
+        p += res;
+        len -= res;
+    }
+
+    return 0;
+}
+
+/** \brief Constructor for the Trace class. */
+
+void
+trace_construct (Trace *trace, int fd, int32_t trigger, uint32_t size)
+{
+    TraceHeader hdr;
+
+    if (trace == NULL)
+        avr_error ("passed null ptr");
+    if (size == 0)
+        avr_error ("trace size must not be 0");
+
+    class_construct ((AvrClass *)trace);
+
+    trace->fd = fd;
+    trace->ring = avr_new (TraceRec, size);
+    trace->size = size;
+    trace->head = 0;
+    trace->count = 0;
+    trace->trigger = trigger;
+    trace->state = (trigger == TRACE_NO_TRIGGER) ? TRACE_ON : TRACE_WAIT;
+    trace->left = 0;
+    trace->written = 0;
+
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, TRACE_MAGIC, sizeof (hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.order = TRACE_ORDER;
+    hdr.rec_size = sizeof (TraceRec);
+    hdr.trigger = trigger;
+    trace_write (trace, &hdr, sizeof (hdr));
+}
+
+/** \brief Destructor for the Trace class, writes what is left in the
+    ring. */
+
+void
+trace_destroy (void *trace)
+{
+    Trace *_trace = (Trace *)trace;
+
+    if (trace == NULL)
+        return;
+
+    if (_trace->state != TRACE_WAIT)
+        trace_flush (_trace);
+    close (_trace->fd);
+    avr_free (_trace->ring);
+
+    class_destroy (trace);
+}
+
+/** \brief Write the records in the ring, oldest first. */
+
+void
+trace_flush (Trace *trace)
+{
+    uint32_t first = trace->head - trace->count;
+    int res = 0;
+
+    if (trace->count > trace->head)
+    {
+        /* wrapped, only before the trigger */
+        first += trace->size;
+        res = trace_write (trace, trace->ring + first,
+                           (trace->size - first) * sizeof (TraceRec));
+        first = 0;
+    }
+    if (res == 0)
+        res = trace_write (trace, trace->ring + first,
+                           (trace->head - first) * sizeof (TraceRec));
+    if (res == 0)
+        trace->written += trace->count;
+
+    /* after a write error the records are dropped */
+    trace->head = 0;
+    trace->count = 0;
+}
+
+/** \brief Start the record of the instruction at \a pc.
+ *
+ * \a regs is the register file, trace_end() completes the record. Returns
+ * NULL if the trace has ended.
+ */
+
+TraceRec *
+trace_begin (Trace *trace, int32_t pc, uint16_t opcode, uint64_t ck,
+             uint8_t *regs)
+{
+    TraceRec *rec;
+
+    switch (trace->state)
+    {
+        case TRACE_DONE:
+            if (trace->count)
+                trace_flush (trace);
+            return NULL;
+
+        case TRACE_WAIT:
+            if (pc != trace->trigger)
+            {
+                if (trace->head == trace->size)
+                    trace->head = 0;
+                if (trace->count < trace->size)
+                    trace->count++;
+                break;
+            }
+            /* The window after the trigger starts with it. */
+            trace_flush (trace);
+            if (trace->state == TRACE_DONE)
+                return NULL;
+            trace->state = TRACE_ON;
+            trace->left = trace->size;
+            /* fall through */
+
+        case TRACE_ON:
+            if (trace->head == trace->size)
+            {
+                trace_flush (trace);
+                if (trace->state == TRACE_DONE)
+                    return NULL;
+            }
+            trace->count++;
+            /* The last record of the window is written by the next call. */
+            if ((trace->trigger != TRACE_NO_TRIGGER) && (--trace->left == 0))
+                trace->state = TRACE_DONE;
+            break;
+    }
+
+    rec = trace->ring + trace->head++;
+    rec->ck = ck;
+    rec->pc = pc;
+    rec->opcode = opcode;
+    rec->nwrites = 0;
+    rec->pad = 0;
+
+    memcpy (trace->regs, regs, sizeof (trace->regs));
+
+    return rec;
+}
+
+/** \brief Complete the record with the handler result \a op, SREG and the
+    changed registers. */
+
+void
+trace_end (Trace *trace, TraceRec *rec, int op, uint8_t sreg, uint8_t *regs)
+{
+    int i;
+
+    rec->op = op;
+    rec->sreg = sreg;
+
+    if (memcmp (trace->regs, regs, sizeof (trace->regs)) == 0)
+        return;
+    for (i = 0; i < sizeof (trace->regs); i++)
+        if (trace->regs[i] != regs[i])
+            trace_rec_write (rec, i, regs[i]);
+}
+
+/** \brief Note a data space write of the traced instruction. */
+extern inline void trace_rec_write (TraceRec *rec, int addr, uint8_t val);
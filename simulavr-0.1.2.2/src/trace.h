@@ -0,0 +1,122 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+#ifndef SIM_TRACE_H
+#define SIM_TRACE_H
+
+/****************************************************************************\
+ *
+ * Trace(AvrClass) Definition
+ *
+\****************************************************************************/
+
+#define TRACE_MAGIC "SIMAVRTR"
+
+enum _trace_constants
+{
+    TRACE_VERSION = 1,          /* bump on any change of the file layout */
+    TRACE_ORDER = 0x01020304,   /* tells the byte order of the file */
+    TRACE_SIZE = 65536,         /* default number of records in the ring */
+    TRACE_WRITES = 2,           /* writes kept in a record */
+    TRACE_NO_TRIGGER = -1,
+};
+
+/* One executed instruction. The records are written as they are in memory,
+   the decoder has to run on a host with the same byte order (checked with
+   TRACE_ORDER). */
+
+typedef struct _TraceRec TraceRec;
+
+struct _TraceRec
+{
+    uint64_t ck;                /* CK before the instruction */
+    uint32_t pc;                /* word address */
+    uint16_t opcode;
+    uint8_t op;                 /* opcode_* id of the handler */
+    uint8_t sreg;               /* SREG after the instruction */
+    uint16_t waddr[TRACE_WRITES]; /* data space writes of the instruction */
+    uint8_t wval[TRACE_WRITES];
+    uint8_t nwrites;            /* writes done, only the first TRACE_WRITES
+                                   are kept (255: 255 or more) */
+    uint8_t pad;
+};
+
+/* The file starts with this, it has the size of a record. */
+
+typedef struct _TraceHeader TraceHeader;
+
+struct _TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t order;             /* TRACE_ORDER */
+    uint32_t rec_size;          /* sizeof (TraceRec) */
+    int32_t trigger;            /* word address or TRACE_NO_TRIGGER */
+};
+
+typedef struct _Trace Trace;
+
+struct _Trace
+{
+    AvrClass parent;
+    int fd;                     /* file descriptor of the trace file */
+    TraceRec *ring;
+    uint32_t size;              /* records in the ring */
+    uint32_t head;              /* next record to fill */
+    uint32_t count;             /* records in the ring, not yet written */
+    int32_t trigger;            /* word address, or TRACE_NO_TRIGGER */
+    int state;                  /* see _trace_state in trace.c */
+    uint32_t left;              /* records to write after the trigger */
+    uint64_t written;           /* records written to the file */
+    uint8_t regs[32];           /* registers before the traced
+                                   instruction */
+};
+
+extern Trace *trace_new (char *file, int32_t trigger, uint32_t size);
+extern void trace_construct (Trace *trace, int fd, int32_t trigger,
+                             uint32_t size);
+extern void trace_destroy (void *trace);
+
+extern TraceRec *trace_begin (Trace *trace, int32_t pc, uint16_t opcode,
+                              uint64_t ck, uint8_t *regs);
+extern void trace_end (Trace *trace, TraceRec *rec, int op, uint8_t sreg,
+                       uint8_t *regs);
+extern void trace_flush (Trace *trace);
+
+/* Note a data space write of the instruction traced in rec. */
+
+extern inline void
+trace_rec_write (TraceRec *rec, int addr, uint8_t val)
+{
+    if (rec->nwrites < TRACE_WRITES)
+    {
+        rec->waddr[rec->nwrites] = addr;
+        rec->wval[rec->nwrites] = val;
+    }
+    if (rec->nwrites < 255)
+        rec->nwrites++;
+}
+
+#endif /* SIM_TRACE_H */
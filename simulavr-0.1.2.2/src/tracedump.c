@@ -0,0 +1,203 @@
+/*
+ * $Id$
+ *
+ ****************************************************************************
+ *
+ * simulavr - A simulator for the Atmel AVR family of microcontrollers.
+ * Copyright (C) 2020 Peter Popovec <popovec.peter@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ ****************************************************************************
+ */
+
+/**
+ * \file tracedump.c
+ * \brief simulavr-trace: print the binary trace written by '--trace'.
+ *
+ * The default output is the text of '--debug', one line per instruction.
+ * See trace.c for the file layout.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "avrerror.h"
+#include "avrclass.h"
+#include "op_names.h"
+
+#include "trace.h"
+
+#include "gnu_getopt.h"
+
+/* records read at once */
+#define TRACE_BLOCK 4096
+
+static char *usage_str =
+    "\nUsage: %s [OPTIONS]... trace\n"
+    "\n"
+    "Print the instruction trace written by simulavr-oseid --trace, in the\n"
+    "format of --debug.\n"
+    "\n" "Options:\n"
+    "  -h, --help             : Show this message\n"
+    "  -w, --writes           : Add the clock cycle, SREG and the writes\n"
+    "  -j, --json             : Print a JSON array, one record per line\n"
+    "  -n, --count <n>        : Print only the first n records\n" "\n";
+
+static struct option long_opts[] = {
+    /* name,             has_arg, flag,   val */
+    { "help",            0,       0,     'h' },
+    { "writes",          0,       0,     'w' },
+    { "json",            0,       0,     'j' },
+    { "count",           1,       0,     'n' },
+    { NULL,              0,       0,      0  }
+};
+
+static void
+usage (char *prog)
+{
+    fprintf (stdout, usage_str, prog);
+    exit (1);
+}
+
+static const char *
+op_name (TraceRec *rec)
+{
+    if (rec->op < NUM_OPCODE_HANLDERS)
+        return global_opcode_name[rec->op];
+    return "BREAK_POINT";
+}
+
+static void
+print_text (TraceRec *rec, int writes)
+{
+    int i;
+
+    printf ("0x%06x (0x%06x) : 0x%04x : %s", rec->pc, rec->pc * 2,
+            rec->opcode, op_name (rec));
+
+    if (writes)
+    {
+        printf (" ; CK=%llu SREG=0x%02x", (unsigned long long)rec->ck,
+                rec->sreg);
+        for (i = 0; (i < rec->nwrites) && (i < TRACE_WRITES); i++)
+        {
+            if (rec->waddr[i] < 0x20)
+                printf (" r%d=0x%02x", rec->waddr[i], rec->wval[i]);
+            else
+                printf (" [0x%04x]=0x%02x", rec->waddr[i], rec->wval[i]);
+        }
+        if (rec->nwrites > TRACE_WRITES)
+            printf (" (+%d%s)", rec->nwrites - TRACE_WRITES,
+                    (rec->nwrites == 255) ? " or more" : "");
+    }
+
+    printf ("\n");
+}
+
+static void
+print_json (TraceRec *rec, int first)
+{
+    int i;
+
+    printf ("%s{\"ck\":%llu,\"pc\":%u,\"opcode\":%u,\"insn\":\"%s\","
+            "\"sreg\":%u,\"writes\":[", first ? " " : ",",
+            (unsigned long long)rec->ck, rec->pc, rec->opcode,
+            op_name (rec), rec->sreg);
+    for (i = 0; (i < rec->nwrites) && (i < TRACE_WRITES); i++)
+        printf ("%s{\"addr\":%u,\"val\":%u}", i ? "," : "", rec->waddr[i],
+                rec->wval[i]);
+    printf ("],\"nwrites\":%u}\n", rec->nwrites);
+}
+
+int
+main (int argc, char **argv)
+{
+    char *prog = argv[0];
+    int writes = 0, json = 0;
+    long long count = -1, num = 0;
+    TraceRec rec[TRACE_BLOCK];
+    TraceHeader hdr;
+    FILE *fp;
+    size_t n, i;
+    int c, option_index;
+
+    opterr = 0;                 /* disable default error message */
+
+    while ((c = getopt_long (argc, argv, "hwjn:", long_opts,
+                             &option_index)) != -1)
+    {
+        switch (c)
+        {
+            case 'w':
+                writes = 1;
+                break;
+            case 'j':
+                json = 1;
+                break;
+            case 'n':
+                count = atoll (optarg);
+                break;
+            default:
+                usage (prog);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usage (prog);
+
+    if ((fp = fopen (argv[optind], "rb")) == NULL)
+        avr_error ("%s: %s", argv[optind], strerror (errno));
+
+    if ((fread (&hdr, sizeof (hdr), 1, fp) != 1)
+        || (memcmp (hdr.magic, TRACE_MAGIC, sizeof (hdr.magic)) != 0))
+        avr_error ("%s: not a trace file", argv[optind]);
+    if (hdr.order != TRACE_ORDER)
+        avr_error ("%s: written on a host with another byte order",
+                   argv[optind]);
+    if ((hdr.version != TRACE_VERSION) || (hdr.rec_size != sizeof (TraceRec)))
+        avr_error ("%s: trace file version not supported", argv[optind]);
+
+    if (json)
+        printf ("[\n");
+
+    while ((count < 0) || (num < count))
+    {
+        n = fread (rec, sizeof (TraceRec), TRACE_BLOCK, fp);
+        if (n == 0)
+            break;
+
+        for (i = 0; (i < n) && ((count < 0) || (num < count)); i++, num++)
+        {
+            if (json)
+                print_json (rec + i, num == 0);
+            else
+                print_text (rec + i, writes);
+        }
+    }
+
+    if (ferror (fp))
+        avr_error ("%s: %s", argv[optind], strerror (errno));
+    fclose (fp);
+
+    if (json)
+        printf ("]\n");
+
+    return 0;
+}
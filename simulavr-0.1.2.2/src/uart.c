@@ -69,6 +69,8 @@ static void uart_iadd_addr (VDevice *vdev, int addr, char *name, int rel_addr,
 static uint8_t uart_intr_read (VDevice *dev, int addr);
 static void uart_intr_write (VDevice *dev, int addr, uint8_t val);
 static void uart_intr_reset (VDevice *dev);
+static void uart_intr_save (VDevice *dev, Snapshot *ss);
+static void uart_intr_load (VDevice *dev, Snapshot *ss);
 static int uart_intr_cb (uint64_t time, AvrClass *data);
 
 int UART_Int_Table[] = {
@@ -132,6 +134,7 @@ uart_intr_construct (UARTIntr_T *uart, int addr, char *name)
 
     vdev_construct ((VDevice *)uart, uart_intr_read, uart_intr_write,
                     uart_intr_reset, uart_iadd_addr);
+    vdev_set_state_fp ((VDevice *)uart, uart_intr_save, uart_intr_load);
 
     uart_intr_reset ((VDevice *)uart);
 }
@@ -281,6 +284,39 @@ uart_intr_reset (VDevice *dev)
     uart->usr_shadow = 0;
 }
 
+static void
+uart_intr_save (VDevice *dev, Snapshot *ss)
+{
+    UARTIntr_T *uart = (UARTIntr_T *)dev;
+
+    snapshot_put_u16 (ss, uart->ubrr);
+    snapshot_put_u8 (ss, uart->ubrr_temp);
+    snapshot_put_u8 (ss, uart->usr);
+    snapshot_put_u8 (ss, uart->ucr);
+    snapshot_put_u8 (ss, uart->usr_shadow);
+    snapshot_put_u8 (ss, uart->intr_cb != NULL);
+}
+
+static void
+uart_intr_load (VDevice *dev, Snapshot *ss)
+{
+    UARTIntr_T *uart = (UARTIntr_T *)dev;
+    CallBack *cb;
+
+    uart->ubrr = snapshot_get_u16 (ss);
+    uart->ubrr_temp = snapshot_get_u8 (ss);
+    uart->usr = snapshot_get_u8 (ss);
+    uart->ucr = snapshot_get_u8 (ss);
+    uart->usr_shadow = snapshot_get_u8 (ss);
+
+    if (snapshot_get_u8 (ss))
+    {
+        cb = callback_new (uart_intr_cb, (AvrClass *)uart);
+        uart->intr_cb = cb;
+        avr_core_async_cb_add ((AvrCore *)vdev_get_core (dev), cb);
+    }
+}
+
 static int
 uart_intr_cb (uint64_t time, AvrClass *data)
 {
@@ -327,6 +363,8 @@ static void uart_add_addr (VDevice *vdev, int addr, char *name, int rel_addr,
 static uint8_t uart_read (VDevice *dev, int addr);
 static void uart_write (VDevice *dev, int addr, uint8_t val);
 static void uart_reset (VDevice *dev);
+static void uart_save (VDevice *dev, Snapshot *ss);
+static void uart_load (VDevice *dev, Snapshot *ss);
 static int uart_clk_incr_cb (uint64_t ck, AvrClass *data);
 
 /** \brief Allocate a new uart structure. */
@@ -360,6 +398,7 @@ uart_construct (UART_T *uart, int addr, char *name, int rel_addr)
 
     vdev_construct ((VDevice *)uart, uart_read, uart_write, uart_reset,
                     uart_add_addr);
+    vdev_set_state_fp ((VDevice *)uart, uart_save, uart_load);
 
     uart_add_addr ((VDevice *)uart, addr, name, 0, NULL);
     if (rel_addr)
@@ -500,6 +539,37 @@ uart_reset (VDevice *dev)
     uart->divisor = 0;
 }
 
+static void
+uart_save (VDevice *dev, Snapshot *ss)
+{
+    UART_T *uart = (UART_T *)dev;
+
+    snapshot_put_u8 (ss, uart->udr_rx);
+    snapshot_put_u8 (ss, uart->udr_tx);
+    snapshot_put_u16 (ss, uart->tcnt);
+    snapshot_put_u16 (ss, uart->divisor);
+    snapshot_put_u8 (ss, uart->clk_cb != NULL);
+}
+
+static void
+uart_load (VDevice *dev, Snapshot *ss)
+{
+    UART_T *uart = (UART_T *)dev;
+    CallBack *cb;
+
+    uart->udr_rx = snapshot_get_u8 (ss);
+    uart->udr_tx = snapshot_get_u8 (ss);
+    uart->tcnt = snapshot_get_u16 (ss);
+    uart->divisor = snapshot_get_u16 (ss);
+
+    if (snapshot_get_u8 (ss))
+    {
+        cb = callback_new (uart_clk_incr_cb, (AvrClass *)uart);
+        uart->clk_cb = cb;
+        avr_core_clk_cb_add ((AvrCore *)vdev_get_core (dev), cb);
+    }
+}
+
 static int
 uart_clk_incr_cb (uint64_t ck, AvrClass *data)
 {
@@ -67,31 +67,6 @@ extern inline uint8_t set_bit_in_byte (uint8_t src, int bit, int val);
 
 extern inline uint16_t set_bit_in_word (uint16_t src, int bit, int val);
 
-/** \brief Return the number of milliseconds of elapsed program time.
-
-    \return an unsigned 64 bit number. Time zero is not well
-    defined, so only time differences should be used. */
-
-uint64_t
-get_program_time (void)
-{
-    static uint64_t result;
-
-// do not call gettimeofday() - this slows down the simulation
-// (due meltdown/spectre mitigation patches in kernel)
-
-/*
-    uint64_t result;
-    struct timeval tv;
-
-    if (gettimeofday (&tv, NULL) < 0)
-        avr_error ("Failed to get program time.");
-
-    result = ((uint64_t) tv.tv_sec * 1000) + ((uint64_t) tv.tv_usec / 1000);
-*/
-    return ++result;
-}
-
 /***************************************************************************\
  *
  * DList(AvrClass) Methods : A doubly linked list.
@@ -59,14 +59,6 @@ set_bit_in_word (uint16_t src, int bit, int val)
     return ((src & ~(1 << bit)) | ((val != 0) << bit));
 }
 
-/****************************************************************************\
- *
- * Utility for getting elapsed program time in milliseconds.
- *
-\****************************************************************************/
-
-extern uint64_t get_program_time (void);
-
 /****************************************************************************\
  *
  * DList(AvrClass) Methods : A doubly linked list.
@@ -26,6 +26,9 @@
 #ifndef SIM_VDEVS_H
 #define SIM_VDEVS_H
 
+#include "display.h"
+#include "snapshot.h"
+
 /****************************************************************************\
  *
  * Virtual Device Definition.
@@ -42,17 +45,22 @@ typedef void (*VDevFP_Write) (VDevice *dev, int addr, uint8_t val);
 typedef void (*VDevFP_Reset) (VDevice *dev);
 typedef void (*VDevFP_AddAddr) (VDevice *dev, int addr, char *name,
                                 int rel_addr, void *data);
+typedef void (*VDevFP_Save) (VDevice *dev, Snapshot *ss);
+typedef void (*VDevFP_Load) (VDevice *dev, Snapshot *ss);
 
 struct _VDevice
 {
     AvrClass parent;
     AvrClass *core;             /* keep a pointer to the core the device is
                                    attached to */
+    Display *display;           /* display of that core (may be NULL) */
     VDevFP_Read read;           /* read access for device */
     VDevFP_Write write;         /* write access for device */
     VDevFP_Reset reset;         /* reset function for device */
     VDevFP_AddAddr add_addr;    /* add an address to the list of addresses
                                    handled by this vdev */
+    VDevFP_Save save;           /* append device state to a snapshot */
+    VDevFP_Load load;           /* restore device state from a snapshot */
 };
 
 extern VDevice *vdev_new (char *name, VDevFP_Read rd, VDevFP_Write wr,
@@ -68,6 +76,11 @@ extern uint8_t vdev_read (VDevice *dev, int addr);
 extern void vdev_write (VDevice *dev, int addr, uint8_t val);
 extern void vdev_reset (VDevice *dev);
 
+extern void vdev_set_state_fp (VDevice *dev, VDevFP_Save save,
+                               VDevFP_Load load);
+extern int vdev_save (VDevice *dev, Snapshot *ss);
+extern void vdev_load (VDevice *dev, Snapshot *ss);
+
 extern void vdev_set_core (VDevice *dev, AvrClass *core);
 
 extern inline AvrClass *vdev_get_core (VDevice *dev)
@@ -75,6 +88,13 @@ extern inline AvrClass *vdev_get_core (VDevice *dev)
     return dev->core;
 }
 
+extern void vdev_set_display (VDevice *dev, Display *disp);
+
+extern inline Display *vdev_get_display (VDevice *dev)
+{
+    return dev->display;
+}
+
 extern void vdev_add_addr (VDevice *dev, int addr, char *name, int rel_addr,
                            void *data);
 extern void vdev_def_AddAddr (VDevice *dev, int addr, char *name, int rel_addr,